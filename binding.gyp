@@ -5,8 +5,37 @@
       "sources": [
         "src/node-mapcache.cpp",
         "src/mapcache.cpp",
-        "src/asynclog.cpp"
+        "src/asynclog.cpp",
+        "src/blankindex.cpp",
+        "src/existencefilter.cpp",
+        "src/writebehind.cpp",
+        "src/accesslog.cpp",
+        "src/sharedcache.cpp",
+        "src/revalidator.cpp",
+        "src/profiler.cpp",
+        "src/exporter.cpp",
+        "src/tilerange.cpp",
+        "src/invalidator.cpp",
+        "src/sourceguard.cpp",
+        "src/connectionpool.cpp",
+        "src/memorymeter.cpp",
+        "src/bodystore.cpp",
+        "src/mapassembler.cpp",
+        "src/pixelkernels.cpp",
+        "src/responsecache.cpp",
+        "src/hottiles.cpp",
+        "src/warmer.cpp",
+        "src/lazyconfig.cpp",
+        "src/variantcache.cpp",
+        "src/disksweeper.cpp",
+        "src/tilecache.cpp",
+        "src/tileidentity.cpp"
       ],
+      "variables": {
+        # Compile the static tracepoints when the SystemTap SDT header is
+        # available: override using `node-gyp configure -- -Dwith_sdt=false`
+        "with_sdt%": "<!(test -f /usr/include/sys/sdt.h && echo true || echo false)"
+      },
       "include_dirs": [
         "<!@(python tools/config.py --include)"
       ],
@@ -29,13 +58,18 @@
             '<!@(python tools/config.py --ldflags)'
           ],
           'libraries': [
-            "<!@(python tools/config.py --libraries)"
+            "<!@(python tools/config.py --libraries)",
+            '-lsqlite3',
+            '-lcurl'
           ],
           'cflags': [
             '<!@(python tools/config.py --cflags)',
             '-Wall'
           ],
         }],
+        ['with_sdt=="true"', {
+          'defines': [ 'NODE_MAPCACHE_SDT' ]
+        }],
       ]
     }
   ]
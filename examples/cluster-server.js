@@ -30,7 +30,9 @@
  *
  * This provides an example of how to use the MapCache module in
  * combination with the Node HTTP module to create a tile caching
- * server that uses all the available processing cores.
+ * server that uses all the available processing cores.  The master
+ * routes each connection to the worker owning the requested tile, so
+ * each worker serves its own share of the tiles.
  */
 
 var cluster = require('cluster'); //for the multi-processing
@@ -43,17 +45,24 @@ var mapcache = require('mapcache'); // the MapCache module
 var port = 3000; // which port will the server run on?
 var baseUrl = "http://localhost:" + port; // what is the server url?
 var conffile = path.join(__dirname, 'mapcache.xml'); // the location of the config file
+var shmfile = '/dev/shm/node-mapcache-example'; // the shared memory tile cache
 var numCPUs = require('os').cpus().length;
 
 if (cluster.isMaster) {
-  // Fork workers.
-  for (var i = 0; i < numCPUs; i++) {
-    cluster.fork();
-  }
+    // Load the configuration to identify the tiles requested
+    mapcache.MapCache.FromConfigFile(conffile, function handleCache(err, cache) {
+        if (err) {
+            throw err;              // error loading the configuration file
+        }
 
-  cluster.on('exit', function(worker, code, signal) {
-    console.log('worker ' + worker.process.pid + ' died');
-  });
+        // Fork the workers and route connections to them
+        var router = new mapcache.cluster.Router({ workers: numCPUs, cache: cache });
+        router.listen(port, "localhost");
+
+        cluster.on('exit', function(worker, code, signal) {
+            console.log('worker ' + worker.process.pid + ' died');
+        });
+    });
 } else {
     // Instantiate a MapCache cache object from the configuration file
     mapcache.MapCache.FromConfigFile(conffile, function handleCache(err, cache) {
@@ -61,8 +70,11 @@ if (cluster.isMaster) {
             throw err;              // error loading the configuration file
         }
 
-        // fire up a http server, handling all requests
-        http.createServer(function handleCacheRequest(req, res) {
+        // share the tiles returned by each worker with the others
+        cache.attachSharedCache(shmfile, { size: 64 * 1024 * 1024 });
+
+        // fire up a http server, handling the requests routed to this worker
+        var server = http.createServer(function handleCacheRequest(req, res) {
             var urlParts = url.parse(decodeURIComponent(req.url)); // parse the request url
             var pathInfo = urlParts.pathname || "/"; // generate the PATH_INFO
             var params = urlParts.query || '';       // generate the QUERY_STRING
@@ -87,7 +99,8 @@ if (cluster.isMaster) {
                     res.end();
                 }
             });
-        }).listen(port, "localhost");
+        });
+        mapcache.cluster.serve(server);
 
         console.log(
             "Server running at " + baseUrl + " - try the following WMS request:\n" +
@@ -0,0 +1,495 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * Cache key affine routing for clustered servers
+ *
+ * When workers share a listening socket the operating system spreads
+ * connections across them, so every worker ends up serving every tile and
+ * per-process caches hold the same tiles N times over.  A `Router` instead
+ * accepts connections in the master, reads the first request line, and hands
+ * the connection to the worker owning the requested tile on a consistent hash
+ * ring.  The socket itself is passed to the worker, so response data never
+ * passes through the master.
+ *
+ * Tiles are hashed by metatile so all the tiles rendered together are served
+ * by the same worker.  Requests for anything other than a single tile are
+ * spread across the workers in turn.  Replacement workers take the place of
+ * those that exit, so the ring and each worker's share of the tiles are
+ * unchanged.
+ *
+ * Alternatively requests can be partitioned by tileset.  With workers loading
+ * lazy configurations each tileset is then only set up by the workers owning
+ * it, so workers start in milliseconds and the parsed configuration isn't
+ * duplicated in every one of them.  Requests naming no single tileset are
+ * treated as a tileset of their own, which is the only one to need the full
+ * configuration.  Each tileset is owned by a configurable number of workers,
+ * among which its tiles are spread by metatile, so a busy tileset isn't
+ * confined to a single worker.
+ */
+
+var cluster = require('cluster');
+var crypto = require('crypto');
+var net = require('net');
+var url = require('url');
+
+/// The message handing a connection to a worker
+var CONNECTION = 'mapcache:connection';
+
+/// The message from a worker that is ready for connections
+var READY = 'mapcache:ready';
+
+/// The maximum size of a request line
+var MAX_REQUEST_LINE = 8192;
+
+/**
+ * Hash a string to an unsigned 32 bit integer
+ */
+function hash(key) {
+    return crypto.createHash('md5').update(key).digest().readUInt32BE(0);
+}
+
+/**
+ * Create a consistent hash ring of `slots` slots
+ *
+ * Each slot is placed on the ring `replicas` times.
+ */
+function Ring(slots, replicas) {
+    var points = [], slot, i;
+
+    for (slot = 0; slot < slots; slot++) {
+        for (i = 0; i < replicas; i++) {
+            points.push({hash: hash(slot + '#' + i), slot: slot});
+        }
+    }
+    points.sort(function byHash(a, b) {
+        return a.hash - b.hash;
+    });
+
+    this.points = points;
+}
+
+/**
+ * Return the slots in the order they own a key
+ *
+ * The first slot owns the key; the others take over in turn if it is
+ * unavailable.
+ */
+Ring.prototype.lookup = function lookup(key) {
+    var points = this.points, h = hash(key), low = 0, high = points.length,
+        order = [], seen = {}, mid, i, slot;
+
+    // find the first point at or after the hash
+    while (low < high) {
+        mid = (low + high) >>> 1;
+        if (points[mid].hash < h) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for (i = 0; i < points.length; i++) {
+        slot = points[(low + i) % points.length].slot;
+        if (!seen[slot]) {
+            seen[slot] = true;
+            order.push(slot);
+        }
+    }
+
+    return order;
+};
+
+/**
+ * Create a router in the cluster master
+ *
+ * `options` may have the following properties:
+ *
+ * - `workers`: the number of workers to fork (default the number of CPUs)
+ * - `replicas`: the number of points each worker has on the hash ring
+ *   (default 100)
+ * - `cache`: a `MapCache` loaded with the same configuration as the workers,
+ *   used to identify the tile requested.  Without it requests are routed on
+ *   their URL.
+ * - `partition`: `'metatile'` to route requests by metatile (the default) or
+ *   `'tileset'` to route them by tileset, which requires `cache`.  The cache
+ *   can be loaded lazily in either case, but a lazy cache only identifies the
+ *   tiles of tilesets it has set up, so with `'metatile'` it should be loaded
+ *   in full.
+ * - `tilesetWorkers`: the number of workers owning each tileset when
+ *   partitioning by tileset (default 1).  The tiles of a tileset are spread
+ *   across its owners by metatile and its other requests in turn.  Tiles are
+ *   only identified in tilesets set up by `cache`, so a lazy cache should
+ *   load the full configuration using `cache.loadConfig()`.
+ * - `keepAlive`: set to `true` to keep connections open between responses.
+ *   Connections are only routed on their first request, so subsequent
+ *   requests on a connection bypass the partitioning.  By default connections
+ *   are closed after each response so that every request is routed (default
+ *   `false`)
+ */
+function Router(options) {
+    options = options || {};
+    this.workers = options.workers || require('os').cpus().length;
+    this.cache = options.cache || null;
+    this.partition = options.partition || 'metatile';
+    if (this.partition !== 'metatile' && this.partition !== 'tileset') {
+        throw new Error('Unknown partition: ' + this.partition);
+    }
+    if (this.partition === 'tileset' && !this.cache) {
+        throw new Error('Partitioning by tileset requires a cache');
+    }
+    this.tilesetWorkers = Math.max(1, Math.min(options.tilesetWorkers || 1, this.workers));
+    this.keepAlive = !!options.keepAlive;
+    this.ring = new Ring(this.workers, options.replicas || 100);
+    this.slots = [];            // the worker in each slot
+    this.pending = [];          // connections waiting for a worker to be ready
+    this.next = 0;              // the slot receiving the next untiled request
+    this.nextOwner = 0;         // the tileset owner receiving the next untiled request
+    this.server = null;
+    this.closed = false;
+    this.routed = 0;
+    this.unrouted = 0;
+    this.failovers = 0;
+}
+
+/**
+ * Fork the workers and accept connections
+ *
+ * The arguments are those of `net.Server.listen()`.
+ */
+Router.prototype.listen = function listen() {
+    var self = this, slot;
+
+    for (slot = 0; slot < this.workers; slot++) {
+        this.fork(slot);
+    }
+
+    this.server = net.createServer(function accept(socket) {
+        self.accept(socket);
+    });
+    return this.server.listen.apply(this.server, arguments);
+};
+
+/**
+ * Start a worker in a slot
+ */
+Router.prototype.fork = function fork(slot) {
+    var self = this,
+        worker = cluster.fork({NODE_MAPCACHE_SLOT: slot});
+
+    this.slots[slot] = {worker: worker, ready: false, connections: 0};
+
+    worker.on('message', function message(msg) {
+        if (msg && msg.cmd === READY && self.slots[slot].worker === worker) {
+            self.slots[slot].ready = true;
+            self.dispatchPending();
+        }
+    });
+
+    worker.on('exit', function exit() {
+        if (self.slots[slot].worker === worker) {
+            self.slots[slot].ready = false;
+            if (!self.closed) {
+                self.fork(slot);    // the replacement takes over the slot
+            }
+        }
+    });
+};
+
+/**
+ * Read the request line of a new connection and route it
+ *
+ * Errors on the connection are handled until it is handed over to a worker,
+ * including while it waits for a worker to become ready.
+ */
+Router.prototype.accept = function accept(socket) {
+    var self = this, head = new Buffer(0);
+
+    function read(data) {
+        var end;
+
+        head = Buffer.concat([head, data]);
+        end = head.toString('binary').indexOf('\n');
+        if (end === -1) {
+            if (head.length > MAX_REQUEST_LINE) {
+                socket.destroy();
+            }
+            return;
+        }
+
+        socket.removeListener('data', read);
+        socket.pause();
+        self.route(socket, head, head.toString('binary', 0, end));
+    }
+
+    function failed() {
+        self.drop(socket);
+    }
+
+    socket.on('data', read);
+    socket.on('error', failed);
+    socket.mapcacheFailed = failed;
+};
+
+/**
+ * Close a connection that failed before it was handed over
+ */
+Router.prototype.drop = function drop(socket) {
+    var i;
+
+    for (i = 0; i < this.pending.length; i++) {
+        if (this.pending[i].socket === socket) {
+            this.pending.splice(i, 1);
+            break;
+        }
+    }
+    socket.destroy();
+};
+
+/**
+ * Choose the slot for a request line and hand the connection to its worker
+ */
+Router.prototype.route = function route(socket, head, line) {
+    var target = line.split(' ')[1] || '/',
+        key = this.key(target),
+        order, i;
+
+    if (key === null) {
+        this.unrouted++;
+        order = [];
+        for (i = 0; i < this.workers; i++) {
+            order.push((this.next + i) % this.workers);
+        }
+        this.next = (this.next + 1) % this.workers;
+    } else {
+        this.routed++;
+        order = this.ring.lookup(key);
+        if (this.partition === 'tileset' && this.tilesetWorkers > 1) {
+            order = this.share(order, target);
+        }
+    }
+
+    // the first ready worker in order takes the connection
+    for (i = 0; i < order.length; i++) {
+        if (this.slots[order[i]].ready) {
+            if (i) {
+                this.failovers++;
+            }
+            return this.handOver(this.slots[order[i]], socket, head);
+        }
+    }
+
+    this.pending.push({socket: socket, head: head, line: line});
+};
+
+/**
+ * Return the routing key of a request target, or `null` to spread it
+ *
+ * With a cache this identifies the tile or tileset synchronously in the
+ * master, using the same parsing as the mapcache core.  It is the main cost
+ * of routing a connection and so bounds the rate at which the master can
+ * accept them.
+ */
+Router.prototype.key = function key(target) {
+    var parts, tile, tileset;
+
+    try {
+        parts = url.parse(decodeURIComponent(target));
+    } catch (err) {
+        return null;
+    }
+
+    if (!this.cache) {
+        return (parts.pathname || '/') + '?' + (parts.query || '');
+    }
+
+    if (this.partition === 'tileset') {
+        // one worker handles the requests that need the full configuration
+        tileset = this.cache.tilesetFor(parts.pathname || '/', parts.query || '');
+        return (tileset !== null) ? 'tileset:' + tileset : '';
+    }
+
+    tile = this.cache.tileKey(parts.pathname || '/', parts.query || '');
+    return (tile) ? tile.metatile : null;
+};
+
+/**
+ * Reorder the workers owning a tileset so that the one sharing a request
+ * comes first
+ *
+ * The owners are the first `tilesetWorkers` slots for the tileset on the
+ * ring.  Tiles go to an owner chosen by metatile, keeping the tiles rendered
+ * together in one worker, and other requests go to each owner in turn.  The
+ * other owners, then the remaining slots, take over if it isn't ready.
+ */
+Router.prototype.share = function share(order, target) {
+    var owners = Math.min(this.tilesetWorkers, order.length), first, parts, tile = null;
+
+    try {
+        parts = url.parse(decodeURIComponent(target));
+        tile = this.cache.tileKey(parts.pathname || '/', parts.query || '');
+    } catch (err) {
+        tile = null;
+    }
+
+    if (tile) {
+        first = hash(tile.metatile) % owners;
+    } else {
+        first = this.nextOwner % owners;
+        this.nextOwner++;
+    }
+    return order.slice(first, owners).concat(order.slice(0, first), order.slice(owners));
+};
+
+/**
+ * Pass a connection and the data read from it to a worker
+ */
+Router.prototype.handOver = function handOver(slot, socket, head) {
+    socket.removeListener('error', socket.mapcacheFailed);
+    slot.connections++;
+    slot.worker.send({
+        cmd: CONNECTION,
+        head: head.toString('base64'),
+        keepAlive: this.keepAlive
+    }, socket);
+};
+
+/**
+ * Route the connections that arrived before any worker was ready
+ */
+Router.prototype.dispatchPending = function dispatchPending() {
+    var pending = this.pending, i;
+
+    this.pending = [];
+    for (i = 0; i < pending.length; i++) {
+        this.route(pending[i].socket, pending[i].head, pending[i].line);
+    }
+};
+
+/**
+ * Describe the routing
+ *
+ * The returned object has the properties `partition`, `tilesetWorkers`,
+ * `keepAlive`, `routed` (the number
+ * of connections routed by key), `unrouted` (the number spread across the workers),
+ * `failovers` (the number routed past a worker that wasn't ready) and
+ * `workers` (an array with the `pid`, `ready` state and `connections` of the
+ * worker in each slot).
+ */
+Router.prototype.stats = function stats() {
+    var workers = [], i;
+
+    for (i = 0; i < this.slots.length; i++) {
+        workers.push({
+            pid: this.slots[i].worker.process.pid,
+            ready: this.slots[i].ready,
+            connections: this.slots[i].connections
+        });
+    }
+
+    return {
+        partition: this.partition,
+        tilesetWorkers: this.tilesetWorkers,
+        keepAlive: this.keepAlive,
+        routed: this.routed,
+        unrouted: this.unrouted,
+        failovers: this.failovers,
+        workers: workers
+    };
+};
+
+/**
+ * Stop accepting connections and disconnect the workers
+ */
+Router.prototype.close = function close(callback) {
+    var i;
+
+    this.closed = true;
+    for (i = 0; i < this.pending.length; i++) {
+        this.pending[i].socket.destroy();
+    }
+    this.pending = [];
+    if (this.server) {
+        this.server.close();
+    }
+    for (i = 0; i < this.slots.length; i++) {
+        this.slots[i].worker.disconnect();
+    }
+    if (callback) {
+        process.nextTick(callback);
+    }
+};
+
+/**
+ * Serve the connections routed to this worker with an HTTP server
+ *
+ * This is called in each worker in place of `server.listen()`.
+ */
+function serve(server) {
+    var listeners = server.listeners('request'), i;
+
+    process.on('message', function message(msg, socket) {
+        var head;
+
+        if (!msg || msg.cmd !== CONNECTION || !socket) {
+            return;
+        }
+
+        if (!msg.keepAlive) {
+            socket.mapcacheClose = true;
+        }
+        head = new Buffer(msg.head, 'base64');
+        server.emit('connection', socket);
+        if (typeof socket.ondata === 'function') {
+            socket.ondata(head, 0, head.length); // the Node 0.10 HTTP parser
+        } else {
+            socket.unshift(head);
+        }
+        socket.resume();
+    });
+
+    // close routed connections after each response when requested: this
+    // runs before the existing request listeners
+    server.removeAllListeners('request');
+    server.on('request', function request(req, res) {
+        if (req.socket.mapcacheClose) {
+            res.setHeader('Connection', 'close');
+        }
+    });
+    for (i = 0; i < listeners.length; i++) {
+        server.on('request', listeners[i]);
+    }
+
+    process.send({cmd: READY});
+}
+
+module.exports.Router = Router;
+module.exports.Ring = Ring;
+module.exports.serve = serve;
+module.exports.slot = function slot() {
+    return ('NODE_MAPCACHE_SLOT' in process.env) ? parseInt(process.env.NODE_MAPCACHE_SLOT, 10) : null;
+};
@@ -49,7 +49,67 @@ try {
     }
 }
 
+var os = require('os');
+
+/**
+ * Decode the records passed to an `enableAccessLog()` callback
+ *
+ * Each record is `accessRecordSize` bytes long with integers in host byte
+ * order; see the README for the layout.  An array of objects is returned, one
+ * per record.
+ */
+function decodeAccessLog(records) {
+    var le = (!os.endianness || os.endianness() === 'LE'),
+        u16 = (le) ? records.readUInt16LE : records.readUInt16BE,
+        u32 = (le) ? records.readUInt32LE : records.readUInt32BE,
+        i32 = (le) ? records.readInt32LE : records.readInt32BE,
+        size = bindings.accessRecordSize,
+        decoded = [],
+        offset, time, flags;
+
+    function str(start, length) {
+        var end = start;
+        while (end < start + length && records[end] !== 0) {
+            end++;
+        }
+        return records.toString('utf8', start, end);
+    }
+
+    for (offset = 0; offset + size <= records.length; offset += size) {
+        time = (le) ?
+            u32.call(records, offset + 4) * 4294967296 + u32.call(records, offset) :
+            u32.call(records, offset) * 4294967296 + u32.call(records, offset + 4);
+        flags = records[offset + 39];
+
+        decoded.push({
+            time: new Date(time / 1000),
+            queueTime: u32.call(records, offset + 8),
+            workTime: u32.call(records, offset + 12),
+            renderTime: u32.call(records, offset + 16),
+            bytes: u32.call(records, offset + 20),
+            z: i32.call(records, offset + 24),
+            x: i32.call(records, offset + 28),
+            y: i32.call(records, offset + 32),
+            status: u16.call(records, offset + 36),
+            service: (records[offset + 38] === 0xff) ? null : records[offset + 38],
+            hit: !!(flags & 1),
+            rendered: !!(flags & 2),
+            blank: !!(flags & 4),
+            failed: !!(flags & 8),
+            tileset: str(offset + 40, 32),
+            grid: str(offset + 72, 24)
+        });
+    }
+
+    return decoded;
+}
+
 // Export the API
 module.exports.MapCache = bindings.MapCache;
 module.exports.versions = bindings.versions;
 module.exports.logLevels = bindings.logLevels;
+module.exports.services = bindings.services;
+module.exports.accessRecordSize = bindings.accessRecordSize;
+module.exports.decodeAccessLog = decodeAccessLog;
+module.exports.Registry = require('./registry').Registry;
+module.exports.cluster = require('./cluster');
@@ -0,0 +1,255 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * A registry of MapCache configurations
+ *
+ * This maps names to configuration files, loading each configuration the
+ * first time it is requested and sharing a single load between concurrent
+ * first requests.  Configurations that haven't been requested within the
+ * `ttl`, or that are the least recently requested when the estimated memory
+ * of the loaded configurations exceeds `maxMemory`, are evicted: they are
+ * loaded again when next requested.  An evicted cache remains usable by any
+ * requests still holding it and is freed once it is garbage collected.
+ */
+
+/**
+ * Create a registry
+ *
+ * `options` may have the following properties:
+ *
+ * - `ttl`: the time in milliseconds after which an unused configuration is
+ *   evicted (default 10 minutes, 0 to disable)
+ * - `maxMemory`: the estimated memory in bytes above which the least
+ *   recently used configurations are evicted (default unlimited)
+ * - `sweepInterval`: the time in milliseconds between checks for idle
+ *   configurations (default 1 minute)
+ * - `logger`: an `EventEmitter` passed to `MapCache.FromConfigFile()`
+ */
+function Registry(options) {
+    var self = this;
+
+    options = options || {};
+    this.ttl = ('ttl' in options) ? options.ttl : 10 * 60 * 1000;
+    this.maxMemory = ('maxMemory' in options) ? options.maxMemory : Infinity;
+    this.logger = options.logger || null;
+    this.entries = {};
+
+    this.timer = setInterval(function sweep() {
+        self.sweep();
+    }, options.sweepInterval || 60 * 1000);
+    if (this.timer.unref) {
+        this.timer.unref();     // don't keep the process alive
+    }
+}
+
+/**
+ * Associate a name with a configuration file
+ *
+ * Registering a name again with a different file evicts any configuration
+ * already loaded for it.
+ */
+Registry.prototype.register = function register(name, conffile) {
+    var entry = this.entries[name];
+
+    if (entry && entry.file === conffile) {
+        return;
+    }
+    if (entry) {
+        this.evict(name);
+    }
+    this.entries[name] = {
+        file: conffile,
+        cache: null,
+        waiting: null,          // callbacks waiting for a load in progress
+        lastUsed: 0,
+        memory: 0,
+        loadTime: 0,
+        loads: 0,
+        evictions: 0
+    };
+};
+
+/**
+ * Remove a name from the registry, evicting any loaded configuration
+ */
+Registry.prototype.unregister = function unregister(name) {
+    this.evict(name);
+    delete this.entries[name];
+};
+
+/**
+ * Retrieve the cache for a name, loading its configuration if necessary
+ *
+ * The callback has the signature `callback(err, cache)` and is always called
+ * asynchronously.
+ */
+Registry.prototype.get = function get(name, callback) {
+    var self = this,
+        entry = this.entries[name],
+        MapCache;
+
+    if (!entry) {
+        return process.nextTick(function unknown() {
+            callback(new Error('No configuration is registered as ' + name));
+        });
+    }
+
+    entry.lastUsed = Date.now();
+    if (entry.cache) {
+        return process.nextTick(function loaded() {
+            callback(null, entry.cache);
+        });
+    }
+    if (entry.waiting) {
+        return entry.waiting.push(callback);
+    }
+
+    // the first request loads the configuration for any that follow
+    entry.waiting = [callback];
+    MapCache = require('./mapcache').MapCache;
+
+    function handleCache(err, cache) {
+        var waiting = entry.waiting, i, stats;
+
+        entry.waiting = null;
+        if (!err && self.entries[name] === entry) {
+            stats = cache.configStats();
+            entry.cache = cache;
+            entry.memory = stats.memory;
+            entry.loadTime = stats.loadTime;
+            entry.loads++;
+            self.enforceBudget(name);
+        }
+
+        for (i = 0; i < waiting.length; i++) {
+            waiting[i](err, cache);
+        }
+    }
+
+    if (this.logger) {
+        MapCache.FromConfigFile(entry.file, this.logger, handleCache);
+    } else {
+        MapCache.FromConfigFile(entry.file, handleCache);
+    }
+};
+
+/**
+ * Evict the loaded configuration for a name
+ */
+Registry.prototype.evict = function evict(name) {
+    var entry = this.entries[name];
+
+    if (entry && entry.cache) {
+        entry.cache = null;
+        entry.memory = 0;
+        entry.evictions++;
+    }
+};
+
+/**
+ * Evict the configurations that have been idle for longer than the `ttl`
+ */
+Registry.prototype.sweep = function sweep() {
+    var now = Date.now(), name, entry;
+
+    if (!this.ttl) {
+        return;
+    }
+    for (name in this.entries) {
+        entry = this.entries[name];
+        if (entry.cache && now - entry.lastUsed >= this.ttl) {
+            this.evict(name);
+        }
+    }
+};
+
+/**
+ * Evict the least recently used configurations while over the memory budget
+ *
+ * The configuration named by `keep` (the one just loaded) is not evicted.
+ */
+Registry.prototype.enforceBudget = function enforceBudget(keep) {
+    var total = 0, loaded = [], name, entry, i;
+
+    for (name in this.entries) {
+        entry = this.entries[name];
+        if (entry.cache) {
+            total += entry.memory;
+            if (name !== keep) {
+                loaded.push(name);
+            }
+        }
+    }
+
+    loaded.sort(function byLastUse(a, b) {
+        return this.entries[a].lastUsed - this.entries[b].lastUsed;
+    }.bind(this));
+
+    for (i = 0; i < loaded.length && total > this.maxMemory; i++) {
+        total -= this.entries[loaded[i]].memory;
+        this.evict(loaded[i]);
+    }
+};
+
+/**
+ * Describe the registered configurations
+ *
+ * An object keyed on name is returned.  Each configuration has the properties
+ * `file`, `loaded`, `loading`, `memory` (the estimated memory of a loaded
+ * configuration in bytes), `loadTime` (the time taken by the last load in
+ * milliseconds), `lastUsed` (a `Date`, or `null`), `loads` and `evictions`.
+ */
+Registry.prototype.stats = function stats() {
+    var result = {}, name, entry;
+
+    for (name in this.entries) {
+        entry = this.entries[name];
+        result[name] = {
+            file: entry.file,
+            loaded: !!entry.cache,
+            loading: !!entry.waiting,
+            memory: entry.memory,
+            loadTime: entry.loadTime,
+            lastUsed: (entry.lastUsed) ? new Date(entry.lastUsed) : null,
+            loads: entry.loads,
+            evictions: entry.evictions
+        };
+    }
+
+    return result;
+};
+
+/**
+ * Stop checking for idle configurations
+ */
+Registry.prototype.close = function close() {
+    clearInterval(this.timer);
+};
+
+module.exports.Registry = Registry;
@@ -0,0 +1,273 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file accesslog.cpp
+ * @brief This defines the `AccessLog` class.
+ */
+
+#include <string.h>
+
+#include <node.h>
+#include <node_buffer.h>
+
+#include "accesslog.hpp"
+
+using namespace v8;
+using namespace node;
+
+// the record layout is part of the API
+typedef char access_record_size_check[(sizeof(AccessLog::Record) == NODE_MAPCACHE_ACCESS_RECORD_SIZE) ? 1 : -1];
+
+std::map<mapcache_source*, void (*)(mapcache_context*, mapcache_map*)> AccessLog::renderers;
+uv_rwlock_t AccessLog::renderers_lock;
+uv_once_t AccessLog::renderers_once = UV_ONCE_INIT;
+
+/// The render time accumulated by the current thread in nanoseconds
+static __thread uint64_t render_time = 0;
+
+/**
+ * @details The number of records is rounded up to a power of two. The
+ * rendering functions of the sources in `cfg` are replaced so render times
+ * can be recorded.
+ *
+ * @param cfg The configuration whose requests are logged.
+ *
+ * @param size The minimum number of records the log can hold.
+ *
+ * @param interval The delivery interval in milliseconds.
+ *
+ * @param callback The function records are delivered to.
+ */
+AccessLog::AccessLog(mapcache_cfg *cfg, uint32_t size, uint64_t interval, Handle<Function> callback) :
+  enqueue_pos(0),
+  dequeue_pos(0),
+  dropped(0),
+  cfg(cfg)
+{
+  uint64_t capacity = 1;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+  cells.resize(capacity);
+  for (uint64_t i = 0; i < capacity; i++) {
+    cells[i].sequence = i;
+  }
+  mask = capacity - 1;
+
+  this->callback = Persistent<Function>::New(callback);
+
+  uv_once(&renderers_once, InitRenderers);
+  uv_rwlock_wrlock(&renderers_lock);
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->sources); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_source *source = (mapcache_source *) val;
+    if (source->render_map != RenderMap) {
+      renderers[source] = source->render_map;
+      source->render_map = RenderMap;
+    }
+  }
+  uv_rwlock_wrunlock(&renderers_lock);
+
+  timer.data = this;
+  uv_timer_init(uv_default_loop(), &timer);
+  uv_timer_start(&timer, Deliver, interval, interval);
+  uv_unref((uv_handle_t *) &timer); // don't keep the process alive
+}
+
+/**
+ * @details This implements the bounded queue described by Dmitry Vyukov at
+ * <http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue>:
+ * producers claim a slot by advancing `enqueue_pos` and publish the record by
+ * updating the slot's sequence number.
+ *
+ * @param record The record to add.
+ *
+ * @return `false` if the log is full and the record was dropped.
+ */
+bool AccessLog::Push(const Record &record) {
+  Cell *cell;
+  uint64_t pos = enqueue_pos;
+
+  for (;;) {
+    cell = &cells[pos & mask];
+    int64_t diff = (int64_t) cell->sequence - (int64_t) pos;
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap(&enqueue_pos, pos, pos + 1)) {
+        break;
+      }
+    } else if (diff < 0) {
+      __sync_fetch_and_add(&dropped, 1);
+      return false;
+    }
+    pos = enqueue_pos;
+  }
+
+  cell->record = record;
+  __sync_synchronize();         // publish the record before the sequence
+  cell->sequence = pos + 1;
+  return true;
+}
+
+/**
+ * @param record Set to the oldest record in the log.
+ *
+ * @return `false` if there are no records ready.
+ */
+bool AccessLog::Pop(Record &record) {
+  Cell *cell = &cells[dequeue_pos & mask];
+  if (cell->sequence != dequeue_pos + 1) {
+    return false;
+  }
+  __sync_synchronize();         // read the sequence before the record
+
+  record = cell->record;
+  __sync_synchronize();         // read the record before releasing the slot
+  cell->sequence = dequeue_pos + mask + 1;
+  dequeue_pos++;
+  return true;
+}
+
+/**
+ * @details This may be called while the `MapCache` instance is being
+ * garbage collected, so it doesn't call into javascript: records that have
+ * not yet been delivered are discarded.
+ */
+void AccessLog::Close() {
+  uv_rwlock_wrlock(&renderers_lock);
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->sources); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_source *source = (mapcache_source *) val;
+
+    // leave functions that have since been replaced by something else
+    if (source->render_map == RenderMap) {
+      source->render_map = renderers[source];
+      renderers.erase(source);
+    }
+  }
+  uv_rwlock_wrunlock(&renderers_lock);
+
+  uv_timer_stop(&timer);
+  uv_close((uv_handle_t *) &timer, Closed);
+}
+
+/**
+ * @param record The record to update.
+ *
+ * @param tileset The tileset name.
+ *
+ * @param grid The grid name.
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ */
+void AccessLog::SetTile(Record &record, const char *tileset, const char *grid, int z, int x, int y) {
+  strncpy(record.tileset, tileset, sizeof(record.tileset));
+  strncpy(record.grid, grid, sizeof(record.grid));
+  record.z = z;
+  record.x = x;
+  record.y = y;
+}
+
+void AccessLog::ResetRenderTime() {
+  render_time = 0;
+}
+
+uint64_t AccessLog::RenderTime() {
+  return render_time;
+}
+
+/**
+ * @details The records are copied into a single `Buffer` which is passed to
+ * the callback along with the number of records dropped since the last
+ * delivery.
+ *
+ * @param handle The delivery timer.
+ */
+void AccessLog::Deliver(uv_timer_t *handle, int status /*UNUSED*/) {
+  HandleScope scope;
+
+  AccessLog *self = static_cast<AccessLog*>(handle->data);
+  std::string data;
+  Record record;
+
+  while (self->Pop(record)) {
+    data.append((const char *) &record, sizeof(record));
+  }
+  uint32_t dropped = __sync_fetch_and_and(&(self->dropped), 0);
+  if (data.empty() && !dropped) {
+    return;
+  }
+
+  Handle<Value> argv[2] = {
+    Buffer::New((char *) data.data(), data.size())->handle_,
+    Uint32::New(dropped)
+  };
+
+  // pass the records to the user specified callback function
+  TryCatch try_catch;
+  self->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+
+/**
+ * @param handle The delivery timer.
+ */
+void AccessLog::Closed(uv_handle_t *handle) {
+  AccessLog *self = static_cast<AccessLog*>(handle->data);
+  delete self;
+}
+
+void AccessLog::InitRenderers() {
+  uv_rwlock_init(&renderers_lock);
+}
+
+/**
+ * @details This times the original rendering function of the source,
+ * accumulating the time for the current thread.
+ *
+ * @param ctx The context of the request.
+ *
+ * @param map The map to render.
+ */
+void AccessLog::RenderMap(mapcache_context *ctx, mapcache_map *map) {
+  uv_rwlock_rdlock(&renderers_lock);
+  void (*render_map)(mapcache_context*, mapcache_map*) = renderers[map->tileset->source];
+  uv_rwlock_rdunlock(&renderers_lock);
+
+  uint64_t start = uv_hrtime();
+  render_map(ctx, map);
+  render_time += uv_hrtime() - start;
+}
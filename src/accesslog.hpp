@@ -0,0 +1,198 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_ACCESSLOG_H__
+#define __NODE_MAPCACHE_ACCESSLOG_H__
+
+/**
+ * @file accesslog.hpp
+ * @brief This declares the `AccessLog` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <v8.h>
+#include <uv.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/// The size in bytes of a single access record
+#define NODE_MAPCACHE_ACCESS_RECORD_SIZE 96
+
+/// The value of `AccessLog::Record::service` when the service is unknown
+#define NODE_MAPCACHE_ACCESS_NO_SERVICE 0xff
+
+/**
+ * @brief A binary log of the requests handled by a cache
+ *
+ * Each request is described by a fixed size `Record` which is pushed onto a
+ * bounded lock free ring buffer by the thread handling the request.  The
+ * Node/V8 thread periodically drains the ring, passing the records to a
+ * javascript callback as a single `Buffer`.  Records are dropped, and
+ * counted, if the ring is full.
+ *
+ * Time spent rendering is measured by replacing the `render_map` function of
+ * each source with one that accumulates the time in a thread local variable.
+ */
+class AccessLog {
+public:
+
+  /// Flags describing how a request was handled
+  enum Flags {
+    /// The resource was returned from the cache
+    HIT = 1,
+    /// A source was used to render the resource
+    RENDERED = 2,
+    /// The tile was returned from the blank tile index
+    BLANK = 4,
+    /// The request failed
+    FAILED = 8
+  };
+
+  /**
+   * @brief An access record
+   *
+   * The layout is fixed, with integers in host byte order.  Strings are NUL
+   * padded and truncated if necessary.
+   */
+  struct Record {
+    /// The time the request was received in microseconds since the epoch
+    uint64_t time;              // offset 0
+    /// The time spent waiting for a thread in microseconds
+    uint32_t queue_us;          // offset 8
+    /// The time spent handling the request in microseconds
+    uint32_t work_us;           // offset 12
+    /// The time spent rendering in microseconds
+    uint32_t render_us;         // offset 16
+    /// The size of the response body in bytes
+    uint32_t bytes;             // offset 20
+    /// The tile zoom level, column and row, or -1 if not a tile request
+    int32_t z, x, y;            // offsets 24, 28, 32
+    /// The HTTP status code
+    uint16_t status;            // offset 36
+    /// The `mapcache.services` value
+    uint8_t service;            // offset 38
+    /// A combination of `Flags`
+    uint8_t flags;              // offset 39
+    /// The tileset name
+    char tileset[32];           // offset 40
+    /// The grid name
+    char grid[24];              // offset 72
+  };
+
+  /// Intantiate a log with space for `size` records
+  AccessLog(mapcache_cfg *cfg, uint32_t size, uint64_t interval, v8::Handle<v8::Function> callback);
+
+  /// Add a record to the log from any thread
+  bool Push(const Record &record);
+
+  /// Stop delivering records and free the log once its timer has closed
+  void Close();
+
+  /// Set the tileset, grid and coordinates of a record
+  static void SetTile(Record &record, const char *tileset, const char *grid, int z, int x, int y);
+
+  /// Start measuring the render time of the current thread
+  static void ResetRenderTime();
+
+  /// The render time of the current thread in nanoseconds, or 0 if nothing rendered
+  static uint64_t RenderTime();
+
+private:
+
+  /// A slot in the ring buffer
+  struct Cell {
+    /// The sequence number controlling access to the slot
+    volatile uint64_t sequence;
+    /// The record in the slot
+    Record record;
+  };
+
+  /// The ring buffer
+  std::vector<Cell> cells;
+
+  /// The index mask for `cells`
+  uint64_t mask;
+
+  /// The position of the next record to be added
+  volatile uint64_t enqueue_pos;
+
+  /// The position of the next record to be delivered
+  uint64_t dequeue_pos;
+
+  /// The number of records dropped since the last delivery
+  volatile uint32_t dropped;
+
+  /// The configuration whose sources are timed
+  mapcache_cfg *cfg;
+
+  /// The function records are delivered to
+  v8::Persistent<v8::Function> callback;
+
+  /// The delivery timer
+  uv_timer_t timer;
+
+  /// Remove a record from the log in the Node/V8 thread
+  bool Pop(Record &record);
+
+  /// Pass the queued records to the callback
+  static void Deliver(uv_timer_t *handle, int status /*UNUSED*/);
+
+  /// Free the log once its timer has closed
+  static void Closed(uv_handle_t *handle);
+
+  /// The original source rendering functions
+  static std::map<mapcache_source*, void (*)(mapcache_context*, mapcache_map*)> renderers;
+
+  /// Protects `renderers`
+  static uv_rwlock_t renderers_lock;
+
+  /// Ensures the renderer lock is initialised once
+  static uv_once_t renderers_once;
+
+  /// Initialise the renderer lock
+  static void InitRenderers();
+
+  /// The replacement source rendering function
+  static void RenderMap(mapcache_context *ctx, mapcache_map *map);
+
+  /// Clear up the javascript handle
+  ~AccessLog() {
+    callback.Dispose();
+  }
+};
+
+#endif  /* __NODE_MAPCACHE_ACCESSLOG_H__ */
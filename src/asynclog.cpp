@@ -57,7 +57,9 @@ AsyncLog::AsyncLog(Persistent<Object> emitter) {
 /**
  * @details This is the callback that is passed to the mapcache core library.
  * It formats the message, queues it for emitting later, and then flags `libuv`
- * to deal with it by calling `EmitLogs` at its convenience.
+ * to deal with it by calling `EmitLogs` at its convenience.  Messages below
+ * the log level of the `MapCache` instance are discarded before they are
+ * formatted.
  *
  * This callback will be fired in an asynchronous thread that will *not* be the
  * same as that the main V8/Node.js is running in.
@@ -71,6 +73,9 @@ void AsyncLog::LogRequestContext(mapcache_context *c, mapcache_log_level level,
   if (!r_ctxt->async_log) return;
   self = r_ctxt->async_log;
 
+  // ignore messages the cache isn't interested in
+  if (r_ctxt->cache && level < r_ctxt->cache->log_level) return;
+
   Log *log = new Log();
 
   // format the message into a string
@@ -111,6 +116,7 @@ void AsyncLog::EmitLogs(uv_async_t *handle, int status /*UNUSED*/) {
     argv[2] = String::New(log->message.c_str());
 
     self->message_queue.pop();   // drain the queue
+    NODE_MAPCACHE_PROBE2(log_emit, (int) log->level, log->message.c_str());
     delete log;
 
     self->callback->Call(self->emitter, argc, argv);
@@ -0,0 +1,516 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * @file blankindex.cpp
+ * @brief This defines the `BlankIndex` class.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "blankindex.hpp"
+#include "tilecache.hpp"
+
+/// The identifier at the start of every index file
+#define BLANK_INDEX_MAGIC "NMCBLANK"
+
+/// The version of the index file format
+#define BLANK_INDEX_VERSION 2
+
+/// The version of the index file format without chunk times, still readable
+#define BLANK_INDEX_VERSION_UNTIMED 1
+
+/**
+ * @defgroup blank_index_io Blank index file helpers
+ *
+ * The index file is written in host byte order as it is only intended to be
+ * read back by the same machine.  Strings are prefixed by their length as a
+ * 32 bit integer.
+ *
+ * @{
+ */
+static void AppendBytes(std::string &data, const void *bytes, size_t size) {
+  data.append((const char *) bytes, size);
+}
+
+static void AppendString(std::string &data, const std::string &str) {
+  uint32_t size = str.size();
+  AppendBytes(data, &size, sizeof(size));
+  data.append(str);
+}
+
+static bool ReadBytes(FILE *fp, void *bytes, size_t size) {
+  return fread(bytes, 1, size, fp) == size;
+}
+
+static bool ReadString(FILE *fp, std::string &str) {
+  uint32_t size;
+  if (!ReadBytes(fp, &size, sizeof(size))) {
+    return false;
+  }
+  str.resize(size);
+  return (size == 0 || ReadBytes(fp, &str[0], size));
+}
+/**@}*/
+
+BlankIndex::~BlankIndex() {
+  for (std::map<std::string, Layer*>::iterator it = layers.begin(); it != layers.end(); ++it) {
+    it->second->buffer.Dispose();
+    delete it->second;
+  }
+}
+
+/**
+ * @details A missing index file is not an error: it simply results in an
+ * empty index.  A corrupt index file is an error as overwriting it might
+ * discard useful information.  The chunks of files written without chunk
+ * times are treated as indexed when their layer was created.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool BlankIndex::Load(std::string &error) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    error = "Could not open the blank index " + path + ": " + strerror(errno);
+    return false;
+  }
+
+  char magic[sizeof(BLANK_INDEX_MAGIC) - 1];
+  uint32_t version, nlayers;
+  bool ok = (ReadBytes(fp, magic, sizeof(magic))
+             && !memcmp(magic, BLANK_INDEX_MAGIC, sizeof(magic))
+             && ReadBytes(fp, &version, sizeof(version))
+             && (version == BLANK_INDEX_VERSION || version == BLANK_INDEX_VERSION_UNTIMED)
+             && ReadBytes(fp, &nlayers, sizeof(nlayers)));
+
+  for (uint32_t i = 0; ok && i < nlayers; i++) {
+    std::string name;
+    uint32_t nchunks;
+    Layer *layer = new Layer();
+
+    ok = (ReadString(fp, name)
+          && ReadString(fp, layer->content_type)
+          && ReadBytes(fp, &(layer->mtime), sizeof(layer->mtime))
+          && ReadString(fp, layer->body)
+          && ReadBytes(fp, &nchunks, sizeof(nchunks)));
+
+    for (uint32_t j = 0; ok && j < nchunks; j++) {
+      uint64_t key;
+      Chunk chunk;
+      chunk.rows.resize(64);
+      chunk.indexed = layer->mtime;
+      ok = (ReadBytes(fp, &key, sizeof(key))
+            && (version == BLANK_INDEX_VERSION_UNTIMED
+                || ReadBytes(fp, &(chunk.indexed), sizeof(chunk.indexed)))
+            && ReadBytes(fp, &(chunk.rows[0]), 64 * sizeof(uint64_t)));
+      if (ok) {
+        Chunk &existing = layer->chunks[key];
+        existing.rows.swap(chunk.rows);
+        existing.indexed = chunk.indexed;
+      }
+    }
+
+    if (ok) {
+      Layer *&existing = layers[name];
+      delete existing;
+      existing = layer;
+    } else {
+      delete layer;
+    }
+  }
+  fclose(fp);
+
+  if (!ok) {
+    error = "The blank index " + path + " is corrupt";
+  }
+  return ok;
+}
+
+/**
+ * @details Serialisation takes place in the Node/V8 thread so that the
+ * resulting snapshot can be written to disk from a different thread without
+ * needing to synchronise access to the index.
+ *
+ * @param data The string to which the index is written.
+ */
+void BlankIndex::Serialise(std::string &data) const {
+  uint32_t version = BLANK_INDEX_VERSION, nlayers = layers.size();
+
+  data.clear();
+  AppendBytes(data, BLANK_INDEX_MAGIC, sizeof(BLANK_INDEX_MAGIC) - 1);
+  AppendBytes(data, &version, sizeof(version));
+  AppendBytes(data, &nlayers, sizeof(nlayers));
+
+  for (std::map<std::string, Layer*>::const_iterator it = layers.begin(); it != layers.end(); ++it) {
+    const Layer *layer = it->second;
+    uint32_t nchunks = layer->chunks.size();
+
+    AppendString(data, it->first);
+    AppendString(data, layer->content_type);
+    AppendBytes(data, &(layer->mtime), sizeof(layer->mtime));
+    AppendString(data, layer->body);
+    AppendBytes(data, &nchunks, sizeof(nchunks));
+
+    for (std::map<uint64_t, Chunk>::const_iterator chunk = layer->chunks.begin();
+         chunk != layer->chunks.end();
+         ++chunk) {
+      AppendBytes(data, &(chunk->first), sizeof(chunk->first));
+      AppendBytes(data, &(chunk->second.indexed), sizeof(chunk->second.indexed));
+      AppendBytes(data, &(chunk->second.rows[0]), 64 * sizeof(uint64_t));
+    }
+  }
+}
+
+/**
+ * @details The data is written to a uniquely named temporary file which then
+ * replaces the index file, ensuring a crash during the write doesn't leave a
+ * truncated index behind.  This is thread safe, and concurrent writes from
+ * several threads or processes each replace the file whole.
+ *
+ * @param path The location of the index file.
+ *
+ * @param data The output from `Serialise()`.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool BlankIndex::Write(const std::string &path, const std::string &data, std::string &error) {
+  std::string name = path + ".XXXXXX";
+  std::vector<char> temp(name.begin(), name.end());
+  temp.push_back('\0');
+
+  int fd = mkstemp(&temp[0]);
+  FILE *fp = (fd != -1 && fchmod(fd, 0644) == 0) ? fdopen(fd, "wb") : NULL;
+  if (!fp) {
+    error = "Could not open " + name + ": " + strerror(errno);
+    if (fd != -1) {
+      close(fd);
+      unlink(&temp[0]);
+    }
+    return false;
+  }
+  std::string tmp(&temp[0]);
+
+  bool ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    error = "Could not write the blank index " + path + ": " + strerror(errno);
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @details A chunk whose oldest tile was indexed before `expired_before` is
+ * discarded: its tiles may have expired from the cache and been rendered
+ * again, so they must be looked up in the cache and indexed afresh.
+ *
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @param expired_before The time before which indexed tiles have expired, or
+ * zero if tiles never expire.
+ *
+ * @param indexed Set to the time the tile's chunk was indexed.
+ *
+ * @return The layer containing the shared blank tile or `NULL` if the tile is
+ * not known to be blank.
+ */
+BlankIndex::Layer* BlankIndex::Find(const std::string &name, int z, int x, int y,
+                                    apr_time_t expired_before, apr_time_t *indexed) {
+  std::map<std::string, Layer*>::iterator layer = layers.find(name);
+  if (layer == layers.end()) {
+    return NULL;
+  }
+
+  unsigned int word;
+  uint64_t bit;
+  std::map<uint64_t, Chunk>::iterator chunk = layer->second->chunks.find(ChunkKey(z, x, y, &word, &bit));
+  if (chunk == layer->second->chunks.end() || !(chunk->second.rows[word] & bit)) {
+    return NULL;
+  }
+  if (chunk->second.indexed < expired_before) {
+    layer->second->chunks.erase(chunk);
+    return NULL;
+  }
+  *indexed = chunk->second.indexed;
+  return layer->second;
+}
+
+/**
+ * @details The first blank tile inserted into a layer becomes the shared
+ * blank tile for that layer.  Subsequent tiles are only indexed if they are
+ * identical to it.
+ *
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @param data The encoded blank tile.
+ *
+ * @param size The size of `data` in bytes.
+ *
+ * @param content_type The MIME type of `data`.
+ *
+ * @param indexed The time the tile was found to be blank.
+ *
+ * @return `true` if the tile was indexed.
+ */
+bool BlankIndex::Insert(const std::string &name, int z, int x, int y,
+                        const char *data, size_t size,
+                        const std::string &content_type,
+                        apr_time_t indexed) {
+  Layer *&layer = layers[name];
+  if (!layer) {
+    layer = new Layer();
+    layer->body.assign(data, size);
+    layer->content_type = content_type;
+    layer->mtime = apr_time_now();
+  } else if (layer->body.size() != size
+             || memcmp(layer->body.data(), data, size)
+             || layer->content_type != content_type) {
+    return false;               // a different shade of blank
+  }
+
+  unsigned int word;
+  uint64_t bit;
+  Chunk &chunk = layer->chunks[ChunkKey(z, x, y, &word, &bit)];
+  if (chunk.rows.empty()) {
+    chunk.rows.resize(64, 0);
+    chunk.indexed = indexed;
+  } else if (indexed < chunk.indexed) {
+    chunk.indexed = indexed;
+  }
+  chunk.rows[word] |= bit;
+  return true;
+}
+
+/**
+ * @details Layers not in this index are moved across.  The tiles of layers in
+ * both indexes are only added if the layers share the same blank tile.  This
+ * allows an index to be built away from the Node/V8 thread and then merged.
+ *
+ * @param other The index to take the tiles from.
+ */
+void BlankIndex::Merge(BlankIndex &other) {
+  for (std::map<std::string, Layer*>::iterator it = other.layers.begin(); it != other.layers.end(); ++it) {
+    Layer *&layer = layers[it->first];
+    Layer *from = it->second;
+    if (!layer) {
+      layer = from;
+      continue;
+    }
+
+    if (layer->body == from->body && layer->content_type == from->content_type) {
+      for (std::map<uint64_t, Chunk>::iterator chunk = from->chunks.begin(); chunk != from->chunks.end(); ++chunk) {
+        Chunk &into = layer->chunks[chunk->first];
+        if (into.rows.empty()) {
+          into = chunk->second;
+          continue;
+        }
+        for (int word = 0; word < 64; word++) {
+          into.rows[word] |= chunk->second.rows[word];
+        }
+        if (chunk->second.indexed < into.indexed) {
+          into.indexed = chunk->second.indexed;
+        }
+      }
+    }
+    from->buffer.Dispose();
+    delete from;
+  }
+  other.layers.clear();
+}
+
+
+/**
+ * @details This walks a layer directory of a disk cache using the default
+ * `tilecache` layout.  Tiles that are symbolic links into a `blanks`
+ * directory are indexed as of the time the link was made, using the body of
+ * the blank tile linked to.  This blocks, so it should be called on an index
+ * that is subsequently merged from the Node/V8 thread.
+ *
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param directory The directory containing the layer tiles.
+ *
+ * @param content_type The MIME type of the layer tiles.
+ *
+ * @return The number of tiles indexed.
+ */
+uint64_t BlankIndex::Seed(const std::string &name, const std::string &directory, const std::string &content_type) {
+  Seeding seeding;
+  seeding.index = this;
+  seeding.name = &name;
+  seeding.content_type = &content_type;
+  seeding.seeded = 0;
+  TilecacheWalker(SeedTile, NULL, &seeding).Walk(directory);
+  return seeding.seeded;
+}
+
+/**
+ * @param path The location of the tile file.
+ *
+ * @param type The directory entry type of the tile file.
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @param data The state of the seeding.
+ */
+bool BlankIndex::SeedTile(const std::string &path, unsigned char type, int z, int x, int y, void *data) {
+  Seeding *seeding = static_cast<Seeding*>(data);
+  struct stat info;
+  char target[4096];
+  ssize_t length;
+  if ((type != DT_LNK && type != DT_UNKNOWN)
+      || lstat(path.c_str(), &info) != 0 || !S_ISLNK(info.st_mode)
+      || (length = readlink(path.c_str(), target, sizeof(target) - 1)) <= 0) {
+    return true;
+  }
+  target[length] = '\0';
+  if (!strstr(target, "blanks/")) {
+    return true;
+  }
+
+  // resolve links relative to the directory containing them
+  std::string blank(target);
+  if (blank[0] != '/') {
+    blank = path.substr(0, path.rfind('/') + 1) + blank;
+  }
+
+  std::map<std::string, std::string>::iterator body = seeding->bodies.find(blank);
+  if (body == seeding->bodies.end()) {
+    body = seeding->bodies.insert(std::make_pair(blank, std::string())).first;
+    FILE *fp = fopen(blank.c_str(), "rb");
+    if (fp) {
+      char buffer[NODE_MAPCACHE_BLANK_MAX_SIZE + 1];
+      size_t size = fread(buffer, 1, sizeof(buffer), fp);
+      if (size && size <= NODE_MAPCACHE_BLANK_MAX_SIZE) {
+        body->second.assign(buffer, size);
+      }
+      fclose(fp);
+    }
+  }
+
+  if (!body->second.empty()
+      && seeding->index->Insert(*(seeding->name), z, x, y, body->second.data(), body->second.size(),
+                                *(seeding->content_type), apr_time_from_sec(info.st_mtime))) {
+    seeding->seeded++;
+  }
+  return true;
+}
+
+/**
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ */
+void BlankIndex::Remove(const std::string &name, int z, int x, int y) {
+  std::map<std::string, Layer*>::iterator layer = layers.find(name);
+  if (layer == layers.end()) {
+    return;
+  }
+
+  unsigned int word;
+  uint64_t bit;
+  std::map<uint64_t, Chunk>::iterator chunk = layer->second->chunks.find(ChunkKey(z, x, y, &word, &bit));
+  if (chunk != layer->second->chunks.end()) {
+    chunk->second.rows[word] &= ~bit;
+  }
+}
+
+/**
+ * @details This clears the bits of the chunks overlapping the range rather
+ * than visiting each tile, so large ranges are cheap to remove.
+ *
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param z The zoom level.
+ *
+ * @param minx The first column.
+ *
+ * @param miny The first row.
+ *
+ * @param maxx One past the last column.
+ *
+ * @param maxy One past the last row.
+ */
+void BlankIndex::RemoveRange(const std::string &name, int z, int minx, int miny, int maxx, int maxy) {
+  std::map<std::string, Layer*>::iterator layer = layers.find(name);
+  if (layer == layers.end() || minx >= maxx || miny >= maxy) {
+    return;
+  }
+
+  std::map<uint64_t, Chunk> &chunks = layer->second->chunks;
+  for (std::map<uint64_t, Chunk>::iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk) {
+    if ((int) (chunk->first >> 56) != (z & 0xff)) {
+      continue;
+    }
+    int x0 = (int) (chunk->first & 0xfffffff) << 6;
+    int y0 = (int) ((chunk->first >> 28) & 0xfffffff) << 6;
+    if (x0 >= maxx || x0 + 64 <= minx || y0 >= maxy || y0 + 64 <= miny) {
+      continue;
+    }
+
+    // the columns of the range within the chunk
+    int from = (minx > x0) ? minx - x0 : 0;
+    int to = (maxx < x0 + 64) ? maxx - x0 : 64;
+    uint64_t mask = ((to - from == 64) ? ~(uint64_t) 0 : ((((uint64_t) 1) << (to - from)) - 1)) << from;
+
+    for (int word = 0; word < 64; word++) {
+      if (y0 + word >= miny && y0 + word < maxy) {
+        chunk->second.rows[word] &= ~mask;
+      }
+    }
+  }
+}
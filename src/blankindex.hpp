@@ -0,0 +1,184 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#ifndef __NODE_MAPCACHE_BLANKINDEX_H__
+#define __NODE_MAPCACHE_BLANKINDEX_H__
+
+/**
+ * @file blankindex.hpp
+ * @brief This declares the `BlankIndex` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <v8.h>
+
+// Apache headers
+#include <apr_time.h>
+
+/// The maximum size of a tile body that is tested for being blank
+#define NODE_MAPCACHE_BLANK_MAX_SIZE 4096
+
+/**
+ * @brief An index of tiles that are known to be blank
+ *
+ * Large parts of a tileset (e.g. oceans) are frequently made up of identical
+ * single colour tiles.  This class records which tiles are blank using a
+ * sparse bitmap per tileset layer and zoom level, allowing those tiles to be
+ * returned from a single shared body without going near the cache backend.
+ * Each chunk of the bitmap records when its oldest tile was indexed, so
+ * tiles that may have expired can be looked up in the cache again.
+ *
+ * A layer is identified by the tileset and grid names (`tileset@grid`).  Each
+ * layer stores the first blank tile body it encounters: only tiles having a
+ * byte identical body are subsequently indexed, so a bit in the index always
+ * means "this tile is the layer's blank tile".
+ *
+ * Tiles stored by a disk cache with `<symlink_blank/>` are links into its
+ * `blanks` directory, so they can be indexed by `Seed()` without decoding
+ * them.
+ *
+ * The index is not thread safe: it should only be accessed from the Node/V8
+ * thread, except for an index being seeded before it is merged.
+ */
+class BlankIndex {
+public:
+
+  /// A 64x64 tile bitmap with the time its oldest tile was indexed
+  struct Chunk {
+    /// One word per tile row, one bit per tile column
+    std::vector<uint64_t> rows;
+    /// The time the oldest tile in the chunk was indexed
+    apr_time_t indexed;
+  };
+
+  /// A tileset/grid combination with its blank tile and bitmaps
+  struct Layer {
+    /// The encoded blank tile shared by all indexed tiles
+    std::string body;
+    /// The MIME type of the blank tile
+    std::string content_type;
+    /// The time the blank tile was first indexed
+    apr_time_t mtime;
+    /// The `Buffer` wrapping `body`, created on first use
+    v8::Persistent<v8::Object> buffer;
+    /// The bitmap chunks, keyed on zoom level and chunk coordinates
+    std::map<uint64_t, Chunk> chunks;
+  };
+
+  /// Intantiate an index persisted at `path`
+  BlankIndex(const std::string &path) :
+    path(path)
+  {}
+
+  /// Dispose of the layers and their javascript handles
+  ~BlankIndex();
+
+  /// Load the index from its file
+  bool Load(std::string &error);
+
+  /// Serialise the index to a string suitable for passing to `Write()`
+  void Serialise(std::string &data) const;
+
+  /// Write serialised index data to the index file
+  static bool Write(const std::string &path, const std::string &data, std::string &error);
+
+  /// Find the layer for a tile if the tile is known to be blank
+  Layer* Find(const std::string &name, int z, int x, int y,
+              apr_time_t expired_before, apr_time_t *indexed);
+
+  /// Record a blank tile in the index
+  bool Insert(const std::string &name, int z, int x, int y,
+              const char *data, size_t size,
+              const std::string &content_type,
+              apr_time_t indexed);
+
+  /// Add the tiles from another index, emptying it
+  void Merge(BlankIndex &other);
+
+  /// Index the tiles of a layer directory linking to blank tiles
+  uint64_t Seed(const std::string &name, const std::string &directory, const std::string &content_type);
+
+  /// Remove a tile from the index
+  void Remove(const std::string &name, int z, int x, int y);
+
+  /// Remove a range of tiles in a zoom level from the index
+  void RemoveRange(const std::string &name, int z, int minx, int miny, int maxx, int maxy);
+
+  /// The location of the index file
+  const std::string path;
+
+private:
+
+  /// The indexed layers, keyed on `tileset@grid`
+  std::map<std::string, Layer*> layers;
+
+  /// The state of a layer directory being seeded
+  struct Seeding {
+    /// The index being seeded
+    BlankIndex *index;
+    /// The layer name
+    const std::string *name;
+    /// The MIME type of the layer tiles
+    const std::string *content_type;
+    /// The blank tiles read so far keyed on path, empty if unusable
+    std::map<std::string, std::string> bodies;
+    /// The number of tiles indexed
+    uint64_t seeded;
+  };
+
+  /// Index a tile found by the walker if it links to a blank tile
+  static bool SeedTile(const std::string &path, unsigned char type, int z, int x, int y, void *data);
+
+  /// Compute the chunk key and bit location for a tile
+  static uint64_t ChunkKey(int z, int x, int y, unsigned int *word, uint64_t *bit);
+};
+
+/**
+ * @details Tiles are grouped into chunks of 64x64 tiles, each chunk being
+ * represented by 64 words with one word per tile row.  This keeps the memory
+ * footprint proportional to the number of areas containing blank tiles rather
+ * than to the size of the grid, which at high zoom levels is enormous.
+ *
+ * @param z The tile zoom level.
+ * @param x The tile column.
+ * @param y The tile row.
+ * @param word Set to the index of the row word within the chunk.
+ * @param bit Set to the bit mask of the tile within the row word.
+ */
+inline uint64_t BlankIndex::ChunkKey(int z, int x, int y, unsigned int *word, uint64_t *bit) {
+  *word = y & 63;
+  *bit = ((uint64_t) 1) << (x & 63);
+  return ((uint64_t) (z & 0xff) << 56) | ((uint64_t) ((y >> 6) & 0xfffffff) << 28) | ((x >> 6) & 0xfffffff);
+}
+
+#endif  /* __NODE_MAPCACHE_BLANKINDEX_H__ */
@@ -0,0 +1,216 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file bodystore.cpp
+ * @brief This defines the `BodyStore` class.
+ */
+
+#include <string.h>
+
+#include <node_buffer.h>
+
+#include "bodystore.hpp"
+
+using namespace v8;
+using namespace node;
+
+/// The xxHash 64 bit primes
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t Rotate(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t Read64(const char *data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint32_t Read32(const char *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint64_t Round(uint64_t accumulator, uint64_t input) {
+  accumulator += input * PRIME2;
+  return Rotate(accumulator, 31) * PRIME1;
+}
+
+static inline uint64_t Merge(uint64_t accumulator, uint64_t value) {
+  accumulator ^= Round(0, value);
+  return accumulator * PRIME1 + PRIME4;
+}
+
+BodyStore::BodyStore(size_t max_size) :
+  max_size(max_size),
+  bytes(0),
+  hits(0),
+  misses(0),
+  saved(0)
+{
+}
+
+/**
+ * @details Disposing of the weak references cancels their callbacks, so the
+ * `Buffer` objects still referenced by javascript simply stop being shared.
+ */
+BodyStore::~BodyStore() {
+  for (std::multimap<uint64_t, Entry*>::iterator it = entries.begin(); it != entries.end(); ++it) {
+    it->second->buffer.Dispose();
+    delete it->second;
+  }
+}
+
+/**
+ * @param data The body.
+ *
+ * @param size The size of the body, which should satisfy `Accepts()`.
+ *
+ * @param hash The hash of the body returned by `Hash()`.
+ */
+Local<Object> BodyStore::Intern(const char *data, size_t size, uint64_t hash) {
+  HandleScope scope;
+
+  std::pair<std::multimap<uint64_t, Entry*>::iterator,
+            std::multimap<uint64_t, Entry*>::iterator> range = entries.equal_range(hash);
+  for (std::multimap<uint64_t, Entry*>::iterator it = range.first; it != range.second; ++it) {
+    Entry *entry = it->second;
+    if (entry->size == size && !memcmp(Buffer::Data(entry->buffer), data, size)) {
+      hits++;
+      saved += size;
+      return scope.Close(Local<Object>::New(entry->buffer));
+    }
+  }
+
+  Local<Object> buffer = Local<Object>::New(Buffer::New((char *) data, size)->handle_);
+  Entry *entry = new Entry();
+  entry->buffer = Persistent<Object>::New(buffer);
+  entry->buffer.MakeWeak(entry, Released);
+  entry->hash = hash;
+  entry->size = size;
+  entry->store = this;
+  entries.insert(std::make_pair(hash, entry));
+
+  bytes += size;
+  misses++;
+  return scope.Close(buffer);
+}
+
+/**
+ * @details This is the XXH64 algorithm with a seed of zero.  Words are read
+ * in the native byte order, so hashes are only comparable within a process.
+ *
+ * @param data The body.
+ *
+ * @param size The size of the body.
+ */
+uint64_t BodyStore::Hash(const char *data, size_t size) {
+  const char *end = data + size;
+  uint64_t hash;
+
+  if (size >= 32) {
+    const char *limit = end - 32;
+    uint64_t v1 = PRIME1 + PRIME2, v2 = PRIME2, v3 = 0, v4 = -PRIME1;
+    do {
+      v1 = Round(v1, Read64(data));
+      v2 = Round(v2, Read64(data + 8));
+      v3 = Round(v3, Read64(data + 16));
+      v4 = Round(v4, Read64(data + 24));
+      data += 32;
+    } while (data <= limit);
+
+    hash = Rotate(v1, 1) + Rotate(v2, 7) + Rotate(v3, 12) + Rotate(v4, 18);
+    hash = Merge(hash, v1);
+    hash = Merge(hash, v2);
+    hash = Merge(hash, v3);
+    hash = Merge(hash, v4);
+  } else {
+    hash = PRIME5;
+  }
+
+  hash += size;
+  for (; data + 8 <= end; data += 8) {
+    hash ^= Round(0, Read64(data));
+    hash = Rotate(hash, 27) * PRIME1 + PRIME4;
+  }
+  if (data + 4 <= end) {
+    hash ^= (uint64_t) Read32(data) * PRIME1;
+    hash = Rotate(hash, 23) * PRIME2 + PRIME3;
+    data += 4;
+  }
+  for (; data < end; data++) {
+    hash ^= (unsigned char) *data * PRIME5;
+    hash = Rotate(hash, 11) * PRIME1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+void BodyStore::GetStats(Stats &stats) const {
+  stats.bodies = entries.size();
+  stats.bytes = bytes;
+  stats.hits = hits;
+  stats.misses = misses;
+  stats.saved = saved;
+}
+
+/**
+ * @param object The weak reference to the collected `Buffer`.
+ *
+ * @param parameter The `Entry` holding the reference.
+ */
+void BodyStore::Released(Persistent<Value> object, void *parameter) {
+  Entry *entry = static_cast<Entry*>(parameter);
+  BodyStore *store = entry->store;
+
+  std::pair<std::multimap<uint64_t, Entry*>::iterator,
+            std::multimap<uint64_t, Entry*>::iterator> range = store->entries.equal_range(entry->hash);
+  for (std::multimap<uint64_t, Entry*>::iterator it = range.first; it != range.second; ++it) {
+    if (it->second == entry) {
+      store->entries.erase(it);
+      break;
+    }
+  }
+
+  store->bytes -= entry->size;
+  entry->buffer.Dispose();
+  entry->buffer.Clear();
+  delete entry;
+}
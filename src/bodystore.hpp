@@ -0,0 +1,134 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_BODYSTORE_H__
+#define __NODE_MAPCACHE_BODYSTORE_H__
+
+/**
+ * @file bodystore.hpp
+ * @brief This declares the `BodyStore` class.
+ */
+
+// Standard headers
+#include <map>
+#include <stdint.h>
+#include <stddef.h>
+
+// Node headers
+#include <v8.h>
+#include <node.h>
+
+/**
+ * @brief A content addressed store of response bodies
+ *
+ * Many tiles have byte for byte identical bodies, such as those covering sea
+ * or areas without data.  The store keeps a weak reference to the `Buffer`
+ * of each body it has returned, keyed on a hash of the body, and returns that
+ * same `Buffer` for any identical body rather than a new copy.  A body stays
+ * in the store for as long as javascript holds a reference to its `Buffer`:
+ * the garbage collector removes it once the last reference has gone.
+ *
+ * The hash is computed with the 64 bit xxHash algorithm and candidates are
+ * compared byte for byte, so collisions never share a body.  Instances must
+ * only be used from the Node/V8 thread, although `Hash()` can be called from
+ * any thread.
+ */
+class BodyStore {
+public:
+
+  /// A snapshot of the store metrics
+  struct Stats {
+    /// The number of distinct bodies held
+    uint64_t bodies;
+    /// The total size of the distinct bodies in bytes
+    uint64_t bytes;
+    /// The number of bodies returned that were already held
+    uint64_t hits;
+    /// The number of bodies returned that were added to the store
+    uint64_t misses;
+    /// The total size of the bodies that were shared rather than copied
+    uint64_t saved;
+  };
+
+  /// Intantiate a store of bodies no larger than `max_size` bytes
+  BodyStore(size_t max_size);
+
+  /// Release the references to the bodies
+  ~BodyStore();
+
+  /// Whether a body of a given size can be stored
+  bool Accepts(size_t size) const {
+    return size && size <= max_size;
+  }
+
+  /// Return a `Buffer` containing a body, sharing one if possible
+  v8::Local<v8::Object> Intern(const char *data, size_t size, uint64_t hash);
+
+  /// Compute the hash identifying a body
+  static uint64_t Hash(const char *data, size_t size);
+
+  /// Retrieve the store metrics
+  void GetStats(Stats &stats) const;
+
+  /// The maximum size of a body in bytes
+  const size_t max_size;
+
+private:
+
+  /// A body held by the store
+  struct Entry {
+    /// The weak reference to the `Buffer` holding the body
+    v8::Persistent<v8::Object> buffer;
+    /// The hash of the body
+    uint64_t hash;
+    /// The size of the body in bytes
+    size_t size;
+    /// The store holding the body
+    BodyStore *store;
+  };
+
+  /// The bodies keyed on their hash
+  std::multimap<uint64_t, Entry*> entries;
+
+  /// The total size of the bodies
+  uint64_t bytes;
+
+  /// The number of bodies that were already held
+  uint64_t hits;
+
+  /// The number of bodies that were added
+  uint64_t misses;
+
+  /// The total size of the bodies that were shared
+  uint64_t saved;
+
+  /// Remove a body once its `Buffer` has been garbage collected
+  static void Released(v8::Persistent<v8::Value> object, void *parameter);
+};
+
+#endif  /* __NODE_MAPCACHE_BODYSTORE_H__ */
@@ -0,0 +1,356 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file connectionpool.cpp
+ * @brief This defines the `ConnectionPool` class.
+ */
+
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "connectionpool.hpp"
+
+uint64_t ConnectionPool::next_id = 0;
+__thread std::map<uint64_t, ConnectionPool::Handle*> *ConnectionPool::thread_handles = NULL;
+std::map<mapcache_source*, ConnectionPool::Hook*> ConnectionPool::registry;
+uv_rwlock_t ConnectionPool::registry_lock;
+uv_once_t ConnectionPool::registry_once = UV_ONCE_INIT;
+
+/**
+ * @details This should be called in the Node/V8 thread when no requests are
+ * using the configuration.
+ *
+ * @param cfg The configuration containing the sources.
+ *
+ * @param max_handles The maximum number of persistent handles.
+ *
+ * @param idle_timeout The time in milliseconds after which an unused handle
+ * is closed.
+ *
+ * @param max_connections The maximum number of connections cached by each
+ * handle.
+ */
+ConnectionPool::ConnectionPool(mapcache_cfg *cfg, uint32_t max_handles, uint64_t idle_timeout, uint32_t max_connections) :
+  id(next_id++),
+  max_handles(max_handles),
+  idle_timeout(idle_timeout * 1000000),
+  max_connections(max_connections)
+{
+  uv_mutex_init(&mutex);
+  stats.handles = 0;
+  stats.requests = stats.connects = stats.expired = stats.overflow = 0;
+
+  uv_once(&registry_once, InitRegistry);
+  uv_rwlock_wrlock(&registry_lock);
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->sources); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_source *source = (mapcache_source *) val;
+    if (source->type != MAPCACHE_SOURCE_WMS) {
+      continue;
+    }
+
+    Hook *hook = new Hook();
+    hook->owner = this;
+    hook->render_map = source->render_map;
+    registry[source] = hook;
+    sources.push_back(source);
+    source->render_map = RenderMap;
+  }
+  uv_rwlock_wrunlock(&registry_lock);
+
+  timer.data = this;
+  uv_timer_init(uv_default_loop(), &timer);
+  uv_timer_start(&timer, Sweep, idle_timeout, idle_timeout);
+  uv_unref((uv_handle_t *) &timer); // don't keep the process alive
+}
+
+ConnectionPool::~ConnectionPool() {
+  for (std::vector<Handle*>::iterator it = handles.begin(); it != handles.end(); ++it) {
+    if ((*it)->curl) {
+      curl_easy_cleanup((*it)->curl);
+    }
+    delete *it;
+  }
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details Sources whose functions have since been replaced by something
+ * else can't be restored: their hooks stay registered, passing renders
+ * straight through to the original functions.
+ */
+void ConnectionPool::Close() {
+  uv_rwlock_wrlock(&registry_lock);
+  for (std::vector<mapcache_source*>::iterator it = sources.begin(); it != sources.end(); ++it) {
+    mapcache_source *source = *it;
+    Hook *hook = registry[source];
+    if (source->render_map == RenderMap) {
+      source->render_map = hook->render_map;
+      registry.erase(source);
+      delete hook;
+    } else {
+      hook->owner = NULL;
+    }
+  }
+  uv_rwlock_wrunlock(&registry_lock);
+
+  uv_timer_stop(&timer);
+  uv_close((uv_handle_t *) &timer, Closed);
+}
+
+/**
+ * @param stats Set to the current metrics.
+ */
+void ConnectionPool::GetStats(Stats &stats) {
+  uv_mutex_lock(&mutex);
+  stats = this->stats;
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @details This mirrors the request made by the mapcache core, other than
+ * the cURL handle being reused: options are reset for each request while the
+ * connection cache of the handle is kept.
+ *
+ * @param ctx The context of the request.
+ *
+ * @param http The HTTP settings of the source.
+ *
+ * @param url The URL to request.
+ *
+ * @param data The buffer receiving the response body.
+ */
+void ConnectionPool::Fetch(mapcache_context *ctx, mapcache_http *http, const char *url, mapcache_buffer *data) {
+  Handle *handle = Acquire();
+  CURL *curl = (handle) ? handle->curl : curl_easy_init();
+  if (!curl) {
+    if (handle) {
+      Release(handle, 0);
+    }
+    ctx->set_error(ctx, 500, (char *) "could not create a cURL handle");
+    return;
+  }
+
+  struct curl_slist *headers = NULL;
+  if (http->headers) {
+    const apr_array_header_t *array = apr_table_elts(http->headers);
+    apr_table_entry_t *elts = (apr_table_entry_t *) array->elts;
+    for (int i = 0; i < array->nelts; i++) {
+      headers = curl_slist_append(headers, apr_pstrcat(ctx->pool, elts[i].key, ": ", elts[i].val, NULL));
+    }
+  }
+
+  char error[CURL_ERROR_SIZE] = "";
+  curl_easy_reset(curl);
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long) http->connection_timeout);
+  curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, (long) max_connections);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, Write);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+  if (headers) {
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  }
+
+  CURLcode ret = curl_easy_perform(curl);
+  long connects = 0;
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL); // the buffer is about to go out of scope
+  if (ret != CURLE_OK) {
+    ctx->set_error(ctx, 502, (char *) "curl failed to request url %s : %s", url,
+                   (error[0]) ? error : curl_easy_strerror(ret));
+  }
+  if (headers) {
+    curl_slist_free_all(headers);
+  }
+
+  if (handle) {
+    Release(handle, connects);
+  } else {
+    curl_easy_cleanup(curl);
+    uv_mutex_lock(&mutex);
+    stats.connects += connects;
+    uv_mutex_unlock(&mutex);
+  }
+}
+
+/**
+ * @details A thread is given a handle the first time it makes a request, as
+ * long as there are fewer than the maximum number of handles.  Handles that
+ * were closed while idle are reopened.
+ */
+ConnectionPool::Handle* ConnectionPool::Acquire() {
+  if (!thread_handles) {
+    thread_handles = new std::map<uint64_t, Handle*>();
+  }
+
+  uv_mutex_lock(&mutex);
+  Handle *handle = NULL;
+  std::map<uint64_t, Handle*>::iterator it = thread_handles->find(id);
+  if (it != thread_handles->end()) {
+    handle = it->second;
+  } else if (handles.size() < max_handles) {
+    handle = new Handle();
+    handle->curl = NULL;
+    handles.push_back(handle);
+    (*thread_handles)[id] = handle;
+  }
+
+  stats.requests++;
+  if (!handle) {
+    stats.overflow++;
+  } else {
+    if (!handle->curl && (handle->curl = curl_easy_init())) {
+      stats.handles++;
+    }
+    handle->in_use = true;
+  }
+  uv_mutex_unlock(&mutex);
+  return handle;
+}
+
+/**
+ * @param handle The handle of the current thread.
+ *
+ * @param connects The number of connections opened by the request.
+ */
+void ConnectionPool::Release(Handle *handle, long connects) {
+  uv_mutex_lock(&mutex);
+  handle->in_use = false;
+  handle->last_used = uv_hrtime();
+  stats.connects += connects;
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param handle The sweep timer.
+ */
+void ConnectionPool::Sweep(uv_timer_t *handle, int status /*UNUSED*/) {
+  ConnectionPool *self = static_cast<ConnectionPool*>(handle->data);
+  uint64_t now = uv_hrtime();
+
+  uv_mutex_lock(&self->mutex);
+  for (std::vector<Handle*>::iterator it = self->handles.begin(); it != self->handles.end(); ++it) {
+    Handle *idle = *it;
+    if (idle->curl && !idle->in_use && now - idle->last_used >= self->idle_timeout) {
+      curl_easy_cleanup(idle->curl);
+      idle->curl = NULL;
+      self->stats.handles--;
+      self->stats.expired++;
+    }
+  }
+  uv_mutex_unlock(&self->mutex);
+}
+
+/**
+ * @param handle The sweep timer.
+ */
+void ConnectionPool::Closed(uv_handle_t *handle) {
+  delete static_cast<ConnectionPool*>(handle->data);
+}
+
+void ConnectionPool::InitRegistry() {
+  uv_rwlock_init(&registry_lock);
+}
+
+/**
+ * @param ptr The received data.
+ *
+ * @param size The size of each data member.
+ *
+ * @param nmemb The number of data members.
+ *
+ * @param data The `mapcache_buffer` receiving the data.
+ */
+size_t ConnectionPool::Write(void *ptr, size_t size, size_t nmemb, void *data) {
+  mapcache_buffer *buffer = (mapcache_buffer *) data;
+  size_t length = size * nmemb;
+  mapcache_buffer_append(buffer, length, ptr);
+  return length;
+}
+
+/**
+ * @details This builds the same GetMap request as the WMS source of the
+ * mapcache core.
+ *
+ * @param ctx The context of the request.
+ *
+ * @param map The map to render.
+ */
+void ConnectionPool::RenderMap(mapcache_context *ctx, mapcache_map *map) {
+  uv_rwlock_rdlock(&registry_lock);
+  Hook *hook = registry[map->tileset->source];
+  uv_rwlock_rdunlock(&registry_lock);
+
+  if (!hook->owner) {
+    hook->render_map(ctx, map);
+    return;
+  }
+
+  mapcache_source_wms *wms = (mapcache_source_wms *) map->tileset->source;
+  apr_table_t *params = apr_table_clone(ctx->pool, wms->wms_default_params);
+  apr_table_setn(params, "BBOX", apr_psprintf(ctx->pool, "%f,%f,%f,%f",
+                                              map->extent.minx, map->extent.miny,
+                                              map->extent.maxx, map->extent.maxy));
+  apr_table_setn(params, "WIDTH", apr_psprintf(ctx->pool, "%d", map->width));
+  apr_table_setn(params, "HEIGHT", apr_psprintf(ctx->pool, "%d", map->height));
+  apr_table_setn(params, "FORMAT", "image/png");
+  apr_table_setn(params, "SRS", map->grid_link->grid->srs);
+  apr_table_overlap(params, wms->getmap_params, APR_OVERLAP_TABLES_SET);
+
+  if (map->dimensions && !apr_is_empty_table(map->dimensions)) {
+    const apr_array_header_t *array = apr_table_elts(map->dimensions);
+    apr_table_entry_t *elts = (apr_table_entry_t *) array->elts;
+    for (int i = 0; i < array->nelts; i++) {
+      apr_table_setn(params, elts[i].key, elts[i].val);
+    }
+  }
+
+  // request the tileset name if the source doesn't specify the layers
+  if (!apr_table_get(params, "LAYERS")) {
+    apr_table_set(params, "LAYERS", map->tileset->name);
+  }
+
+  map->encoded_data = mapcache_buffer_create(30000, ctx->pool);
+  char *url = mapcache_http_build_url(ctx, wms->http->url, params);
+  hook->owner->Fetch(ctx, wms->http, url, map->encoded_data);
+  if (GC_HAS_ERROR(ctx)) {
+    return;
+  }
+
+  if (!mapcache_imageio_is_valid_format(ctx, map->encoded_data)) {
+    char *returned = apr_pstrndup(ctx->pool, (char *) map->encoded_data->buf, map->encoded_data->size);
+    ctx->set_error(ctx, 502, (char *) "wms request for tileset %s returned an unsupported format:\n%s",
+                   map->tileset->name, returned);
+  }
+}
@@ -0,0 +1,187 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_CONNECTIONPOOL_H__
+#define __NODE_MAPCACHE_CONNECTIONPOOL_H__
+
+/**
+ * @file connectionpool.hpp
+ * @brief This declares the `ConnectionPool` class.
+ */
+
+// Standard headers
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// cURL headers
+#include <curl/curl.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief Persistent upstream connections for WMS sources
+ *
+ * The mapcache core creates and destroys a cURL handle for every request to
+ * a WMS source, so a connection is opened (and any TLS negotiated) for every
+ * tile rendered.  This class replaces the `render_map` function of each WMS
+ * source with an equivalent one that performs the request using a cURL
+ * handle belonging to the current thread.  The handle is kept between
+ * requests, along with its cache of open connections, so requests from the
+ * same thread reuse connections to a source.
+ *
+ * The number of handles is bounded: threads beyond the bound use a handle
+ * for a single request as the core does.  Handles that haven't been used for
+ * a period are closed by a timer in the Node/V8 thread.
+ *
+ * SQLite and memcache caches need no equivalent as the mapcache core already
+ * keeps their connections in process wide pools.
+ */
+class ConnectionPool {
+public:
+
+  /// A snapshot of the pool metrics
+  struct Stats {
+    /// The number of handles with open connections
+    uint32_t handles;
+    /// The number of requests made
+    uint64_t requests;
+    /// The number of new connections opened by those requests
+    uint64_t connects;
+    /// The number of handles closed after being idle
+    uint64_t expired;
+    /// The number of requests made without a persistent handle
+    uint64_t overflow;
+  };
+
+  /// Replace the rendering functions of the WMS sources in `cfg`
+  ConnectionPool(mapcache_cfg *cfg, uint32_t max_handles, uint64_t idle_timeout, uint32_t max_connections);
+
+  /// Retrieve the current metrics
+  void GetStats(Stats &stats);
+
+  /// Restore the source functions and free the pool once its timer has closed
+  void Close();
+
+private:
+
+  /// A cURL handle belonging to a thread
+  struct Handle {
+    /// The handle, or `NULL` if it has been closed
+    CURL *curl;
+    /// Set while the owning thread is making a request
+    bool in_use;
+    /// The high resolution time the handle was last used
+    uint64_t last_used;
+  };
+
+  /// A source whose `render_map` function has been replaced
+  struct Hook {
+    /// The instance handling the source, or `NULL` once it has gone
+    ConnectionPool *owner;
+    /// The original function
+    void (*render_map)(mapcache_context *ctx, mapcache_map *map);
+  };
+
+  /// Identifies the handles of this instance in each thread
+  const uint64_t id;
+
+  /// The maximum number of handles
+  const uint32_t max_handles;
+
+  /// The time after which an unused handle is closed in nanoseconds
+  const uint64_t idle_timeout;
+
+  /// The maximum number of connections cached by each handle
+  const uint32_t max_connections;
+
+  /// Protects the handles and the metrics
+  uv_mutex_t mutex;
+
+  /// The handles of every thread
+  std::vector<Handle*> handles;
+
+  /// The metrics
+  Stats stats;
+
+  /// Closes idle handles
+  uv_timer_t timer;
+
+  /// The sources whose functions have been replaced
+  std::vector<mapcache_source*> sources;
+
+  /// Request a URL into a buffer, setting an error in `ctx` on failure
+  void Fetch(mapcache_context *ctx, mapcache_http *http, const char *url, mapcache_buffer *data);
+
+  /// Claim the handle of the current thread, returning `NULL` if there are too many
+  Handle* Acquire();
+
+  /// Return the handle of the current thread
+  void Release(Handle *handle, long connects);
+
+  /// Close idle handles
+  static void Sweep(uv_timer_t *handle, int status /*UNUSED*/);
+
+  /// Free the pool once its timer has closed
+  static void Closed(uv_handle_t *handle);
+
+  /// Close the handles
+  ~ConnectionPool();
+
+  /// The identifier of the next instance
+  static uint64_t next_id;
+
+  /// The handles of the current thread keyed on instance identifier
+  static __thread std::map<uint64_t, Handle*> *thread_handles;
+
+  /// Replaced sources mapped to their hooks
+  static std::map<mapcache_source*, Hook*> registry;
+
+  /// Protects the registry
+  static uv_rwlock_t registry_lock;
+
+  /// Ensures the registry lock is initialised once
+  static uv_once_t registry_once;
+
+  /// Initialise the registry lock
+  static void InitRegistry();
+
+  /// Append received data to a buffer
+  static size_t Write(void *ptr, size_t size, size_t nmemb, void *data);
+
+  /// The replacement source rendering function
+  static void RenderMap(mapcache_context *ctx, mapcache_map *map);
+};
+
+#endif  /* __NODE_MAPCACHE_CONNECTIONPOOL_H__ */
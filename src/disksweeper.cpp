@@ -0,0 +1,462 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file disksweeper.cpp
+ * @brief This defines the `DiskSweeper` class.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include "disksweeper.hpp"
+#include "tilecache.hpp"
+
+/// The niceness of the sweeper thread
+#define NODE_MAPCACHE_SWEEPER_NICENESS 19
+
+/// The number of seconds in each bucket of the use time histogram
+#define SWEEPER_AGE_BUCKET 3600
+
+/// The shortest wait used to keep within the rate, in nanoseconds
+#define SWEEPER_MIN_WAIT 10000000ULL
+
+/**
+ * @details Every tileset and grid combination stored in a disk cache that can
+ * be walked is swept: caches using a filename template and tilesets with
+ * dimensions are skipped.
+ *
+ * @param cfg The configuration containing the caches.
+ *
+ * @param options The limits applied to the caches.
+ */
+DiskSweeper::DiskSweeper(mapcache_cfg *cfg, const Options &options) :
+  options(options),
+  started(false),
+  stopping(false),
+  pass_start(0),
+  operations(0)
+{
+  uv_mutex_init(&mutex);
+  uv_mutex_init(&records_mutex);
+  uv_cond_init(&stop_cond);
+
+  stats.passes = 0;
+  stats.running = false;
+  stats.pass_scanned = stats.pass_removed = stats.pass_reclaimed = stats.pass_time = 0;
+  stats.scanned = stats.removed = stats.reclaimed = 0;
+  stats.expired = stats.idle = stats.evicted = 0;
+  stats.records = 0;
+  stats.dropped = stats.errors = 0;
+
+  std::map<std::string, Target> caches;
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->tilesets); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_tileset *tileset = (mapcache_tileset *) val;
+    if (tileset->cache->type != MAPCACHE_CACHE_DISK
+        || ((mapcache_cache_disk *) tileset->cache)->filename_template
+        || !((mapcache_cache_disk *) tileset->cache)->base_directory
+        || (tileset->dimensions && tileset->dimensions->nelts)) {
+      continue;
+    }
+
+    Target &target = caches[tileset->cache->name];
+    target.name = tileset->cache->name;
+    for (int i = 0; i < tileset->grid_links->nelts; i++) {
+      mapcache_grid_link *grid_link = APR_ARRAY_IDX(tileset->grid_links, i, mapcache_grid_link*);
+      Layer layer;
+      layer.name = std::string(tileset->name) + "@" + grid_link->grid->name;
+      layer.directory = std::string(((mapcache_cache_disk *) tileset->cache)->base_directory)
+        + "/" + tileset->name + "/" + grid_link->grid->name;
+      layer.auto_expire = tileset->auto_expire;
+      target.layers.push_back(layer);
+    }
+  }
+
+  for (std::map<std::string, Target>::iterator it = caches.begin(); it != caches.end(); ++it) {
+    targets.push_back(it->second);
+    stats.caches[it->first].files = stats.caches[it->first].bytes = 0;
+  }
+}
+
+/**
+ * @details Any pass in progress is abandoned at the next file.
+ */
+DiskSweeper::~DiskSweeper() {
+  if (started) {
+    uv_mutex_lock(&mutex);
+    stopping = true;
+    uv_cond_signal(&stop_cond);
+    uv_mutex_unlock(&mutex);
+    uv_thread_join(&thread);
+  }
+
+  uv_cond_destroy(&stop_cond);
+  uv_mutex_destroy(&records_mutex);
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @param error Set to a description of any failure.
+ */
+bool DiskSweeper::Start(std::string &error) {
+  if (targets.empty()) {
+    error = "The configuration has no disk caches that can be swept";
+    return false;
+  }
+  if (uv_thread_create(&thread, Run, this) != 0) {
+    error = "Could not create the disk sweeper thread";
+    return false;
+  }
+  started = true;
+  return true;
+}
+
+/**
+ * @details This should be called from the Node/V8 thread for every tile
+ * request.  Once `options.records` tiles are recorded, requests for other
+ * tiles are counted as dropped and those tiles are aged by when they were
+ * written.
+ *
+ * @param layer The layer name (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ */
+void DiskSweeper::Record(const std::string &layer, int z, int x, int y) {
+  std::string key = Key(layer, z, x, y);
+  uint32_t now = (uint32_t) time(NULL);
+
+  uv_mutex_lock(&records_mutex);
+  std::map<std::string, uint32_t>::iterator it = records.find(key);
+  if (it != records.end()) {
+    it->second = now;
+  } else if (records.size() < options.records) {
+    records[key] = now;
+  } else {
+    stats.dropped++;
+  }
+  uv_mutex_unlock(&records_mutex);
+}
+
+/**
+ * @param stats Set to the current metrics.
+ */
+void DiskSweeper::GetStats(Stats &stats) {
+  uv_mutex_lock(&mutex);
+  uv_mutex_lock(&records_mutex);
+  stats = this->stats;
+  stats.records = records.size();
+  uv_mutex_unlock(&records_mutex);
+  uv_mutex_unlock(&mutex);
+}
+
+void DiskSweeper::Run(void *arg) {
+  static_cast<DiskSweeper*>(arg)->Sweep();
+}
+
+/**
+ * @details On Linux the sweeper thread is given the lowest CPU priority and,
+ * where supported, the idle I/O scheduling class so its disk access yields to
+ * tile requests.  The first pass starts straight away.
+ */
+void DiskSweeper::Sweep() {
+#ifdef __linux__
+  pid_t tid = (pid_t) syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS, (id_t) tid, NODE_MAPCACHE_SWEEPER_NICENESS);
+#ifdef SYS_ioprio_set
+  syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, tid, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+#endif
+#endif
+
+  do {
+    uint64_t start = uv_hrtime();
+    if (!Pass()) {
+      break;
+    }
+    uint64_t elapsed = uv_hrtime() - start, interval = options.interval * 1000000;
+    if (elapsed < interval && !Wait(interval - elapsed)) {
+      break;
+    }
+  } while (true);
+}
+
+/**
+ * @details Each cache is walked once, removing expired and idle tiles.  If the
+ * tiles that remain exceed `max_size`, the histogram of their use times
+ * gathered by the walk gives the hour before which tiles must be removed, and
+ * the cache is walked again removing them.
+ */
+bool DiskSweeper::Pass() {
+  uv_mutex_lock(&mutex);
+  stats.running = true;
+  stats.pass_scanned = stats.pass_removed = stats.pass_reclaimed = 0;
+  uv_mutex_unlock(&mutex);
+
+  uint64_t start = uv_hrtime();
+  pass_start = start;
+  operations = 0;
+
+  for (std::vector<Target>::const_iterator target = targets.begin(); target != targets.end(); ++target) {
+    uv_mutex_lock(&mutex);
+    stats.cache = target->name;
+    uv_mutex_unlock(&mutex);
+
+    uint32_t now = (uint32_t) time(NULL);
+    Usage usage;
+    Ages ages;
+    if (!SweepCache(*target, now, 0, usage, ages)) {
+      return false;
+    }
+
+    if (options.max_size && usage.bytes > options.max_size) {
+      uint64_t excess = usage.bytes - options.max_size, oldest = 0;
+      uint32_t cutoff = 0;
+      for (Ages::const_iterator it = ages.begin(); it != ages.end() && oldest < excess; ++it) {
+        oldest += it->second;
+        cutoff = (it->first + 1) * SWEEPER_AGE_BUCKET;
+      }
+      ages.clear();
+      if (!SweepCache(*target, now, cutoff, usage, ages)) {
+        return false;
+      }
+    }
+
+    uv_mutex_lock(&mutex);
+    stats.caches[target->name] = usage;
+    uv_mutex_unlock(&mutex);
+  }
+
+  uv_mutex_lock(&mutex);
+  stats.passes++;
+  stats.running = false;
+  stats.cache.clear();
+  stats.pass_time = uv_hrtime() - start;
+  uv_mutex_unlock(&mutex);
+  return true;
+}
+
+/**
+ * @param target The cache to sweep.
+ *
+ * @param now The time of the sweep in seconds since the epoch.
+ *
+ * @param cutoff Tiles last used before this time are removed (0 for none).
+ *
+ * @param usage Set to the tiles kept.
+ *
+ * @param ages Updated with the bytes kept by the hour they were last used.
+ */
+bool DiskSweeper::SweepCache(const Target &target, uint32_t now, uint32_t cutoff, Usage &usage, Ages &ages) {
+  usage.files = usage.bytes = 0;
+  for (std::vector<Layer>::const_iterator layer = target.layers.begin(); layer != target.layers.end(); ++layer) {
+    Walk walk;
+    walk.sweeper = this;
+    walk.layer = &(*layer);
+    walk.now = now;
+    walk.cutoff = cutoff;
+    walk.usage = &usage;
+    walk.ages = &ages;
+    if (!TilecacheWalker(SweepTile, WalkFailed, &walk).Walk(layer->directory)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @details Only files matching the `tilecache` layout are visited, so only
+ * tiles are ever removed.  Symbolic links to blank tiles are removed like any
+ * other tile.
+ *
+ * @param path The location of the tile file.
+ *
+ * @param type The directory entry type of the tile file.
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @param data The state of the walk.
+ */
+bool DiskSweeper::SweepTile(const std::string &path, unsigned char type, int z, int x, int y, void *data) {
+  Walk *walk = static_cast<Walk*>(data);
+  DiskSweeper *self = walk->sweeper;
+  const Layer &layer = *(walk->layer);
+  if (!self->Throttle()) {
+    return false;
+  }
+
+  struct stat info;
+  if (lstat(path.c_str(), &info) != 0) {
+    if (errno != ENOENT) {
+      self->Fail(path, errno);
+    }
+    return true;
+  }
+  if (!S_ISREG(info.st_mode) && !S_ISLNK(info.st_mode)) {
+    return true;
+  }
+
+  std::string key = Key(layer.name, z, x, y);
+  uint32_t modified = (uint32_t) info.st_mtime, used = modified;
+  uv_mutex_lock(&self->records_mutex);
+  std::map<std::string, uint32_t>::const_iterator record = self->records.find(key);
+  if (record != self->records.end() && record->second > used) {
+    used = record->second;
+  }
+  uv_mutex_unlock(&self->records_mutex);
+
+  bool expired = (layer.auto_expire && modified + (uint32_t) layer.auto_expire < walk->now),
+    idle = (self->options.max_age && used + self->options.max_age < walk->now),
+    evicted = (walk->cutoff && used < walk->cutoff);
+
+  if (!expired && !idle && !evicted) {
+    walk->usage->files++;
+    walk->usage->bytes += info.st_size;
+    (*walk->ages)[used / SWEEPER_AGE_BUCKET] += info.st_size;
+    uv_mutex_lock(&self->mutex);
+    self->stats.scanned++;
+    self->stats.pass_scanned++;
+    uv_mutex_unlock(&self->mutex);
+    return true;
+  }
+
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    self->Fail(path, errno);
+    return true;
+  }
+
+  uv_mutex_lock(&self->records_mutex);
+  self->records.erase(key);
+  uv_mutex_unlock(&self->records_mutex);
+
+  uv_mutex_lock(&self->mutex);
+  self->stats.scanned++;
+  self->stats.pass_scanned++;
+  self->stats.removed++;
+  self->stats.pass_removed++;
+  self->stats.reclaimed += info.st_size;
+  self->stats.pass_reclaimed += info.st_size;
+  if (expired) {
+    self->stats.expired++;
+  } else if (idle) {
+    self->stats.idle++;
+  } else {
+    self->stats.evicted++;
+  }
+  uv_mutex_unlock(&self->mutex);
+  return true;
+}
+
+/**
+ * @param path The directory that couldn't be read.
+ *
+ * @param errnum The error number of the failure.
+ *
+ * @param data The state of the walk.
+ */
+void DiskSweeper::WalkFailed(const std::string &path, int errnum, void *data) {
+  static_cast<Walk*>(data)->sweeper->Fail(path, errnum);
+}
+
+/**
+ * @param layer The layer name (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ */
+std::string DiskSweeper::Key(const std::string &layer, int z, int x, int y) {
+  char coords[48];
+  snprintf(coords, sizeof(coords), "/%d/%d/%d", z, x, y);
+  return layer + coords;
+}
+
+/**
+ * @details The files examined since the start of the pass are compared with
+ * the number allowed by `options.rate` in the time elapsed, waiting for the
+ * difference once it is long enough to be worth sleeping for.
+ */
+bool DiskSweeper::Throttle() {
+  uint64_t allowed = ++operations * 1000000000ULL / options.rate,
+    elapsed = uv_hrtime() - pass_start;
+  if (allowed > elapsed + SWEEPER_MIN_WAIT) {
+    return Wait(allowed - elapsed);
+  }
+
+  uv_mutex_lock(&mutex);
+  bool running = !stopping;
+  uv_mutex_unlock(&mutex);
+  return running;
+}
+
+/**
+ * @param timeout The time to wait in nanoseconds.
+ */
+bool DiskSweeper::Wait(uint64_t timeout) {
+  uint64_t now = uv_hrtime(), deadline = now + timeout;
+  uv_mutex_lock(&mutex);
+  while (!stopping && now < deadline) {
+    uv_cond_timedwait(&stop_cond, &mutex, deadline - now);
+    now = uv_hrtime();
+  }
+  bool running = !stopping;
+  uv_mutex_unlock(&mutex);
+  return running;
+}
+
+/**
+ * @param path The file or directory that failed.
+ *
+ * @param errnum The error number of the failure.
+ */
+void DiskSweeper::Fail(const std::string &path, int errnum) {
+  uv_mutex_lock(&mutex);
+  stats.errors++;
+  stats.last_error = "Could not sweep " + path + ": " + strerror(errnum);
+  uv_mutex_unlock(&mutex);
+}
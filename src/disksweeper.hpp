@@ -0,0 +1,256 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_DISKSWEEPER_H__
+#define __NODE_MAPCACHE_DISKSWEEPER_H__
+
+/**
+ * @file disksweeper.hpp
+ * @brief This declares the `DiskSweeper` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief A background pruner of disk caches
+ *
+ * Disk caches grow without bound as tiles are rendered.  This class walks the
+ * tileset directories of every disk cache in a configuration from a low
+ * priority thread, examining at most `rate` files a second, and removes tiles
+ * that have passed their tileset's `<auto_expire>` time, that have not been
+ * used for `max_age` seconds or that are the least recently used once a cache
+ * exceeds `max_size` bytes.
+ *
+ * Only caches using the default `tilecache` layout for tilesets without
+ * dimensions are swept, using `TilecacheWalker`.  A tile is last used when it was last requested
+ * through the binding, as recorded by `Record()`, or otherwise when it was
+ * written.  Enforcing the
+ * size budget uses a histogram of use times gathered by one walk of a cache
+ * followed by a second walk removing the tiles older than the cutoff, so the
+ * memory used doesn't depend on the number of tiles.  Directories are left in
+ * place as mapcache may be about to write into them.
+ */
+class DiskSweeper {
+public:
+
+  /// The limits applied to the caches
+  struct Options {
+    /// The maximum number of files examined a second
+    uint32_t rate;
+    /// The time between the start of each pass, in milliseconds
+    uint64_t interval;
+    /// The number of seconds after which unused tiles are removed (0 for none)
+    uint64_t max_age;
+    /// The maximum number of bytes in each cache (0 for no limit)
+    uint64_t max_size;
+    /// The maximum number of tiles whose use is recorded
+    uint32_t records;
+  };
+
+  /// The contents of a cache after the last pass
+  struct Usage {
+    /// The number of tiles kept
+    uint64_t files;
+    /// The size of the tiles kept in bytes
+    uint64_t bytes;
+  };
+
+  /// A snapshot of the sweeper metrics
+  struct Stats {
+    /// The number of completed passes
+    uint64_t passes;
+    /// Whether a pass is in progress
+    bool running;
+    /// The name of the cache being swept
+    std::string cache;
+    /// The number of files examined in the current or last pass
+    uint64_t pass_scanned;
+    /// The number of tiles removed in the current or last pass
+    uint64_t pass_removed;
+    /// The bytes reclaimed in the current or last pass
+    uint64_t pass_reclaimed;
+    /// The duration of the last completed pass in nanoseconds
+    uint64_t pass_time;
+    /// The total number of files examined
+    uint64_t scanned;
+    /// The total number of tiles removed
+    uint64_t removed;
+    /// The total bytes reclaimed
+    uint64_t reclaimed;
+    /// The tiles removed as they had expired
+    uint64_t expired;
+    /// The tiles removed as they had not been used for `max_age`
+    uint64_t idle;
+    /// The tiles removed to keep a cache within `max_size`
+    uint64_t evicted;
+    /// The number of tiles whose use is recorded
+    uint32_t records;
+    /// The number of uses not recorded as the record was full
+    uint64_t dropped;
+    /// The number of files that could not be examined or removed
+    uint64_t errors;
+    /// The message from the last failure
+    std::string last_error;
+    /// The contents of each cache after its last pass, keyed on name
+    std::map<std::string, Usage> caches;
+  };
+
+  /// Instantiate a sweeper for the disk caches in `cfg`
+  DiskSweeper(mapcache_cfg *cfg, const Options &options);
+
+  /// Start the sweeper thread
+  bool Start(std::string &error);
+
+  /// Record a request for a tile in a layer (`tileset@grid`)
+  void Record(const std::string &layer, int z, int x, int y);
+
+  /// Retrieve the current metrics
+  void GetStats(Stats &stats);
+
+  /// Stop the sweeper thread, abandoning any pass in progress
+  ~DiskSweeper();
+
+  /// The limits applied to the caches
+  const Options options;
+
+private:
+
+  /// A tileset and grid combination stored in a disk cache
+  struct Layer {
+    /// The layer name (`tileset@grid`)
+    std::string name;
+    /// The directory containing the layer tiles
+    std::string directory;
+    /// The number of seconds after which its tiles expire (0 for never)
+    int auto_expire;
+  };
+
+  /// A disk cache being swept
+  struct Target {
+    /// The cache name
+    std::string name;
+    /// The layers stored in the cache
+    std::vector<Layer> layers;
+  };
+
+  /// The bytes kept in a cache, keyed on the hour they were last used
+  typedef std::map<uint32_t, uint64_t> Ages;
+
+  /// The caches being swept
+  std::vector<Target> targets;
+
+  /// Protects the metrics and `stopping`
+  uv_mutex_t mutex;
+
+  /// Protects `records`
+  uv_mutex_t records_mutex;
+
+  /// Signalled when the sweeper should stop
+  uv_cond_t stop_cond;
+
+  /// The sweeper thread
+  uv_thread_t thread;
+
+  /// Set once `Start()` has succeeded
+  bool started;
+
+  /// Set when the sweeper thread should exit
+  bool stopping;
+
+  /// The time each tile was last requested, keyed on tile
+  std::map<std::string, uint32_t> records;
+
+  /// The metrics
+  Stats stats;
+
+  /// The time the current pass started, for rate limiting
+  uint64_t pass_start;
+
+  /// The number of files examined in the current pass, for rate limiting
+  uint64_t operations;
+
+  /// The entry point of the sweeper thread
+  static void Run(void *arg);
+
+  /// Sweep the caches every interval until stopped
+  void Sweep();
+
+  /// Sweep every cache once, returning false if stopped
+  bool Pass();
+
+  /// Sweep a cache, removing tiles last used before `cutoff`
+  bool SweepCache(const Target &target, uint32_t now, uint32_t cutoff, Usage &usage, Ages &ages);
+
+  /// The state of a walk over a layer directory
+  struct Walk {
+    /// The sweeper walking the directory
+    DiskSweeper *sweeper;
+    /// The layer being swept
+    const Layer *layer;
+    /// The time of the sweep in seconds since the epoch
+    uint32_t now;
+    /// Tiles last used before this time are removed (0 for none)
+    uint32_t cutoff;
+    /// Updated with the tiles kept
+    Usage *usage;
+    /// Updated with the bytes kept by the hour they were last used
+    Ages *ages;
+  };
+
+  /// Sweep a tile found by the walker, returning false if stopped
+  static bool SweepTile(const std::string &path, unsigned char type, int z, int x, int y, void *data);
+
+  /// Record a directory that couldn't be walked
+  static void WalkFailed(const std::string &path, int errnum, void *data);
+
+  /// Identify a tile in the access record
+  static std::string Key(const std::string &layer, int z, int x, int y);
+
+  /// Wait to keep within the rate, returning false if stopped
+  bool Throttle();
+
+  /// Wait for `timeout` nanoseconds, returning false if stopped
+  bool Wait(uint64_t timeout);
+
+  /// Record a failure
+  void Fail(const std::string &path, int errnum);
+};
+
+#endif  /* __NODE_MAPCACHE_DISKSWEEPER_H__ */
@@ -0,0 +1,222 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+/**
+ * @file existencefilter.cpp
+ * @brief This defines the `ExistenceFilter` class.
+ */
+
+#include <math.h>
+
+#include <uv.h>
+
+#include "existencefilter.hpp"
+#include "tilecache.hpp"
+
+/**
+ * @details The filter is sized using the standard Bloom filter formulae: `m =
+ * -n ln(p) / ln(2)^2` bits and `k = (m / n) ln(2)` hash functions.
+ *
+ * @param capacity The expected number of tiles in each layer.
+ *
+ * @param error_rate The desired false positive rate when at capacity.
+ */
+ExistenceFilter::ExistenceFilter(uint32_t capacity, double error_rate) :
+  ready(false),
+  build_time(0)
+{
+  double n = (capacity) ? capacity : 1;
+  double m = ceil(-n * log(error_rate) / (M_LN2 * M_LN2));
+  nbits = (((uint64_t) m + 63) / 64) * 64;
+  nhashes = (unsigned int) floor((nbits / n) * M_LN2 + 0.5);
+  if (nhashes < 1) {
+    nhashes = 1;
+  }
+}
+
+ExistenceFilter::~ExistenceFilter() {
+  for (std::map<std::string, Layer*>::iterator it = layers.begin(); it != layers.end(); ++it) {
+    delete it->second;
+  }
+}
+
+/**
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param directory The directory containing the layer tiles, or an empty
+ * string if the layer can't be walked.
+ */
+void ExistenceFilter::AddLayer(const std::string &name, const std::string &directory) {
+  Layer *layer = new Layer();
+  layer->directory = directory;
+  layer->bits.resize(nbits / 64, 0);
+  layer->nhashes = nhashes;
+  layer->count = 0;
+
+  Layer *&existing = layers[name];
+  delete existing;
+  existing = layer;
+}
+
+/**
+ * @details This is a blocking operation that should be run in its own thread.
+ * Tiles stored while the filter is being built are recorded as normal.
+ */
+void ExistenceFilter::Build() {
+  uint64_t start = uv_hrtime();
+  for (std::map<std::string, Layer*>::iterator it = layers.begin(); it != layers.end(); ++it) {
+    if (!it->second->directory.empty()) {
+      std::pair<ExistenceFilter*, Layer*> walking(this, it->second);
+      TilecacheWalker(AddTile, NULL, &walking).Walk(it->second->directory);
+    }
+  }
+  build_time = (uv_hrtime() - start) / 1000000;
+}
+
+/**
+ * @details Layers that aren't tracked, because their cache can't be walked or
+ * the filter is still being built, may contain any tile.
+ *
+ * @param name The layer name (`tileset@grid`).
+ */
+bool ExistenceFilter::Tracks(const std::string &name) const {
+  std::map<std::string, Layer*>::const_iterator it = layers.find(name);
+  return ready && it != layers.end() && !it->second->directory.empty();
+}
+
+/**
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @return `false` if the tile is definitely not in the cache.
+ */
+bool ExistenceFilter::MayContain(const std::string &name, int z, int x, int y) const {
+  if (!Tracks(name)) {
+    return true;
+  }
+
+  const Layer *layer = layers.find(name)->second;
+  uint64_t h1, h2;
+  Hash(z, x, y, &h1, &h2);
+  for (unsigned int i = 0; i < layer->nhashes; i++) {
+    uint64_t bit = (h1 + i * h2) % nbits;
+    if (!(layer->bits[bit >> 6] & (((uint64_t) 1) << (bit & 63)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @param name The layer name (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ */
+void ExistenceFilter::Insert(const std::string &name, int z, int x, int y) {
+  std::map<std::string, Layer*>::iterator it = layers.find(name);
+  if (it != layers.end()) {
+    Insert(it->second, z, x, y);
+  }
+}
+
+void ExistenceFilter::Insert(Layer *layer, int z, int x, int y) {
+  uint64_t h1, h2;
+  Hash(z, x, y, &h1, &h2);
+  for (unsigned int i = 0; i < layer->nhashes; i++) {
+    uint64_t bit = (h1 + i * h2) % nbits;
+    __sync_fetch_and_or(&(layer->bits[bit >> 6]), ((uint64_t) 1) << (bit & 63));
+  }
+  __sync_fetch_and_add(&(layer->count), 1);
+}
+
+/**
+ * @details This uses the number of insertions as an estimate of the number of
+ * distinct tiles: tiles that are stored more than once are counted more than
+ * once, so this errs on the side of caution.
+ *
+ * @param layer The layer to estimate the rate for.
+ */
+double ExistenceFilter::FalsePositiveRate(const Layer *layer) const {
+  return pow(1.0 - exp(-(double) layer->nhashes * layer->count / nbits), layer->nhashes);
+}
+
+/**
+ * @param path The location of the tile file.
+ *
+ * @param type The directory entry type of the tile file.
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @param data The filter and the layer being walked.
+ */
+bool ExistenceFilter::AddTile(const std::string &path, unsigned char type, int z, int x, int y, void *data) {
+  std::pair<ExistenceFilter*, Layer*> *walking = static_cast<std::pair<ExistenceFilter*, Layer*>*>(data);
+  walking->first->Insert(walking->second, z, x, y);
+  return true;
+}
+
+/**
+ * @details The bit positions are derived from two hashes using the double
+ * hashing technique described by Kirsch and Mitzenmacher.  The hashes are
+ * produced using the SplitMix64 finaliser.
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @param h1 Set to the first hash.
+ *
+ * @param h2 Set to the second hash.
+ */
+void ExistenceFilter::Hash(int z, int x, int y, uint64_t *h1, uint64_t *h2) {
+  uint64_t h = ((uint64_t) (uint32_t) x << 32) ^ (uint32_t) y ^ ((uint64_t) z << 58);
+
+  h += 0x9e3779b97f4a7c15ULL;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  *h1 = h ^ (h >> 31);
+
+  h = *h1 + 0x9e3779b97f4a7c15ULL;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  *h2 = (h ^ (h >> 31)) | 1;
+}
@@ -0,0 +1,125 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#ifndef __NODE_MAPCACHE_EXISTENCEFILTER_H__
+#define __NODE_MAPCACHE_EXISTENCEFILTER_H__
+
+/**
+ * @file existencefilter.hpp
+ * @brief This declares the `ExistenceFilter` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * @brief A probabilistic record of the tiles present in the cache
+ *
+ * This maintains a Bloom filter for each tileset layer (`tileset@grid`).  A
+ * negative answer from `MayContain()` means the tile is definitely not cached
+ * and will have to be rendered; a positive answer means the tile is probably
+ * cached.
+ *
+ * The filters are populated by walking the directory tree of disk caches
+ * using the default `tilecache` layout and are subsequently updated as tiles
+ * are stored.  Layers whose cache can't be walked are not filtered:
+ * `MayContain()` always returns `true` for them.
+ *
+ * The set of layers is fixed before `Build()` is called.  After that the
+ * filter bits are updated atomically, so `Insert()` and `MayContain()` are
+ * safe to call from any thread, including while the filter is being built.
+ */
+class ExistenceFilter {
+public:
+
+  /// The Bloom filter for a tileset layer
+  struct Layer {
+    /// The cache directory containing the layer, empty if it can't be walked
+    std::string directory;
+    /// The filter bits
+    std::vector<uint64_t> bits;
+    /// The number of hash functions used
+    unsigned int nhashes;
+    /// The number of tiles added to the filter
+    volatile uint32_t count;
+  };
+
+  /// Intantiate a filter sized for `capacity` tiles per layer
+  ExistenceFilter(uint32_t capacity, double error_rate);
+
+  /// Add a layer to the filter
+  void AddLayer(const std::string &name, const std::string &directory);
+
+  /// Populate the filter from the cache directories
+  void Build();
+
+  /// Check whether a tile might be present in the cache
+  bool MayContain(const std::string &name, int z, int x, int y) const;
+
+  /// Check whether the filter has been built for a layer
+  bool Tracks(const std::string &name) const;
+
+  /// Record that a tile is present in the cache
+  void Insert(const std::string &name, int z, int x, int y);
+
+  /// Estimate the false positive rate of a layer
+  double FalsePositiveRate(const Layer *layer) const;
+
+  /// The layers in the filter, keyed on `tileset@grid`
+  std::map<std::string, Layer*> layers;
+
+  /// Set once the filter has been built
+  bool ready;
+
+  /// The time taken to build the filter in milliseconds
+  uint64_t build_time;
+
+  /// Clear up the layers
+  ~ExistenceFilter();
+
+private:
+
+  /// The number of bits in each layer
+  uint64_t nbits;
+
+  /// The number of hash functions used by each layer
+  unsigned int nhashes;
+
+  /// Add a tile to a layer
+  void Insert(Layer *layer, int z, int x, int y);
+
+  /// Add a tile found in a layer directory, called by the walker
+  static bool AddTile(const std::string &path, unsigned char type, int z, int x, int y, void *data);
+
+  /// Compute the two hashes from which the bit positions are derived
+  static void Hash(int z, int x, int y, uint64_t *h1, uint64_t *h2);
+};
+
+#endif  /* __NODE_MAPCACHE_EXISTENCEFILTER_H__ */
@@ -0,0 +1,420 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file exporter.cpp
+ * @brief This defines the `TileExporter` class.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "exporter.hpp"
+
+/// The maximum number of tiles waiting to be written
+#define NODE_MAPCACHE_EXPORT_QUEUE_SIZE 1024
+
+/**
+ * @param options The tiles to export.
+ *
+ * @param path The location of the MBTiles file to create.
+ *
+ * @param factory Used by the reader threads to create mapcache contexts.
+ */
+TileExporter::TileExporter(const Options &options, const std::string &path, ContextFactory factory) :
+  options(options),
+  path(path),
+  factory(factory),
+  range(options.grid_link, options.minz, options.maxz, (options.has_extent) ? &(options.extent) : NULL),
+  readers(0),
+  aborted(false),
+  db(NULL)
+{
+  uv_mutex_init(&mutex);
+  uv_cond_init(&not_empty);
+  uv_cond_init(&not_full);
+
+  stats.tiles = stats.missing = stats.bytes = stats.unique = stats.duration = 0;
+}
+
+TileExporter::~TileExporter() {
+  while (!queue.empty()) {
+    delete queue.front();
+    queue.pop_front();
+  }
+  if (db) {
+    sqlite3_close(db);
+  }
+  uv_cond_destroy(&not_full);
+  uv_cond_destroy(&not_empty);
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details This is a blocking operation that should be run in the thread
+ * pool: the calling thread acts as the writer.  The file must not already
+ * exist.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool TileExporter::Run(std::string &error) {
+  uint64_t start = uv_hrtime();
+
+  struct stat info;
+  if (stat(path.c_str(), &info) == 0) {
+    error = "The export file already exists: " + path;
+    return false;
+  }
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+    error = "Could not create the export file: " + std::string((db) ? sqlite3_errmsg(db) : path.c_str());
+    return false;
+  }
+  if (!CreateSchema(error) || !InsertMetadata(error)) {
+    return false;
+  }
+
+  // start the readers
+  std::vector<uv_thread_t> threads(options.threads);
+  for (unsigned int i = 0; i < options.threads; i++) {
+    if (uv_thread_create(&threads[i], RunReader, this) != 0) {
+      threads.resize(i);
+      break;
+    }
+    uv_mutex_lock(&mutex);
+    readers++;
+    uv_mutex_unlock(&mutex);
+  }
+  if (threads.empty()) {
+    error = "Could not create the export reader threads";
+    return false;
+  }
+
+  bool written = Write(error);
+  if (!written) {
+    range.Stop();
+    uv_mutex_lock(&mutex);
+    aborted = true;
+    uv_cond_broadcast(&not_full);
+    uv_mutex_unlock(&mutex);
+  }
+  for (std::vector<uv_thread_t>::iterator it = threads.begin(); it != threads.end(); ++it) {
+    uv_thread_join(&(*it));
+  }
+  if (!written) {
+    return false;
+  }
+
+  // indexing once the tiles are written is quicker than maintaining the index
+  const char *index = (options.dedupe)
+    ? "CREATE UNIQUE INDEX map_index ON map (zoom_level, tile_column, tile_row)"
+    : "CREATE UNIQUE INDEX tile_index ON tiles (zoom_level, tile_column, tile_row)";
+  if (!Exec(index, error)) {
+    return false;
+  }
+
+  sqlite3_close(db);
+  db = NULL;
+  stats.duration = uv_hrtime() - start;
+  return true;
+}
+
+/**
+ * @details Tiles are read directly from the cache so that tiles which aren't
+ * cached are skipped rather than rendered.
+ */
+void TileExporter::Read() {
+  apr_pool_t *pool = NULL, *tile_pool = NULL;
+  mapcache_context *ctx = NULL;
+
+  if (apr_pool_create(&pool, NULL) == APR_SUCCESS
+      && apr_pool_create(&tile_pool, pool) == APR_SUCCESS) {
+    ctx = factory(pool);
+  }
+
+  int z, y, minx, maxx;
+  while (ctx && range.NextRow(z, y, minx, maxx)) {
+    ctx->config = options.cfg;
+
+    for (int x = minx; x < maxx && !aborted; x++) {
+      mapcache_tile *tile = mapcache_tileset_tile_create(tile_pool, options.tileset, options.grid_link);
+      tile->x = x;
+      tile->y = y;
+      tile->z = z;
+
+      int ret = options.tileset->cache->tile_get(ctx, tile);
+      if (ret == MAPCACHE_SUCCESS && !tile->encoded_data && tile->raw_image) {
+        tile->encoded_data = options.tileset->format->write(ctx, tile->raw_image, options.tileset->format);
+      }
+
+      Tile *queued = NULL;
+      if (ret == MAPCACHE_SUCCESS && !GC_HAS_ERROR(ctx) && tile->encoded_data) {
+        queued = new Tile();
+        queued->z = z;
+        queued->x = x;
+        queued->y = y;
+        queued->data.assign((const char *) tile->encoded_data->buf, tile->encoded_data->size);
+      }
+      ctx->clear_errors(ctx);
+      apr_pool_clear(tile_pool);
+
+      uv_mutex_lock(&mutex);
+      if (!queued) {
+        stats.missing++;
+      } else {
+        while (queue.size() >= NODE_MAPCACHE_EXPORT_QUEUE_SIZE && !aborted) {
+          uv_cond_wait(&not_full, &mutex);
+        }
+        if (aborted) {
+          delete queued;
+        } else {
+          queue.push_back(queued);
+          uv_cond_signal(&not_empty);
+        }
+      }
+      uv_mutex_unlock(&mutex);
+    }
+  }
+
+  if (pool) {
+    apr_pool_destroy(pool);
+  }
+
+  uv_mutex_lock(&mutex);
+  readers--;
+  uv_cond_signal(&not_empty);
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param arg The `TileExporter` instance.
+ */
+void TileExporter::RunReader(void *arg) {
+  static_cast<TileExporter*>(arg)->Read();
+}
+
+/**
+ * @details Durability is traded for speed: the file is only valid once the
+ * export has succeeded.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool TileExporter::CreateSchema(std::string &error) {
+  if (!Exec("PRAGMA synchronous = OFF", error)
+      || !Exec("PRAGMA journal_mode = MEMORY", error)
+      || !Exec("CREATE TABLE metadata (name TEXT, value TEXT)", error)) {
+    return false;
+  }
+
+  if (!options.dedupe) {
+    return Exec("CREATE TABLE tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB)", error);
+  }
+  return Exec("CREATE TABLE map (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_id INTEGER)", error)
+    && Exec("CREATE TABLE images (tile_id INTEGER PRIMARY KEY, tile_data BLOB)", error)
+    && Exec("CREATE VIEW tiles AS SELECT map.zoom_level AS zoom_level, map.tile_column AS tile_column,"
+            " map.tile_row AS tile_row, images.tile_data AS tile_data"
+            " FROM map JOIN images ON images.tile_id = map.tile_id", error);
+}
+
+/**
+ * @details The bounds are only included for grids in geographic or web
+ * mercator coordinates, which can be converted to longitude and latitude.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool TileExporter::InsertMetadata(std::string &error) {
+  mapcache_grid *grid = options.grid_link->grid;
+  std::vector<std::pair<std::string, std::string> > metadata;
+  char value[128];
+
+  metadata.push_back(std::make_pair("name", std::string(options.tileset->name)));
+  metadata.push_back(std::make_pair("type", std::string("baselayer")));
+  metadata.push_back(std::make_pair("version", std::string("1.0.0")));
+  metadata.push_back(std::make_pair("description", std::string(options.tileset->name) + " exported from " + grid->name));
+
+  const char *mime_type = (options.tileset->format) ? options.tileset->format->mime_type : NULL;
+  if (mime_type) {
+    metadata.push_back(std::make_pair("format", std::string((strstr(mime_type, "jpeg")) ? "jpg" : "png")));
+  }
+
+  snprintf(value, sizeof(value), "%d", options.minz);
+  metadata.push_back(std::make_pair("minzoom", std::string(value)));
+  snprintf(value, sizeof(value), "%d", options.maxz);
+  metadata.push_back(std::make_pair("maxzoom", std::string(value)));
+
+  mapcache_extent e = (options.has_extent) ? options.extent : grid->extent;
+  bool geographic = !strcasecmp(grid->srs, "EPSG:4326");
+  if (!strcasecmp(grid->srs, "EPSG:900913") || !strcasecmp(grid->srs, "EPSG:3857")) {
+    const double radius = 6378137;
+    e.minx = e.minx / radius * 180 / M_PI;
+    e.maxx = e.maxx / radius * 180 / M_PI;
+    e.miny = atan(sinh(e.miny / radius)) * 180 / M_PI;
+    e.maxy = atan(sinh(e.maxy / radius)) * 180 / M_PI;
+    geographic = true;
+  }
+  if (geographic) {
+    snprintf(value, sizeof(value), "%.6f,%.6f,%.6f,%.6f", e.minx, e.miny, e.maxx, e.maxy);
+    metadata.push_back(std::make_pair("bounds", std::string(value)));
+  }
+
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, "INSERT INTO metadata (name, value) VALUES (?, ?)", -1, &stmt, NULL) != SQLITE_OK) {
+    error = std::string("Could not prepare the metadata: ") + sqlite3_errmsg(db);
+    return false;
+  }
+  bool inserted = true;
+  for (std::vector<std::pair<std::string, std::string> >::iterator it = metadata.begin(); it != metadata.end() && inserted; ++it) {
+    sqlite3_bind_text(stmt, 1, it->first.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, it->second.c_str(), -1, SQLITE_TRANSIENT);
+    inserted = (sqlite3_step(stmt) == SQLITE_DONE);
+    sqlite3_reset(stmt);
+  }
+  if (!inserted) {
+    error = std::string("Could not insert the metadata: ") + sqlite3_errmsg(db);
+  }
+  sqlite3_finalize(stmt);
+  return inserted;
+}
+
+/**
+ * @details Tiles are inserted in transactions of `batch_size` tiles.  MBTiles
+ * uses the TMS tile scheme, as does the mapcache grid, so rows are written as
+ * they are.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool TileExporter::Write(std::string &error) {
+  sqlite3_stmt *insert_tile = NULL, *insert_image = NULL;
+  const char *sql = (options.dedupe)
+    ? "INSERT INTO map (zoom_level, tile_column, tile_row, tile_id) VALUES (?, ?, ?, ?)"
+    : "INSERT INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
+  if (sqlite3_prepare_v2(db, sql, -1, &insert_tile, NULL) != SQLITE_OK
+      || (options.dedupe
+          && sqlite3_prepare_v2(db, "INSERT INTO images (tile_data) VALUES (?)", -1, &insert_image, NULL) != SQLITE_OK)) {
+    error = std::string("Could not prepare the tile insert: ") + sqlite3_errmsg(db);
+    sqlite3_finalize(insert_tile);
+    return false;
+  }
+
+  std::map<std::string, sqlite3_int64> images;
+  uint32_t batched = 0;
+  bool ok = Exec("BEGIN", error);
+
+  while (ok) {
+    uv_mutex_lock(&mutex);
+    while (queue.empty() && readers) {
+      uv_cond_wait(&not_empty, &mutex);
+    }
+    if (queue.empty()) {
+      uv_mutex_unlock(&mutex);
+      break;                    // the readers have finished
+    }
+    Tile *tile = queue.front();
+    queue.pop_front();
+    uv_cond_signal(&not_full);
+    uv_mutex_unlock(&mutex);
+
+    sqlite3_bind_int(insert_tile, 1, tile->z);
+    sqlite3_bind_int(insert_tile, 2, tile->x);
+    sqlite3_bind_int(insert_tile, 3, tile->y);
+    if (!options.dedupe) {
+      sqlite3_bind_blob(insert_tile, 4, tile->data.data(), tile->data.size(), SQLITE_STATIC);
+      stats.unique++;
+    } else {
+      std::string digest = Digest(tile->data);
+      std::map<std::string, sqlite3_int64>::iterator image = images.find(digest);
+      if (image == images.end()) {
+        sqlite3_bind_blob(insert_image, 1, tile->data.data(), tile->data.size(), SQLITE_STATIC);
+        ok = (sqlite3_step(insert_image) == SQLITE_DONE);
+        sqlite3_reset(insert_image);
+        image = images.insert(std::make_pair(digest, sqlite3_last_insert_rowid(db))).first;
+        stats.unique++;
+      }
+      sqlite3_bind_int64(insert_tile, 4, image->second);
+    }
+    ok = ok && (sqlite3_step(insert_tile) == SQLITE_DONE);
+    sqlite3_reset(insert_tile);
+    if (!ok) {
+      error = std::string("Could not insert a tile: ") + sqlite3_errmsg(db);
+    }
+
+    stats.tiles++;
+    stats.bytes += tile->data.size();
+    delete tile;
+
+    if (ok && ++batched >= options.batch_size) {
+      ok = Exec("COMMIT", error) && Exec("BEGIN", error);
+      batched = 0;
+    }
+  }
+
+  ok = ok && Exec("COMMIT", error);
+  sqlite3_finalize(insert_tile);
+  sqlite3_finalize(insert_image);
+  return ok;
+}
+
+/**
+ * @param sql The statement to execute.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool TileExporter::Exec(const char *sql, std::string &error) {
+  char *message = NULL;
+  if (sqlite3_exec(db, sql, NULL, NULL, &message) != SQLITE_OK) {
+    error = std::string("SQLite error: ") + ((message) ? message : sqlite3_errmsg(db));
+    sqlite3_free(message);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @details The key combines the data length with two independent 64 bit
+ * hashes of the data (FNV-1a and a multiplicative hash with the SplitMix64
+ * finaliser), making accidental collisions vanishingly unlikely.
+ *
+ * @param data The tile data.
+ */
+std::string TileExporter::Digest(const std::string &data) {
+  uint64_t h1 = 0xcbf29ce484222325ULL, h2 = data.size();
+  for (std::string::size_type i = 0; i < data.size(); i++) {
+    unsigned char c = data[i];
+    h1 = (h1 ^ c) * 0x100000001b3ULL;
+    h2 = (h2 + c + 1) * 0x9e3779b97f4a7c15ULL;
+    h2 ^= h2 >> 29;
+  }
+  h2 = (h2 ^ (h2 >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h2 = (h2 ^ (h2 >> 27)) * 0x94d049bb133111ebULL;
+  h2 ^= h2 >> 31;
+
+  uint64_t key[3] = { h1, h2, data.size() };
+  return std::string((const char *) key, sizeof(key));
+}
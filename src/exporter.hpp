@@ -0,0 +1,195 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_EXPORTER_H__
+#define __NODE_MAPCACHE_EXPORTER_H__
+
+/**
+ * @file exporter.hpp
+ * @brief This declares the `TileExporter` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// Apache headers
+#include <apr_pools.h>
+
+// SQLite headers
+#include <sqlite3.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+#include "tilerange.hpp"
+
+/**
+ * @brief An exporter of cached tiles to an MBTiles file
+ *
+ * Tiles within a zoom range and extent are read directly from the cache of a
+ * tileset by a number of reader threads: tiles that are not cached are
+ * skipped rather than rendered.  The tiles are passed through a bounded queue
+ * to a single writer which inserts them into a new SQLite database using the
+ * MBTiles 1.1 layout, committing them in large transactions.
+ *
+ * Identical tiles can optionally be stored once, in which case `tiles` is a
+ * view joining the `map` and `images` tables as is common practice.
+ */
+class TileExporter {
+public:
+
+  /// A function creating a mapcache context from a memory pool
+  typedef mapcache_context* (*ContextFactory)(apr_pool_t *pool);
+
+  /// The tiles to export
+  struct Options {
+    /// The configuration containing the tileset
+    mapcache_cfg *cfg;
+    /// The tileset to export
+    mapcache_tileset *tileset;
+    /// The grid of the tileset to export
+    mapcache_grid_link *grid_link;
+    /// The minimum zoom level
+    int minz;
+    /// The maximum zoom level
+    int maxz;
+    /// Set if only tiles intersecting `extent` are exported
+    bool has_extent;
+    /// The extent to export in the grid SRS
+    mapcache_extent extent;
+    /// Set if identical tiles are stored once
+    bool dedupe;
+    /// The number of reader threads
+    unsigned int threads;
+    /// The number of tiles inserted per transaction
+    uint32_t batch_size;
+  };
+
+  /// A summary of the export
+  struct Stats {
+    /// The number of tiles exported
+    uint64_t tiles;
+    /// The number of tile locations that weren't cached
+    uint64_t missing;
+    /// The total size of the exported tiles in bytes
+    uint64_t bytes;
+    /// The number of distinct tiles stored
+    uint64_t unique;
+    /// The time taken in nanoseconds
+    uint64_t duration;
+  };
+
+  /// Intantiate an exporter writing to `path`
+  TileExporter(const Options &options, const std::string &path, ContextFactory factory);
+
+  /// Export the tiles, blocking until finished
+  bool Run(std::string &error);
+
+  /// The summary of the export
+  const Stats& GetStats() const {
+    return stats;
+  }
+
+  ~TileExporter();
+
+private:
+
+  /// A tile read from the cache
+  struct Tile {
+    int z, x, y;
+    std::string data;
+  };
+
+  /// The tiles to export
+  Options options;
+
+  /// The file to write to
+  std::string path;
+
+  /// Creates contexts for the reader threads
+  ContextFactory factory;
+
+  /// The tiles to read
+  TileRange range;
+
+  /// Protects the queue and the reader count
+  uv_mutex_t mutex;
+
+  /// Signalled when a tile is queued or a reader finishes
+  uv_cond_t not_empty;
+
+  /// Signalled when a tile is removed from the queue
+  uv_cond_t not_full;
+
+  /// The tiles waiting to be written
+  std::deque<Tile*> queue;
+
+  /// The number of reader threads still running
+  unsigned int readers;
+
+  /// Set if the writer fails, stopping the readers
+  volatile bool aborted;
+
+  /// The summary of the export
+  Stats stats;
+
+  /// The database being written to
+  sqlite3 *db;
+
+  /// Read tiles and queue them for writing
+  void Read();
+
+  /// The reader thread entry point
+  static void RunReader(void *arg);
+
+  /// Create the database tables and metadata
+  bool CreateSchema(std::string &error);
+
+  /// Insert the metadata describing the tileset
+  bool InsertMetadata(std::string &error);
+
+  /// Write queued tiles until the readers have finished
+  bool Write(std::string &error);
+
+  /// Execute a SQL statement
+  bool Exec(const char *sql, std::string &error);
+
+  /// Compute the deduplication key of tile data
+  static std::string Digest(const std::string &data);
+};
+
+#endif  /* __NODE_MAPCACHE_EXPORTER_H__ */
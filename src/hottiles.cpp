@@ -0,0 +1,343 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file hottiles.cpp
+ * @brief This defines the `HotTiles` class.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hottiles.hpp"
+
+/// The first line of a record file, identifying the format
+#define HOT_TILES_MAGIC "node-mapcache hot tiles 1\n"
+
+/// A serialised record being written in the thread pool
+struct SaveRequest {
+  uv_work_t request;
+  std::string path;
+  std::string data;
+};
+
+std::set<HotTiles*> HotTiles::records;
+
+/**
+ * @param path The location of the record file.
+ *
+ * @param capacity The maximum number of tiles in the record.
+ */
+HotTiles::HotTiles(const std::string &path, size_t capacity) :
+  path(path),
+  capacity(capacity),
+  recorded(0),
+  saves(0),
+  started(false),
+  loaded(false)
+{
+  static bool registered = false;
+  if (!registered) {
+    atexit(SaveAtExit);
+    registered = true;
+  }
+  records.insert(this);
+}
+
+HotTiles::~HotTiles() {
+  records.erase(this);
+}
+
+/**
+ * @details A missing file is not an error: it simply results in an empty
+ * record.  The tiles are read most requested first, so a record loaded with a
+ * smaller capacity keeps the hottest tiles.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool HotTiles::Load(std::string &error) {
+  FILE *fp = fopen(path.c_str(), "r");
+  if (!fp) {
+    if (errno == ENOENT) {
+      loaded = true;
+      return true;
+    }
+    error = "Could not open the hot tile record " + path + ": " + strerror(errno);
+    return false;
+  }
+
+  char line[512];
+  bool ok = (fgets(line, sizeof(line), fp) && !strcmp(line, HOT_TILES_MAGIC));
+  while (ok && fgets(line, sizeof(line), fp)) {
+    unsigned long long count;
+    int offset = 0;
+    char *end = strchr(line, '\n');
+    ok = (end && sscanf(line, "%llu\t%n", &count, &offset) == 1 && offset);
+    if (ok && index.size() < capacity) {
+      Insert(std::string(line + offset, end), (uint64_t) count);
+    }
+  }
+  ok = ok && !ferror(fp);
+  fclose(fp);
+
+  if (!ok) {
+    error = "The hot tile record " + path + " is corrupt";
+  }
+  loaded = ok;
+  return ok;
+}
+
+/**
+ * @param layer The name of the layer containing the tile (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ */
+void HotTiles::Record(const std::string &layer, int z, int x, int y) {
+  char coords[64];
+  snprintf(coords, sizeof(coords), "/%d/%d/%d", z, x, y);
+  std::string key = layer + coords;
+
+  recorded++;
+  std::map<std::string, Ranking::iterator>::iterator found = index.find(key);
+  if (found == index.end()) {
+    Insert(key, 1);
+    return;
+  }
+
+  uint64_t count = found->second->first + 1;
+  ranking.erase(found->second);
+  found->second = ranking.insert(std::make_pair(count, key));
+}
+
+/**
+ * @details A tile replacing the least requested tile inherits its count, so
+ * its count is an upper bound on its requests.
+ *
+ * @param key The tile, as `layer/z/x/y`.
+ *
+ * @param count The request count of the tile.
+ */
+void HotTiles::Insert(const std::string &key, uint64_t count) {
+  if (!capacity) {
+    return;
+  }
+  if (index.size() >= capacity) {
+    Ranking::iterator coldest = ranking.begin();
+    count += coldest->first;
+    index.erase(coldest->second);
+    ranking.erase(coldest);
+  }
+  index[key] = ranking.insert(std::make_pair(count, key));
+}
+
+/**
+ * @param limit The maximum number of tiles to return.
+ *
+ * @param tiles Receives the tiles.
+ */
+void HotTiles::Hottest(size_t limit, std::vector<Tile> &tiles) const {
+  tiles.clear();
+  for (Ranking::const_reverse_iterator it = ranking.rbegin(); it != ranking.rend() && tiles.size() < limit; ++it) {
+    const std::string &key = it->second;
+    size_t y_pos = key.rfind('/'), x_pos = key.rfind('/', y_pos - 1), z_pos = key.rfind('/', x_pos - 1);
+    if (y_pos == std::string::npos || x_pos == std::string::npos || z_pos == std::string::npos || !z_pos) {
+      continue;
+    }
+
+    Tile tile;
+    tile.layer = key.substr(0, z_pos);
+    tile.z = atoi(key.c_str() + z_pos + 1);
+    tile.x = atoi(key.c_str() + x_pos + 1);
+    tile.y = atoi(key.c_str() + y_pos + 1);
+    tile.count = it->first;
+    tiles.push_back(tile);
+  }
+}
+
+/**
+ * @details The tiles are written most requested first, one per line as the
+ * request count and the tile (`layer/z/x/y`) separated by a tab.
+ *
+ * @param data The string to which the record is written.
+ */
+void HotTiles::Serialise(std::string &data) const {
+  data = HOT_TILES_MAGIC;
+  for (Ranking::const_reverse_iterator it = ranking.rbegin(); it != ranking.rend(); ++it) {
+    char count[32];
+    snprintf(count, sizeof(count), "%llu\t", (unsigned long long) it->first);
+    data += count + it->second + "\n";
+  }
+}
+
+void HotTiles::Decay() {
+  Ranking decayed;
+  for (Ranking::iterator it = ranking.begin(); it != ranking.end(); ++it) {
+    if (it->first > 1) {
+      index[it->second] = decayed.insert(std::make_pair(it->first / 2, it->second));
+    } else {
+      index.erase(it->second);
+    }
+  }
+  ranking.swap(decayed);
+}
+
+/**
+ * @details The data is written to a uniquely named temporary file which then
+ * replaces the record file, ensuring a crash during the write doesn't leave a
+ * truncated record behind.  This is thread safe, and concurrent writes from
+ * several threads or processes each replace the file whole.
+ *
+ * @param path The location of the record file.
+ *
+ * @param data The output from `Serialise()`.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool HotTiles::Write(const std::string &path, const std::string &data, std::string &error) {
+  std::string name = path + ".XXXXXX";
+  std::vector<char> temp(name.begin(), name.end());
+  temp.push_back('\0');
+
+  int fd = mkstemp(&temp[0]);
+  FILE *fp = (fd != -1 && fchmod(fd, 0644) == 0) ? fdopen(fd, "w") : NULL;
+  if (!fp) {
+    error = "Could not open " + name + ": " + strerror(errno);
+    if (fd != -1) {
+      close(fd);
+      unlink(&temp[0]);
+    }
+    return false;
+  }
+  std::string tmp(&temp[0]);
+
+  bool ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    error = "Could not write the hot tile record " + path + ": " + strerror(errno);
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @details The timer doesn't keep the event loop alive.
+ *
+ * @param interval The time between saves in milliseconds.
+ */
+void HotTiles::Start(uint64_t interval) {
+  uv_timer_init(uv_default_loop(), &timer);
+  timer.data = this;
+  uv_timer_start(&timer, Save, interval, interval);
+  uv_unref((uv_handle_t *) &timer);
+  started = true;
+}
+
+/**
+ * @details The record is written synchronously before the timer is closed,
+ * unless it failed to load.
+ */
+void HotTiles::Close() {
+  std::string data, error;
+  if (loaded) {
+    Serialise(data);
+    Write(path, data, error);
+  }
+
+  if (!started) {
+    delete this;
+    return;
+  }
+  uv_timer_stop(&timer);
+  uv_close((uv_handle_t *) &timer, Closed);
+}
+
+/**
+ * @details The record is serialised in the Node/V8 thread and written in
+ * the thread pool.  A failed write is retried at the next interval.
+ *
+ * @param handle The save timer.
+ */
+void HotTiles::Save(uv_timer_t *handle, int status /*UNUSED*/) {
+  HotTiles *self = static_cast<HotTiles*>(handle->data);
+
+  SaveRequest *save = new SaveRequest();
+  save->request.data = save;
+  save->path = self->path;
+  self->Serialise(save->data);
+  self->Decay();
+  self->saves++;
+
+  uv_queue_work(uv_default_loop(), &save->request, SaveWork, (uv_after_work_cb) SaveAfter);
+}
+
+/**
+ * @param req The asynchronous libuv request.
+ */
+void HotTiles::SaveWork(uv_work_t *req) {
+  SaveRequest *save = static_cast<SaveRequest*>(req->data);
+  std::string error;
+  Write(save->path, save->data, error);
+}
+
+/**
+ * @param req The asynchronous libuv request.
+ */
+void HotTiles::SaveAfter(uv_work_t *req) {
+  delete static_cast<SaveRequest*>(req->data);
+}
+
+/**
+ * @param handle The save timer.
+ */
+void HotTiles::Closed(uv_handle_t *handle) {
+  delete static_cast<HotTiles*>(handle->data);
+}
+
+/**
+ * @details This runs in the main thread as the process exits, so the records
+ * are written synchronously.
+ */
+void HotTiles::SaveAtExit() {
+  for (std::set<HotTiles*>::iterator it = records.begin(); it != records.end(); ++it) {
+    if (!(*it)->loaded) {
+      continue;
+    }
+    std::string data, error;
+    (*it)->Serialise(data);
+    Write((*it)->path, data, error);
+  }
+}
@@ -0,0 +1,164 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_HOTTILES_H__
+#define __NODE_MAPCACHE_HOTTILES_H__
+
+/**
+ * @file hottiles.hpp
+ * @brief This declares the `HotTiles` class.
+ */
+
+// Standard headers
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+/**
+ * @brief A record of the most requested tiles
+ *
+ * The record counts requests for at most `capacity` tiles using the Space
+ * Saving algorithm: once it is full, a newly requested tile replaces the
+ * least requested one and inherits its count.  The most requested tiles are
+ * therefore kept however many distinct tiles are requested.  Counts are
+ * halved each time the record is saved, so it follows changes in demand.
+ *
+ * The record is written to a small file periodically by a timer and when the
+ * process exits normally, and is loaded from the file when created.  It can
+ * then be used to prefetch the tiles into the cache, warming up a new process
+ * before it serves requests.  Instances must only be used from the Node/V8
+ * thread.
+ */
+class HotTiles {
+public:
+
+  /// A tile in the record
+  struct Tile {
+    /// The name of the layer containing the tile (`tileset@grid`)
+    std::string layer;
+    /// The tile coordinates
+    int z, x, y;
+    /// The number of requests counted for the tile
+    uint64_t count;
+  };
+
+  /// Instantiate an empty record of `capacity` tiles stored at `path`
+  HotTiles(const std::string &path, size_t capacity);
+
+  /// Load the record from its file
+  bool Load(std::string &error);
+
+  /// Count a request for a tile
+  void Record(const std::string &layer, int z, int x, int y);
+
+  /// Retrieve up to `limit` tiles, most requested first
+  void Hottest(size_t limit, std::vector<Tile> &tiles) const;
+
+  /// The number of tiles in the record
+  size_t Size() const {
+    return index.size();
+  }
+
+  /// Serialise the record to a string
+  void Serialise(std::string &data) const;
+
+  /// Halve the request counts, dropping tiles that reach zero
+  void Decay();
+
+  /// Write the serialised record to disk
+  static bool Write(const std::string &path, const std::string &data, std::string &error);
+
+  /// Save the record periodically
+  void Start(uint64_t interval);
+
+  /// Stop saving the record and free it once its timer has closed
+  void Close();
+
+  /// The location of the record file
+  const std::string path;
+
+  /// The maximum number of tiles in the record
+  const size_t capacity;
+
+  /// The number of requests counted
+  uint64_t recorded;
+
+  /// The number of times the record has been saved
+  uint64_t saves;
+
+private:
+
+  /// The tile keys ordered by request count
+  typedef std::multimap<uint64_t, std::string> Ranking;
+
+  /// The tiles ordered by request count
+  Ranking ranking;
+
+  /// The position of each tile in `ranking`, keyed on tile
+  std::map<std::string, Ranking::iterator> index;
+
+  /// Saves the record periodically
+  uv_timer_t timer;
+
+  /// Set once the timer has been initialised
+  bool started;
+
+  /// Set once the record has been loaded, so writing it won't lose data
+  bool loaded;
+
+  /// Insert a tile with a count, replacing the least requested tile if full
+  void Insert(const std::string &key, uint64_t count);
+
+  /// Release the memory, called once the timer has closed
+  ~HotTiles();
+
+  /// Serialise and write the record in the thread pool
+  static void Save(uv_timer_t *handle, int status /*UNUSED*/);
+
+  /// Write a serialised record
+  static void SaveWork(uv_work_t *req);
+
+  /// Free a serialised record once written
+  static void SaveAfter(uv_work_t *req);
+
+  /// Free the record once its timer has closed
+  static void Closed(uv_handle_t *handle);
+
+  /// The records of the process, written when it exits
+  static std::set<HotTiles*> records;
+
+  /// Write every record synchronously
+  static void SaveAtExit();
+};
+
+#endif  /* __NODE_MAPCACHE_HOTTILES_H__ */
@@ -0,0 +1,144 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file invalidator.cpp
+ * @brief This defines the `TileInvalidator` class.
+ */
+
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "invalidator.hpp"
+
+/**
+ * @param options The tiles to invalidate.
+ *
+ * @param factory Used by the threads to create mapcache contexts.
+ */
+TileInvalidator::TileInvalidator(const Options &options, ContextFactory factory) :
+  processed(0),
+  errors(0),
+  duration(0),
+  options(options),
+  factory(factory),
+  range(options.grid_link, options.minz, options.maxz, (options.has_extent) ? &(options.extent) : NULL)
+{
+  total = range.Count();
+}
+
+/**
+ * @details The tiles are deleted by the cache of the tileset, so any
+ * writes of them queued in the write behind buffer are discarded as well.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool TileInvalidator::Run(std::string &error) {
+  uint64_t start = uv_hrtime();
+
+  std::vector<uv_thread_t> threads(options.threads);
+  for (unsigned int i = 0; i < options.threads; i++) {
+    if (uv_thread_create(&threads[i], RunDeleter, this) != 0) {
+      threads.resize(i);
+      break;
+    }
+  }
+  if (threads.empty()) {
+    error = "Could not create the invalidation threads";
+    return false;
+  }
+
+  for (std::vector<uv_thread_t>::iterator it = threads.begin(); it != threads.end(); ++it) {
+    uv_thread_join(&(*it));
+  }
+
+  duration = uv_hrtime() - start;
+  return true;
+}
+
+/**
+ * @details Each thread uses its own context and memory pool, clearing the
+ * tile pool after every tile so that memory use is bounded regardless of
+ * the size of the range.
+ */
+void TileInvalidator::Delete() {
+  apr_pool_t *pool = NULL, *tile_pool = NULL;
+  mapcache_context *ctx = NULL;
+
+  if (apr_pool_create(&pool, NULL) == APR_SUCCESS
+      && apr_pool_create(&tile_pool, pool) == APR_SUCCESS) {
+    ctx = factory(pool);
+  }
+  if (!ctx) {
+    range.Stop();
+  }
+
+  int z, y, minx, maxx;
+  while (ctx && range.NextRow(z, y, minx, maxx)) {
+    ctx->config = options.cfg;
+
+    for (int x = minx; x < maxx; x++) {
+      mapcache_tile *tile = mapcache_tileset_tile_create(tile_pool, options.tileset, options.grid_link);
+      tile->x = x;
+      tile->y = y;
+      tile->z = z;
+      for (std::vector<std::pair<std::string, std::string> >::const_iterator it = options.dimensions.begin();
+           tile->dimensions && it != options.dimensions.end();
+           ++it) {
+        apr_table_set(tile->dimensions, it->first.c_str(), it->second.c_str());
+      }
+
+      options.tileset->cache->tile_delete(ctx, tile);
+      if (GC_HAS_ERROR(ctx)) {
+        __sync_fetch_and_add(&errors, 1);
+        ctx->clear_errors(ctx);
+      }
+      apr_pool_clear(tile_pool);
+
+      if (options.shared_cache) {
+        char coords[64];
+        apr_snprintf(coords, sizeof(coords), "/%d/%d/%d", z, x, y);
+        if (!options.shared_cache->Remove(options.shared_prefix + coords)) {
+          __sync_fetch_and_add(&errors, 1);
+        }
+      }
+    }
+    __sync_fetch_and_add(&processed, (uint64_t) (maxx - minx));
+  }
+
+  if (pool) {
+    apr_pool_destroy(pool);
+  }
+}
+
+/**
+ * @param arg The `TileInvalidator` instance.
+ */
+void TileInvalidator::RunDeleter(void *arg) {
+  static_cast<TileInvalidator*>(arg)->Delete();
+}
@@ -0,0 +1,138 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_INVALIDATOR_H__
+#define __NODE_MAPCACHE_INVALIDATOR_H__
+
+/**
+ * @file invalidator.hpp
+ * @brief This declares the `TileInvalidator` class.
+ */
+
+// Standard headers
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// Apache headers
+#include <apr_pools.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+#include "tilerange.hpp"
+#include "sharedcache.hpp"
+
+/**
+ * @brief A remover of cached tiles within a zoom range and extent
+ *
+ * The rows of the range are shared between a number of threads, each of
+ * which deletes the tiles of its rows from the cache of the tileset and from
+ * the shared memory cache (if any).  Progress is recorded in counters which
+ * can be read from any thread while the invalidation runs.
+ */
+class TileInvalidator {
+public:
+
+  /// A function creating a mapcache context from a memory pool
+  typedef mapcache_context* (*ContextFactory)(apr_pool_t *pool);
+
+  /// The tiles to invalidate
+  struct Options {
+    /// The configuration containing the tileset
+    mapcache_cfg *cfg;
+    /// The tileset to invalidate
+    mapcache_tileset *tileset;
+    /// The grid of the tileset to invalidate
+    mapcache_grid_link *grid_link;
+    /// The minimum zoom level
+    int minz;
+    /// The maximum zoom level
+    int maxz;
+    /// Set if only tiles intersecting `extent` are invalidated
+    bool has_extent;
+    /// The extent to invalidate in the grid SRS
+    mapcache_extent extent;
+    /// The dimension values of the tiles, overriding the defaults
+    std::vector<std::pair<std::string, std::string> > dimensions;
+    /// The number of threads deleting tiles
+    unsigned int threads;
+    /// The shared memory cache to remove tiles from, if any
+    SharedCache *shared_cache;
+    /// The prefix of the shared memory cache keys for the tileset
+    std::string shared_prefix;
+  };
+
+  /// Intantiate an invalidator
+  TileInvalidator(const Options &options, ContextFactory factory);
+
+  /// Delete the tiles, blocking until finished
+  bool Run(std::string &error);
+
+  /// The tile range being invalidated
+  const TileRange& Range() const {
+    return range;
+  }
+
+  /// The total number of tiles in the range
+  uint64_t total;
+
+  /// The number of tiles processed so far
+  volatile uint64_t processed;
+
+  /// The number of tiles that could not be deleted
+  volatile uint64_t errors;
+
+  /// The time taken in nanoseconds
+  uint64_t duration;
+
+private:
+
+  /// The tiles to invalidate
+  Options options;
+
+  /// Creates contexts for the threads
+  ContextFactory factory;
+
+  /// The tiles to delete
+  TileRange range;
+
+  /// Delete the tiles of rows claimed from the range
+  void Delete();
+
+  /// The thread entry point
+  static void RunDeleter(void *arg);
+};
+
+#endif  /* __NODE_MAPCACHE_INVALIDATOR_H__ */
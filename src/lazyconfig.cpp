@@ -0,0 +1,473 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file lazyconfig.cpp
+ * @brief This defines the `LazyConfig` class.
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lazyconfig.hpp"
+
+extern "C" {
+#include "ezxml.h"
+}
+
+/// The text of an element with surrounding whitespace removed
+static std::string ElementText(ezxml_t element) {
+  std::string text(ezxml_txt(element));
+  size_t start = text.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos) {
+    return "";
+  }
+  return text.substr(start, text.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+/// The XML of an element and its descendants
+static std::string ElementXml(ezxml_t element) {
+  char *xml = ezxml_toxml(element);
+  std::string result((xml) ? xml : "");
+  free(xml);
+  return result;
+}
+
+LazyConfig::Entry::Entry() :
+  cfg(NULL),
+  pool(NULL),
+  init_time(0)
+{
+  uv_mutex_init(&mutex);
+}
+
+LazyConfig::Entry::~Entry() {
+  if (pool) {
+    apr_pool_destroy(pool);
+  }
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @param path The location of the mapcache configuration file.
+ *
+ * @param factory Creates the contexts used to parse the configurations.
+ */
+LazyConfig::LazyConfig(const std::string &path, ContextFactory factory) :
+  path(path),
+  factory(factory)
+{
+}
+
+LazyConfig::~LazyConfig() {
+  for (std::map<std::string, Tileset*>::iterator it = tilesets.begin(); it != tilesets.end(); ++it) {
+    delete it->second;
+  }
+}
+
+/**
+ * @details This reads the configuration file without setting anything up,
+ * and is much quicker than parsing it with the mapcache core.  Each top level
+ * element is stored as XML: tilesets, sources and caches by name, and
+ * everything else in a document shared by every tileset.  Errors in the
+ * elements themselves are only reported when a configuration containing them
+ * is set up.
+ *
+ * @param error Set to the reason if the file could not be read.
+ *
+ * @return `true` if the file was indexed.
+ */
+bool LazyConfig::Index(std::string &error) {
+  ezxml_t doc = ezxml_parse_file(path.c_str());
+  if (!doc) {
+    error = "failed to parse " + path + ": is it a valid XML file?";
+    return false;
+  }
+  const char *parse_error = ezxml_error(doc);
+  if (parse_error && *parse_error) {
+    error = "failed to parse " + path + ": " + parse_error;
+    ezxml_free(doc);
+    return false;
+  }
+  if (strcmp(ezxml_name(doc), "mapcache")) {
+    error = "failed to parse " + path + ": the root element is not <mapcache>";
+    ezxml_free(doc);
+    return false;
+  }
+
+  for (ezxml_t element = doc->child; element; element = element->ordered) {
+    const char *name = ezxml_attr(element, "name");
+    if (!strcmp(element->name, "tileset") && name) {
+      Tileset *tileset = new Tileset();
+      tileset->xml = ElementXml(element);
+      tileset->source = ElementText(ezxml_child(element, "source"));
+      tileset->cache = ElementText(ezxml_child(element, "cache"));
+      std::map<std::string, Tileset*>::iterator it = tilesets.find(name);
+      if (it != tilesets.end()) {
+        delete it->second;      // the last definition wins, as it does in mapcache
+      }
+      tilesets[name] = tileset;
+    } else if (!strcmp(element->name, "source") && name) {
+      sources[name] = ElementXml(element);
+    } else if (!strcmp(element->name, "cache") && name) {
+      Cache &cache = caches[name];
+      cache.xml = ElementXml(element);
+      cache.caches.clear();
+      for (ezxml_t child = ezxml_child(element, "cache"); child; child = ezxml_next(child)) {
+        cache.caches.push_back(ElementText(child));
+      }
+    } else {
+      shared += ElementXml(element);
+    }
+  }
+  ezxml_free(doc);
+
+  for (std::map<std::string, Tileset*>::iterator it = tilesets.begin(); it != tilesets.end(); ++it) {
+    BuildDocument(it->second);
+  }
+  return true;
+}
+
+/**
+ * @details The document contains the shared elements followed by the caches,
+ * source and tileset, in the order the mapcache core parses them.  The
+ * tileset XML is released once it has been added.
+ *
+ * @param tileset The tileset to build the document for.
+ */
+void LazyConfig::BuildDocument(Tileset *tileset) {
+  std::string &document = tileset->entry.document;
+  std::vector<std::string> added;
+
+  document = "<mapcache>" + shared;
+  AddCache(tileset->cache, added, document);
+  if (!tileset->source.empty()) {
+    std::map<std::string, std::string>::const_iterator source = sources.find(tileset->source);
+    if (source != sources.end()) {
+      document += source->second;
+    }
+  }
+  document += tileset->xml + "</mapcache>";
+  std::string().swap(tileset->xml);
+}
+
+/**
+ * @details Caches combining other caches (e.g. composite or multitier caches)
+ * reference them by name, so these are added first.  A cache that doesn't
+ * exist is left out for the mapcache core to report when it parses the
+ * document.
+ *
+ * @param name The cache name.
+ *
+ * @param added The caches already added to the document.
+ *
+ * @param document The document being built.
+ */
+void LazyConfig::AddCache(const std::string &name, std::vector<std::string> &added, std::string &document) {
+  if (std::find(added.begin(), added.end(), name) != added.end()) {
+    return;
+  }
+  std::map<std::string, Cache>::const_iterator cache = caches.find(name);
+  if (cache == caches.end()) {
+    return;
+  }
+  added.push_back(name);
+  for (std::vector<std::string>::const_iterator it = cache->second.caches.begin();
+       it != cache->second.caches.end(); ++it) {
+    AddCache(*it, added, document);
+  }
+  document += cache->second.xml;
+}
+
+/**
+ * @details A tile or map request names its tileset in the path (TMS, KML,
+ * Google Maps and RESTful WMTS requests, as `tileset` or `tileset@grid`) or
+ * in the `LAYER` (WMTS and Virtual Earth) or `LAYERS` (WMS) parameter.  This
+ * only looks at the request so the tileset doesn't need to be set up.
+ *
+ * @param path_info The `PATH_INFO` of the request.
+ *
+ * @param params The parsed query string of the request.
+ *
+ * @param exists Checks whether a tileset exists.
+ *
+ * @param data Passed to `exists`.
+ *
+ * @param name Set to the name of the tileset.
+ *
+ * @return `true` if the request names exactly one tileset that exists.
+ */
+bool LazyConfig::RequestedTileset(const char *path_info, apr_table_t *params,
+                                  TilesetExists exists, void *data, std::string &name) {
+  const char *layer = (params) ? apr_table_get(params, "LAYER") : NULL;
+  const char *layers = (params) ? apr_table_get(params, "LAYERS") : NULL;
+
+  if (layer) {
+    name = layer;
+  } else if (layers) {
+    // every layer must be the same tileset
+    std::string list(layers);
+    size_t comma = list.find(',');
+    name = list.substr(0, comma);
+    while (comma != std::string::npos) {
+      size_t next = list.find(',', comma + 1);
+      if (list.substr(comma + 1, next - comma - 1) != name) {
+        return false;
+      }
+      comma = next;
+    }
+  } else if (path_info) {
+    // skip the service name, then look for a segment naming a tileset
+    std::string path(path_info);
+    size_t start = path.find_first_not_of('/');
+    start = (start == std::string::npos) ? start : path.find('/', start);
+    while (start != std::string::npos) {
+      size_t end = path.find('/', start + 1);
+      std::string segment = path.substr(start + 1, end - start - 1);
+      name = segment.substr(0, segment.find('@'));
+      if (!name.empty() && exists(name, data)) {
+        return true;
+      }
+      start = end;
+    }
+    return false;
+  } else {
+    return false;
+  }
+
+  return !name.empty() && exists(name, data);
+}
+
+/**
+ * @param path_info The `PATH_INFO` of the request.
+ *
+ * @param params The parsed query string of the request.
+ *
+ * @return The tileset, or `NULL` if the request doesn't name exactly one
+ * tileset.
+ */
+LazyConfig::Tileset* LazyConfig::TilesetFor(const char *path_info, apr_table_t *params) {
+  std::string name;
+  if (!RequestedTileset(path_info, params, name)) {
+    return NULL;
+  }
+  return tilesets.find(name)->second;
+}
+
+/**
+ * @param name The tileset name.
+ *
+ * @param data The `LazyConfig` instance.
+ *
+ * @return `true` if the tileset is in the configuration file.
+ */
+bool LazyConfig::HasTileset(const std::string &name, void *data) {
+  const std::map<std::string, Tileset*> &tilesets = static_cast<LazyConfig*>(data)->tilesets;
+  return tilesets.find(name) != tilesets.end();
+}
+
+/**
+ * @details Once the full configuration has been set up it is used for every
+ * request, as it contains every tileset.  Otherwise the configuration of the
+ * tileset named by the request is returned, or the full configuration if the
+ * request doesn't name exactly one.  This can be called from any thread and
+ * blocks while the configuration is being set up.
+ *
+ * @param path_info The `PATH_INFO` of the request.
+ *
+ * @param params The parsed query string of the request.
+ *
+ * @param error Set to the reason the configuration couldn't be set up.
+ *
+ * @return The configuration, or `NULL` on error.
+ */
+mapcache_cfg* LazyConfig::ConfigFor(const char *path_info, apr_table_t *params, std::string &error) {
+  if (full.cfg) {
+    return Full(error);
+  }
+  Tileset *tileset = TilesetFor(path_info, params);
+  return (tileset) ? Initialise(&tileset->entry, error) : Full(error);
+}
+
+/**
+ * @details Unlike `ConfigFor()` this never sets up a configuration so it can
+ * be used where blocking is not an option.
+ *
+ * @param path_info The `PATH_INFO` of the request.
+ *
+ * @param params The parsed query string of the request.
+ *
+ * @return The configuration, or `NULL` if it hasn't been set up.
+ */
+mapcache_cfg* LazyConfig::Initialised(const char *path_info, apr_table_t *params) {
+  mapcache_cfg *cfg = full.cfg;
+  if (!cfg) {
+    Tileset *tileset = TilesetFor(path_info, params);
+    cfg = (tileset) ? tileset->entry.cfg : NULL;
+  }
+  if (cfg) {
+    __sync_synchronize();       // pairs with the barrier in `Initialise()`
+  }
+  return cfg;
+}
+
+/**
+ * @param tilesets Populated with the state of each tileset.
+ *
+ * @param config Set to the state of the full configuration.
+ */
+void LazyConfig::GetStats(std::vector<EntryStats> &tilesets, EntryStats &config) {
+  for (std::map<std::string, Tileset*>::iterator it = this->tilesets.begin(); it != this->tilesets.end(); ++it) {
+    EntryStats stats;
+    stats.name = it->first;
+    stats.initialised = (it->second->entry.cfg != NULL);
+    stats.init_time = (stats.initialised) ? it->second->entry.init_time : 0;
+    tilesets.push_back(stats);
+  }
+  config.initialised = (full.cfg != NULL);
+  config.init_time = (config.initialised) ? full.init_time : 0;
+}
+
+/**
+ * @details A configuration is set up exactly once: threads requesting it
+ * while it is being set up wait for the first to finish.  Failure is also
+ * permanent, with every request receiving the same error, as the file is
+ * not read again.
+ *
+ * @param entry The configuration to retrieve.
+ *
+ * @param error Set to the reason the configuration couldn't be set up.
+ *
+ * @return The configuration, or `NULL` on error.
+ */
+mapcache_cfg* LazyConfig::Initialise(Entry *entry, std::string &error) {
+  mapcache_cfg *cfg = entry->cfg;
+  if (cfg) {
+    __sync_synchronize();       // see the configuration as it was set up
+    return cfg;
+  }
+
+  uv_mutex_lock(&entry->mutex);
+  if (!entry->cfg && entry->error.empty()) {
+    Load(entry, entry->error);
+  }
+  cfg = entry->cfg;
+  if (!cfg) {
+    error = entry->error;
+  }
+  uv_mutex_unlock(&entry->mutex);
+  return cfg;
+}
+
+/**
+ * @details A tileset document is written to a temporary file as the mapcache
+ * core only parses files.  The configuration is given its own memory pool so
+ * it can be set up from any thread.
+ *
+ * @param entry The configuration to set up, with its mutex held.
+ *
+ * @param error Set to the reason the configuration couldn't be set up.
+ *
+ * @return `true` on success.
+ */
+bool LazyConfig::Load(Entry *entry, std::string &error) {
+  uint64_t start = uv_hrtime();
+  apr_pool_t *pool = NULL;
+  if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+    error = "Could not create the configuration memory pool";
+    return false;
+  }
+
+  mapcache_context *ctx = factory(pool);
+  mapcache_cfg *cfg = (ctx) ? mapcache_configuration_create(pool) : NULL;
+  if (!cfg) {
+    error = "Could not create the configuration";
+    apr_pool_destroy(pool);
+    return false;
+  }
+
+  std::string file = path;
+  if (!entry->document.empty()) {
+    const char *tmpdir = getenv("TMPDIR");
+    std::string name = std::string((tmpdir && *tmpdir) ? tmpdir : "/tmp") + "/node-mapcache-XXXXXX";
+    std::vector<char> temp(name.begin(), name.end());
+    temp.push_back('\0');
+
+    int fd = mkstemp(&temp[0]);
+    if (fd == -1) {
+      error = "Could not create a temporary configuration file: " + std::string(strerror(errno));
+      apr_pool_destroy(pool);
+      return false;
+    }
+    const char *data = entry->document.data();
+    size_t remaining = entry->document.size();
+    while (remaining) {
+      ssize_t written = write(fd, data, remaining);
+      if (written == -1 && errno == EINTR) {
+        continue;
+      } else if (written == -1) {
+        error = "Could not write a temporary configuration file: " + std::string(strerror(errno));
+        close(fd);
+        unlink(&temp[0]);
+        apr_pool_destroy(pool);
+        return false;
+      }
+      data += written;
+      remaining -= written;
+    }
+    close(fd);
+    file = &temp[0];
+  }
+
+  mapcache_configuration_parse(ctx, file.c_str(), cfg, 1);
+  if (file != path) {
+    unlink(file.c_str());
+  }
+  if (GC_HAS_ERROR(ctx)) {
+    error = "failed to parse " + path + ": " + ctx->get_error_message(ctx);
+    apr_pool_destroy(pool);
+    return false;
+  }
+
+  mapcache_configuration_post_config(ctx, cfg);
+  if (GC_HAS_ERROR(ctx)) {
+    error = "post-config failed for " + path + ": " + ctx->get_error_message(ctx);
+    apr_pool_destroy(pool);
+    return false;
+  }
+
+  entry->pool = pool;
+  entry->init_time = uv_hrtime() - start;
+  std::string().swap(entry->document);
+  __sync_synchronize();         // publish the configuration once it is set up
+  entry->cfg = cfg;
+  return true;
+}
@@ -0,0 +1,212 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_LAZYCONFIG_H__
+#define __NODE_MAPCACHE_LAZYCONFIG_H__
+
+/**
+ * @file lazyconfig.hpp
+ * @brief This declares the `LazyConfig` class.
+ */
+
+// Standard headers
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// Apache headers
+#include <apr_pools.h>
+#include <apr_tables.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief A mapcache configuration loaded a tileset at a time
+ *
+ * Parsing and setting up a configuration with many tilesets can take a long
+ * time, most of which is wasted if only a few of the tilesets are requested.
+ * Instead the configuration file is only indexed when the instance is
+ * created: the XML elements are stored by name and each tileset is recorded
+ * along with the source and caches it references.
+ *
+ * The first request for a tileset then builds a configuration document
+ * containing only that tileset, its source and caches, and the grids,
+ * formats, services and settings shared by every tileset.  This is parsed
+ * and set up by the mapcache core in its own memory pool, exactly once
+ * however many threads request the tileset at the same time.  Requests that
+ * don't name a single tileset, such as capabilities documents, load the full
+ * configuration in the same way, after which it is used for every request.
+ */
+class LazyConfig {
+public:
+
+  /// A function creating a mapcache context from a memory pool
+  typedef mapcache_context* (*ContextFactory)(apr_pool_t *pool);
+
+  /// A function checking whether a named tileset exists
+  typedef bool (*TilesetExists)(const std::string &name, void *data);
+
+  /// The initialisation state of a tileset or the full configuration
+  struct EntryStats {
+    /// The tileset name, empty for the full configuration
+    std::string name;
+    /// Set once the configuration has been set up
+    bool initialised;
+    /// The time taken to set it up in nanoseconds
+    uint64_t init_time;
+  };
+
+  /// Intantiate a lazy configuration of the file at `path`
+  LazyConfig(const std::string &path, ContextFactory factory);
+
+  ~LazyConfig();
+
+  /// Index the tilesets in the configuration file
+  bool Index(std::string &error);
+
+  /// The configuration needed to handle a request, set up if necessary
+  mapcache_cfg* ConfigFor(const char *path_info, apr_table_t *params, std::string &error);
+
+  /// The configuration for a request if it has already been set up
+  mapcache_cfg* Initialised(const char *path_info, apr_table_t *params);
+
+  /// The full configuration, set up if necessary
+  mapcache_cfg* Full(std::string &error) {
+    return Initialise(&full, error);
+  }
+
+  /// The full configuration if it has already been set up
+  mapcache_cfg* Loaded() {
+    mapcache_cfg *cfg = full.cfg;
+    if (cfg) {
+      __sync_synchronize();     // pairs with the barrier in `Initialise()`
+    }
+    return cfg;
+  }
+
+  /// Find the single tileset in the file named by a request, if any
+  bool RequestedTileset(const char *path_info, apr_table_t *params, std::string &name) {
+    return RequestedTileset(path_info, params, HasTileset, this, name);
+  }
+
+  /// Find the single tileset named by a request, if any
+  static bool RequestedTileset(const char *path_info, apr_table_t *params,
+                               TilesetExists exists, void *data, std::string &name);
+
+  /// Retrieve the state of the tilesets and the full configuration
+  void GetStats(std::vector<EntryStats> &tilesets, EntryStats &config);
+
+  /// The configuration file
+  const std::string path;
+
+private:
+
+  /// A configuration that is set up on first use
+  struct Entry {
+    /// The configuration document, or empty for the full configuration file
+    std::string document;
+    /// The configuration once set up
+    mapcache_cfg * volatile cfg;
+    /// The memory pool of the configuration
+    apr_pool_t *pool;
+    /// The error raised by setting up the configuration, if any
+    std::string error;
+    /// The time taken to set up the configuration in nanoseconds
+    uint64_t init_time;
+    /// Ensures the configuration is only set up once
+    uv_mutex_t mutex;
+
+    Entry();
+    ~Entry();
+  };
+
+  /// A tileset in the configuration file
+  struct Tileset {
+    /// The XML of the tileset element
+    std::string xml;
+    /// The name of the tileset's source
+    std::string source;
+    /// The name of the tileset's cache
+    std::string cache;
+    /// The tileset configuration
+    Entry entry;
+  };
+
+  /// A cache in the configuration file
+  struct Cache {
+    /// The XML of the cache element
+    std::string xml;
+    /// The names of the caches it contains, if any
+    std::vector<std::string> caches;
+  };
+
+  /// The tilesets keyed on name
+  std::map<std::string, Tileset*> tilesets;
+
+  /// The XML of the sources keyed on name
+  std::map<std::string, std::string> sources;
+
+  /// The caches keyed on name
+  std::map<std::string, Cache> caches;
+
+  /// The XML of the elements used by every tileset
+  std::string shared;
+
+  /// The full configuration
+  Entry full;
+
+  /// Creates the contexts used to set up configurations
+  ContextFactory factory;
+
+  /// The tileset named by a request, if any
+  Tileset* TilesetFor(const char *path_info, apr_table_t *params);
+
+  /// Check whether a tileset is in the configuration file
+  static bool HasTileset(const std::string &name, void *data);
+
+  /// Build the configuration document of a tileset
+  void BuildDocument(Tileset *tileset);
+
+  /// Add a cache and the caches it contains to a document
+  void AddCache(const std::string &name, std::vector<std::string> &added, std::string &document);
+
+  /// Retrieve a configuration, setting it up if necessary
+  mapcache_cfg* Initialise(Entry *entry, std::string &error);
+
+  /// Parse and set up a configuration
+  bool Load(Entry *entry, std::string &error);
+};
+
+#endif  /* __NODE_MAPCACHE_LAZYCONFIG_H__ */
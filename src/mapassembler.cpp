@@ -0,0 +1,554 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file mapassembler.cpp
+ * @brief This defines the `MapAssembler` class.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <apr_strings.h>
+#include <apr_date.h>
+
+#include "mapassembler.hpp"
+
+struct MapAssembler::Job {
+  /// The assembler running the job
+  MapAssembler *assembler;
+  /// The function performing each task
+  Task task;
+  /// The data shared by the tasks
+  void *data;
+  /// The number of tasks
+  int count;
+  /// The index of the next task to be claimed
+  volatile int next;
+  /// The number of helper contexts claimed
+  volatile int claimed;
+  /// The contexts used by each thread, the first being the request's own
+  std::vector<mapcache_context*> contexts;
+  /// The number of tasks not yet finished, protected by `mutex`
+  int remaining;
+  /// The number of queue entries not yet released by a helper, protected by `mutex`
+  int pending;
+  /// Set when a task fails, after which the remaining tasks are skipped
+  volatile bool failed;
+  /// The HTTP code of the first failure
+  int error_code;
+  /// The message of the first failure
+  std::string error_message;
+};
+
+struct MapAssembler::Assembly {
+  /// The request being assembled
+  mapcache_request_get_map *req_map;
+  /// The tiles covering each map
+  std::vector<mapcache_tile**> map_tiles;
+  /// The number of tiles covering each map
+  std::vector<int> map_ntiles;
+  /// Every tile of every map
+  std::vector<mapcache_tile*> tiles;
+  /// The assembled image
+  mapcache_image *image;
+  /// The number of rows in each band
+  int band_height;
+};
+
+/**
+ * @param threads The number of helper threads.
+ *
+ * @param band_height The number of rows in each band of a map.
+ *
+ * @param simd Set to resample and merge bands using `PixelKernels`.
+ */
+MapAssembler::MapAssembler(unsigned int threads, unsigned int band_height, bool simd) :
+  threads(threads),
+  band_height(band_height),
+  simd(simd),
+  closing(false),
+  maps(0),
+  tiles(0),
+  bands(0)
+{
+  uv_mutex_init(&mutex);
+  uv_cond_init(&wake);
+  uv_cond_init(&finished);
+
+  helpers.reserve(threads);
+  for (unsigned int i = 0; i < threads; i++) {
+    uv_thread_t thread;
+    if (uv_thread_create(&thread, Helper, this) == 0) {
+      helpers.push_back(thread);
+    }
+  }
+}
+
+/**
+ * @details This should only be called once no requests are using the
+ * assembler.
+ */
+MapAssembler::~MapAssembler() {
+  uv_mutex_lock(&mutex);
+  closing = true;
+  uv_cond_broadcast(&wake);
+  uv_mutex_unlock(&mutex);
+
+  for (std::vector<uv_thread_t>::iterator it = helpers.begin(); it != helpers.end(); ++it) {
+    uv_thread_join(&(*it));
+  }
+
+  uv_cond_destroy(&finished);
+  uv_cond_destroy(&wake);
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details This follows `mapcache_core_get_map()` for the assemble
+ * strategy, setting an error and returning `NULL` on failure.
+ *
+ * @param ctx The request context.
+ *
+ * @param req_map The dispatched GetMap request.
+ */
+mapcache_http_response* MapAssembler::GetMap(mapcache_context *ctx, mapcache_request_get_map *req_map) {
+  Assembly assembly;
+  mapcache_map **request_maps = req_map->maps;
+  int nmaps = req_map->nmaps;
+
+  assembly.req_map = req_map;
+  assembly.map_tiles.resize(nmaps, NULL);
+  assembly.map_ntiles.resize(nmaps, 0);
+  assembly.band_height = band_height;
+
+  // find the tiles covering each map
+  for (int i = 0; i < nmaps; i++) {
+    mapcache_map *map = request_maps[i];
+    mapcache_tileset_get_map_tiles(ctx, map->tileset, map->grid_link, &(map->extent), map->width, map->height,
+                                   &(assembly.map_ntiles[i]), &(assembly.map_tiles[i]));
+    if (GC_HAS_ERROR(ctx)) {
+      return NULL;
+    }
+    for (int j = 0; j < assembly.map_ntiles[i]; j++) {
+      assembly.map_tiles[i][j]->dimensions = map->dimensions;
+      assembly.tiles.push_back(assembly.map_tiles[i][j]);
+    }
+  }
+
+  // fetch and decode the tiles in parallel
+  Run(ctx, FetchTile, &assembly, assembly.tiles.size());
+  if (GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+
+  // the maps with data determine the modification and expiry times
+  mapcache_map *basemap = NULL;
+  for (int i = 0; i < nmaps; i++) {
+    mapcache_map *map = request_maps[i];
+    map->nodata = 1;
+    for (int j = 0; j < assembly.map_ntiles[i]; j++) {
+      mapcache_tile *tile = assembly.map_tiles[i][j];
+      if (tile->nodata) {
+        continue;
+      }
+      map->nodata = 0;
+      if (tile->mtime > map->mtime) {
+        map->mtime = tile->mtime;
+      }
+      if (tile->expires && (tile->expires < map->expires || !map->expires)) {
+        map->expires = tile->expires;
+      }
+    }
+    if (map->nodata) {
+      continue;
+    }
+    if (!basemap) {
+      basemap = map;
+      continue;
+    }
+    if (map->mtime > basemap->mtime) {
+      basemap->mtime = map->mtime;
+    }
+    if (map->expires && (map->expires < basemap->expires || !basemap->expires)) {
+      basemap->expires = map->expires;
+    }
+  }
+  if (!basemap) {
+    ctx->set_error(ctx, 404, (char *) "no tiles containing image data could be retrieved to create map "
+                   "(not in cache, and/or no source configured)");
+    return NULL;
+  }
+
+  // assemble the bands of the map in parallel
+  mapcache_image *image = mapcache_image_create(ctx);
+  image->w = basemap->width;
+  image->h = basemap->height;
+  image->stride = image->w * 4;
+  image->data = (unsigned char *) apr_pcalloc(ctx->pool, image->stride * image->h);
+  assembly.image = image;
+  Run(ctx, AssembleBand, &assembly, (basemap->height + band_height - 1) / band_height);
+  if (GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  basemap->raw_image = image;
+  __sync_fetch_and_add(&maps, 1);
+
+  // encode the map
+  mapcache_http_response *response = mapcache_http_response_create(ctx->pool);
+  mapcache_image_format *format = req_map->getmap_format;
+  response->data = format->write(ctx, image, format);
+  if (GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  if (format->mime_type) {
+    apr_table_set(response->headers, "Content-Type", format->mime_type);
+  }
+
+  if (basemap->expires) {
+    char *timestr = (char *) apr_palloc(ctx->pool, APR_RFC822_DATE_LEN);
+    apr_table_set(response->headers, "Cache-Control", apr_psprintf(ctx->pool, "max-age=%d", basemap->expires));
+    apr_rfc822_date(timestr, apr_time_now() + apr_time_from_sec(basemap->expires));
+    apr_table_set(response->headers, "Expires", timestr);
+  }
+  response->mtime = basemap->mtime;
+
+  return response;
+}
+
+void MapAssembler::GetStats(Stats &stats) const {
+  stats.maps = maps;
+  stats.tiles = tiles;
+  stats.bands = bands;
+}
+
+/**
+ * @details Up to one helper per remaining task is asked to help, each using
+ * a clone of the request context.  Any error is set on `ctx` once all the
+ * tasks have finished.
+ *
+ * @param ctx The request context, used by the current thread.
+ *
+ * @param task The function performing each task.
+ *
+ * @param data The data shared by the tasks.
+ *
+ * @param count The number of tasks.
+ */
+void MapAssembler::Run(mapcache_context *ctx, Task task, void *data, int count) {
+  if (count < 1) {
+    return;
+  }
+
+  Job job;
+  job.assembler = this;
+  job.task = task;
+  job.data = data;
+  job.count = count;
+  job.next = 0;
+  job.claimed = 0;
+  job.remaining = count;
+  job.failed = false;
+  job.error_code = 0;
+  job.contexts.push_back(ctx);
+
+  // the contexts are cloned here as the request pool isn't thread safe
+  int wanted = ((unsigned int) count - 1 < helpers.size()) ? count - 1 : helpers.size();
+  for (int i = 0; i < wanted; i++) {
+    mapcache_context *clone = ctx->clone(ctx);
+    if (!clone) {
+      break;
+    }
+    job.contexts.push_back(clone);
+  }
+  job.pending = job.contexts.size() - 1;
+
+  uv_mutex_lock(&mutex);
+  for (int i = 0; i < job.pending; i++) {
+    queue.push_back(&job);
+  }
+  uv_cond_broadcast(&wake);
+  uv_mutex_unlock(&mutex);
+
+  Work(&job, ctx);
+
+  // withdraw the requests for help that haven't been taken and wait for the
+  // helpers that did take one
+  uv_mutex_lock(&mutex);
+  for (std::deque<Job*>::iterator it = queue.begin(); it != queue.end();) {
+    if (*it == &job) {
+      it = queue.erase(it);
+      job.pending--;
+    } else {
+      ++it;
+    }
+  }
+  while (job.remaining || job.pending) {
+    uv_cond_wait(&finished, &mutex);
+  }
+  uv_mutex_unlock(&mutex);
+
+  if (job.failed) {
+    ctx->set_error(ctx, job.error_code, (char *) "%s", job.error_message.c_str());
+  }
+}
+
+/**
+ * @param job The job being performed.
+ *
+ * @param ctx The context of the current thread.
+ */
+void MapAssembler::Work(Job *job, mapcache_context *ctx) {
+  for (;;) {
+    int index = __sync_fetch_and_add(&(job->next), 1);
+    if (index >= job->count) {
+      return;
+    }
+
+    if (!job->failed) {
+      job->task(job, ctx, index);
+    }
+
+    uv_mutex_lock(&mutex);
+    if (GC_HAS_ERROR(ctx)) {
+      if (!job->failed) {
+        const char *message = ctx->get_error_message(ctx);
+        job->failed = true;
+        job->error_code = ctx->get_error(ctx);
+        job->error_message = (message) ? message : "";
+      }
+      ctx->clear_errors(ctx);
+    }
+    if (!--(job->remaining)) {
+      uv_cond_broadcast(&finished);
+    }
+    uv_mutex_unlock(&mutex);
+  }
+}
+
+/**
+ * @param arg The `MapAssembler` instance.
+ */
+void MapAssembler::Helper(void *arg) {
+  MapAssembler *assembler = static_cast<MapAssembler*>(arg);
+
+  uv_mutex_lock(&(assembler->mutex));
+  for (;;) {
+    while (assembler->queue.empty() && !assembler->closing) {
+      uv_cond_wait(&(assembler->wake), &(assembler->mutex));
+    }
+    if (assembler->queue.empty()) {
+      break;                    // closing
+    }
+
+    Job *job = assembler->queue.front();
+    assembler->queue.pop_front();
+    uv_mutex_unlock(&(assembler->mutex));
+
+    int slot = __sync_add_and_fetch(&(job->claimed), 1);
+    assembler->Work(job, job->contexts[slot]);
+
+    uv_mutex_lock(&(assembler->mutex));
+    job->pending--;
+    uv_cond_broadcast(&(assembler->finished));
+  }
+  uv_mutex_unlock(&(assembler->mutex));
+}
+
+/**
+ * @details Tiles are decoded here so that the bands only read them.
+ */
+void MapAssembler::FetchTile(Job *job, mapcache_context *ctx, int index) {
+  Assembly *assembly = static_cast<Assembly*>(job->data);
+  mapcache_tile *tile = assembly->tiles[index];
+
+  mapcache_tileset_tile_get(ctx, tile);
+  if (GC_HAS_ERROR(ctx)) {
+    return;
+  }
+  if (!tile->nodata && !tile->raw_image && tile->encoded_data) {
+    tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
+  }
+  __sync_fetch_and_add(&(job->assembler->tiles), 1);
+}
+
+/**
+ * @details Each map of the request is assembled from the tiles overlapping
+ * the band, plus a margin for resampling, and merged with the maps before
+ * it.  The result is written to the rows of the band in the map.
+ */
+void MapAssembler::AssembleBand(Job *job, mapcache_context *ctx, int index) {
+  Assembly *assembly = static_cast<Assembly*>(job->data);
+  mapcache_image *image = assembly->image;
+  int first = index * assembly->band_height;
+  int rows = ((int) image->h - first < assembly->band_height) ? (int) image->h - first : assembly->band_height;
+  bool simd = job->assembler->simd;
+  mapcache_image *band = NULL;
+  PixelKernels::Image output = { image->data + first * image->stride, image->w, (size_t) rows, image->stride };
+  PixelKernels::Image overlay = { NULL, image->w, (size_t) rows, image->w * 4 };
+
+  for (int i = 0; i < assembly->req_map->nmaps; i++) {
+    mapcache_map *map = assembly->req_map->maps[i];
+    if (map->nodata) {
+      continue;
+    }
+
+    // the band covers whole rows of the map
+    double resolution = (map->extent.maxy - map->extent.miny) / map->height;
+    mapcache_extent extent = map->extent;
+    extent.maxy = map->extent.maxy - first * resolution;
+    extent.miny = map->extent.maxy - (first + rows) * resolution;
+
+    mapcache_tile **band_tiles = (mapcache_tile **) apr_palloc(ctx->pool,
+                                                               assembly->map_ntiles[i] * sizeof(mapcache_tile*));
+    int nband_tiles = 0;
+    for (int j = 0; j < assembly->map_ntiles[i]; j++) {
+      mapcache_tile *tile = assembly->map_tiles[i][j];
+      mapcache_grid *grid = tile->grid_link->grid;
+      double margin = 2 * grid->levels[tile->z]->resolution;
+      mapcache_extent bbox;
+      mapcache_grid_get_extent(ctx, grid, tile->x, tile->y, tile->z, &bbox);
+      if (bbox.miny <= extent.maxy + margin && bbox.maxy >= extent.miny - margin) {
+        band_tiles[nband_tiles++] = tile;
+      }
+    }
+
+    if (simd) {
+      // the first map is resampled straight into the band of the map
+      if (!band) {
+        ResampleTiles(ctx, extent, nband_tiles, band_tiles, assembly->req_map->resample_mode, output);
+        band = image;
+      } else {
+        if (!overlay.data) {
+          overlay.data = (unsigned char *) apr_palloc(ctx->pool, overlay.stride * rows);
+        }
+        ResampleTiles(ctx, extent, nband_tiles, band_tiles, assembly->req_map->resample_mode, overlay);
+        PixelKernels::Composite(output, overlay);
+      }
+      continue;
+    }
+
+    mapcache_image *part = mapcache_tileset_assemble_map_tiles(ctx, map->tileset, map->grid_link, &extent,
+                                                               map->width, rows, nband_tiles, band_tiles,
+                                                               assembly->req_map->resample_mode);
+    if (GC_HAS_ERROR(ctx)) {
+      return;
+    }
+    if (!band) {
+      band = part;
+    } else {
+      mapcache_image_merge(ctx, band, part);
+      if (GC_HAS_ERROR(ctx)) {
+        return;
+      }
+    }
+  }
+
+  if (!simd) {
+    for (int y = 0; y < rows; y++) {
+      memcpy(image->data + (first + y) * image->stride, band->data + y * band->stride, image->w * 4);
+    }
+  }
+  __sync_fetch_and_add(&(job->assembler->bands), 1);
+}
+
+/**
+ * @details The decoded tiles are copied into a mosaic which is resampled
+ * into the band with the same geometry as the mapcache core: nearest
+ * neighbour sampling is used when the tiles are at the resolution of the map.
+ *
+ * @param ctx The context of the current thread.
+ *
+ * @param extent The extent of the band.
+ *
+ * @param ntiles The number of tiles overlapping the band.
+ *
+ * @param tiles The tiles overlapping the band.
+ *
+ * @param mode The resampling mode of the request.
+ *
+ * @param band The image receiving the band.
+ */
+void MapAssembler::ResampleTiles(mapcache_context *ctx, const mapcache_extent &extent,
+                                 int ntiles, mapcache_tile **tiles, mapcache_resample_mode mode,
+                                 PixelKernels::Image &band) {
+  if (!ntiles) {
+    for (size_t y = 0; y < band.h; y++) {
+      memset(band.data + y * band.stride, 0, band.w * 4);
+    }
+    return;
+  }
+
+  // find the extent of the tiles
+  mapcache_grid *grid = tiles[0]->grid_link->grid;
+  double resolution = grid->levels[tiles[0]->z]->resolution;
+  mapcache_extent *bboxes = (mapcache_extent *) apr_palloc(ctx->pool, ntiles * sizeof(mapcache_extent));
+  mapcache_extent bounds;
+  for (int i = 0; i < ntiles; i++) {
+    mapcache_grid_get_extent(ctx, grid, tiles[i]->x, tiles[i]->y, tiles[i]->z, &bboxes[i]);
+    if (!i) {
+      bounds = bboxes[i];
+      continue;
+    }
+    bounds.minx = (bboxes[i].minx < bounds.minx) ? bboxes[i].minx : bounds.minx;
+    bounds.miny = (bboxes[i].miny < bounds.miny) ? bboxes[i].miny : bounds.miny;
+    bounds.maxx = (bboxes[i].maxx > bounds.maxx) ? bboxes[i].maxx : bounds.maxx;
+    bounds.maxy = (bboxes[i].maxy > bounds.maxy) ? bboxes[i].maxy : bounds.maxy;
+  }
+
+  // copy the tiles into a mosaic
+  PixelKernels::Image mosaic;
+  mosaic.w = (size_t) ((bounds.maxx - bounds.minx) / resolution + 0.5);
+  mosaic.h = (size_t) ((bounds.maxy - bounds.miny) / resolution + 0.5);
+  mosaic.stride = mosaic.w * 4;
+  mosaic.data = (unsigned char *) apr_pcalloc(ctx->pool, mosaic.stride * mosaic.h);
+  for (int i = 0; i < ntiles; i++) {
+    mapcache_image *raw = tiles[i]->raw_image;
+    if (tiles[i]->nodata || !raw) {
+      continue;
+    }
+    size_t ox = (size_t) ((bboxes[i].minx - bounds.minx) / resolution + 0.5);
+    size_t oy = (size_t) ((bounds.maxy - bboxes[i].maxy) / resolution + 0.5);
+    size_t width = (ox + raw->w > mosaic.w) ? mosaic.w - ox : raw->w;
+    for (size_t y = 0; y < raw->h && oy + y < mosaic.h; y++) {
+      memcpy(mosaic.data + (oy + y) * mosaic.stride + ox * 4, raw->data + y * raw->stride, width * 4);
+    }
+  }
+
+  // resample the mosaic into the band
+  double hresolution = (extent.maxx - extent.minx) / band.w;
+  double vresolution = (extent.maxy - extent.miny) / band.h;
+  double off_x = (bounds.minx - extent.minx) / hresolution;
+  double off_y = (extent.maxy - bounds.maxy) / vresolution;
+  double scale_x = resolution / hresolution, scale_y = resolution / vresolution;
+  if ((fabs(scale_x - 1) < 0.0001 && fabs(scale_y - 1) < 0.0001) || mode != MAPCACHE_RESAMPLE_BILINEAR) {
+    PixelKernels::ResampleNearest(mosaic, band, off_x, off_y, scale_x, scale_y);
+  } else {
+    PixelKernels::ResampleBilinear(mosaic, band, off_x, off_y, scale_x, scale_y);
+  }
+}
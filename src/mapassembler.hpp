@@ -0,0 +1,164 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_MAPASSEMBLER_H__
+#define __NODE_MAPCACHE_MAPASSEMBLER_H__
+
+/**
+ * @file mapassembler.hpp
+ * @brief This declares the `MapAssembler` class.
+ */
+
+// Standard headers
+#include <string>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+// Module headers
+#include "pixelkernels.hpp"
+
+/**
+ * @brief Assembles WMS maps from tiles using several threads
+ *
+ * The mapcache core assembles a map by fetching each tile covering it in
+ * turn and then resampling them into the map in the thread handling the
+ * request.  The assembler instead divides the work for a map between that
+ * thread and a set of helper threads: the tiles are first fetched and decoded
+ * in parallel, and the map is then assembled in horizontal bands which are
+ * resampled and merged in parallel.
+ *
+ * The thread handling a request takes part in its own work, so a request
+ * progresses even when every helper is busy.  Each thread uses its own clone
+ * of the request context.
+ *
+ * Bands are resampled and merged by the mapcache core unless `simd` is set,
+ * in which case the vectorised `PixelKernels` are used.
+ */
+class MapAssembler {
+public:
+
+  /// A snapshot of the assembler metrics
+  struct Stats {
+    /// The number of maps assembled
+    uint64_t maps;
+    /// The number of tiles fetched for those maps
+    uint64_t tiles;
+    /// The number of bands assembled
+    uint64_t bands;
+  };
+
+  /// Start the helper threads
+  MapAssembler(unsigned int threads, unsigned int band_height, bool simd);
+
+  /// Stop the helper threads, waiting for them to finish
+  ~MapAssembler();
+
+  /// Respond to a GetMap request using the assemble strategy
+  mapcache_http_response* GetMap(mapcache_context *ctx, mapcache_request_get_map *req_map);
+
+  /// Retrieve the assembler metrics
+  void GetStats(Stats &stats) const;
+
+  /// The number of helper threads
+  const unsigned int threads;
+
+  /// The number of rows in each band of a map
+  const unsigned int band_height;
+
+  /// Set if bands are resampled and merged by `PixelKernels`
+  const bool simd;
+
+private:
+
+  /// A set of tasks shared between a request thread and the helpers
+  struct Job;
+
+  /// The tiles and bands of a request being assembled
+  struct Assembly;
+
+  /// A function performing the task at an index of a job
+  typedef void (*Task)(Job *job, mapcache_context *ctx, int index);
+
+  /// Perform the tasks of a job in the current thread and the helpers
+  void Run(mapcache_context *ctx, Task task, void *data, int count);
+
+  /// Perform tasks from a job until there are none left
+  void Work(Job *job, mapcache_context *ctx);
+
+  /// Wait for jobs and help with them
+  static void Helper(void *arg);
+
+  /// Fetch and decode a tile
+  static void FetchTile(Job *job, mapcache_context *ctx, int index);
+
+  /// Assemble a band of the map
+  static void AssembleBand(Job *job, mapcache_context *ctx, int index);
+
+  /// Resample the tiles of a map overlapping a band using `PixelKernels`
+  static void ResampleTiles(mapcache_context *ctx, const mapcache_extent &extent,
+                            int ntiles, mapcache_tile **tiles, mapcache_resample_mode mode,
+                            PixelKernels::Image &band);
+
+  /// The jobs waiting for a helper, listed once for each helper wanted
+  std::deque<Job*> queue;
+
+  /// The helper threads
+  std::vector<uv_thread_t> helpers;
+
+  /// Protects the queue and the progress of jobs
+  uv_mutex_t mutex;
+
+  /// Signals the helpers that there is a job or they should stop
+  uv_cond_t wake;
+
+  /// Signals a thread waiting for a job that a task or helper has finished
+  uv_cond_t finished;
+
+  /// Set when the helpers should stop
+  bool closing;
+
+  /// The number of maps assembled
+  volatile uint64_t maps;
+
+  /// The number of tiles fetched
+  volatile uint64_t tiles;
+
+  /// The number of bands assembled
+  volatile uint64_t bands;
+};
+
+#endif  /* __NODE_MAPCACHE_MAPASSEMBLER_H__ */
@@ -32,6 +32,9 @@
 
 #include "mapcache.hpp"
 
+/// The interval between invalidation progress reports in milliseconds
+#define NODE_MAPCACHE_PROGRESS_INTERVAL 1000
+
 /**
  * @details This is a global pool from which the underlying mapcache C
  * code draws its memory.  It is initialised the first time a
@@ -47,6 +50,21 @@ apr_pool_t *MapCache::global_pool = NULL;
  */
 apr_thread_mutex_t *MapCache::thread_mutex = NULL;
 
+/**
+ * @details This pool is used in the Node/V8 thread when a request needs to be
+ * inspected before it is dispatched. It is cleared after each use.
+ */
+apr_pool_t *MapCache::scratch_pool = NULL;
+
+/**
+ * @details Some responses (e.g. blank tiles) can be generated directly in the
+ * Node/V8 thread.  They are queued and returned on the next iteration of the
+ * event loop via this handle so that the `get` callback is always called
+ * asynchronously.
+ */
+uv_async_t MapCache::immediate_async;
+std::queue<MapCache::RequestBaton *> MapCache::immediate_queue;
+
 /**
  * @defgroup cache_response Properties of the cache response object
  *
@@ -91,9 +109,127 @@ void MapCache::Init(Handle<Object> target) {
   headers_symbol = NODE_PSYMBOL("headers");
 
   NODE_SET_PROTOTYPE_METHOD(mapcache_template, "get", GetAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableBlankIndex", EnableBlankIndex);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "saveBlankIndex", SaveBlankIndexAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableExistenceFilter", EnableExistenceFilter);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "existenceFilterStats", ExistenceFilterStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableWriteBehind", EnableWriteBehind);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "writeBehindStats", WriteBehindStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "flushWrites", FlushWritesAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "setLogLevel", SetLogLevel);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableAccessLog", EnableAccessLog);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "attachSharedCache", AttachSharedCache);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "sharedCacheStats", SharedCacheStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableRevalidation", EnableRevalidation);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableMetatileCoalescing", EnableMetatileCoalescing);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "metatileCoalescingStats", MetatileCoalescingStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "profile", ProfileAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "export", ExportAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "invalidate", InvalidateAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "configStats", ConfigStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "loadConfig", LoadConfigAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "setRequestMemoryLimit", SetRequestMemoryLimit);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "memoryStats", MemoryStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableBodySharing", EnableBodySharing);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "bodySharingStats", BodySharingStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableParallelAssembly", EnableParallelAssembly);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "parallelAssemblyStats", ParallelAssemblyStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableResponseCache", EnableResponseCache);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "responseCacheStats", ResponseCacheStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "tileKey", GetTileKey);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "tilesetFor", GetTilesetName);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableHotTiles", EnableHotTiles);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "saveHotTiles", SaveHotTilesAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "hotTilesStats", HotTilesStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "warmup", WarmupAsync);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableFormatVariants", EnableFormatVariants);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "formatVariantStats", FormatVariantStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableDiskSweeper", EnableDiskSweeper);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "diskSweeperStats", DiskSweeperStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "revalidationStats", RevalidationStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableSourceGuard", EnableSourceGuard);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "sourceGuardStats", SourceGuardStats);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "enableConnectionReuse", EnableConnectionReuse);
+  NODE_SET_PROTOTYPE_METHOD(mapcache_template, "connectionReuseStats", ConnectionReuseStats);
   NODE_SET_METHOD(mapcache_template, "FromConfigFile", FromConfigFileAsync);
 
   target->Set(String::NewSymbol("MapCache"), mapcache_template->GetFunction());
+
+  // the handle is only referenced while there are responses to return
+  uv_async_init(uv_default_loop(), &immediate_async, GetRequestImmediate);
+  uv_unref((uv_handle_t *) &immediate_async);
+}
+
+/**
+ * @details This frees the configuration context along with any optional
+ * features that were enabled on the instance.
+ */
+MapCache::~MapCache() {
+  if (blank_index) {
+    delete blank_index;
+    blank_index = NULL;
+  }
+  if (existence_filter) {
+    delete existence_filter;
+    existence_filter = NULL;
+  }
+  if (write_behind) {
+    delete write_behind;        // this blocks until queued tiles are written
+    write_behind = NULL;
+  }
+  if (access_log) {
+    access_log->Close();        // this frees the log asynchronously
+    access_log = NULL;
+  }
+  if (shared_cache) {
+    delete shared_cache;
+    shared_cache = NULL;
+  }
+  if (revalidator) {
+    revalidator->Close();       // this frees the revalidator asynchronously
+    revalidator = NULL;
+  }
+  if (source_guard) {
+    delete source_guard;
+    source_guard = NULL;
+  }
+  if (connection_pool) {
+    connection_pool->Close();   // this frees the pool asynchronously
+    connection_pool = NULL;
+  }
+  if (body_store) {
+    delete body_store;
+    body_store = NULL;
+  }
+  if (map_assembler) {
+    delete map_assembler;       // this waits for the helper threads to stop
+    map_assembler = NULL;
+  }
+  if (response_cache) {
+    delete response_cache;
+    response_cache = NULL;
+  }
+  if (hot_tiles) {
+    hot_tiles->Close();         // this saves and frees the record
+    hot_tiles = NULL;
+  }
+  if (variant_cache) {
+    delete variant_cache;
+    variant_cache = NULL;
+  }
+  if (disk_sweeper) {
+    delete disk_sweeper;        // this waits for the sweeper thread to stop
+    disk_sweeper = NULL;
+  }
+  if (config && config->lazy) {
+    delete config->lazy;
+    config->lazy = NULL;
+  }
+  if (config && config->pool) {
+    apr_pool_destroy(config->pool);
+    config = NULL;
+  }
+  logger.Dispose();
 }
 
 /**
@@ -140,6 +276,11 @@ Handle<Value> MapCache::New(const Arguments& args) {
  * @param logger [optional] An `EventEmitter` that can be used to capture
  * mapcache log messages.
  *
+ * @param options [optional] An object with the boolean property `lazy`: if
+ * this is set the configuration is only indexed, each tileset being set up
+ * when it is first requested.  An object is taken to be the logger if it has
+ * an `emit` method.
+ *
  * @param callback A function that is called on error or when the
  * cache has been created. It should have the signature `callback(err,
  * cache)`.
@@ -148,18 +289,28 @@ Handle<Value> MapCache::FromConfigFileAsync(const Arguments& args) {
   HandleScope scope;
 
   Local<Object> emitter;
+  Local<Object> options;
   Local<Function> callback;
 
   switch (args.Length()) {
+  case 4:
+    ASSIGN_OBJ_ARG(1, emitter);
+    ASSIGN_OBJ_ARG(2, options);
+    ASSIGN_FUN_ARG(3, callback);
+    break;
   case 3:
     ASSIGN_OBJ_ARG(1, emitter);
     ASSIGN_FUN_ARG(2, callback);
+    if (!emitter->Get(String::NewSymbol("emit"))->IsFunction()) {
+      options = emitter;        // the logger is optional
+      emitter = Local<Object>();
+    }
     break;
   case 2:
     ASSIGN_FUN_ARG(1, callback);
     break;
   default:
-    THROW_CSTR_ERROR(Error, "usage: MapCache.FromConfigFile(configfile, [logger], callback)");
+    THROW_CSTR_ERROR(Error, "usage: MapCache.FromConfigFile(configfile, [logger], [options], callback)");
   }
   REQ_STR_ARG(0, conffile);
 
@@ -184,6 +335,7 @@ Handle<Value> MapCache::FromConfigFileAsync(const Arguments& args) {
   baton->cache = NULL;
   baton->callback = Persistent<Function>::New(callback);
   baton->conffile = *conffile;
+  baton->lazy = !options.IsEmpty() && options->Get(String::NewSymbol("lazy"))->BooleanValue();
 
   uv_queue_work(uv_default_loop(),
                 &baton->request,
@@ -212,6 +364,13 @@ Handle<Value> MapCache::FromConfigFileAsync(const Arguments& args) {
  * @param queryString A string with the URL `QUERY_STRING` data. This
  * should not be prefixed with a `?`.
  *
+ * @param options [optional] An object with the optional properties `format`
+ * (the name of an image format in the configuration to transcode a single
+ * tile into, once format variants are enabled), `quality` (the JPEG quality
+ * of the variant, defaulting to that of the format) and `vary` (the value of
+ * the `Vary` header added to the response, defaulting to `Accept`, or `false`
+ * for none).
+ *
  * @param callback A function that is called on error or when the
  * resource has been created. It should have the signature
  * `callback(err, resource)`.
@@ -219,19 +378,133 @@ Handle<Value> MapCache::FromConfigFileAsync(const Arguments& args) {
 Handle<Value> MapCache::GetAsync(const Arguments& args) {
   HandleScope scope;
 
-  if (args.Length() != 4) {
-    THROW_CSTR_ERROR(Error, "usage: cache.get(baseUrl, pathInfo, queryString, callback)");
+  Local<Object> options;
+  Local<Function> callback;
+  switch (args.Length()) {
+  case 5:
+    ASSIGN_OBJ_ARG(3, options);
+    ASSIGN_FUN_ARG(4, callback);
+    break;
+  case 4:
+    ASSIGN_FUN_ARG(3, callback);
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.get(baseUrl, pathInfo, queryString, [options], callback)");
   }
   REQ_STR_ARG(0, baseUrl);
   REQ_STR_ARG(1, pathInfo);
   REQ_STR_ARG(2, queryString);
-  REQ_FUN_ARG(3, callback);
 
   MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+
+  // the format variant requested, if any
+  std::string variant, variant_format, vary;
+  double quality = 0;
+  if (!options.IsEmpty()) {
+    Local<Value> format = options->Get(String::NewSymbol("format"));
+    if (!format->IsUndefined() && !format->IsNull()) {
+      if (!format->IsString()) {
+        THROW_CSTR_ERROR(TypeError, "Option `format` must be a string");
+      }
+      if (!cache->variant_cache) {
+        THROW_CSTR_ERROR(Error, "Format variants are not enabled");
+      }
+      variant_format = *String::Utf8Value(format);
+      if (variant_format.empty() || variant_format.find('/') != std::string::npos) {
+        THROW_CSTR_ERROR(Error, "Option `format` is not a valid format name");
+      }
+    }
+    ASSIGN_NUM_OPTION(options, quality, quality);
+    if (quality < 0 || quality > 100) {
+      THROW_CSTR_ERROR(RangeError, "The variant quality is out of range");
+    }
+    variant = variant_format;
+    if (!variant.empty() && (int) quality) {
+      char suffix[16];
+      apr_snprintf(suffix, sizeof(suffix), "-q%d", (int) quality);
+      variant += suffix;
+    }
+
+    Local<Value> vary_option = options->Get(String::NewSymbol("vary"));
+    if (vary_option->IsUndefined()) {
+      vary = "Accept";
+    } else if (vary_option->IsString()) {
+      vary = *String::Utf8Value(vary_option);
+    } else if (!vary_option->IsFalse()) {
+      THROW_CSTR_ERROR(TypeError, "Option `vary` must be a string or false");
+    }
+  }
+
   RequestBaton *baton = new RequestBaton();
+  baton->time = apr_time_now();
+  baton->epoch = cache->invalidation_epoch;
+  baton->start = uv_hrtime();
+  baton->variant = variant;
+  baton->variant_format = variant_format;
+  baton->variant_quality = (int) quality;
+  baton->vary = vary;
+  NODE_MAPCACHE_PROBE2(get_enqueue, *pathInfo, *queryString);
+
+  // identify single tile requests if any features depend on them
+  if (cache->blank_index || cache->existence_filter || cache->shared_cache || cache->coalesce_metatiles
+      || cache->hot_tiles || cache->disk_sweeper || !baton->variant.empty()) {
+    baton->has_tile = cache->IdentifyTile(*pathInfo, *queryString, &(baton->tile));
+    if (baton->has_tile) {
+      baton->layer = LayerName(baton->tile);
+    }
+  }
+
+  if (baton->has_tile && cache->hot_tiles) {
+    cache->hot_tiles->Record(baton->layer, baton->tile.z, baton->tile.x, baton->tile.y);
+  }
+  if (baton->has_tile && cache->disk_sweeper) {
+    cache->disk_sweeper->Record(baton->layer, baton->tile.z, baton->tile.x, baton->tile.y);
+  }
+
+  // tiles that are known to be blank are returned without using the thread
+  // pool, unless a variant is requested
+  if (baton->has_tile && cache->blank_index && baton->variant.empty()) {
+    int auto_expire = baton->tile.tileset->auto_expire;
+    apr_time_t indexed;
+    BlankIndex::Layer *layer = cache->blank_index->Find(baton->layer, baton->tile.z, baton->tile.x, baton->tile.y,
+                                                        (auto_expire) ? baton->time - apr_time_from_sec(auto_expire) : 0,
+                                                        &indexed);
+    if (layer) {
+      if (layer->buffer.IsEmpty()) {
+        layer->buffer = Persistent<Object>::New(Buffer::New(layer->body.data(), layer->body.size())->handle_);
+      }
+      baton->cache = cache;
+      baton->callback = Persistent<Function>::New(callback);
+      baton->result = Persistent<Object>::New(TileResponse(layer->buffer, layer->body.size(),
+                                                           layer->content_type.c_str(), indexed,
+                                                           baton->tile));
+      SetVaryHeader(baton->result, baton->vary);
+      RespondImmediately(baton, layer->body.size(), AccessLog::HIT | AccessLog::BLANK);
+      return Undefined();
+    }
+  }
+
+  // tiles in the shared memory cache are returned without using the thread
+  // pool, unless a variant is requested
+  if (baton->has_tile && cache->shared_cache && baton->tile.tileset->format && baton->variant.empty()) {
+    std::string data;
+    apr_time_t mtime;
+    int auto_expire = baton->tile.tileset->auto_expire;
+    if (cache->shared_cache->Get(cache->SharedKey(baton->layer, baton->tile), data, &mtime)
+        && (!auto_expire || mtime + apr_time_from_sec(auto_expire) > baton->time)) {
+      baton->cache = cache;
+      baton->callback = Persistent<Function>::New(callback);
+      baton->result = Persistent<Object>::New(TileResponse(cache->BodyBuffer(data.data(), data.size(), NULL), data.size(),
+                                                           baton->tile.tileset->format->mime_type, mtime,
+                                                           baton->tile));
+      SetVaryHeader(baton->result, baton->vary);
+      RespondImmediately(baton, data.size(), AccessLog::HIT);
+      return Undefined();
+    }
+  }
 
   // create the pool for this request
-  if (apr_pool_create(&(baton->pool), cache->config->pool) != APR_SUCCESS) {
+  if (MemoryMeter::CreatePool(&(baton->pool), cache->config->pool) != APR_SUCCESS) {
     delete baton;
     THROW_CSTR_ERROR(Error, "Could not create the mapcache request memory pool");
   }
@@ -246,190 +519,3207 @@ Handle<Value> MapCache::GetAsync(const Arguments& args) {
 
   cache->Ref(); // increment reference count so cache is not garbage collected
 
+  // requests for tiles in a metatile that is already being requested wait
+  // for that request instead of blocking a thread on the metatile lock:
+  // tiles that the existence filter reports as probably cached are read from
+  // the cache straight away instead
+  if (baton->has_tile && cache->coalesce_metatiles && cache->existence_filter
+      && cache->existence_filter->Tracks(baton->layer)
+      && cache->existence_filter->MayContain(baton->layer, baton->tile.z, baton->tile.x, baton->tile.y)) {
+    cache->coalesce_bypassed++;
+  } else if (baton->has_tile && cache->coalesce_metatiles) {
+    baton->metatile = MetatileKey(baton->layer, baton->tile);
+    std::map<std::string, std::vector<RequestBaton*> >::iterator job = cache->metatile_jobs.find(baton->metatile);
+    if (job != cache->metatile_jobs.end()) {
+      job->second.push_back(baton); // dispatched by `GetRequestAfter`
+      cache->coalesced++;
+      return Undefined();
+    }
+    cache->metatile_jobs[baton->metatile]; // this request leads the job
+    baton->leads_metatile = true;
+  }
+
+  cache->QueueRequest(baton);
+  return Undefined();
+}
+
+/**
+ * @details Tiles that are definitely not cached need rendering: these are
+ * limited in number so that they don't occupy every thread and starve
+ * requests for tiles that are cached.
+ *
+ * @param baton The request to queue.
+ */
+void MapCache::QueueRequest(RequestBaton *baton) {
+  if (baton->has_tile && existence_filter
+      && !existence_filter->MayContain(baton->layer, baton->tile.z, baton->tile.x, baton->tile.y)) {
+    baton->render_lane = true;
+    if (renders_active >= render_limit) {
+      render_queue.push_back(baton); // dispatched by `GetRequestAfter`
+      return;
+    }
+    renders_active++;
+  }
+
   uv_queue_work(uv_default_loop(),
                 &baton->request,
                 GetRequestWork,
                 (uv_after_work_cb) GetRequestAfter);
-  return Undefined();
 }
 
 /**
- * @details An APR memory pool and thread mutex are created when the
- * first `MapCache` instance is created. This method frees up that
- * memory and should be called when Node no longer requires this
- * module.
+ * @details Tiles in the same metatile are rendered together by the mapcache
+ * core, so requests for them share a key.
  *
- * @param target The object representing the module.
+ * @param layer The name of the layer containing the tile.
+ *
+ * @param key The location of the tile.
  */
-void MapCache::Destroy() {
-  if (thread_mutex) {
-    apr_thread_mutex_destroy(thread_mutex);
-    thread_mutex = NULL;
-  }
-  apr_pool_destroy(global_pool);
-  global_pool = NULL;
+std::string MapCache::MetatileKey(const std::string &layer, const TileKey &key) {
+  char coords[64];
+  apr_snprintf(coords, sizeof(coords), "/%d/%d/%d", key.z,
+               key.x / key.tileset->metasize_x, key.y / key.tileset->metasize_y);
+  return layer + coords;
 }
 
 /**
- * @details This is called by `GetRequestAsync` and runs in a
- * different thread to that function.
+ * @details This enables an index of tiles known to be blank.  Single tile
+ * requests for tiles in the index are answered in the Node/V8 thread from a
+ * single shared `Buffer`, bypassing the cache backend altogether.  Tiles are
+ * added to the index as blank tiles are returned by the cache, and removed as
+ * other tiles are.  The tiles of tilesets with `<auto_expire>` are looked up
+ * in the cache again once they may have expired.
  *
- * @param req The asynchronous libuv request.
+ * Tiles seeded into disk caches with `<symlink_blank/>` are added by walking
+ * the caches in the thread pool.  The walk needs the full configuration, so
+ * it is skipped for a lazy instance whose full configuration isn't loaded.
+ *
+ * Note that the `Buffer` is shared between responses and should therefore be
+ * treated as read only.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param path A string representing the file path of the index.  The index is
+ * loaded from this file if it exists.
+ *
+ * @param callback [optional] A function that is called once the seeded tiles
+ * have been indexed. It should have the signature `callback(err, seeded)`
+ * where `seeded` is the number of tiles found.
  */
-void MapCache::GetRequestWork(uv_work_t *req) {
-  /* No HandleScope! This is run in a separate thread: *No* contact
-     should be made with the Node/V8 world here. */
-
-  RequestBaton *baton =  static_cast<RequestBaton*>(req->data);
-  mapcache_context *ctx;
-  apr_table_t *params;
-  mapcache_request *request = NULL;
-  mapcache_http_response *http_response = NULL;
+Handle<Value> MapCache::EnableBlankIndex(const Arguments& args) {
+  HandleScope scope;
 
-  // set up the local context
-  ctx = (mapcache_context *)CreateRequestContext(baton->pool, baton->cache, baton->async_log);
-  if (!ctx) {
-    baton->error = "Could not create the request context";
-    return;
+  Local<Function> callback;
+  switch (args.Length()) {
+  case 2:
+    ASSIGN_FUN_ARG(1, callback);
+  case 1:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableBlankIndex(path, [callback])");
   }
+  REQ_STR_ARG(0, path);
 
-  // point the context to our cache configuration
-  ctx->config = baton->cache->config->cfg;
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->blank_index) {
+    THROW_CSTR_ERROR(Error, "The blank tile index is already enabled");
+  }
 
-#ifdef DEBUG
-  ctx->log(ctx, MAPCACHE_DEBUG, (char *) "cache request: %s%s%s%s",
-           baton->baseUrl.c_str(),
-           baton->pathInfo.c_str(),
-           ((baton->queryString.empty()) ? "" : "?"),
-           baton->queryString.c_str());
-#endif
+  std::string error;
+  BlankIndex *index = new BlankIndex(*path);
+  if (!index->Load(error)) {
+    delete index;
+    return ThrowException(Exception::Error(String::New(error.c_str())));
+  }
+  cache->blank_index = index;
 
-  // parse the query string and dispatch the request
-  params = mapcache_http_parse_param_string(ctx, (char*) baton->queryString.c_str());
-  mapcache_service_dispatch_request(ctx, &request, (char*) baton->pathInfo.c_str(), params, ctx->config);
-  if (GC_HAS_ERROR(ctx) || !request) {
-    http_response = mapcache_core_respond_to_error(ctx);
-  } else {
-    switch (request->type) {
-    case MAPCACHE_REQUEST_GET_CAPABILITIES: {
-      mapcache_request_get_capabilities *req = (mapcache_request_get_capabilities*)request;
-      http_response = mapcache_core_get_capabilities(ctx, request->service, req, (char*) baton->baseUrl.c_str(), (char*) baton->pathInfo.c_str(), ctx->config);
-      break;
-    }
-    case MAPCACHE_REQUEST_GET_TILE: {
-      mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
-      http_response = mapcache_core_get_tile(ctx, req_tile);
-      break;
-    }
-    case MAPCACHE_REQUEST_PROXY: {
-      mapcache_request_proxy *req_proxy = (mapcache_request_proxy*)request;
-      http_response = mapcache_core_proxy_request(ctx, req_proxy);
-      break;
-    }
-    case MAPCACHE_REQUEST_GET_MAP: {
-      mapcache_request_get_map *req_map = (mapcache_request_get_map*)request;
-      http_response = mapcache_core_get_map(ctx, req_map);
-      break;
-    }
-    case MAPCACHE_REQUEST_GET_FEATUREINFO: {
-      mapcache_request_get_feature_info *req_fi = (mapcache_request_get_feature_info*)request;
-      http_response = mapcache_core_get_featureinfo(ctx, req_fi);
-      break;
-    }
-    default:
-      ctx->set_error(ctx, 500, (char*)"###BUG### unknown request type");
-      break;
+  // find the layers stored as links to blank tiles
+  SeedBaton *baton = new SeedBaton();
+  mapcache_cfg *cfg = cache->Config(error);
+  for (apr_hash_index_t *hi = (cfg) ? apr_hash_first(NULL, cfg->tilesets) : NULL; hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_tileset *tileset = (mapcache_tileset *) val;
+    mapcache_cache_disk *disk = (mapcache_cache_disk *) tileset->cache;
+    if (tileset->cache->type != MAPCACHE_CACHE_DISK || !disk->symlink_blank || disk->filename_template
+        || !disk->base_directory || !tileset->format || !tileset->format->mime_type
+        || (tileset->dimensions && tileset->dimensions->nelts)) {
+      continue;
     }
 
-    if (GC_HAS_ERROR(ctx)) {
-      http_response = mapcache_core_respond_to_error(ctx);
+    for (int i = 0; i < tileset->grid_links->nelts; i++) {
+      mapcache_grid_link *grid_link = APR_ARRAY_IDX(tileset->grid_links, i, mapcache_grid_link*);
+      BlankSeed seed;
+      seed.name = std::string(tileset->name) + "@" + grid_link->grid->name;
+      seed.directory = std::string(disk->base_directory) + "/" + tileset->name + "/" + grid_link->grid->name;
+      seed.content_type = tileset->format->mime_type;
+      baton->layers.push_back(seed);
     }
   }
 
-  if (!http_response) {
-    ctx->set_error(ctx, 500, (char*)"###BUG### NULL response");
-    http_response = mapcache_core_respond_to_error(ctx);
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  if (!callback.IsEmpty()) {
+    baton->callback = Persistent<Function>::New(callback);
   }
+  baton->seeds = new BlankIndex(*path);
+  baton->seeded = 0;
+  baton->epoch = cache->invalidation_epoch;
 
-  if (!http_response) {
-    baton->error = "No response was received from the cache";
+  cache->Ref(); // increment reference count so cache is not garbage collected
+
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                SeedBlankIndexWork,
+                (uv_after_work_cb) SeedBlankIndexAfter);
+  return Undefined();
+}
+
+/**
+ * @details This writes the blank tile index to the file it was loaded from.
+ * The index is serialised in the Node/V8 thread and written to disk
+ * asynchronously.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param callback A function that is called on error or when the index has
+ * been written. It should have the signature `callback(err)`.
+ */
+Handle<Value> MapCache::SaveBlankIndexAsync(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 1) {
+    THROW_CSTR_ERROR(Error, "usage: cache.saveBlankIndex(callback)");
   }
+  REQ_FUN_ARG(0, callback);
 
-  ctx->clear_errors(ctx);
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->blank_index) {
+    THROW_CSTR_ERROR(Error, "The blank tile index is not enabled");
+  }
 
-  baton->response = http_response;
-  return;
+  SaveBaton *baton = new SaveBaton();
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+  baton->path = cache->blank_index->path;
+  cache->blank_index->Serialise(baton->data);
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                SaveBlankIndexWork,
+                (uv_after_work_cb) SaveBlankIndexAfter);
+  return Undefined();
 }
 
 /**
- * @details This is set by `GetRequestAsync` to run after
- * `GetRequestWork` has finished, being passed the response generated
- * by the latter and running in the same thread as the former. It
- * formats the cache response into javascript datatypes and returns
- * them via the original callback.
+ * @details This enables a Bloom filter per tileset layer recording which tiles
+ * are present in the cache.  Disk caches using the default `tilecache` layout
+ * are walked in a separate thread to populate the filter; tiles are added as
+ * they are subsequently returned by the cache.
  *
- * @param req The asynchronous libuv request.
+ * Once the filter is built, requests for tiles that are definitely not cached
+ * are routed to a render lane: this limits the number of renders occupying
+ * the thread pool so requests for cached tiles are not starved.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties
+ * `capacity` (the expected number of tiles per layer), `errorRate` (the
+ * false positive rate at capacity) and `renderConcurrency` (the number of
+ * renders allowed at once).
+ *
+ * @param callback [optional] A function that is called when the filter has
+ * been built. It should have the signature `callback(err, stats)`.
  */
-void MapCache::GetRequestAfter(uv_work_t *req) {
+Handle<Value> MapCache::EnableExistenceFilter(const Arguments& args) {
   HandleScope scope;
 
-  RequestBaton *baton = static_cast<RequestBaton*>(req->data);
-  MapCache *cache = baton->cache;
-  mapcache_http_response *response = baton->response;
+  Local<Object> options;
+  Local<Function> callback;
 
-  Handle<Value> argv[2];
+  switch (args.Length()) {
+  case 2:
+    ASSIGN_OBJ_ARG(0, options);
+    ASSIGN_FUN_ARG(1, callback);
+    break;
+  case 1:
+    if (args[0]->IsFunction()) {
+      ASSIGN_FUN_ARG(0, callback);
+    } else {
+      ASSIGN_OBJ_ARG(0, options);
+    }
+    break;
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableExistenceFilter([options], [callback])");
+  }
 
-  if (baton->async_log) baton->async_log->close(); // finish with the logger
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->existence_filter) {
+    THROW_CSTR_ERROR(Error, "The existence filter is already enabled");
+  }
 
-  if (!baton->error.empty()) {
-    argv[0] = Exception::Error(String::New(baton->error.c_str()));
-    argv[1] = Undefined();
-  } else {
-    // convert the http_response to a javascript object
-    Local<Object> result = Object::New();
-    result->Set(code_symbol, Integer::New(response->code)); // the HTTP response code
+  // by default leave one thread free for requests that aren't rendering
+  const char *threads = getenv("UV_THREADPOOL_SIZE");
+  double capacity = 1000000, error_rate = 0.01,
+    render_limit = ((threads && atoi(threads) > 0) ? atoi(threads) : 4) - 1;
+  ASSIGN_NUM_OPTION(options, capacity, capacity);
+  ASSIGN_NUM_OPTION(options, errorRate, error_rate);
+  ASSIGN_NUM_OPTION(options, renderConcurrency, render_limit);
+  if (capacity < 1 || capacity > 0xffffffff || error_rate <= 0 || error_rate >= 1) {
+    THROW_CSTR_ERROR(RangeError, "The existence filter capacity or error rate is out of range");
+  }
 
-    // set the mtime to as a javascript date
-    if (response->mtime) {
-      result->Set(mtime_symbol, Date::New(apr_time_as_msec(response->mtime)));
+  REQ_FULL_CONFIG(cache, cfg);
+  ExistenceFilter *filter = new ExistenceFilter((uint32_t) capacity, error_rate);
+
+  // add a layer for every tileset and grid combination
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->tilesets); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_tileset *tileset = (mapcache_tileset *) val;
+    bool walkable = (tileset->cache->type == MAPCACHE_CACHE_DISK
+                     && !((mapcache_cache_disk *) tileset->cache)->filename_template
+                     && (!tileset->dimensions || !tileset->dimensions->nelts));
+
+    for (int i = 0; i < tileset->grid_links->nelts; i++) {
+      mapcache_grid_link *grid_link = APR_ARRAY_IDX(tileset->grid_links, i, mapcache_grid_link*);
+      std::string directory;
+      if (walkable) {
+        directory = std::string(((mapcache_cache_disk *) tileset->cache)->base_directory)
+          + "/" + tileset->name + "/" + grid_link->grid->name;
+      }
+      filter->AddLayer(std::string(tileset->name) + "@" + grid_link->grid->name, directory);
     }
+  }
 
-    // Set the response headers as a javascript object with header
-    // names as keys and header values as an array. Header values are
-    // in an array as more than one header of the same name can be
-    // set.
-    Local<Object> headers = Object::New();
-    if (response->headers && !apr_is_empty_table(response->headers)) {
-      const apr_array_header_t *elts = apr_table_elts(response->headers);
-      int i;
-      for (i = 0; i < elts->nelts; i++) {
-        apr_table_entry_t entry = APR_ARRAY_IDX(elts, i, apr_table_entry_t);
-        Local<Array> values;
-        Local<String> key = String::New(entry.key);
-        Local<String> value = String::New(entry.val);
-        if (headers->Has(key)) {
-          // the header exists: append the value
-          values = Local<Array>::Cast(headers->Get(key));
-          values->Set(values->Length() - 1, value);
-        } else {
-          // create a new header
-          values = Array::New(1);
-          values->Set(0, value);
-          headers->Set(key, values);
+  FilterBaton *baton = new FilterBaton();
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->filter = filter;
+  if (!callback.IsEmpty()) {
+    baton->callback = Persistent<Function>::New(callback);
+  }
+  baton->async.data = baton;
+  uv_async_init(uv_default_loop(), &baton->async, BuildExistenceFilterAfter);
+
+  if (uv_thread_create(&baton->thread, BuildExistenceFilter, baton) != 0) {
+    uv_close((uv_handle_t *) &baton->async, FilterBatonClosed);
+    delete filter;
+    THROW_CSTR_ERROR(Error, "Could not create the existence filter thread");
+  }
+
+  cache->existence_filter = filter;
+  cache->render_limit = (render_limit < 1) ? 1 : (unsigned int) render_limit;
+  cache->Ref(); // the cache must outlive the thread building the filter
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `ready`: whether the filter has been built and is routing requests
+ * - `buildTime`: the time taken to build the filter in milliseconds
+ * - `rendersActive`: the number of requests using the render lane
+ * - `renderQueue`: the number of requests waiting for the render lane
+ * - `layers`: an object keyed on `tileset@grid` with the number of `tiles`
+ *   added to each layer, whether the cache was `walked` and the estimated
+ *   `falsePositiveRate`
+ */
+Handle<Value> MapCache::ExistenceFilterStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->existence_filter) {
+    THROW_CSTR_ERROR(Error, "The existence filter is not enabled");
+  }
+
+  return scope.Close(cache->ExistenceFilterStatsObject());
+}
+
+/**
+ * @details When a tile is not cached the mapcache core renders its metatile
+ * and stores every tile in the metatile before the request completes.  This
+ * moves the storage to a background thread: the requested tile is returned as
+ * soon as it is encoded and the metatile tiles are queued to be written.
+ * Queued tiles are returned by subsequent requests before they have been
+ * written.
+ *
+ * The queue is bounded: once it is full tiles are written synchronously as
+ * normal.  Queued tiles are written before the `MapCache` instance is
+ * destroyed; `flushWrites()` should be used to ensure they are written
+ * before the process exits.
+ *
+ * The metatile lock is released once the tiles are queued, so queued tiles
+ * are invisible to other processes waiting on it.  When the caches are shared
+ * with other processes the `shared` option writes every tile synchronously.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties
+ * `queueSize`, defining the maximum number of tiles that can be queued, and
+ * `shared`, which is `true` when other processes use the same caches.
+ */
+Handle<Value> MapCache::EnableWriteBehind(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+    break;
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableWriteBehind([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->write_behind) {
+    THROW_CSTR_ERROR(Error, "Write behind is already enabled");
+  }
+
+  double queue_size = 1024;
+  ASSIGN_NUM_OPTION(options, queueSize, queue_size);
+  if (queue_size < 1 || queue_size > 0xffffffff) {
+    THROW_CSTR_ERROR(RangeError, "The write behind queue size is out of range");
+  }
+
+  bool shared = !options.IsEmpty() && options->Get(String::NewSymbol("shared"))->BooleanValue();
+
+  REQ_FULL_CONFIG(cache, cfg);
+  std::string error;
+  WriteBehind *write_behind = new WriteBehind(cfg, (uint32_t) queue_size, shared, CreateWriteContext);
+  if (!write_behind->Start(error)) {
+    delete write_behind;
+    THROW_CSTR_ERROR(Error, error.c_str());
+  }
+  cache->write_behind = write_behind;
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `queued`: the number of tiles queued or being written
+ * - `queueSize`: the maximum number of tiles that can be queued
+ * - `batches`: the number of groups of tiles waiting to be written
+ * - `written`: the number of tiles written in the background
+ * - `synchronous`: the number of tiles written synchronously because the
+ *   queue was full or the caches are shared
+ * - `shared`: whether the caches are shared with other processes
+ * - `errors`: the number of tiles that failed to be written in the background
+ * - `lastError`: the message from the last failure, if any
+ */
+Handle<Value> MapCache::WriteBehindStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->write_behind) {
+    THROW_CSTR_ERROR(Error, "Write behind is not enabled");
+  }
+
+  WriteBehind::Stats stats;
+  cache->write_behind->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("queued"), Uint32::New(stats.queued));
+  result->Set(String::NewSymbol("queueSize"), Uint32::New(stats.capacity));
+  result->Set(String::NewSymbol("batches"), Uint32::New(stats.batches));
+  result->Set(String::NewSymbol("written"), Number::New(stats.written));
+  result->Set(String::NewSymbol("synchronous"), Number::New(stats.synchronous));
+  result->Set(String::NewSymbol("shared"), Boolean::New(cache->write_behind->Shared()));
+  result->Set(String::NewSymbol("errors"), Number::New(stats.errors));
+  if (!stats.last_error.empty()) {
+    result->Set(String::NewSymbol("lastError"), String::New(stats.last_error.c_str()));
+  }
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This waits in the thread pool until every tile queued by the
+ * background writer has been written, e.g. before the process exits.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param callback A function that is called once the tiles have been written.
+ * It should have the signature `callback(err)`.
+ */
+Handle<Value> MapCache::FlushWritesAsync(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 1) {
+    THROW_CSTR_ERROR(Error, "usage: cache.flushWrites(callback)");
+  }
+  REQ_FUN_ARG(0, callback);
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->write_behind) {
+    THROW_CSTR_ERROR(Error, "Write behind is not enabled");
+  }
+
+  Baton *baton = new Baton();
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                FlushWritesWork,
+                (uv_after_work_cb) FlushWritesAfter);
+  return Undefined();
+}
+
+/**
+ * @details Log messages below this level are discarded in the thread that
+ * generates them, before they are formatted or passed to the Node/V8 thread.
+ * By default all messages are passed to the logger.  The level can be changed
+ * at any time, affecting requests already in progress.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param level An integer from `mapcache.logLevels`.
+ */
+Handle<Value> MapCache::SetLogLevel(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 1) {
+    THROW_CSTR_ERROR(Error, "usage: cache.setLogLevel(level)");
+  }
+  if (!args[0]->IsUint32()) {
+    THROW_CSTR_ERROR(TypeError, "Argument 0 must be an integer");
+  }
+  uint32_t level = args[0]->Uint32Value();
+  if (level > MAPCACHE_EMERG) {
+    THROW_CSTR_ERROR(RangeError, "The log level is not one of `mapcache.logLevels`");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  cache->log_level = (mapcache_log_level) level;
+
+  return Undefined();
+}
+
+/**
+ * @details This enables a binary log of the requests handled by the cache.
+ * Each request is described by a fixed size record which is queued by the
+ * thread handling the request.  The queued records are periodically passed to
+ * the callback as a single `Buffer`; `mapcache.decodeAccessLog()` decodes
+ * them.  Records are dropped if they are not delivered before the queue
+ * fills.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties `size`
+ * (the number of records that can be queued) and `interval` (the delivery
+ * interval in milliseconds).
+ *
+ * @param callback A function that is called with the records. It should have
+ * the signature `callback(records, dropped)`.
+ */
+Handle<Value> MapCache::EnableAccessLog(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  Local<Function> callback;
+  switch (args.Length()) {
+  case 2:
+    ASSIGN_OBJ_ARG(0, options);
+    ASSIGN_FUN_ARG(1, callback);
+    break;
+  case 1:
+    ASSIGN_FUN_ARG(0, callback);
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableAccessLog([options], callback)");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->access_log) {
+    THROW_CSTR_ERROR(Error, "The access log is already enabled");
+  }
+
+  double size = 4096, interval = 1000;
+  ASSIGN_NUM_OPTION(options, size, size);
+  ASSIGN_NUM_OPTION(options, interval, interval);
+  if (size < 1 || size > 0x1000000 || interval < 1) {
+    THROW_CSTR_ERROR(RangeError, "The access log size or interval is out of range");
+  }
+
+  REQ_FULL_CONFIG(cache, cfg);
+  cache->access_log = new AccessLog(cfg, (uint32_t) size, (uint64_t) interval, callback);
+
+  return Undefined();
+}
+
+/**
+ * @details This attaches the cache to a tile cache in shared memory, backed by
+ * a file which is created if it doesn't exist.  Every `MapCache` instance
+ * attached to the same file, e.g. in each worker of a cluster, shares the
+ * tiles in it: single tile requests are answered from shared memory in the
+ * Node/V8 thread where possible and tiles returned by the cache are added to
+ * it.
+ *
+ * The file should be on a memory backed file system such as `/dev/shm`.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param path The location of the shared cache file.
+ *
+ * @param options [optional] An object with the optional properties `size`
+ * (the size of the file in bytes) and `slotSize` (the maximum size of a
+ * tile).  These are only used when the file is created.
+ */
+Handle<Value> MapCache::AttachSharedCache(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 2:
+    ASSIGN_OBJ_ARG(1, options);
+  case 1:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.attachSharedCache(path, [options])");
+  }
+  REQ_STR_ARG(0, path);
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->shared_cache) {
+    THROW_CSTR_ERROR(Error, "The shared cache is already attached");
+  }
+
+  double size = 256 * 1024 * 1024, slot_size = 64 * 1024;
+  ASSIGN_NUM_OPTION(options, size, size);
+  ASSIGN_NUM_OPTION(options, slotSize, slot_size);
+  if (slot_size < 1 || slot_size > 0x10000000 || size < 1) {
+    THROW_CSTR_ERROR(RangeError, "The shared cache size or slot size is out of range");
+  }
+
+  std::string error;
+  SharedCache *shared_cache = new SharedCache(*path);
+  if (!shared_cache->Attach((uint64_t) size, (uint32_t) slot_size, error)) {
+    delete shared_cache;
+    THROW_CSTR_ERROR(Error, error.c_str());
+  }
+  cache->shared_cache = shared_cache;
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties, with the
+ * counters being shared by every process attached to the cache:
+ *
+ * - `slots`: the number of tiles the cache can hold
+ * - `slotSize`: the maximum size of a tile in bytes
+ * - `hits`: the number of tiles found
+ * - `misses`: the number of tiles not found
+ * - `inserts`: the number of tiles stored
+ */
+Handle<Value> MapCache::SharedCacheStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->shared_cache) {
+    THROW_CSTR_ERROR(Error, "The shared cache is not attached");
+  }
+
+  SharedCache::Stats stats;
+  cache->shared_cache->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("slots"), Number::New(stats.slots));
+  result->Set(String::NewSymbol("slotSize"), Uint32::New(stats.slot_size));
+  result->Set(String::NewSymbol("hits"), Number::New(stats.hits));
+  result->Set(String::NewSymbol("misses"), Number::New(stats.misses));
+  result->Set(String::NewSymbol("inserts"), Number::New(stats.inserts));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details Once enabled, single tile requests for tiles that need rendering
+ * are grouped by the metatile containing the tile.  While a request for a
+ * metatile is being handled, requests for other tiles in it wait in the
+ * Node/V8 thread rather than occupying a thread blocked on the metatile lock.
+ * When the first request completes the waiting requests are dispatched
+ * together and read the tiles rendered by it from the cache.
+ *
+ * Every single tile request is coalesced unless its tile is probably cached:
+ * once an existence filter has been built, requests for tiles it reports as
+ * present are dispatched straight away as they are likely to be answered
+ * from the cache.
+ */
+Handle<Value> MapCache::EnableMetatileCoalescing(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  cache->coalesce_metatiles = true;
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `active`: the number of metatiles currently being requested
+ * - `waiting`: the number of requests waiting for those metatiles
+ * - `coalesced`: the total number of requests that have waited for another
+ *   request for the same metatile
+ * - `bypassed`: the total number of requests dispatched straight away as
+ *   the existence filter reports their tiles as cached
+ */
+Handle<Value> MapCache::MetatileCoalescingStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->coalesce_metatiles) {
+    THROW_CSTR_ERROR(Error, "Metatile coalescing is not enabled");
+  }
+
+  uint32_t waiting = 0;
+  for (std::map<std::string, std::vector<RequestBaton*> >::const_iterator it = cache->metatile_jobs.begin();
+       it != cache->metatile_jobs.end(); ++it) {
+    waiting += it->second.size();
+  }
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("active"), Uint32::New(cache->metatile_jobs.size()));
+  result->Set(String::NewSymbol("waiting"), Uint32::New(waiting));
+  result->Set(String::NewSymbol("coalesced"), Number::New(cache->coalesced));
+  result->Set(String::NewSymbol("bypassed"), Number::New(cache->coalesce_bypassed));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This exports the cached tiles of a tileset to a new MBTiles file.
+ * Tiles are read directly from the cache by a number of threads, so tiles
+ * that aren't cached are skipped rather than rendered, and written by a
+ * single thread in large transactions.  The callback receives an error (if
+ * any) and a summary with the following properties:
+ *
+ * - `tiles`: the number of tiles exported
+ * - `missing`: the number of tiles in the range that weren't cached
+ * - `unique`: the number of distinct tiles stored
+ * - `bytes`: the total size of the exported tiles
+ * - `duration`: the time taken in milliseconds
+ * - `tilesPerSecond`: the export throughput
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options An object with the properties `tileset` (the tileset name)
+ * and the optional properties `grid` (the grid name, defaulting to the first
+ * grid of the tileset), `zoomRange` (an array of the minimum and maximum zoom
+ * levels), `extent` (an array of `minx, miny, maxx, maxy` in the grid SRS),
+ * `dedupe` (set to store identical tiles once), `threads` (the number of
+ * reader threads) and `batchSize` (the number of tiles per transaction).
+ *
+ * @param path The location of the MBTiles file, which must not exist.
+ *
+ * @param callback The function called once the export has finished.
+ */
+Handle<Value> MapCache::ExportAsync(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 3) {
+    THROW_CSTR_ERROR(Error, "usage: cache.export(options, path, callback)");
+  }
+  REQ_OBJ_ARG(0, options);
+  REQ_STR_ARG(1, path);
+  REQ_FUN_ARG(2, callback);
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  REQ_FULL_CONFIG(cache, cfg);
+  TileExporter::Options export_options;
+  export_options.cfg = cfg;
+
+  Handle<Value> thrown = ParseTileSelection(export_options.cfg, options,
+                                            &export_options.tileset, &export_options.grid_link,
+                                            &export_options.minz, &export_options.maxz,
+                                            &export_options.has_extent, &export_options.extent);
+  if (!thrown.IsEmpty()) {
+    return thrown;
+  }
+
+  // the remaining options
+  export_options.dedupe = options->Get(String::NewSymbol("dedupe"))->BooleanValue();
+  double threads = 4, batch_size = 10000;
+  ASSIGN_NUM_OPTION(options, threads, threads);
+  ASSIGN_NUM_OPTION(options, batchSize, batch_size);
+  if (threads < 1 || threads > 64 || batch_size < 1 || batch_size > 0xffffffff) {
+    THROW_CSTR_ERROR(RangeError, "The export threads or batch size is out of range");
+  }
+  export_options.threads = (unsigned int) threads;
+  export_options.batch_size = (uint32_t) batch_size;
+
+  ExportBaton *baton = new ExportBaton();
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+  baton->exporter = new TileExporter(export_options, *path, CreateWriteContext);
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                ExportWork,
+                (uv_after_work_cb) ExportAfter);
+  return Undefined();
+}
+
+/**
+ * @details This deletes the cached tiles of a tileset within a zoom range and
+ * extent.  The rows of the range are divided between a number of threads
+ * which delete the tiles from the cache of the tileset, discarding any
+ * queued writes of them, and from the shared memory cache.  The tiles are
+ * removed from the blank tile index before the deletion starts, and
+ * responses to requests received before or during the invalidation are not
+ * added to the memory caches.  Tiles cannot be removed from the existence
+ * filter: invalidated tiles are looked up in the cache as normal.
+ *
+ * The callback receives an error (if any) and a summary with the following
+ * properties:
+ *
+ * - `tiles`: the number of tile locations in the range
+ * - `errors`: the number of tiles that could not be deleted
+ * - `duration`: the time taken in milliseconds
+ * - `tilesPerSecond`: the invalidation throughput
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options An object with the property `tileset` (the tileset name)
+ * and the optional properties `grid`, `zoomRange` and `extent` as for
+ * `cache.export()`, `dimensions` (an object mapping dimension names to the
+ * values of the tiles to invalidate, defaulting to the dimension defaults)
+ * and `threads` (the number of deleting threads).
+ *
+ * @param progress An optional function called periodically with the number
+ * of tiles processed and the total number of tiles.
+ *
+ * @param callback The function called once the invalidation has finished.
+ */
+Handle<Value> MapCache::InvalidateAsync(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 2 && args.Length() != 3) {
+    THROW_CSTR_ERROR(Error, "usage: cache.invalidate(options, [progress], callback)");
+  }
+  REQ_OBJ_ARG(0, options);
+  Local<Function> progress, callback;
+  if (args.Length() == 3) {
+    ASSIGN_FUN_ARG(1, progress);
+    ASSIGN_FUN_ARG(2, callback);
+  } else {
+    ASSIGN_FUN_ARG(1, callback);
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  REQ_FULL_CONFIG(cache, cfg);
+  TileInvalidator::Options invalidate_options;
+  invalidate_options.cfg = cfg;
+
+  Handle<Value> thrown = ParseTileSelection(invalidate_options.cfg, options,
+                                            &invalidate_options.tileset, &invalidate_options.grid_link,
+                                            &invalidate_options.minz, &invalidate_options.maxz,
+                                            &invalidate_options.has_extent, &invalidate_options.extent);
+  if (!thrown.IsEmpty()) {
+    return thrown;
+  }
+
+  // the dimensions
+  Local<Value> dimensions = options->Get(String::NewSymbol("dimensions"));
+  if (!dimensions->IsUndefined()) {
+    if (!dimensions->IsObject()) {
+      THROW_CSTR_ERROR(TypeError, "Option `dimensions` must be an object");
+    }
+    Local<Object> values = dimensions->ToObject();
+    Local<Array> names = values->GetOwnPropertyNames();
+    for (uint32_t i = 0; i < names->Length(); i++) {
+      String::Utf8Value name(names->Get(i));
+      bool found = false;
+      for (int j = 0; invalidate_options.tileset->dimensions && j < invalidate_options.tileset->dimensions->nelts; j++) {
+        if (!strcmp(APR_ARRAY_IDX(invalidate_options.tileset->dimensions, j, mapcache_dimension*)->name, *name)) {
+          found = true;
+          break;
         }
       }
+      if (!found) {
+        THROW_CSTR_ERROR(Error, "The dimension is not used by the tileset");
+      }
+      Local<Value> value = values->Get(names->Get(i));
+      if (!value->IsString()) {
+        THROW_CSTR_ERROR(TypeError, "Dimension values must be strings");
+      }
+      invalidate_options.dimensions.push_back(std::make_pair(std::string(*name), std::string(*String::Utf8Value(value))));
     }
-    result->Set(headers_symbol, headers);
+  }
+
+  double threads = 4;
+  ASSIGN_NUM_OPTION(options, threads, threads);
+  if (threads < 1 || threads > 64) {
+    THROW_CSTR_ERROR(RangeError, "The invalidation threads are out of range");
+  }
+  invalidate_options.threads = (unsigned int) threads;
+
+  std::string layer = std::string(invalidate_options.tileset->name) + "@" + invalidate_options.grid_link->grid->name;
+  invalidate_options.shared_cache = cache->shared_cache;
+  invalidate_options.shared_prefix = cache->SharedPrefix(layer);
+
+  InvalidateBaton *baton = new InvalidateBaton();
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+  baton->invalidator = new TileInvalidator(invalidate_options, CreateWriteContext);
+  baton->timer.data = baton;
+
+  // the source of the tiles may answer queries differently
+  if (cache->response_cache && invalidate_options.tileset->source) {
+    cache->response_cache->Purge(invalidate_options.tileset->source->name);
+  }
+
+  // the variants of the tiles are transcoded again when next requested
+  if (cache->variant_cache) {
+    cache->variant_cache->Purge(invalidate_options.tileset->name);
+  }
+
+  // remove the tiles from the blank tile index up front
+  if (cache->blank_index) {
+    const TileRange &range = baton->invalidator->Range();
+    for (int z = invalidate_options.minz; z <= invalidate_options.maxz; z++) {
+      const mapcache_extent_i &limits = range.Limits(z);
+      cache->blank_index->RemoveRange(layer, z, limits.minx, limits.miny, limits.maxx, limits.maxy);
+    }
+  }
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+  cache->invalidations_active++;
+
+  uv_timer_init(uv_default_loop(), &baton->timer);
+  if (!progress.IsEmpty()) {
+    baton->progress = Persistent<Function>::New(progress);
+    uv_timer_start(&baton->timer, InvalidateProgress,
+                   NODE_MAPCACHE_PROGRESS_INTERVAL, NODE_MAPCACHE_PROGRESS_INTERVAL);
+  }
+
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                InvalidateWork,
+                (uv_after_work_cb) InvalidateAfter);
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `file`: the configuration file, if known
+ * - `memory`: the estimated memory allocated while loading the
+ *   configuration in bytes
+ * - `loadTime`: the time taken to load the configuration in milliseconds
+ *
+ * A lazy configuration also has the following properties, `memory` and
+ * `loadTime` covering only indexing the file:
+ *
+ * - `lazy`: `true`
+ * - `loaded`: whether the full configuration has been set up
+ * - `fullLoadTime`: the time taken to set up the full configuration in
+ *   milliseconds, if it has been
+ * - `tilesets`: an object keyed on tileset name, each value having the
+ *   properties `initialised` and, if it is, `initTime` in milliseconds
+ */
+Handle<Value> MapCache::ConfigStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  const char *file = cache->ConfigFile();
+
+  Local<Object> result = Object::New();
+  if (*file) {
+    result->Set(String::NewSymbol("file"), String::New(file));
+  }
+  result->Set(String::NewSymbol("memory"), Number::New(cache->config->memory));
+  result->Set(String::NewSymbol("loadTime"), Number::New(cache->config->load_time / 1e6));
+
+  if (cache->config->lazy) {
+    std::vector<LazyConfig::EntryStats> tilesets;
+    LazyConfig::EntryStats full;
+    cache->config->lazy->GetStats(tilesets, full);
+
+    Local<Object> states = Object::New();
+    for (std::vector<LazyConfig::EntryStats>::iterator it = tilesets.begin(); it != tilesets.end(); ++it) {
+      Local<Object> state = Object::New();
+      state->Set(String::NewSymbol("initialised"), Boolean::New(it->initialised));
+      if (it->initialised) {
+        state->Set(String::NewSymbol("initTime"), Number::New(it->init_time / 1e6));
+      }
+      states->Set(String::New(it->name.c_str()), state);
+    }
+    result->Set(String::NewSymbol("lazy"), Boolean::New(true));
+    result->Set(String::NewSymbol("loaded"), Boolean::New(full.initialised));
+    if (full.initialised) {
+      result->Set(String::NewSymbol("fullLoadTime"), Number::New(full.init_time / 1e6));
+    }
+    result->Set(String::NewSymbol("tilesets"), states);
+  }
+
+  return scope.Close(result);
+}
+
+/**
+ * @details The full configuration of a lazy instance is only available once
+ * it has been loaded by `cache.loadConfig()` or a request that doesn't name a
+ * single tileset: it is never set up here as that would block the event loop.
+ *
+ * @param error Set to the reason the configuration isn't available.
+ *
+ * @return The configuration, or `NULL` on error.
+ */
+mapcache_cfg* MapCache::Config(std::string &error) {
+  if (!config->cfg && config->lazy) {
+    config->cfg = config->lazy->Loaded();
+  }
+  if (!config->cfg) {
+    error = "The full configuration is not loaded: use cache.loadConfig() first";
+  }
+  return config->cfg;
+}
+
+/**
+ * @details The features acting on every tileset, such as the existence filter
+ * or invalidation, need the full configuration.  For a lazy instance this
+ * sets it up in the thread pool so that it can be loaded without blocking
+ * requests; for other instances the callback is simply called.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param callback A function that is called on error or when the
+ * configuration has been loaded. It should have the signature `callback(err)`.
+ */
+Handle<Value> MapCache::LoadConfigAsync(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 1) {
+    THROW_CSTR_ERROR(Error, "usage: cache.loadConfig(callback)");
+  }
+  REQ_FUN_ARG(0, callback);
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  LoadConfigBaton *baton = new LoadConfigBaton();
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+  baton->cfg = cache->config->cfg;
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                LoadConfigWork,
+                (uv_after_work_cb) LoadConfigAfter);
+  return Undefined();
+}
+
+/**
+ * @details This runs in the thread pool: concurrent requests for tilesets
+ * continue to be served while the configuration is set up.
+ *
+ * @param req The asynchronous request.
+ */
+void MapCache::LoadConfigWork(uv_work_t *req) {
+  LoadConfigBaton *baton = static_cast<LoadConfigBaton*>(req->data);
+  if (!baton->cfg) {
+    baton->cfg = baton->cache->config->lazy->Full(baton->error);
+  }
+}
+
+/**
+ * @param req The asynchronous request.
+ */
+void MapCache::LoadConfigAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  LoadConfigBaton *baton = static_cast<LoadConfigBaton*>(req->data);
+  MapCache *cache = baton->cache;
+  Handle<Value> argv[1];
+
+  if (baton->cfg) {
+    cache->config->cfg = baton->cfg;
+    argv[0] = Undefined();
+  } else {
+    argv[0] = Exception::Error(String::New(baton->error.c_str()));
+  }
+
+  // pass the results to the user specified callback function
+  TryCatch try_catch;
+  baton->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+
+  // clean up
+  baton->callback.Dispose();
+  cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton;
+}
+
+/**
+ * @details Before a request is handled by the mapcache core the memory needed
+ * for its images is estimated: a request needing more than the limit fails
+ * with a 400 response.  The limit applies to the estimate rather than to the
+ * memory actually allocated by a request.  The limit can be changed at any
+ * time, affecting requests not yet dispatched.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param bytes The maximum memory in bytes, or 0 for no limit.
+ */
+Handle<Value> MapCache::SetRequestMemoryLimit(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 1) {
+    THROW_CSTR_ERROR(Error, "usage: cache.setRequestMemoryLimit(bytes)");
+  }
+  if (!args[0]->IsNumber() || args[0]->NumberValue() < 0) {
+    THROW_CSTR_ERROR(TypeError, "Argument 0 must be a positive number");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  cache->memory_meter.limit = (size_t) args[0]->NumberValue();
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties, all in bytes
+ * apart from the count.  The memory of requests is estimated from the size of
+ * their images rather than measured from their pools:
+ *
+ * - `config`: the estimated memory of the configuration
+ * - `requests`: the estimated memory reserved by requests in progress
+ * - `total`: the sum of `config` and `requests`
+ * - `peak`: the greatest value of `total`
+ * - `limit`: the maximum estimated memory of a single request, or 0
+ * - `rejected`: the number of requests whose estimate exceeded the limit
+ */
+Handle<Value> MapCache::MemoryStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  MemoryMeter *meter = &(cache->memory_meter);
+  size_t config = cache->config->memory;
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("config"), Number::New(config));
+  result->Set(String::NewSymbol("requests"), Number::New(meter->requests));
+  result->Set(String::NewSymbol("total"), Number::New(config + meter->requests));
+  result->Set(String::NewSymbol("peak"), Number::New(config + meter->peak));
+  result->Set(String::NewSymbol("limit"), Number::New(meter->limit));
+  result->Set(String::NewSymbol("rejected"), Number::New(meter->rejected));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details Once enabled, successful responses with identical bodies share a
+ * single `Buffer` rather than each having a copy, which reduces the memory
+ * used by javascript code holding many responses such as an in-process tile
+ * cache.  Bodies are hashed in the thread pool and compared in full before
+ * being shared.  Shared buffers must not be modified.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional property `maxSize`
+ * (the largest body shared in bytes).
+ */
+Handle<Value> MapCache::EnableBodySharing(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableBodySharing([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->body_store) {
+    THROW_CSTR_ERROR(Error, "Body sharing is already enabled");
+  }
+
+  double max_size = 64 * 1024;
+  ASSIGN_NUM_OPTION(options, maxSize, max_size);
+  if (max_size < 1) {
+    THROW_CSTR_ERROR(RangeError, "The maximum body size must be positive");
+  }
+
+  cache->body_store = new BodyStore((size_t) max_size);
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `bodies`: the number of distinct bodies currently shared
+ * - `bytes`: the total size of those bodies
+ * - `hits`: the number of responses given a body that was already held
+ * - `misses`: the number of responses given a new body
+ * - `saved`: the total size of the bodies that were shared rather than
+ *   copied, in bytes
+ */
+Handle<Value> MapCache::BodySharingStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->body_store) {
+    THROW_CSTR_ERROR(Error, "Body sharing is not enabled");
+  }
+
+  BodyStore::Stats stats;
+  cache->body_store->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("bodies"), Number::New(stats.bodies));
+  result->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+  result->Set(String::NewSymbol("hits"), Number::New(stats.hits));
+  result->Set(String::NewSymbol("misses"), Number::New(stats.misses));
+  result->Set(String::NewSymbol("saved"), Number::New(stats.saved));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details Once enabled, WMS GetMap requests using the assemble strategy
+ * fetch and decode their tiles in parallel and then assemble the map in
+ * horizontal bands in parallel.  The work is shared between the thread
+ * handling the request and a set of helper threads belonging to the
+ * instance.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties
+ * `threads` (the number of helper threads, defaulting to the size of the
+ * libuv thread pool), `bandHeight` (the number of rows in each band) and
+ * `simd` (resample and merge bands using the vectorised pixel kernels).
+ */
+Handle<Value> MapCache::EnableParallelAssembly(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableParallelAssembly([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->map_assembler) {
+    THROW_CSTR_ERROR(Error, "Parallel assembly is already enabled");
+  }
+
+  const char *threads = getenv("UV_THREADPOOL_SIZE");
+  double helpers = (threads && atoi(threads) > 0) ? atoi(threads) : 4, band_height = 256;
+  ASSIGN_NUM_OPTION(options, threads, helpers);
+  ASSIGN_NUM_OPTION(options, bandHeight, band_height);
+  if (helpers < 1 || helpers > 256 || band_height < 1 || band_height > 0xffffffff) {
+    THROW_CSTR_ERROR(RangeError, "The thread count or band height is out of range");
+  }
+
+  bool simd = !options.IsEmpty() && options->Get(String::NewSymbol("simd"))->BooleanValue();
+
+  cache->map_assembler = new MapAssembler((unsigned int) helpers, (unsigned int) band_height, simd);
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `threads`: the number of helper threads
+ * - `maps`: the number of maps assembled
+ * - `tiles`: the number of tiles fetched for those maps
+ * - `bands`: the number of bands assembled
+ * - `kernels`: the pixel kernels in use (`scalar`, `sse2` or `avx2`), if
+ *   the `simd` option is set
+ */
+Handle<Value> MapCache::ParallelAssemblyStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->map_assembler) {
+    THROW_CSTR_ERROR(Error, "Parallel assembly is not enabled");
+  }
+
+  MapAssembler::Stats stats;
+  cache->map_assembler->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("threads"), Uint32::New(cache->map_assembler->threads));
+  result->Set(String::NewSymbol("maps"), Number::New(stats.maps));
+  result->Set(String::NewSymbol("tiles"), Number::New(stats.tiles));
+  result->Set(String::NewSymbol("bands"), Number::New(stats.bands));
+  if (cache->map_assembler->simd) {
+    result->Set(String::NewSymbol("kernels"),
+                String::New(PixelKernels::LevelName(PixelKernels::Selected())));
+  }
+
+  return scope.Close(result);
+}
+
+/**
+ * @details Once enabled, successful responses to proxied requests and WMS
+ * `GetFeatureInfo` queries are kept in memory for a time to live and
+ * returned to identical requests without querying the source.  Requests are
+ * identified by their parameters as parsed by mapcache, so differences in
+ * the case or order of query string parameters don't matter.  The responses
+ * from the source of a tileset are discarded when the tileset is invalidated.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties
+ * `maxSize` (the maximum total size of the responses in bytes, defaulting to
+ * 16MiB), `ttl` (the time to live of responses in seconds, defaulting to 60)
+ * and `sources` (an object mapping `GetFeatureInfo` source names and proxy
+ * forwarding rule names to their own time to live, with zero disabling
+ * caching).
+ */
+Handle<Value> MapCache::EnableResponseCache(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableResponseCache([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->response_cache) {
+    THROW_CSTR_ERROR(Error, "The response cache is already enabled");
+  }
+
+  double max_size = 16 * 1024 * 1024, ttl = 60;
+  ASSIGN_NUM_OPTION(options, maxSize, max_size);
+  ASSIGN_NUM_OPTION(options, ttl, ttl);
+  if (max_size < 1 || ttl < 0 || ttl > 0xffffffff) {
+    THROW_CSTR_ERROR(RangeError, "The response cache size or time to live is out of range");
+  }
+
+  ResponseCache *response_cache = new ResponseCache((uint64_t) max_size, (uint32_t) ttl);
+
+  // the time to live of each source
+  Local<Value> sources = (options.IsEmpty()) ? Local<Value>() : options->Get(String::NewSymbol("sources"));
+  if (!sources.IsEmpty() && !sources->IsUndefined()) {
+    if (!sources->IsObject()) {
+      delete response_cache;
+      THROW_CSTR_ERROR(TypeError, "Option `sources` must be an object");
+    }
+    Local<Object> ttls = sources->ToObject();
+    Local<Array> names = ttls->GetOwnPropertyNames();
+    for (uint32_t i = 0; i < names->Length(); i++) {
+      Local<Value> value = ttls->Get(names->Get(i));
+      if (!value->IsNumber() || value->NumberValue() < 0 || value->NumberValue() > 0xffffffff) {
+        delete response_cache;
+        THROW_CSTR_ERROR(RangeError, "Source times to live must be a number of seconds");
+      }
+      response_cache->SetSourceTtl(*String::Utf8Value(names->Get(i)), (uint32_t) value->NumberValue());
+    }
+  }
+
+  cache->response_cache = response_cache;
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `responses`: the number of responses held
+ * - `bytes`: the total size of the responses held
+ * - `hits`: the number of requests answered from the cache
+ * - `misses`: the number of cacheable requests that queried the source
+ * - `evicted`: the number of responses evicted to stay within `maxSize`
+ * - `expired`: the number of responses discarded after their time to live
+ */
+Handle<Value> MapCache::ResponseCacheStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->response_cache) {
+    THROW_CSTR_ERROR(Error, "The response cache is not enabled");
+  }
+
+  ResponseCache::Stats stats;
+  cache->response_cache->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("responses"), Uint32::New(stats.responses));
+  result->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+  result->Set(String::NewSymbol("hits"), Number::New(stats.hits));
+  result->Set(String::NewSymbol("misses"), Number::New(stats.misses));
+  result->Set(String::NewSymbol("evicted"), Number::New(stats.evicted));
+  result->Set(String::NewSymbol("expired"), Number::New(stats.expired));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This identifies requests for a single tile in the same way as the
+ * blank tile index and shared memory cache, without querying the cache.  The
+ * returned object has the properties `tileset`, `grid`, `z`, `x` and `y`,
+ * along with `metatile`, a string identifying the metatile containing the
+ * tile.  `null` is returned for any other request.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param pathInfo A string with the URL `PATH_INFO` data.
+ *
+ * @param queryString A string with the URL `QUERY_STRING` data.
+ */
+Handle<Value> MapCache::GetTileKey(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 2) {
+    THROW_CSTR_ERROR(Error, "usage: cache.tileKey(pathInfo, queryString)");
+  }
+  REQ_STR_ARG(0, pathInfo);
+  REQ_STR_ARG(1, queryString);
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  TileKey key;
+  if (!cache->IdentifyTile(*pathInfo, *queryString, &key)) {
+    return scope.Close(Null());
+  }
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("tileset"), String::New(key.tileset->name));
+  result->Set(String::NewSymbol("grid"), String::New(key.grid_link->grid->name));
+  result->Set(String::NewSymbol("z"), Integer::New(key.z));
+  result->Set(String::NewSymbol("x"), Integer::New(key.x));
+  result->Set(String::NewSymbol("y"), Integer::New(key.y));
+  result->Set(String::NewSymbol("metatile"), String::New(MetatileKey(LayerName(key), key).c_str()));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This identifies the tileset named by a tile or map request from
+ * the URL alone, so a lazy configuration doesn't need to set the tileset up.
+ * `null` is returned for requests naming no tileset or several.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param pathInfo A string with the URL `PATH_INFO` data.
+ *
+ * @param queryString A string with the URL `QUERY_STRING` data.
+ */
+Handle<Value> MapCache::GetTilesetName(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 2) {
+    THROW_CSTR_ERROR(Error, "usage: cache.tilesetFor(pathInfo, queryString)");
+  }
+  REQ_STR_ARG(0, pathInfo);
+  REQ_STR_ARG(1, queryString);
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  std::string name;
+  if (!cache->IdentifyTileset(*pathInfo, *queryString, name)) {
+    return scope.Close(Null());
+  }
+
+  return scope.Close(String::New(name.c_str()));
+}
+
+/**
+ * @details This enables a record of the most requested tiles, which is
+ * loaded from a file if it exists.  The record is written back to the file
+ * periodically, when the process exits normally and when the instance is
+ * garbage collected.  `warmup()` prefetches the tiles in the record.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param path A string representing the file path of the record.
+ *
+ * @param options [optional] An object with the optional properties `size`
+ * (the number of tiles recorded, defaulting to 10000) and `interval` (the
+ * time between writes in milliseconds, defaulting to one minute).
+ */
+Handle<Value> MapCache::EnableHotTiles(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 2:
+    ASSIGN_OBJ_ARG(1, options);
+  case 1:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableHotTiles(path, [options])");
+  }
+  REQ_STR_ARG(0, path);
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->hot_tiles) {
+    THROW_CSTR_ERROR(Error, "The hot tile record is already enabled");
+  }
+
+  double size = 10000, interval = 60000;
+  ASSIGN_NUM_OPTION(options, size, size);
+  ASSIGN_NUM_OPTION(options, interval, interval);
+  if (size < 1 || size > 0xffffffff || interval < 1) {
+    THROW_CSTR_ERROR(RangeError, "The hot tile record size or interval is out of range");
+  }
+
+  std::string error;
+  HotTiles *hot_tiles = new HotTiles(*path, (size_t) size);
+  if (!hot_tiles->Load(error)) {
+    hot_tiles->Close();
+    return ThrowException(Exception::Error(String::New(error.c_str())));
+  }
+  hot_tiles->Start((uint64_t) interval);
+
+  cache->hot_tiles = hot_tiles;
+  return Undefined();
+}
+
+/**
+ * @details This writes the record of the most requested tiles to the file
+ * it was loaded from.  With a callback the record is written asynchronously;
+ * without one it is written before returning, which suits handlers of the
+ * process `exit` event.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param callback [optional] A function that is called on error or when the
+ * record has been written. It should have the signature `callback(err)`.
+ */
+Handle<Value> MapCache::SaveHotTilesAsync(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Function> callback;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_FUN_ARG(0, callback);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.saveHotTiles([callback])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->hot_tiles) {
+    THROW_CSTR_ERROR(Error, "The hot tile record is not enabled");
+  }
+
+  if (callback.IsEmpty()) {
+    std::string data, error;
+    cache->hot_tiles->Serialise(data);
+    if (!HotTiles::Write(cache->hot_tiles->path, data, error)) {
+      return ThrowException(Exception::Error(String::New(error.c_str())));
+    }
+    return Undefined();
+  }
+
+  SaveBaton *baton = new SaveBaton();
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+  baton->path = cache->hot_tiles->path;
+  cache->hot_tiles->Serialise(baton->data);
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+
+  // the outcome is returned in the same way as for the blank tile index
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                SaveHotTilesWork,
+                (uv_after_work_cb) SaveBlankIndexAfter);
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `tiles`: the number of tiles in the record
+ * - `size`: the maximum number of tiles in the record
+ * - `recorded`: the number of tile requests counted
+ * - `saves`: the number of periodic writes of the record
+ */
+Handle<Value> MapCache::HotTilesStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->hot_tiles) {
+    THROW_CSTR_ERROR(Error, "The hot tile record is not enabled");
+  }
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("tiles"), Number::New(cache->hot_tiles->Size()));
+  result->Set(String::NewSymbol("size"), Number::New(cache->hot_tiles->capacity));
+  result->Set(String::NewSymbol("recorded"), Number::New(cache->hot_tiles->recorded));
+  result->Set(String::NewSymbol("saves"), Number::New(cache->hot_tiles->saves));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This prefetches the most requested tiles in the hot tile record
+ * using a set of threads, rendering any that aren't cached.  A server can
+ * wait for the warmup to finish before accepting requests, or warm up while
+ * serving requests with `lowPriority` set.  Tiles of layers that are no
+ * longer in the configuration are skipped.
+ *
+ * The callback receives an error (if any) and an object with the properties
+ * `tiles` (the number of tiles prefetched), `errors` (the number that could
+ * not be fetched), `duration` (in milliseconds) and `tilesPerSecond`.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties `limit`
+ * (the maximum number of tiles to prefetch, defaulting to the whole record),
+ * `threads` (defaulting to 4) and `lowPriority` (set to run the threads at a
+ * lower scheduling priority on Linux).
+ *
+ * @param callback A function that is called on error or when the warmup has
+ * finished. It should have the signature `callback(err, stats)`.
+ */
+Handle<Value> MapCache::WarmupAsync(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  Local<Function> callback;
+  switch (args.Length()) {
+  case 2:
+    ASSIGN_OBJ_ARG(0, options);
+    ASSIGN_FUN_ARG(1, callback);
+    break;
+  case 1:
+    ASSIGN_FUN_ARG(0, callback);
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.warmup([options], callback)");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->hot_tiles) {
+    THROW_CSTR_ERROR(Error, "The hot tile record is not enabled");
+  }
+
+  double limit = cache->hot_tiles->capacity, threads = 4;
+  ASSIGN_NUM_OPTION(options, limit, limit);
+  ASSIGN_NUM_OPTION(options, threads, threads);
+  if (limit < 0 || threads < 1 || threads > 64) {
+    THROW_CSTR_ERROR(RangeError, "The warmup limit or threads are out of range");
+  }
+  bool low_priority = !options.IsEmpty() && options->Get(String::NewSymbol("lowPriority"))->BooleanValue();
+
+  // resolve the recorded layers against the configuration
+  REQ_FULL_CONFIG(cache, cfg);
+  std::vector<HotTiles::Tile> hottest;
+  std::vector<TileWarmer::Tile> tiles;
+  cache->hot_tiles->Hottest((size_t) limit, hottest);
+  for (std::vector<HotTiles::Tile>::iterator it = hottest.begin(); it != hottest.end(); ++it) {
+    size_t at = it->layer.rfind('@');
+    if (at == std::string::npos) {
+      continue;
+    }
+    mapcache_tileset *tileset = mapcache_configuration_get_tileset(cfg, it->layer.substr(0, at).c_str());
+    for (int i = 0; tileset && i < tileset->grid_links->nelts; i++) {
+      mapcache_grid_link *grid_link = APR_ARRAY_IDX(tileset->grid_links, i, mapcache_grid_link*);
+      if (it->layer.compare(at + 1, std::string::npos, grid_link->grid->name) == 0) {
+        TileWarmer::Tile tile = { tileset, grid_link, it->x, it->y, it->z };
+        tiles.push_back(tile);
+        break;
+      }
+    }
+  }
+
+  WarmupBaton *baton = new WarmupBaton();
+  baton->request.data = baton;
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+  baton->warmer = new TileWarmer(cfg, tiles, (unsigned int) threads, low_priority, CreateWriteContext);
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+
+  uv_queue_work(uv_default_loop(),
+                &baton->request,
+                WarmupWork,
+                (uv_after_work_cb) WarmupAfter);
+  return Undefined();
+}
+
+/**
+ * @details Once enabled, `get()` can be asked to transcode a single tile into
+ * another image format in the configuration, such as a lower quality JPEG for
+ * clients on slow links.  Tiles are transcoded in the thread pool by the
+ * mapcache core and the variants kept in memory, and optionally on disk,
+ * so each is only transcoded once.  A variant is replaced once its original
+ * tile changes, and the variants of a tileset are discarded from memory when
+ * it is invalidated.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties `maxSize`
+ * (the maximum total size of the variants in memory in bytes, defaulting to
+ * 64MiB) and `directory` (a directory to also store the variants in).
+ */
+Handle<Value> MapCache::EnableFormatVariants(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableFormatVariants([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->variant_cache) {
+    THROW_CSTR_ERROR(Error, "Format variants are already enabled");
+  }
+
+  double max_size = 64 * 1024 * 1024;
+  ASSIGN_NUM_OPTION(options, maxSize, max_size);
+  if (max_size < 1) {
+    THROW_CSTR_ERROR(RangeError, "The format variant cache size is out of range");
+  }
+
+  std::string directory;
+  Local<Value> directory_option = (options.IsEmpty()) ? Local<Value>() : options->Get(String::NewSymbol("directory"));
+  if (!directory_option.IsEmpty() && !directory_option->IsUndefined()) {
+    if (!directory_option->IsString()) {
+      THROW_CSTR_ERROR(TypeError, "Option `directory` must be a string");
+    }
+    directory = *String::Utf8Value(directory_option);
+    while (directory.size() > 1 && directory[directory.size() - 1] == '/') {
+      directory.erase(directory.size() - 1);
+    }
+  }
+
+  cache->variant_cache = new VariantCache((uint64_t) max_size, directory);
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `variants`: the number of variants in memory
+ * - `bytes`: the total size of the variants in memory
+ * - `maxSize`: the maximum total size of the variants in memory
+ * - `hits`: the number of variants returned from memory
+ * - `diskHits`: the number of variants read from disk
+ * - `transcoded`: the number of tiles transcoded
+ * - `errors`: the number of tiles that could not be transcoded
+ * - `evicted`: the number of variants evicted from memory
+ */
+Handle<Value> MapCache::FormatVariantStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->variant_cache) {
+    THROW_CSTR_ERROR(Error, "Format variants are not enabled");
+  }
+
+  VariantCache::Stats stats;
+  cache->variant_cache->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("variants"), Uint32::New(stats.variants));
+  result->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+  result->Set(String::NewSymbol("maxSize"), Number::New(cache->variant_cache->max_size));
+  result->Set(String::NewSymbol("hits"), Number::New(stats.hits));
+  result->Set(String::NewSymbol("diskHits"), Number::New(stats.disk_hits));
+  result->Set(String::NewSymbol("transcoded"), Number::New(stats.transcoded));
+  result->Set(String::NewSymbol("errors"), Number::New(stats.errors));
+  result->Set(String::NewSymbol("evicted"), Number::New(stats.evicted));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This starts a low priority thread that repeatedly walks the
+ * tileset directories of the disk caches using the default `tilecache`
+ * layout, removing tiles that have expired, that have not been used for
+ * `maxAge` seconds or that are the least recently used once a cache exceeds
+ * `maxSize` bytes.  Tile requests handled by the instance are recorded as
+ * uses; other tiles are aged by when they were written.  Tiles with an
+ * `<auto_expire>` time are always removed once they have expired.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties `rate`
+ * (the maximum number of files examined a second, defaulting to 1000),
+ * `interval` (the milliseconds between the start of each pass, defaulting to
+ * an hour), `maxAge` (the seconds after which unused tiles are removed),
+ * `maxSize` (the maximum number of bytes in each cache) and `records` (the
+ * maximum number of tiles whose use is recorded, defaulting to 1000000).
+ */
+Handle<Value> MapCache::EnableDiskSweeper(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableDiskSweeper([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->disk_sweeper) {
+    THROW_CSTR_ERROR(Error, "The disk sweeper is already enabled");
+  }
+
+  double rate = 1000, interval = 3600000, max_age = 0, max_size = 0, records = 1000000;
+  ASSIGN_NUM_OPTION(options, rate, rate);
+  ASSIGN_NUM_OPTION(options, interval, interval);
+  ASSIGN_NUM_OPTION(options, maxAge, max_age);
+  ASSIGN_NUM_OPTION(options, maxSize, max_size);
+  ASSIGN_NUM_OPTION(options, records, records);
+  if (rate < 1 || rate > 0xffffffff || interval < 1 || max_age < 0 || max_size < 0
+      || records < 1 || records > 0xffffffff) {
+    THROW_CSTR_ERROR(RangeError, "The disk sweeper rate, interval or limits are out of range");
+  }
+
+  DiskSweeper::Options sweeper_options;
+  sweeper_options.rate = (uint32_t) rate;
+  sweeper_options.interval = (uint64_t) interval;
+  sweeper_options.max_age = (uint64_t) max_age;
+  sweeper_options.max_size = (uint64_t) max_size;
+  sweeper_options.records = (uint32_t) records;
+
+  REQ_FULL_CONFIG(cache, cfg);
+  std::string error;
+  DiskSweeper *disk_sweeper = new DiskSweeper(cfg, sweeper_options);
+  if (!disk_sweeper->Start(error)) {
+    delete disk_sweeper;
+    THROW_CSTR_ERROR(Error, error.c_str());
+  }
+  cache->disk_sweeper = disk_sweeper;
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `passes`: the number of completed passes over the caches
+ * - `running`: whether a pass is in progress
+ * - `cache`: the name of the cache being swept, if any
+ * - `pass`: the `scanned`, `removed` and `reclaimed` counts of the current
+ *   or last pass
+ * - `passTime`: the duration of the last completed pass in milliseconds
+ * - `scanned`: the number of tile files examined
+ * - `removed`: the number of tiles removed
+ * - `reclaimed`: the number of bytes reclaimed
+ * - `expired`, `idle` and `evicted`: the tiles removed as they had expired,
+ *   had not been used for `maxAge` or exceeded `maxSize`
+ * - `records`: the number of tiles whose use is recorded
+ * - `dropped`: the number of uses not recorded as the record was full
+ * - `errors`: the number of files that could not be examined or removed
+ * - `lastError`: the message from the last failure, if any
+ * - `caches`: the `files` and `bytes` kept in each cache by its last pass,
+ *   keyed on cache name
+ */
+Handle<Value> MapCache::DiskSweeperStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->disk_sweeper) {
+    THROW_CSTR_ERROR(Error, "The disk sweeper is not enabled");
+  }
+
+  DiskSweeper::Stats stats;
+  cache->disk_sweeper->GetStats(stats);
+
+  Local<Object> pass = Object::New();
+  pass->Set(String::NewSymbol("scanned"), Number::New(stats.pass_scanned));
+  pass->Set(String::NewSymbol("removed"), Number::New(stats.pass_removed));
+  pass->Set(String::NewSymbol("reclaimed"), Number::New(stats.pass_reclaimed));
+
+  Local<Object> caches = Object::New();
+  for (std::map<std::string, DiskSweeper::Usage>::const_iterator it = stats.caches.begin(); it != stats.caches.end(); ++it) {
+    Local<Object> usage = Object::New();
+    usage->Set(String::NewSymbol("files"), Number::New(it->second.files));
+    usage->Set(String::NewSymbol("bytes"), Number::New(it->second.bytes));
+    caches->Set(String::New(it->first.c_str()), usage);
+  }
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("passes"), Number::New(stats.passes));
+  result->Set(String::NewSymbol("running"), Boolean::New(stats.running));
+  if (!stats.cache.empty()) {
+    result->Set(String::NewSymbol("cache"), String::New(stats.cache.c_str()));
+  }
+  result->Set(String::NewSymbol("pass"), pass);
+  result->Set(String::NewSymbol("passTime"), Number::New(stats.pass_time / 1000000.0));
+  result->Set(String::NewSymbol("scanned"), Number::New(stats.scanned));
+  result->Set(String::NewSymbol("removed"), Number::New(stats.removed));
+  result->Set(String::NewSymbol("reclaimed"), Number::New(stats.reclaimed));
+  result->Set(String::NewSymbol("expired"), Number::New(stats.expired));
+  result->Set(String::NewSymbol("idle"), Number::New(stats.idle));
+  result->Set(String::NewSymbol("evicted"), Number::New(stats.evicted));
+  result->Set(String::NewSymbol("records"), Uint32::New(stats.records));
+  result->Set(String::NewSymbol("dropped"), Number::New(stats.dropped));
+  result->Set(String::NewSymbol("errors"), Number::New(stats.errors));
+  if (!stats.last_error.empty()) {
+    result->Set(String::NewSymbol("lastError"), String::New(stats.last_error.c_str()));
+  }
+  result->Set(String::NewSymbol("caches"), caches);
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This profiles the requests handled by the instance for a period,
+ * timing each phase of a request in the threads that handle it.  The
+ * callback receives an error (if any) and a report with the following
+ * properties:
+ *
+ * - `duration`: the time profiled in milliseconds
+ * - `phases`: an object with a property for each of the phases `queue`,
+ *   `dispatch`, `core`, `finish` and `respond`, each having the properties
+ *   `count` (the number of times the phase was timed), `wall` and `cpu` (the
+ *   total wall clock and thread CPU time in milliseconds).  No CPU time is
+ *   spent in the `queue` phase.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param duration The time to profile for in milliseconds.
+ *
+ * @param callback The function called with the report.
+ */
+Handle<Value> MapCache::ProfileAsync(const Arguments& args) {
+  HandleScope scope;
+
+  if (args.Length() != 2) {
+    THROW_CSTR_ERROR(Error, "usage: cache.profile(duration, callback)");
+  }
+  if (!args[0]->IsUint32()) {
+    THROW_CSTR_ERROR(TypeError, "Argument 0 must be an integer");
+  }
+  uint32_t duration = args[0]->Uint32Value();
+  REQ_FUN_ARG(1, callback);
+
+  if (duration < 1) {
+    THROW_CSTR_ERROR(RangeError, "The profile duration must be positive");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->profiler.Running()) {
+    THROW_CSTR_ERROR(Error, "A profile is already running");
+  }
+
+  ProfileBaton *baton = new ProfileBaton();
+  baton->cache = cache;
+  baton->async_log = NULL;
+  baton->callback = Persistent<Function>::New(callback);
+  baton->timer.data = baton;
+
+  cache->Ref(); // increment reference count so cache is not garbage collected
+  cache->profiler.Start();
+
+  uv_timer_init(uv_default_loop(), &baton->timer);
+  uv_timer_start(&baton->timer, ProfileAfter, duration, 0);
+  return Undefined();
+}
+
+/**
+ * @details This is set by `ProfileAsync` to run once the profile duration has
+ * elapsed.
+ *
+ * @param handle The profile timer.
+ */
+void MapCache::ProfileAfter(uv_timer_t *handle, int status /*UNUSED*/) {
+  HandleScope scope;
+
+  ProfileBaton *baton = static_cast<ProfileBaton*>(handle->data);
+  Profiler &profiler = baton->cache->profiler;
+  uint64_t duration = profiler.Stop();
+
+  Local<Object> phases = Object::New();
+  for (int i = 0; i < Profiler::PHASES; i++) {
+    const Profiler::Totals &totals = profiler.totals[i];
+    Local<Object> phase = Object::New();
+    phase->Set(String::NewSymbol("count"), Number::New(totals.count));
+    phase->Set(String::NewSymbol("wall"), Number::New(totals.wall / 1e6));
+    phase->Set(String::NewSymbol("cpu"), Number::New(totals.cpu / 1e6));
+    phases->Set(String::NewSymbol(Profiler::PhaseName((Profiler::Phase) i)), phase);
+  }
+
+  Local<Object> report = Object::New();
+  report->Set(String::NewSymbol("duration"), Number::New(duration / 1e6));
+  report->Set(String::NewSymbol("phases"), phases);
+
+  Handle<Value> argv[2] = { Undefined(), report };
+
+  // pass the report to the user specified callback function
+  TryCatch try_catch;
+  baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+
+  uv_close((uv_handle_t *) handle, ProfileClosed);
+}
+
+/**
+ * @param handle The profile timer.
+ */
+void MapCache::ProfileClosed(uv_handle_t *handle) {
+  ProfileBaton *baton = static_cast<ProfileBaton*>(handle->data);
+  baton->callback.Dispose();
+  baton->cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton;
+}
+
+/**
+ * @details This enables stale-while-revalidate handling of tilesets that set
+ * `auto_expire`.  Rather than deleting and rendering an expired tile before
+ * responding, the expired tile is returned with its original modification
+ * time while a single refresh of it runs in the thread pool.  Refreshes are
+ * also started at random as tiles approach expiry, with the odds rising as
+ * expiry nears, which spreads out the refresh of tiles cached together.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options [optional] An object with the optional properties `beta`
+ * (the weighting of early refreshes, 0 disables them) and `maxPending` (the
+ * maximum number of refreshes queued or running).
+ */
+Handle<Value> MapCache::EnableRevalidation(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableRevalidation([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->revalidator) {
+    THROW_CSTR_ERROR(Error, "Revalidation is already enabled");
+  }
+
+  double beta = 1, max_pending = 64;
+  ASSIGN_NUM_OPTION(options, beta, beta);
+  ASSIGN_NUM_OPTION(options, maxPending, max_pending);
+  if (beta < 0 || max_pending < 1 || max_pending > 0xffffffff) {
+    THROW_CSTR_ERROR(RangeError, "The revalidation beta or maximum pending refreshes is out of range");
+  }
+
+  REQ_FULL_CONFIG(cache, cfg);
+  cache->revalidator = new Revalidator(cfg, beta, (uint32_t) max_pending, DispatchRefreshes, cache);
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `stale`: the number of expired tiles returned while being refreshed
+ * - `early`: the number of refreshes started before the tile expired
+ * - `refreshed`: the number of refreshes completed
+ * - `skipped`: the number of refreshes not started as `maxPending` were
+ *   already queued or running
+ * - `errors`: the number of refreshes that failed
+ * - `pending`: the number of refreshes queued or running
+ * - `refreshTime`: the mean duration of a refresh in milliseconds
+ * - `lastError`: the message from the last failure, if any
+ */
+Handle<Value> MapCache::RevalidationStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->revalidator) {
+    THROW_CSTR_ERROR(Error, "Revalidation is not enabled");
+  }
+
+  Revalidator::Stats stats;
+  cache->revalidator->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("stale"), Number::New(stats.stale));
+  result->Set(String::NewSymbol("early"), Number::New(stats.early));
+  result->Set(String::NewSymbol("refreshed"), Number::New(stats.refreshed));
+  result->Set(String::NewSymbol("skipped"), Number::New(stats.skipped));
+  result->Set(String::NewSymbol("errors"), Number::New(stats.errors));
+  result->Set(String::NewSymbol("pending"), Uint32::New(stats.pending));
+  result->Set(String::NewSymbol("refreshTime"), Number::New(stats.refresh_time / 1000.0));
+  if (!stats.last_error.empty()) {
+    result->Set(String::NewSymbol("lastError"), String::New(stats.last_error.c_str()));
+  }
+
+  return scope.Close(result);
+}
+
+/**
+ * @details This limits the concurrency of each source and adds a circuit
+ * breaker to it, so that a slow or failing source can't tie up every thread
+ * in the pool.  Renders over the limit of a source wait for a slot, failing
+ * with a 503 error if too many are waiting or none becomes free in time.
+ * The limit of a source shrinks when renders are slower than a threshold and
+ * grows again when they are quick.  After a number of consecutive failures
+ * the circuit of a source opens and its renders fail immediately; a single
+ * render is let through after a period to test whether it has recovered.
+ * Combined with revalidation, expired tiles are served while a source is
+ * unavailable.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options An optional object with the properties `maxConcurrency`,
+ * `minConcurrency` (the bounds of the concurrency limit), `maxQueue` (the
+ * number of renders that may wait for a slot), `queueTimeout` (the time a
+ * render waits for a slot in milliseconds), `latencyThreshold` (the render
+ * time in milliseconds above which the limit shrinks), `failureThreshold`
+ * (the consecutive failures opening the circuit) and `openTime` (the time in
+ * milliseconds the circuit stays open).  A `sources` property can map source
+ * names to objects overriding these for particular sources.
+ */
+Handle<Value> MapCache::EnableSourceGuard(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableSourceGuard([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->source_guard) {
+    THROW_CSTR_ERROR(Error, "The source guard is already enabled");
+  }
+
+  SourceGuard::Options limits;
+  limits.max_concurrency = 8;
+  limits.min_concurrency = 1;
+  limits.max_queue = 32;
+  limits.queue_timeout = 10000;
+  limits.latency_threshold = 5000;
+  limits.failure_threshold = 5;
+  limits.open_time = 30000;
+  Handle<Value> thrown = ParseSourceLimits(options, &limits);
+  if (!thrown.IsEmpty()) {
+    return thrown;
+  }
+
+  REQ_FULL_CONFIG(cache, cfg);
+  std::map<std::string, SourceGuard::Options> overrides;
+  Local<Value> sources = (options.IsEmpty()) ? Local<Value>() : options->Get(String::NewSymbol("sources"));
+  if (!sources.IsEmpty() && !sources->IsUndefined()) {
+    if (!sources->IsObject()) {
+      THROW_CSTR_ERROR(TypeError, "Option `sources` must be an object");
+    }
+    Local<Object> source_options = sources->ToObject();
+    Local<Array> names = source_options->GetOwnPropertyNames();
+    for (uint32_t i = 0; i < names->Length(); i++) {
+      String::Utf8Value name(names->Get(i));
+      if (!apr_hash_get(cfg->sources, *name, APR_HASH_KEY_STRING)) {
+        THROW_CSTR_ERROR(Error, "The source does not exist");
+      }
+      Local<Value> source_limits = source_options->Get(names->Get(i));
+      if (!source_limits->IsObject()) {
+        THROW_CSTR_ERROR(TypeError, "Source options must be objects");
+      }
+      SourceGuard::Options &source = overrides[*name] = limits;
+      thrown = ParseSourceLimits(source_limits->ToObject(), &source);
+      if (!thrown.IsEmpty()) {
+        return thrown;
+      }
+    }
+  }
+
+  cache->source_guard = new SourceGuard(cfg, limits, overrides);
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object is keyed on source name.  Each source has
+ * the following properties:
+ *
+ * - `state`: the circuit breaker state, one of `closed`, `open` or
+ *   `half-open`
+ * - `limit`: the current concurrency limit
+ * - `active`: the number of renders running
+ * - `waiting`: the number of renders waiting for a slot
+ * - `requests`: the number of renders started
+ * - `failures`: the number of renders that failed
+ * - `rejected`: the number of renders refused by the limit or the circuit
+ *   breaker
+ * - `trips`: the number of times the circuit has opened
+ * - `latency`: the moving average render time in milliseconds
+ */
+Handle<Value> MapCache::SourceGuardStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->source_guard) {
+    THROW_CSTR_ERROR(Error, "The source guard is not enabled");
+  }
+
+  std::vector<SourceGuard::Stats> stats;
+  cache->source_guard->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  for (std::vector<SourceGuard::Stats>::const_iterator it = stats.begin(); it != stats.end(); ++it) {
+    Local<Object> source = Object::New();
+    source->Set(String::NewSymbol("state"), String::New(SourceGuard::StateName(it->state)));
+    source->Set(String::NewSymbol("limit"), Number::New(it->limit));
+    source->Set(String::NewSymbol("active"), Uint32::New(it->active));
+    source->Set(String::NewSymbol("waiting"), Uint32::New(it->waiting));
+    source->Set(String::NewSymbol("requests"), Number::New(it->requests));
+    source->Set(String::NewSymbol("failures"), Number::New(it->failures));
+    source->Set(String::NewSymbol("rejected"), Number::New(it->rejected));
+    source->Set(String::NewSymbol("trips"), Number::New(it->trips));
+    source->Set(String::NewSymbol("latency"), Number::New(it->latency));
+    result->Set(String::New(it->name.c_str()), source);
+  }
+
+  return scope.Close(result);
+}
+
+/**
+ * @details Properties missing from `options` leave the corresponding limits
+ * unchanged.
+ *
+ * @param options The javascript options object, which may be empty.
+ *
+ * @param limits The limits to update.
+ *
+ * @return An empty handle on success, otherwise the thrown exception.
+ */
+Handle<Value> MapCache::ParseSourceLimits(Local<Object> options, SourceGuard::Options *limits) {
+  double max_concurrency = limits->max_concurrency,
+    min_concurrency = limits->min_concurrency,
+    max_queue = limits->max_queue,
+    queue_timeout = limits->queue_timeout,
+    latency_threshold = limits->latency_threshold,
+    failure_threshold = limits->failure_threshold,
+    open_time = limits->open_time;
+  ASSIGN_NUM_OPTION(options, maxConcurrency, max_concurrency);
+  ASSIGN_NUM_OPTION(options, minConcurrency, min_concurrency);
+  ASSIGN_NUM_OPTION(options, maxQueue, max_queue);
+  ASSIGN_NUM_OPTION(options, queueTimeout, queue_timeout);
+  ASSIGN_NUM_OPTION(options, latencyThreshold, latency_threshold);
+  ASSIGN_NUM_OPTION(options, failureThreshold, failure_threshold);
+  ASSIGN_NUM_OPTION(options, openTime, open_time);
+  if (min_concurrency < 1 || max_concurrency < min_concurrency || max_concurrency > 0xffffffff
+      || max_queue < 0 || max_queue > 0xffffffff || queue_timeout < 0 || latency_threshold < 0
+      || failure_threshold < 1 || failure_threshold > 0xffffffff || open_time < 0) {
+    THROW_CSTR_ERROR(RangeError, "A source guard limit is out of range");
+  }
+
+  limits->max_concurrency = (uint32_t) max_concurrency;
+  limits->min_concurrency = (uint32_t) min_concurrency;
+  limits->max_queue = (uint32_t) max_queue;
+  limits->queue_timeout = (uint64_t) queue_timeout;
+  limits->latency_threshold = (uint64_t) latency_threshold;
+  limits->failure_threshold = (uint32_t) failure_threshold;
+  limits->open_time = (uint64_t) open_time;
+  return Handle<Value>();
+}
+
+/**
+ * @details This makes requests to WMS sources from each thread in the pool
+ * reuse a persistent cURL handle, so connections to a source are kept open
+ * between the tiles rendered by a thread rather than opened for every tile.
+ * Handles unused for `idleTimeout` are closed.  This must be enabled before
+ * the access log and the source guard, which wrap the requests it makes.
+ *
+ * `args` should contain the following parameters:
+ *
+ * @param options An optional object with the properties `maxHandles` (the
+ * maximum number of persistent handles, defaulting to the number of threads
+ * in the pool), `idleTimeout` (the time in milliseconds after which an
+ * unused handle is closed) and `maxConnections` (the maximum number of
+ * connections kept open by each handle).
+ */
+Handle<Value> MapCache::EnableConnectionReuse(const Arguments& args) {
+  HandleScope scope;
+
+  Local<Object> options;
+  switch (args.Length()) {
+  case 1:
+    ASSIGN_OBJ_ARG(0, options);
+  case 0:
+    break;
+  default:
+    THROW_CSTR_ERROR(Error, "usage: cache.enableConnectionReuse([options])");
+  }
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (cache->connection_pool) {
+    THROW_CSTR_ERROR(Error, "Connection reuse is already enabled");
+  }
+  if (cache->access_log || cache->source_guard) {
+    THROW_CSTR_ERROR(Error, "Connection reuse must be enabled before the access log and source guard");
+  }
+
+  const char *threads = getenv("UV_THREADPOOL_SIZE");
+  double max_handles = (threads && atoi(threads) > 0) ? atoi(threads) : 4,
+    idle_timeout = 30000, max_connections = 4;
+  ASSIGN_NUM_OPTION(options, maxHandles, max_handles);
+  ASSIGN_NUM_OPTION(options, idleTimeout, idle_timeout);
+  ASSIGN_NUM_OPTION(options, maxConnections, max_connections);
+  if (max_handles < 1 || max_handles > 0xffffffff || idle_timeout < 1
+      || max_connections < 1 || max_connections > 0xffffffff) {
+    THROW_CSTR_ERROR(RangeError, "The connection reuse limits are out of range");
+  }
+
+  REQ_FULL_CONFIG(cache, cfg);
+  cache->connection_pool = new ConnectionPool(cfg, (uint32_t) max_handles,
+                                              (uint64_t) idle_timeout, (uint32_t) max_connections);
+
+  return Undefined();
+}
+
+/**
+ * @details The returned object has the following properties:
+ *
+ * - `handles`: the number of persistent handles that are open
+ * - `requests`: the number of requests made to WMS sources
+ * - `connects`: the number of new connections opened by those requests
+ * - `expired`: the number of handles closed after being idle
+ * - `overflow`: the number of requests made without a persistent handle as
+ *   `maxHandles` were in use
+ */
+Handle<Value> MapCache::ConnectionReuseStats(const Arguments& args) {
+  HandleScope scope;
+
+  MapCache* cache = ObjectWrap::Unwrap<MapCache>(args.This());
+  if (!cache->connection_pool) {
+    THROW_CSTR_ERROR(Error, "Connection reuse is not enabled");
+  }
+
+  ConnectionPool::Stats stats;
+  cache->connection_pool->GetStats(stats);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("handles"), Uint32::New(stats.handles));
+  result->Set(String::NewSymbol("requests"), Number::New(stats.requests));
+  result->Set(String::NewSymbol("connects"), Number::New(stats.connects));
+  result->Set(String::NewSymbol("expired"), Number::New(stats.expired));
+  result->Set(String::NewSymbol("overflow"), Number::New(stats.overflow));
+
+  return scope.Close(result);
+}
+
+/**
+ * @details An APR memory pool and thread mutex are created when the
+ * first `MapCache` instance is created. This method frees up that
+ * memory and should be called when Node no longer requires this
+ * module.
+ *
+ * @param target The object representing the module.
+ */
+void MapCache::Destroy() {
+  if (thread_mutex) {
+    apr_thread_mutex_destroy(thread_mutex);
+    thread_mutex = NULL;
+  }
+  apr_pool_destroy(global_pool); // this includes the scratch pool
+  global_pool = NULL;
+  scratch_pool = NULL;
+}
+
+/**
+ * @details This is called by `GetRequestAsync` and runs in a
+ * different thread to that function.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::GetRequestWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  RequestBaton *baton =  static_cast<RequestBaton*>(req->data);
+  uint64_t work_start = uv_hrtime();
+  Profiler::Timer timer(&(baton->cache->profiler));
+  mapcache_context *ctx;
+  apr_table_t *params;
+  mapcache_request *request = NULL;
+  mapcache_http_response *http_response = NULL;
+
+  NODE_MAPCACHE_PROBE3(work_start, baton->pathInfo.c_str(), baton->queryString.c_str(),
+                       (work_start - baton->start) / 1000);
+  baton->cache->profiler.Add(Profiler::QUEUE, work_start - baton->start, 0);
+
+  // set up the local context
+  ctx = (mapcache_context *)CreateRequestContext(baton->pool, baton->cache, baton->async_log);
+  if (!ctx) {
+    baton->error = "Could not create the request context";
+    return;
+  }
+
+  // point the context to our cache configuration, setting up the requested
+  // tileset first if it is lazy
+  params = mapcache_http_parse_param_string(ctx, (char*) baton->queryString.c_str());
+  if (baton->cache->config->lazy) {
+    ctx->config = baton->cache->config->lazy->ConfigFor(baton->pathInfo.c_str(), params, baton->error);
+    if (!ctx->config) {
+      return;
+    }
+  } else {
+    ctx->config = baton->cache->config->cfg;
+  }
+  AccessLog::ResetRenderTime();
+  Revalidator::ResetStaleTime();
+
+#ifdef DEBUG
+  if (baton->cache->log_level <= MAPCACHE_DEBUG) {
+    ctx->log(ctx, MAPCACHE_DEBUG, (char *) "cache request: %s%s%s%s",
+             baton->baseUrl.c_str(),
+             baton->pathInfo.c_str(),
+             ((baton->queryString.empty()) ? "" : "?"),
+             baton->queryString.c_str());
+  }
+#endif
+
+  // dispatch the request
+  mapcache_service_dispatch_request(ctx, &request, (char*) baton->pathInfo.c_str(), params, ctx->config);
+  timer.Lap(Profiler::DISPATCH);
+  if (!GC_HAS_ERROR(ctx) && request) {
+    size_t needed = MemoryMeter::Estimate(request);
+    if (baton->cache->memory_meter.Reserve(needed)) {
+      baton->reserved = needed;
+    } else {
+      ctx->set_error(ctx, 400, (char *) "the request needs an estimated %lu bytes, exceeding the limit of %lu",
+                     (unsigned long) needed, (unsigned long) baton->cache->memory_meter.limit);
+    }
+  }
+  if (GC_HAS_ERROR(ctx) || !request) {
+    http_response = mapcache_core_respond_to_error(ctx);
+  } else if (baton->cache->response_cache
+             && baton->cache->response_cache->Find(ctx, request, baton->response_key, &http_response)) {
+    // the response was cached so the source isn't queried
+  } else {
+    NODE_MAPCACHE_PROBE2(core_start, baton->pathInfo.c_str(), (int) request->type);
+    switch (request->type) {
+    case MAPCACHE_REQUEST_GET_CAPABILITIES: {
+      mapcache_request_get_capabilities *req = (mapcache_request_get_capabilities*)request;
+      http_response = mapcache_core_get_capabilities(ctx, request->service, req, (char*) baton->baseUrl.c_str(), (char*) baton->pathInfo.c_str(), ctx->config);
+      break;
+    }
+    case MAPCACHE_REQUEST_GET_TILE: {
+      mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
+      http_response = mapcache_core_get_tile(ctx, req_tile);
+      break;
+    }
+    case MAPCACHE_REQUEST_PROXY: {
+      mapcache_request_proxy *req_proxy = (mapcache_request_proxy*)request;
+      http_response = mapcache_core_proxy_request(ctx, req_proxy);
+      break;
+    }
+    case MAPCACHE_REQUEST_GET_MAP: {
+      mapcache_request_get_map *req_map = (mapcache_request_get_map*)request;
+      if (baton->cache->map_assembler && req_map->getmap_strategy == MAPCACHE_GETMAP_ASSEMBLE) {
+        http_response = baton->cache->map_assembler->GetMap(ctx, req_map);
+      } else {
+        http_response = mapcache_core_get_map(ctx, req_map);
+      }
+      break;
+    }
+    case MAPCACHE_REQUEST_GET_FEATUREINFO: {
+      mapcache_request_get_feature_info *req_fi = (mapcache_request_get_feature_info*)request;
+      http_response = mapcache_core_get_featureinfo(ctx, req_fi);
+      break;
+    }
+    default:
+      ctx->set_error(ctx, 500, (char*)"###BUG### unknown request type");
+      break;
+    }
+
+    if (GC_HAS_ERROR(ctx)) {
+      http_response = mapcache_core_respond_to_error(ctx);
+    }
+    NODE_MAPCACHE_PROBE3(core_end, baton->pathInfo.c_str(), (int) request->type,
+                         (http_response) ? (int) http_response->code : 0);
+  }
+  timer.Lap(Profiler::CORE);
+
+  if (!http_response) {
+    ctx->set_error(ctx, 500, (char*)"###BUG### NULL response");
+    http_response = mapcache_core_respond_to_error(ctx);
+  }
+
+  // expired tiles being revalidated keep their original modification time
+  if (http_response && !http_response->mtime && Revalidator::StaleTime()) {
+    http_response->mtime = Revalidator::StaleTime();
+  }
+
+  if (!http_response) {
+    baton->error = "No response was received from the cache";
+  } else if (baton->has_tile && baton->cache->blank_index && baton->variant.empty()) {
+    // only inspect the tiles that the blank index can hold
+    baton->is_blank = IsBlankResponse(ctx, http_response);
+  }
+
+  // transcode a tile into the variant requested
+  if (baton->has_tile && !baton->variant.empty() && request && request->type == MAPCACHE_REQUEST_GET_TILE
+      && http_response && http_response->code == 200 && http_response->data) {
+    TranscodeTile(ctx, baton, (mapcache_request_get_tile *) request, http_response);
+  }
+
+  // hash the body here rather than in the Node/V8 thread
+  BodyStore *body_store = baton->cache->body_store;
+  if (body_store && http_response && http_response->code == 200 && http_response->data
+      && body_store->Accepts(http_response->data->size)) {
+    baton->body_hash = BodyStore::Hash((char *)http_response->data->buf, http_response->data->size);
+    baton->has_body_hash = true;
+  }
+
+  ctx->clear_errors(ctx);
+
+  baton->response = http_response;
+  if (baton->cache->access_log) {
+    RecordAccess(baton, request, work_start);
+  }
+
+  timer.Lap(Profiler::FINISH);
+  NODE_MAPCACHE_PROBE3(work_end, baton->pathInfo.c_str(),
+                       (http_response) ? (int) http_response->code : 0,
+                       (http_response && http_response->data) ? (size_t) http_response->data->size : 0);
+  return;
+}
+
+/**
+ * @details This is set by `GetRequestAsync` to run after
+ * `GetRequestWork` has finished, being passed the response generated
+ * by the latter and running in the same thread as the former. It
+ * formats the cache response into javascript datatypes and returns
+ * them via the original callback.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::GetRequestAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  RequestBaton *baton = static_cast<RequestBaton*>(req->data);
+  MapCache *cache = baton->cache;
+  mapcache_http_response *response = baton->response;
+  Profiler::Timer timer(&(cache->profiler));
+
+  Handle<Value> argv[2];
+
+  if (baton->async_log) baton->async_log->close(); // finish with the logger
+
+  // hand the render lane on to the next request waiting for it
+  if (baton->render_lane) {
+    if (cache->render_queue.empty()) {
+      cache->renders_active--;
+    } else {
+      RequestBaton *next = cache->render_queue.front();
+      cache->render_queue.pop_front();
+      uv_queue_work(uv_default_loop(),
+                    &next->request,
+                    GetRequestWork,
+                    (uv_after_work_cb) GetRequestAfter);
+    }
+  }
+
+  if (baton->error.empty() && response->code == 200 && baton->has_tile && cache->existence_filter) {
+    cache->RecordCachedTile(baton);
+  }
+
+  // the requests that waited for this metatile can now be read from the cache
+  if (baton->leads_metatile) {
+    std::map<std::string, std::vector<RequestBaton*> >::iterator job = cache->metatile_jobs.find(baton->metatile);
+    std::vector<RequestBaton*> waiting;
+    waiting.swap(job->second);
+    cache->metatile_jobs.erase(job);
+    for (std::vector<RequestBaton*>::iterator it = waiting.begin(); it != waiting.end(); ++it) {
+      cache->QueueRequest(*it);
+    }
+  }
+
+  if (!baton->error.empty()) {
+    argv[0] = Exception::Error(String::New(baton->error.c_str()));
+    argv[1] = Undefined();
+  } else {
+    // convert the http_response to a javascript object
+    Local<Object> result = Object::New();
+    result->Set(code_symbol, Integer::New(response->code)); // the HTTP response code
+
+    // set the mtime to as a javascript date
+    if (response->mtime) {
+      result->Set(mtime_symbol, Date::New(apr_time_as_msec(response->mtime)));
+    }
+
+    // Set the response headers as a javascript object with header
+    // names as keys and header values as an array. Header values are
+    // in an array as more than one header of the same name can be
+    // set.
+    Local<Object> headers = Object::New();
+    if (response->headers && !apr_is_empty_table(response->headers)) {
+      const apr_array_header_t *elts = apr_table_elts(response->headers);
+      int i;
+      for (i = 0; i < elts->nelts; i++) {
+        apr_table_entry_t entry = APR_ARRAY_IDX(elts, i, apr_table_entry_t);
+        Local<Array> values;
+        Local<String> key = String::New(entry.key);
+        Local<String> value = String::New(entry.val);
+        if (headers->Has(key)) {
+          // the header exists: append the value
+          values = Local<Array>::Cast(headers->Get(key));
+          values->Set(values->Length() - 1, value);
+        } else {
+          // create a new header
+          values = Array::New(1);
+          values->Set(0, value);
+          headers->Set(key, values);
+        }
+      }
+    }
+    result->Set(headers_symbol, headers);
+
+    // set the response data as a Node Buffer object
+    if (response->data) {
+      result->Set(data_symbol, cache->BodyBuffer((char *)response->data->buf, response->data->size,
+                                                 (baton->has_body_hash) ? &(baton->body_hash) : NULL));
+
+      // add the content-length header
+      Local<Array> values = Array::New(1);
+      values->Set(0, Uint32::New(response->data->size));
+      headers->Set(String::New("Content-Length"), values);
+
+      // tiles read before or during an invalidation may be stale
+      bool current = !cache->invalidations_active && baton->epoch == cache->invalidation_epoch;
+
+      // add the tile to the shared memory cache
+      if (current && baton->has_tile && cache->shared_cache && response->code == 200) {
+        cache->shared_cache->Set(cache->SharedKey(baton->layer, baton->tile),
+                                 (char *)response->data->buf, response->data->size,
+                                 (response->mtime) ? response->mtime : apr_time_now());
+      }
+
+      // add proxied and `GetFeatureInfo` responses to the response cache
+      if (current && baton->response_key.ttl && !baton->response_key.hit && response->code == 200) {
+        cache->response_cache->Insert(baton->response_key, response);
+      }
+
+      // add the tile to the blank index, or remove it if it is no longer blank
+      if (current && baton->is_blank && cache->blank_index) {
+        const char *content_type = apr_table_get(response->headers, "Content-Type");
+        cache->blank_index->Insert(baton->layer,
+                                   baton->tile.z, baton->tile.x, baton->tile.y,
+                                   (char *)response->data->buf, response->data->size,
+                                   (content_type) ? content_type : "",
+                                   (response->mtime) ? response->mtime : apr_time_now());
+      } else if (baton->has_tile && cache->blank_index && baton->variant.empty() && response->code == 200) {
+        cache->blank_index->Remove(baton->layer, baton->tile.z, baton->tile.x, baton->tile.y);
+      }
+    }
+
+    // return the transcoded tile in place of the original, which is the one
+    // added to the caches above
+    if (baton->has_variant) {
+      const std::string &data = baton->transcoded.data;
+      result->Set(data_symbol, cache->BodyBuffer(data.data(), data.size(), NULL));
+
+      Local<Array> length = Array::New(1);
+      length->Set(0, Uint32::New(data.size()));
+      headers->Set(String::New("Content-Length"), length);
+
+      Local<Array> content_type = Array::New(1);
+      content_type->Set(0, String::New(baton->transcoded.content_type.c_str()));
+      headers->Set(String::New("Content-Type"), content_type);
+    }
+    SetVaryHeader(result, baton->vary);
+
+    argv[0] = Undefined();
+    argv[1] = result;
+  }
+
+  timer.Lap(Profiler::RESPOND);
+  NODE_MAPCACHE_PROBE3(respond, baton->pathInfo.c_str(),
+                       (baton->error.empty()) ? (int) response->code : 0,
+                       (baton->error.empty() && response->data) ? (size_t) response->data->size : 0);
+
+  // pass the results to the user specified callback function
+  TryCatch try_catch;
+  baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+
+  // clean up
+  baton->callback.Dispose();
+  cache->Unref(); // decrement the cache reference so it can be garbage collected
+  cache->memory_meter.Release(baton->reserved);
+  apr_pool_destroy(baton->pool); // free all memory for this request
+  delete baton;
+  return;
+}
+
+/**
+ * @details This is called on the first iteration of the event loop after
+ * responses have been added to `immediate_queue` by `GetAsync`. It returns
+ * each response via the original callback.
+ *
+ * @param handle The `immediate_async` handle.
+ */
+void MapCache::GetRequestImmediate(uv_async_t *handle, int status /*UNUSED*/) {
+  HandleScope scope;
+  Handle<Value> argv[2];
+
+  while (!immediate_queue.empty()) {
+    RequestBaton *baton = immediate_queue.front();
+    immediate_queue.pop();
+
+    argv[0] = Undefined();
+    argv[1] = baton->result;
+
+    // pass the results to the user specified callback function
+    TryCatch try_catch;
+    baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    // clean up
+    baton->result.Dispose();
+    baton->callback.Dispose();
+    delete baton;
+  }
+
+  uv_unref((uv_handle_t *) handle); // the event loop can exit
+}
+
+/**
+ * @details This is called by `SaveBlankIndexAsync` and runs in a
+ * different thread to that function.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::SaveBlankIndexWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  SaveBaton *baton = static_cast<SaveBaton*>(req->data);
+  BlankIndex::Write(baton->path, baton->data, baton->error);
+}
+
+/**
+ * @details This is set by `SaveBlankIndexAsync` to run after
+ * `SaveBlankIndexWork` has finished. It passes any error to the original
+ * callback.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::SaveBlankIndexAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  SaveBaton *baton = static_cast<SaveBaton*>(req->data);
+  Handle<Value> argv[1];
+
+  if (!baton->error.empty()) {
+    argv[0] = Exception::Error(String::New(baton->error.c_str()));
+  } else {
+    argv[0] = Undefined();
+  }
+
+  // pass the results to the user specified callback function
+  TryCatch try_catch;
+  baton->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+
+  // clean up
+  baton->callback.Dispose();
+  baton->cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton;
+}
+
+/**
+ * @details This walks the layer directories in the thread pool, adding the
+ * tiles to a separate index as the blank tile index may only be used from the
+ * Node/V8 thread.
+ *
+ * @param req The asynchronous request.
+ */
+void MapCache::SeedBlankIndexWork(uv_work_t *req) {
+  SeedBaton *baton = static_cast<SeedBaton*>(req->data);
+  for (std::vector<BlankSeed>::const_iterator it = baton->layers.begin(); it != baton->layers.end(); ++it) {
+    baton->seeded += baton->seeds->Seed(it->name, it->directory, it->content_type);
+  }
+}
+
+/**
+ * @details The seeded tiles are discarded if tiles were invalidated while
+ * the caches were being walked, as they may no longer be blank.
+ *
+ * @param req The asynchronous request.
+ */
+void MapCache::SeedBlankIndexAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  SeedBaton *baton = static_cast<SeedBaton*>(req->data);
+  MapCache *cache = baton->cache;
+
+  if (!cache->invalidations_active && baton->epoch == cache->invalidation_epoch) {
+    cache->blank_index->Merge(*(baton->seeds));
+  } else {
+    baton->seeded = 0;
+  }
+
+  if (!baton->callback.IsEmpty()) {
+    Handle<Value> argv[2] = { Null(), Number::New(baton->seeded) };
+
+    // pass the results to the user specified callback function
+    TryCatch try_catch;
+    baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+    baton->callback.Dispose();
+  }
+
+  // clean up
+  cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton->seeds;
+  delete baton;
+}
+
+/**
+ * @details This runs at the end of `GetRequestWork`, in the same thread.
+ *
+ * @param baton The request.
+ *
+ * @param request The dispatched mapcache request, if any.
+ *
+ * @param work_start The high resolution time the work started.
+ */
+void MapCache::RecordAccess(const RequestBaton *baton, mapcache_request *request, uint64_t work_start) {
+  AccessLog::Record record;
+  uint64_t render_time = AccessLog::RenderTime();
+
+  memset(&record, 0, sizeof(record));
+  record.time = baton->time;
+  record.queue_us = (work_start - baton->start) / 1000;
+  record.work_us = (uv_hrtime() - work_start) / 1000;
+  record.render_us = render_time / 1000;
+  record.z = record.x = record.y = -1;
+  record.service = (request && request->service) ? request->service->type : NODE_MAPCACHE_ACCESS_NO_SERVICE;
+
+  if (request && request->type == MAPCACHE_REQUEST_GET_TILE) {
+    mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
+    if (req_tile->ntiles) {
+      mapcache_tile *tile = req_tile->tiles[0];
+      AccessLog::SetTile(record, tile->tileset->name, tile->grid_link->grid->name, tile->z, tile->x, tile->y);
+    }
+  }
+
+  if (baton->response) {
+    record.status = baton->response->code;
+    record.bytes = (baton->response->data) ? baton->response->data->size : 0;
+  }
+
+  if (!baton->response || record.status >= 400) {
+    record.flags |= AccessLog::FAILED;
+  } else if (render_time) {
+    record.flags |= AccessLog::RENDERED;
+  } else if (baton->response_key.hit
+             || (request && (request->type == MAPCACHE_REQUEST_GET_TILE || request->type == MAPCACHE_REQUEST_GET_MAP))) {
+    record.flags |= AccessLog::HIT;
+  }
+
+  baton->cache->access_log->Push(record);
+}
+
+/**
+ * @details This is called in the Node/V8 thread when the revalidator has
+ * queued tile refreshes, dispatching each one to the thread pool.
+ *
+ * @param handle The revalidator's dispatch handle.
+ */
+void MapCache::DispatchRefreshes(uv_async_t *handle, int status /*UNUSED*/) {
+  MapCache *cache = static_cast<MapCache*>(handle->data);
+  Revalidator::Refresh *refresh;
+
+  while ((refresh = cache->revalidator->Next())) {
+    RefreshBaton *baton = new RefreshBaton();
+    baton->request.data = baton;
+    baton->cache = cache;
+    baton->async_log = NULL;
+    baton->refresh = refresh;
+    baton->start = uv_hrtime();
+
+    cache->Ref(); // the cache must outlive the refresh
+
+    uv_queue_work(uv_default_loop(),
+                  &baton->request,
+                  RefreshWork,
+                  (uv_after_work_cb) RefreshAfter);
+  }
+}
+
+/**
+ * @details This is called by `DispatchRefreshes` and runs in a different
+ * thread to that function.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::RefreshWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  RefreshBaton *baton = static_cast<RefreshBaton*>(req->data);
+  mapcache_context *ctx = (mapcache_context *) CreateRequestContext(baton->refresh->pool, baton->cache, NULL);
+  if (!ctx) {
+    return;
+  }
+  ctx->config = baton->cache->config->cfg;
+  baton->cache->revalidator->Run(baton->refresh, ctx);
+}
+
+/**
+ * @details This is set by `DispatchRefreshes` to run after `RefreshWork` has
+ * finished.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::RefreshAfter(uv_work_t *req) {
+  RefreshBaton *baton = static_cast<RefreshBaton*>(req->data);
+
+  baton->cache->revalidator->Finish(baton->refresh, (uv_hrtime() - baton->start) / 1000);
+  baton->cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton;
+}
+
+/**
+ * @details This parses the `tileset`, `grid`, `zoomRange` and `extent`
+ * options shared by the functions operating on a range of tiles.  The grid
+ * defaults to the first grid of the tileset, the zoom range to every level
+ * of the grid and the extent to the whole grid.
+ *
+ * @param cfg The configuration containing the tileset.
+ *
+ * @param options The javascript options object.
+ *
+ * @param tileset Set to the tileset.
+ *
+ * @param grid_link Set to the grid of the tileset.
+ *
+ * @param minz Set to the minimum zoom level.
+ *
+ * @param maxz Set to the maximum zoom level.
+ *
+ * @param has_extent Set if an extent was specified.
+ *
+ * @param extent Set to the extent, if specified.
+ *
+ * @return An empty handle on success, otherwise the thrown exception.
+ */
+Handle<Value> MapCache::ParseTileSelection(mapcache_cfg *cfg, Local<Object> options,
+                                           mapcache_tileset **tileset, mapcache_grid_link **grid_link,
+                                           int *minz, int *maxz, bool *has_extent, mapcache_extent *extent) {
+  // the tileset and grid
+  Local<Value> tileset_name = options->Get(String::NewSymbol("tileset"));
+  if (!tileset_name->IsString()) {
+    THROW_CSTR_ERROR(TypeError, "Option `tileset` must be a string");
+  }
+  *tileset = mapcache_configuration_get_tileset(cfg, *String::Utf8Value(tileset_name));
+  if (!*tileset) {
+    THROW_CSTR_ERROR(Error, "The tileset does not exist");
+  }
+
+  Local<Value> grid_name = options->Get(String::NewSymbol("grid"));
+  if (!grid_name->IsUndefined() && !grid_name->IsString()) {
+    THROW_CSTR_ERROR(TypeError, "Option `grid` must be a string");
+  }
+  *grid_link = NULL;
+  for (int i = 0; i < (*tileset)->grid_links->nelts; i++) {
+    mapcache_grid_link *link = APR_ARRAY_IDX((*tileset)->grid_links, i, mapcache_grid_link*);
+    if (grid_name->IsUndefined() || !strcmp(link->grid->name, *String::Utf8Value(grid_name))) {
+      *grid_link = link;
+      break;
+    }
+  }
+  if (!*grid_link) {
+    THROW_CSTR_ERROR(Error, "The grid is not used by the tileset");
+  }
+
+  // the zoom range
+  *minz = (*grid_link)->minz;
+  *maxz = (*grid_link)->maxz - 1;
+  Local<Value> zoom_range = options->Get(String::NewSymbol("zoomRange"));
+  if (!zoom_range->IsUndefined()) {
+    Local<Array> range = Local<Array>::Cast(zoom_range);
+    if (!zoom_range->IsArray() || range->Length() != 2
+        || !range->Get(0)->IsInt32() || !range->Get(1)->IsInt32()) {
+      THROW_CSTR_ERROR(TypeError, "Option `zoomRange` must be an array of two integers");
+    }
+    *minz = range->Get(0)->Int32Value();
+    *maxz = range->Get(1)->Int32Value();
+  }
+  if (*minz < (*grid_link)->minz || *minz > *maxz || *maxz >= (*grid_link)->maxz) {
+    THROW_CSTR_ERROR(RangeError, "The zoom range is outside the grid");
+  }
+
+  // the extent
+  Local<Value> extent_value = options->Get(String::NewSymbol("extent"));
+  *has_extent = !extent_value->IsUndefined();
+  if (*has_extent) {
+    Local<Array> bounds = Local<Array>::Cast(extent_value);
+    if (!extent_value->IsArray() || bounds->Length() != 4) {
+      THROW_CSTR_ERROR(TypeError, "Option `extent` must be an array of four numbers");
+    }
+    double values[4];
+    for (int i = 0; i < 4; i++) {
+      if (!bounds->Get(i)->IsNumber()) {
+        THROW_CSTR_ERROR(TypeError, "Option `extent` must be an array of four numbers");
+      }
+      values[i] = bounds->Get(i)->NumberValue();
+    }
+    extent->minx = values[0];
+    extent->miny = values[1];
+    extent->maxx = values[2];
+    extent->maxy = values[3];
+  }
+
+
+  return Handle<Value>();
+}
+
+/**
+ * @details This is called by `ExportAsync` and runs in a different thread to
+ * that function.  It acts as the writer while the export readers run in
+ * their own threads.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::ExportWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  ExportBaton *baton = static_cast<ExportBaton*>(req->data);
+  baton->exporter->Run(baton->error);
+}
+
+/**
+ * @details This is set by `ExportAsync` to run after `ExportWork` has
+ * finished.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::ExportAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  ExportBaton *baton = static_cast<ExportBaton*>(req->data);
+  Handle<Value> argv[2];
+
+  if (!baton->error.empty()) {
+    argv[0] = Exception::Error(String::New(baton->error.c_str()));
+    argv[1] = Undefined();
+  } else {
+    const TileExporter::Stats &stats = baton->exporter->GetStats();
+    double seconds = stats.duration / 1e9;
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("tiles"), Number::New(stats.tiles));
+    result->Set(String::NewSymbol("missing"), Number::New(stats.missing));
+    result->Set(String::NewSymbol("unique"), Number::New(stats.unique));
+    result->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+    result->Set(String::NewSymbol("duration"), Number::New(stats.duration / 1e6));
+    result->Set(String::NewSymbol("tilesPerSecond"), Number::New((seconds > 0) ? stats.tiles / seconds : 0));
+
+    argv[0] = Undefined();
+    argv[1] = result;
+  }
+
+  // pass the results to the user specified callback function
+  TryCatch try_catch;
+  baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+
+  // clean up
+  baton->callback.Dispose();
+  baton->cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton->exporter;
+  delete baton;
+}
+
+/**
+ * @details This is called by `SaveHotTilesAsync` and runs in a different
+ * thread to that function.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::SaveHotTilesWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  SaveBaton *baton = static_cast<SaveBaton*>(req->data);
+  HotTiles::Write(baton->path, baton->data, baton->error);
+}
+
+/**
+ * @details This is called by `WarmupAsync` and runs in a different thread to
+ * that function.  It waits while the warmup threads run.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::WarmupWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  WarmupBaton *baton = static_cast<WarmupBaton*>(req->data);
+  baton->warmer->Run(baton->error);
+}
+
+/**
+ * @details This is set by `WarmupAsync` to run after `WarmupWork` has
+ * finished.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::WarmupAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  WarmupBaton *baton = static_cast<WarmupBaton*>(req->data);
+  Handle<Value> argv[2];
+
+  if (!baton->error.empty()) {
+    argv[0] = Exception::Error(String::New(baton->error.c_str()));
+    argv[1] = Undefined();
+  } else {
+    const TileWarmer *warmer = baton->warmer;
+    double seconds = warmer->duration / 1e9;
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("tiles"), Number::New(warmer->Total()));
+    result->Set(String::NewSymbol("errors"), Number::New(warmer->errors));
+    result->Set(String::NewSymbol("duration"), Number::New(warmer->duration / 1e6));
+    result->Set(String::NewSymbol("tilesPerSecond"), Number::New((seconds > 0) ? warmer->Total() / seconds : 0));
+
+    argv[0] = Undefined();
+    argv[1] = result;
+  }
+
+  // pass the results to the user specified callback function
+  TryCatch try_catch;
+  baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
 
-    // set the response data as a Node Buffer object
-    if (response->data) {
-      result->Set(data_symbol, Buffer::New((char *)response->data->buf, response->data->size)->handle_);
+  // clean up
+  baton->callback.Dispose();
+  baton->cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton->warmer;
+  delete baton;
+}
 
-      // add the content-length header
-      Local<Array> values = Array::New(1);
-      values->Set(0, Uint32::New(response->data->size));
-      headers->Set(String::New("Content-Length"), values);
-    }
+/**
+ * @details This is called by `InvalidateAsync` and runs in a different
+ * thread to that function.  It waits while the invalidation threads run.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::InvalidateWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  InvalidateBaton *baton = static_cast<InvalidateBaton*>(req->data);
+  baton->invalidator->Run(baton->error);
+}
+
+/**
+ * @details This is set by `InvalidateAsync` to run periodically while tiles
+ * are being invalidated.
+ *
+ * @param handle The progress timer.
+ */
+void MapCache::InvalidateProgress(uv_timer_t *handle, int status /*UNUSED*/) {
+  HandleScope scope;
+
+  InvalidateBaton *baton = static_cast<InvalidateBaton*>(handle->data);
+  Handle<Value> argv[2] = {
+    Number::New(baton->invalidator->processed),
+    Number::New(baton->invalidator->total)
+  };
+
+  TryCatch try_catch;
+  baton->progress->Call(Context::GetCurrent()->Global(), 2, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+}
+
+/**
+ * @details This is set by `InvalidateAsync` to run after `InvalidateWork`
+ * has finished.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::InvalidateAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  InvalidateBaton *baton = static_cast<InvalidateBaton*>(req->data);
+  MapCache *cache = baton->cache;
+  Handle<Value> argv[2];
+
+  uv_timer_stop(&baton->timer);
+  cache->invalidations_active--;
+  cache->invalidation_epoch++;
+
+  if (!baton->error.empty()) {
+    argv[0] = Exception::Error(String::New(baton->error.c_str()));
+    argv[1] = Undefined();
+  } else {
+    const TileInvalidator *invalidator = baton->invalidator;
+    double seconds = invalidator->duration / 1e9;
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("tiles"), Number::New(invalidator->total));
+    result->Set(String::NewSymbol("errors"), Number::New(invalidator->errors));
+    result->Set(String::NewSymbol("duration"), Number::New(invalidator->duration / 1e6));
+    result->Set(String::NewSymbol("tilesPerSecond"), Number::New((seconds > 0) ? invalidator->total / seconds : 0));
 
     argv[0] = Undefined();
     argv[1] = result;
@@ -442,12 +3732,472 @@ void MapCache::GetRequestAfter(uv_work_t *req) {
     FatalException(try_catch);
   }
 
+  uv_close((uv_handle_t *) &baton->timer, InvalidateClosed);
+}
+
+/**
+ * @param handle The progress timer.
+ */
+void MapCache::InvalidateClosed(uv_handle_t *handle) {
+  InvalidateBaton *baton = static_cast<InvalidateBaton*>(handle->data);
+  baton->callback.Dispose();
+  if (!baton->progress.IsEmpty()) {
+    baton->progress.Dispose();
+  }
+  baton->cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton->invalidator;
+  delete baton;
+}
+
+/**
+ * @details This is called by `FlushWritesAsync` and runs in a different
+ * thread to that function.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::FlushWritesWork(uv_work_t *req) {
+  /* No HandleScope! This is run in a separate thread: *No* contact
+     should be made with the Node/V8 world here. */
+
+  Baton *baton = static_cast<Baton*>(req->data);
+  baton->cache->write_behind->Flush();
+}
+
+/**
+ * @details This is set by `FlushWritesAsync` to run after `FlushWritesWork`
+ * has finished.
+ *
+ * @param req The asynchronous libuv request.
+ */
+void MapCache::FlushWritesAfter(uv_work_t *req) {
+  HandleScope scope;
+
+  Baton *baton = static_cast<Baton*>(req->data);
+  Handle<Value> argv[1] = { Undefined() };
+
+  // pass the results to the user specified callback function
+  TryCatch try_catch;
+  baton->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+  if (try_catch.HasCaught()) {
+    FatalException(try_catch);
+  }
+
   // clean up
   baton->callback.Dispose();
+  baton->cache->Unref(); // decrement the cache reference so it can be garbage collected
+  delete baton;
+}
+
+/**
+ * @details This is the entry point of the thread created by
+ * `EnableExistenceFilter`. *No* contact should be made with the Node/V8 world
+ * here.
+ *
+ * @param arg The `FilterBaton`.
+ */
+void MapCache::BuildExistenceFilter(void *arg) {
+  FilterBaton *baton = static_cast<FilterBaton*>(arg);
+  baton->filter->Build();
+  uv_async_send(&baton->async);
+}
+
+/**
+ * @details This runs in the Node/V8 thread once the filter has been built. It
+ * activates the filter and calls the optional callback.
+ *
+ * @param handle The `async` handle of the `FilterBaton`.
+ */
+void MapCache::BuildExistenceFilterAfter(uv_async_t *handle, int status /*UNUSED*/) {
+  HandleScope scope;
+
+  FilterBaton *baton = static_cast<FilterBaton*>(handle->data);
+  MapCache *cache = baton->cache;
+
+  uv_thread_join(&baton->thread);
+  baton->filter->ready = true;
+
+  if (!baton->callback.IsEmpty()) {
+    Handle<Value> argv[2] = {
+      Undefined(),
+      cache->ExistenceFilterStatsObject()
+    };
+
+    // pass the results to the user specified callback function
+    TryCatch try_catch;
+    baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+  }
+
+  // clean up
   cache->Unref(); // decrement the cache reference so it can be garbage collected
-  apr_pool_destroy(baton->pool); // free all memory for this request
+  uv_close((uv_handle_t *) handle, FilterBatonClosed);
+}
+
+/**
+ * @param handle The `async` handle of the `FilterBaton`.
+ */
+void MapCache::FilterBatonClosed(uv_handle_t *handle) {
+  FilterBaton *baton = static_cast<FilterBaton*>(handle->data);
+  baton->callback.Dispose();
   delete baton;
-  return;
+}
+
+Local<Object> MapCache::ExistenceFilterStatsObject() {
+  HandleScope scope;
+
+  Local<Object> stats = Object::New();
+  stats->Set(String::NewSymbol("ready"), Boolean::New(existence_filter->ready));
+  stats->Set(String::NewSymbol("buildTime"), Number::New(existence_filter->build_time));
+  stats->Set(String::NewSymbol("rendersActive"), Uint32::New(renders_active));
+  stats->Set(String::NewSymbol("renderQueue"), Uint32::New(render_queue.size()));
+
+  Local<Object> layers = Object::New();
+  for (std::map<std::string, ExistenceFilter::Layer*>::const_iterator it = existence_filter->layers.begin();
+       it != existence_filter->layers.end();
+       ++it) {
+    Local<Object> layer = Object::New();
+    layer->Set(String::NewSymbol("tiles"), Uint32::New(it->second->count));
+    layer->Set(String::NewSymbol("walked"), Boolean::New(!it->second->directory.empty()));
+    layer->Set(String::NewSymbol("falsePositiveRate"),
+               Number::New(existence_filter->FalsePositiveRate(it->second)));
+    layers->Set(String::New(it->first.c_str()), layer);
+  }
+  stats->Set(String::NewSymbol("layers"), layers);
+
+  return scope.Close(stats);
+}
+
+/**
+ * @details Bodies are shared by the body store if it is enabled and accepts
+ * the size, otherwise a new `Buffer` is created.
+ *
+ * @param data The response body.
+ *
+ * @param size The size of the body.
+ *
+ * @param hash The hash of the body if it has already been computed, or
+ * `NULL`.
+ */
+Local<Object> MapCache::BodyBuffer(const char *data, size_t size, const uint64_t *hash) {
+  HandleScope scope;
+
+  if (body_store && body_store->Accepts(size)) {
+    return scope.Close(body_store->Intern(data, size, (hash) ? *hash : BodyStore::Hash(data, size)));
+  }
+  return scope.Close(Local<Object>::New(Buffer::New((char *) data, size)->handle_));
+}
+
+/**
+ * @details A tile that used the render lane was rendered as part of a
+ * metatile, all of which has now been stored, so every tile in the metatile
+ * is recorded.
+ *
+ * @param baton The completed request.
+ */
+void MapCache::RecordCachedTile(const RequestBaton *baton) {
+  const TileKey &tile = baton->tile;
+  if (!baton->render_lane) {
+    existence_filter->Insert(baton->layer, tile.z, tile.x, tile.y);
+    return;
+  }
+
+  const mapcache_extent_i &limits = tile.grid_link->grid_limits[tile.z];
+  int metasize_x = tile.tileset->metasize_x, metasize_y = tile.tileset->metasize_y;
+  int minx = (tile.x / metasize_x) * metasize_x, miny = (tile.y / metasize_y) * metasize_y;
+
+  for (int x = minx; x < minx + metasize_x && x < limits.maxx; x++) {
+    for (int y = miny; y < miny + metasize_y && y < limits.maxy; y++) {
+      if (x >= limits.minx && y >= limits.miny) {
+        existence_filter->Insert(baton->layer, tile.z, x, y);
+      }
+    }
+  }
+}
+
+/**
+ * @details The request is dispatched in the Node/V8 thread using the scratch
+ * pool in order to determine whether it is a request for a single tile.  Only
+ * tiles without dimensions that are requested in their native format are
+ * identified: these are the tiles that can be safely answered from an index.
+ *
+ * @param pathInfo The `PATH_INFO` data for the cache request.
+ *
+ * @param queryString The `QUERY_STRING` data for the cache request.
+ *
+ * @param key Populated with the tile location if a tile is identified.
+ *
+ * @return `true` if the request is for a single tile.
+ */
+bool MapCache::IdentifyTile(const char *pathInfo, const char *queryString, TileKey *key) {
+  if (!scratch_pool && apr_pool_create(&scratch_pool, global_pool) != APR_SUCCESS) {
+    scratch_pool = NULL;
+    return false;
+  }
+
+  bool found = false;
+  mapcache_context *ctx = (mapcache_context *)CreateRequestContext(scratch_pool, this, NULL);
+  if (ctx) {
+    mapcache_request *request = NULL;
+    apr_table_t *params = mapcache_http_parse_param_string(ctx, (char*) queryString);
+
+    // a lazy configuration isn't set up here as that would block
+    ctx->config = (config->lazy) ? config->lazy->Initialised(pathInfo, params) : config->cfg;
+    if (ctx->config) {
+      mapcache_service_dispatch_request(ctx, &request, (char*) pathInfo, params, ctx->config);
+    }
+    if (ctx->config && !GC_HAS_ERROR(ctx) && request && request->type == MAPCACHE_REQUEST_GET_TILE) {
+      mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
+      if (req_tile->ntiles == 1) {
+        mapcache_tile *tile = req_tile->tiles[0];
+        if (apr_is_empty_table(tile->dimensions)
+            && (!req_tile->format || req_tile->format == tile->tileset->format)) {
+          key->tileset = tile->tileset;
+          key->grid_link = tile->grid_link;
+          key->x = tile->x;
+          key->y = tile->y;
+          key->z = tile->z;
+          key->service = (request->service) ? request->service->type : NODE_MAPCACHE_ACCESS_NO_SERVICE;
+          found = true;
+        }
+      }
+    }
+  }
+
+  apr_pool_clear(scratch_pool);
+  return found;
+}
+
+/**
+ * @param pathInfo The `PATH_INFO` data for the cache request.
+ *
+ * @param queryString The `QUERY_STRING` data for the cache request.
+ *
+ * @param name Set to the tileset name if one is identified.
+ *
+ * @return `true` if the request names a single tileset.
+ */
+bool MapCache::IdentifyTileset(const char *pathInfo, const char *queryString, std::string &name) {
+  if (!scratch_pool && apr_pool_create(&scratch_pool, global_pool) != APR_SUCCESS) {
+    scratch_pool = NULL;
+    return false;
+  }
+
+  bool found = false;
+  mapcache_context *ctx = (mapcache_context *)CreateRequestContext(scratch_pool, this, NULL);
+  if (ctx) {
+    apr_table_t *params = mapcache_http_parse_param_string(ctx, (char*) queryString);
+    if (config->lazy) {
+      found = config->lazy->RequestedTileset(pathInfo, params, name);
+    } else {
+      found = LazyConfig::RequestedTileset(pathInfo, params, HasTileset, config->cfg, name);
+    }
+  }
+
+  apr_pool_clear(scratch_pool);
+  return found;
+}
+
+/**
+ * @details The response is returned via the callback as soon as the event
+ * loop is free: callbacks are never called synchronously.
+ *
+ * @param baton The request, with `result` set to the response.
+ *
+ * @param bytes The size of the response data.
+ *
+ * @param flags The `AccessLog::Flags` describing the response.
+ */
+void MapCache::RespondImmediately(RequestBaton *baton, size_t bytes, uint8_t flags) {
+  MapCache *cache = baton->cache;
+
+  if (cache->access_log) {
+    AccessLog::Record record;
+    memset(&record, 0, sizeof(record));
+    record.time = baton->time;
+    record.work_us = (uv_hrtime() - baton->start) / 1000;
+    record.bytes = bytes;
+    record.status = 200;
+    record.service = baton->tile.service;
+    record.flags = flags;
+    AccessLog::SetTile(record, baton->tile.tileset->name, baton->tile.grid_link->grid->name,
+                       baton->tile.z, baton->tile.x, baton->tile.y);
+    cache->access_log->Push(record);
+  }
+
+  immediate_queue.push(baton);
+  uv_ref((uv_handle_t *) &immediate_async); // ensure the response is returned
+  uv_async_send(&immediate_async);
+}
+
+/**
+ * @details Keys are qualified by the configuration file so that caches for
+ * different configurations can share a file.
+ *
+ * @param layer The name of the layer containing the tile.
+ *
+ * @param key The location of the tile.
+ */
+std::string MapCache::SharedKey(const std::string &layer, const TileKey &key) const {
+  char coords[64];
+  apr_snprintf(coords, sizeof(coords), "/%d/%d/%d", key.z, key.x, key.y);
+  return SharedPrefix(layer) + coords;
+}
+
+/**
+ * @details This runs in the thread pool once the original tile has been
+ * retrieved.  The variant is taken from memory or disk if it was transcoded
+ * from the same tile, otherwise the tile is transcoded and the variant
+ * cached.  Tiles already in the format, formats that don't exist and tiles
+ * that can't be transcoded are returned unchanged, as are tiles with
+ * dimensions, which the variant key doesn't identify.
+ *
+ * @param ctx The context of the request.
+ *
+ * @param baton The request, with `transcoded` and `has_variant` set on
+ * success.
+ *
+ * @param req_tile The tile request.
+ *
+ * @param response The response containing the original tile.
+ */
+void MapCache::TranscodeTile(mapcache_context *ctx, RequestBaton *baton,
+                             mapcache_request_get_tile *req_tile, mapcache_http_response *response) {
+  if (req_tile->ntiles != 1) {
+    return;
+  }
+  mapcache_tile *tile = req_tile->tiles[0];
+  if (tile->dimensions && !apr_is_empty_table(tile->dimensions)) {
+    return;
+  }
+  mapcache_image_format *format = mapcache_configuration_get_image_format(ctx->config,
+                                                                          baton->variant_format.c_str());
+  if (!format) {
+    return;
+  }
+  if (baton->variant_quality && format->type == GC_JPEG) {
+    format = mapcache_imageio_create_jpeg_format(ctx->pool, format->name, baton->variant_quality,
+                                                 ((mapcache_image_format_jpeg *) format)->photometric);
+  }
+  if (format == tile->tileset->format) {
+    return;
+  }
+
+  VariantCache *variants = baton->cache->variant_cache;
+  VariantCache::Variant &variant = baton->transcoded;
+  std::string key = VariantCache::Key(std::string(tile->tileset->name) + "@" + tile->grid_link->grid->name,
+                                      tile->z, tile->x, tile->y, baton->variant);
+  if (variants->Get(key, variant) && variant.mtime == response->mtime) {
+    baton->has_variant = true;
+    return;
+  }
+
+  variant.content_type = format->mime_type;
+  variant.mtime = response->mtime;
+  if (variants->Load(key, response->mtime, variant)) {
+    variants->Put(key, variant, false);
+  } else if (variants->Transcode(ctx, response->data, format, variant.data)) {
+    variants->Put(key, variant, true);
+  } else {
+    return;
+  }
+  baton->has_variant = true;
+}
+
+/**
+ * @param result The response object, which has a `headers` property.
+ *
+ * @param vary The header value, or empty to leave the headers unchanged.
+ */
+void MapCache::SetVaryHeader(Handle<Object> result, const std::string &vary) {
+  if (vary.empty()) {
+    return;
+  }
+  Local<Array> values = Array::New(1);
+  values->Set(0, String::New(vary.c_str()));
+  result->Get(headers_symbol)->ToObject()->Set(String::New("Vary"), values);
+}
+
+/**
+ * @details This mirrors the headers generated by the mapcache core for a tile
+ * request.  It is used for tiles that are returned without involving the
+ * mapcache core.
+ *
+ * @param buffer The `Buffer` containing the tile data.
+ *
+ * @param size The size of the tile data in bytes.
+ *
+ * @param content_type The MIME type of the tile data.
+ *
+ * @param mtime The tile modification time.
+ *
+ * @param key The location of the tile.
+ */
+Local<Object> MapCache::TileResponse(Handle<Object> buffer, size_t size, const char *content_type,
+                                     apr_time_t mtime, const TileKey &key) {
+  HandleScope scope;
+  char date[APR_RFC822_DATE_LEN], max_age[32];
+
+  Local<Object> result = Object::New();
+  result->Set(code_symbol, Integer::New(200));
+  result->Set(mtime_symbol, Date::New(apr_time_as_msec(mtime)));
+  result->Set(data_symbol, buffer);
+
+  Local<Object> headers = Object::New();
+  Local<Array> values = Array::New(1);
+  values->Set(0, String::New(content_type));
+  headers->Set(String::New("Content-Type"), values);
+
+  if (key.tileset->expires) {
+    values = Array::New(1);
+    apr_snprintf(max_age, sizeof(max_age), "max-age=%d", key.tileset->expires);
+    values->Set(0, String::New(max_age));
+    headers->Set(String::New("Cache-Control"), values);
+
+    apr_rfc822_date(date, apr_time_now() + apr_time_from_sec(key.tileset->expires));
+    values = Array::New(1);
+    values->Set(0, String::New(date));
+    headers->Set(String::New("Expires"), values);
+  }
+
+  apr_rfc822_date(date, mtime);
+  values = Array::New(1);
+  values->Set(0, String::New(date));
+  headers->Set(String::New("Last-Modified"), values);
+
+  values = Array::New(1);
+  values->Set(0, Uint32::New(size));
+  headers->Set(String::New("Content-Length"), values);
+
+  result->Set(headers_symbol, headers);
+  return scope.Close(result);
+}
+
+/**
+ * @details A tile is considered blank if it decodes to a single colour.  Only
+ * small responses are decoded as blank tiles compress extremely well: this
+ * keeps the overhead for ordinary tiles negligible.
+ *
+ * This is called from a thread pool thread.
+ *
+ * @param ctx The request context.
+ *
+ * @param response The response to a single tile request.
+ */
+bool MapCache::IsBlankResponse(mapcache_context *ctx, mapcache_http_response *response) {
+  if (response->code != 200 || !response->data
+      || !response->data->size || response->data->size > NODE_MAPCACHE_BLANK_MAX_SIZE) {
+    return false;
+  }
+
+  bool blank = false;
+  mapcache_image *image = mapcache_imageio_decode(ctx, response->data);
+  if (image && !GC_HAS_ERROR(ctx)) {
+    blank = (mapcache_image_blank_color(image) != MAPCACHE_FALSE);
+  }
+  ctx->clear_errors(ctx);
+  return blank;
 }
 
 /**
@@ -462,6 +4212,8 @@ void MapCache::FromConfigFileWork(uv_work_t *req) {
 
   ConfigBaton *baton = static_cast<ConfigBaton*>(req->data);
   config_context *config = baton->config;
+  uint64_t start = uv_hrtime();
+  size_t heap = HeapInUse();
 
   // create the context for loading the configuration
   mapcache_context *ctx = (mapcache_context*) CreateRequestContext(config->pool, baton->cache, baton->async_log);
@@ -474,6 +4226,19 @@ void MapCache::FromConfigFileWork(uv_work_t *req) {
   ctx->log(ctx, MAPCACHE_DEBUG, (char *)"mapcache node conf file: %s", baton->conffile.c_str());
 #endif
 
+  // only index a lazy configuration: tilesets are set up when requested
+  if (baton->lazy) {
+    config->lazy = new LazyConfig(baton->conffile, CreateWriteContext);
+    if (!config->lazy->Index(baton->error)) {
+      return;
+    }
+    config->cfg = NULL;
+    size_t used = HeapInUse();
+    config->memory = (used > heap) ? used - heap : 0;
+    config->load_time = uv_hrtime() - start;
+    return;
+  }
+
   // parse the configuration file
   mapcache_configuration_parse(ctx, baton->conffile.c_str(), config->cfg, 1);
   if(GC_HAS_ERROR(ctx)) {
@@ -490,9 +4255,31 @@ void MapCache::FromConfigFileWork(uv_work_t *req) {
     return;
   }
 
+  size_t used = HeapInUse();
+  config->memory = (used > heap) ? used - heap : 0;
+  config->load_time = uv_hrtime() - start;
   return;
 }
 
+/**
+ * @details This is used to estimate the memory used by a configuration: it
+ * includes memory allocated by other threads so is only an approximation
+ * while requests are being handled.
+ *
+ * @return The number of bytes allocated from the heap.
+ */
+size_t MapCache::HeapInUse() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+  struct mallinfo info = mallinfo();
+  return (size_t) (unsigned int) info.uordblks + (size_t) (unsigned int) info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
 /**
  * @details This is set by `FromConfigFileAsync` to run after
  * `FromConfigFileWork` has finished, being passed the response
@@ -511,6 +4298,9 @@ void MapCache::FromConfigFileAfter(uv_work_t *req) {
   if (baton->async_log) baton->async_log->close(); // finish with the logger
 
   if (!baton->error.empty()) {
+    if (baton->config->lazy) {
+      delete baton->config->lazy;
+    }
     apr_pool_destroy(baton->config->pool); // free the memory
     argv[0] = Exception::Error(String::New(baton->error.c_str()));
     argv[1] = Undefined();
@@ -615,7 +4405,8 @@ MapCache::request_context* MapCache::CreateRequestContext(apr_pool_t *pool, MapC
 /**
  * @details This is set as a function pointer to the context created
  * by `CreateRequestContext`. It is called by the wrapped mapcache
- * library when required.
+ * library when required.  Clones are used by other threads so each is given
+ * a pool with its own allocator.
  *
  * @param ctxt The mapcache context to clone.
  */
@@ -624,7 +4415,7 @@ mapcache_context* MapCache::CloneRequestContext(mapcache_context *ctx) {
                                                             sizeof(request_context));
   request_context *rctx = (request_context *) newctx;
   mapcache_context_copy(ctx,newctx);
-  if (apr_pool_create(&newctx->pool,ctx->pool) != APR_SUCCESS) {
+  if (MemoryMeter::CreatePool(&newctx->pool,ctx->pool) != APR_SUCCESS) {
     return NULL;
   }
   rctx->cache = ((request_context *) ctx)->cache;
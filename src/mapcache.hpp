@@ -39,6 +39,12 @@
 // Standard headers
 #include <string>
 #include <queue>
+#include <deque>
+#include <map>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
 
 // Node headers
 #include <v8.h>
@@ -57,6 +63,29 @@ extern "C" {
 #include "mapcache.h"
 }
 
+// Module headers
+#include "blankindex.hpp"
+#include "existencefilter.hpp"
+#include "writebehind.hpp"
+#include "accesslog.hpp"
+#include "sharedcache.hpp"
+#include "revalidator.hpp"
+#include "profiler.hpp"
+#include "probes.hpp"
+#include "exporter.hpp"
+#include "invalidator.hpp"
+#include "sourceguard.hpp"
+#include "connectionpool.hpp"
+#include "memorymeter.hpp"
+#include "bodystore.hpp"
+#include "mapassembler.hpp"
+#include "responsecache.hpp"
+#include "hottiles.hpp"
+#include "warmer.hpp"
+#include "lazyconfig.hpp"
+#include "variantcache.hpp"
+#include "disksweeper.hpp"
+
 /// Define a permanent, read only javascript constant
 #define NODE_MAPCACHE_CONSTANT(TARGET, NAME, CONSTANT)                  \
   (TARGET)->Set(String::NewSymbol(#NAME),                               \
@@ -105,6 +134,23 @@ extern "C" {
   Local<Object> VAR;        \
   ASSIGN_OBJ_ARG(I, VAR);
 
+/// Assign an optional numeric property of an options object to a variable
+#define ASSIGN_NUM_OPTION(OPTIONS, NAME, VAR)                               \
+  if (!(OPTIONS).IsEmpty() && (OPTIONS)->Has(String::NewSymbol(#NAME))) {   \
+    Local<Value> _option = (OPTIONS)->Get(String::NewSymbol(#NAME));        \
+    if (!_option->IsNumber())                                               \
+      THROW_CSTR_ERROR(TypeError,                                           \
+                       "Option `" #NAME "` must be a number");              \
+    VAR = _option->NumberValue();                                           \
+  }
+
+/// Create a variable for the loaded full configuration of a `MapCache` instance
+#define REQ_FULL_CONFIG(CACHE, VAR)                           \
+  std::string VAR##_error;                                    \
+  mapcache_cfg *VAR = (CACHE)->Config(VAR##_error);           \
+  if (!VAR)                                                   \
+    THROW_CSTR_ERROR(Error, VAR##_error.c_str());
+
 using namespace node;
 using namespace v8;
 
@@ -131,6 +177,132 @@ public:
   /// Request a resource from the cache
   static Handle<Value> GetAsync(const Arguments& args);
 
+  /// Enable the index of blank tiles
+  static Handle<Value> EnableBlankIndex(const Arguments& args);
+
+  /// Write the index of blank tiles to disk
+  static Handle<Value> SaveBlankIndexAsync(const Arguments& args);
+
+  /// Enable the filter recording which tiles exist in the cache
+  static Handle<Value> EnableExistenceFilter(const Arguments& args);
+
+  /// Return statistics describing the existence filter
+  static Handle<Value> ExistenceFilterStats(const Arguments& args);
+
+  /// Enable storing tiles in a background thread
+  static Handle<Value> EnableWriteBehind(const Arguments& args);
+
+  /// Return statistics describing the background writer
+  static Handle<Value> WriteBehindStats(const Arguments& args);
+
+  /// Wait for the background writer to store all queued tiles
+  static Handle<Value> FlushWritesAsync(const Arguments& args);
+
+  /// Set the minimum level of log messages passed to the logger
+  static Handle<Value> SetLogLevel(const Arguments& args);
+
+  /// Enable the binary access log
+  static Handle<Value> EnableAccessLog(const Arguments& args);
+
+  /// Attach to a tile cache in shared memory
+  static Handle<Value> AttachSharedCache(const Arguments& args);
+
+  /// Return statistics describing the shared memory cache
+  static Handle<Value> SharedCacheStats(const Arguments& args);
+
+  /// Serve expired tiles while refreshing them in the background
+  static Handle<Value> EnableRevalidation(const Arguments& args);
+
+  /// Return statistics describing tile revalidation
+  static Handle<Value> RevalidationStats(const Arguments& args);
+
+  /// Limit the concurrency of sources and fail fast when they are unhealthy
+  static Handle<Value> EnableSourceGuard(const Arguments& args);
+
+  /// Return statistics describing each guarded source
+  static Handle<Value> SourceGuardStats(const Arguments& args);
+
+  /// Keep connections to WMS sources open between requests
+  static Handle<Value> EnableConnectionReuse(const Arguments& args);
+
+  /// Return statistics describing connection reuse
+  static Handle<Value> ConnectionReuseStats(const Arguments& args);
+
+  /// Group concurrent single tile requests by metatile
+  static Handle<Value> EnableMetatileCoalescing(const Arguments& args);
+
+  /// Return statistics describing metatile coalescing
+  static Handle<Value> MetatileCoalescingStats(const Arguments& args);
+
+  /// Profile the phases of requests for a period
+  static Handle<Value> ProfileAsync(const Arguments& args);
+
+  /// Export cached tiles to an MBTiles file
+  static Handle<Value> ExportAsync(const Arguments& args);
+
+  /// Delete the cached tiles within a zoom range and extent
+  static Handle<Value> InvalidateAsync(const Arguments& args);
+
+  /// Return statistics describing the loaded configuration
+  static Handle<Value> ConfigStats(const Arguments& args);
+
+  /// Load the full configuration of a lazy instance in the thread pool
+  static Handle<Value> LoadConfigAsync(const Arguments& args);
+
+  /// Set the maximum memory a single request may use
+  static Handle<Value> SetRequestMemoryLimit(const Arguments& args);
+
+  /// Return statistics describing the memory held by the instance
+  static Handle<Value> MemoryStats(const Arguments& args);
+
+  /// Share a single `Buffer` between responses with identical bodies
+  static Handle<Value> EnableBodySharing(const Arguments& args);
+
+  /// Return statistics describing body sharing
+  static Handle<Value> BodySharingStats(const Arguments& args);
+
+  /// Assemble WMS maps using several threads
+  static Handle<Value> EnableParallelAssembly(const Arguments& args);
+
+  /// Return statistics describing parallel map assembly
+  static Handle<Value> ParallelAssemblyStats(const Arguments& args);
+
+  /// Cache proxied and `GetFeatureInfo` responses in memory
+  static Handle<Value> EnableResponseCache(const Arguments& args);
+
+  /// Return statistics describing the response cache
+  static Handle<Value> ResponseCacheStats(const Arguments& args);
+
+  /// Identify the single tile requested by a URL
+  static Handle<Value> GetTileKey(const Arguments& args);
+
+  /// Identify the single tileset requested by a URL
+  static Handle<Value> GetTilesetName(const Arguments& args);
+
+  /// Enable the record of the most requested tiles
+  static Handle<Value> EnableHotTiles(const Arguments& args);
+
+  /// Write the record of the most requested tiles to disk
+  static Handle<Value> SaveHotTilesAsync(const Arguments& args);
+
+  /// Return statistics describing the record of the most requested tiles
+  static Handle<Value> HotTilesStats(const Arguments& args);
+
+  /// Prefetch the most requested tiles into the cache
+  static Handle<Value> WarmupAsync(const Arguments& args);
+
+  /// Enable tiles to be transcoded into other formats
+  static Handle<Value> EnableFormatVariants(const Arguments& args);
+
+  /// Return statistics describing the transcoded tiles
+  static Handle<Value> FormatVariantStats(const Arguments& args);
+
+  /// Start pruning the disk caches in the background
+  static Handle<Value> EnableDiskSweeper(const Arguments& args);
+
+  /// Return statistics describing the disk cache pruning
+  static Handle<Value> DiskSweeperStats(const Arguments& args);
+
   /// Free up the class memory
   static void Destroy();
 
@@ -163,10 +335,23 @@ private:
   /// The per-process thread mutex
   static apr_thread_mutex_t *thread_mutex;
 
+  /// A memory pool used for short lived allocations in the Node/V8 thread
+  static apr_pool_t *scratch_pool;
+
+  /// The handle used to return responses that don't need the thread pool
+  static uv_async_t immediate_async;
+
   /// An association of a mapcache configuration and memory pool
   struct config_context {
+    /// The configuration, `NULL` until a lazy configuration is fully loaded
     mapcache_cfg *cfg;
     apr_pool_t *pool;
+    /// The configuration loaded a tileset at a time, if lazy
+    LazyConfig *lazy;
+    /// The estimated memory allocated while loading the configuration in bytes
+    size_t memory;
+    /// The time taken to load the configuration in nanoseconds
+    uint64_t load_time;
   };
 
   /// The unique per-instance cache context
@@ -175,6 +360,57 @@ private:
   /// A handle to an optional `EventEmitter` used for logging
   Persistent<Object> logger;
 
+  /// The optional index of blank tiles
+  BlankIndex *blank_index;
+
+  /// The optional filter recording which tiles exist in the cache
+  ExistenceFilter *existence_filter;
+
+  /// The optional background tile writer
+  WriteBehind *write_behind;
+
+  /// The optional binary access log
+  AccessLog *access_log;
+
+  /// The optional tile cache in shared memory
+  SharedCache *shared_cache;
+
+  /// The optional revalidator of expired tiles
+  Revalidator *revalidator;
+
+  /// The optional concurrency limits and circuit breakers of sources
+  SourceGuard *source_guard;
+
+  /// The optional persistent connections to WMS sources
+  ConnectionPool *connection_pool;
+
+  /// The optional store of response bodies shared between responses
+  BodyStore *body_store;
+
+  /// The optional assembler of WMS maps using several threads
+  MapAssembler *map_assembler;
+
+  /// The optional cache of proxied and `GetFeatureInfo` responses
+  ResponseCache *response_cache;
+
+  /// The optional record of the most requested tiles
+  HotTiles *hot_tiles;
+
+  /// The optional cache of tiles transcoded into other formats
+  VariantCache *variant_cache;
+
+  /// The optional pruner of the disk caches
+  DiskSweeper *disk_sweeper;
+
+  /// The location of a single tile in a tileset
+  struct TileKey {
+    mapcache_tileset *tileset;
+    mapcache_grid_link *grid_link;
+    int x, y, z;
+    /// The `mapcache_service_type` of the request
+    int service;
+  };
+
   /// The structure used when performing asynchronous operations
   struct Baton {
     /// The asynchronous request
@@ -201,8 +437,165 @@ private:
     std::string queryString;
     /// The mapcache response to the request
     mapcache_http_response *response;
+    /// The time the request was received
+    apr_time_t time;
+    /// The high resolution time the request was received
+    uint64_t start;
+    /// Set if the request is for a single tile identified by `tile`
+    bool has_tile;
+    /// The tile requested, if `has_tile` is set
+    TileKey tile;
+    /// The name of the layer containing `tile`
+    std::string layer;
+    /// Set if the tile is not cached and the request uses the render lane
+    bool render_lane;
+    /// The key of the metatile containing `tile`, if requests are coalesced
+    std::string metatile;
+    /// Set if other requests for `metatile` wait for this one
+    bool leads_metatile;
+    /// Set if the response is a blank tile
+    bool is_blank;
+    /// The value of `invalidation_epoch` when the request was received
+    uint32_t epoch;
+    /// The memory reserved for the request by `memory_meter`
+    size_t reserved;
+    /// Set if `body_hash` has been computed
+    bool has_body_hash;
+    /// The hash of the response body, used by `body_store`
+    uint64_t body_hash;
+    /// The identity of the request in `response_cache`
+    ResponseCache::Key response_key;
+    /// The name of the format variant requested, if any
+    std::string variant;
+    /// The image format of the variant
+    std::string variant_format;
+    /// The JPEG quality of the variant, or zero for that of the format
+    int variant_quality;
+    /// The tile transcoded into the variant, if `has_variant` is set
+    VariantCache::Variant transcoded;
+    /// Set if the response data is replaced by `transcoded`
+    bool has_variant;
+    /// The request headers the response varies on, if any
+    std::string vary;
+    /// A response that was created without using the thread pool
+    Persistent<Object> result;
+  };
+
+  /// A Baton specifically used when saving the blank tile index or hot tiles
+  struct SaveBaton : Baton {
+    /// The file path of the index or record
+    std::string path;
+    /// The serialised index or record
+    std::string data;
+  };
+
+  /// A layer directory from which the blank tile index is seeded
+  struct BlankSeed {
+    /// The layer name (`tileset@grid`)
+    std::string name;
+    /// The directory containing the layer tiles
+    std::string directory;
+    /// The MIME type of the layer tiles
+    std::string content_type;
+  };
+
+  /// A Baton specifically used when seeding the blank tile index
+  struct SeedBaton : Baton {
+    /// The layer directories to seed from
+    std::vector<BlankSeed> layers;
+    /// The index being seeded, merged once complete
+    BlankIndex *seeds;
+    /// The number of tiles seeded
+    uint64_t seeded;
+    /// The invalidation epoch when seeding started
+    uint32_t epoch;
+  };
+
+  /// A Baton specifically used when building the existence filter
+  struct FilterBaton : Baton {
+    /// The filter being built
+    ExistenceFilter *filter;
+    /// The thread in which the filter is built
+    uv_thread_t thread;
+    /// The handle signalling that the filter has been built
+    uv_async_t async;
+  };
+
+  /// A Baton specifically used when refreshing an expired tile
+  struct RefreshBaton : Baton {
+    /// The refresh being run
+    Revalidator::Refresh *refresh;
+    /// The high resolution time the refresh was dispatched
+    uint64_t start;
+  };
+
+  /// A Baton specifically used when exporting tiles
+  struct ExportBaton : Baton {
+    /// The exporter doing the work
+    TileExporter *exporter;
   };
 
+  /// A Baton specifically used when prefetching tiles
+  struct WarmupBaton : Baton {
+    /// The warmer doing the work
+    TileWarmer *warmer;
+  };
+
+  /// A Baton specifically used when invalidating tiles
+  struct InvalidateBaton : Baton {
+    /// The invalidator doing the work
+    TileInvalidator *invalidator;
+    /// The optional function receiving progress reports
+    Persistent<Function> progress;
+    /// The timer reporting progress
+    uv_timer_t timer;
+  };
+
+  /// A Baton specifically used when profiling requests
+  struct ProfileBaton : Baton {
+    /// The timer ending the profile
+    uv_timer_t timer;
+  };
+
+  /// The requests waiting to be returned by `GetRequestImmediate`
+  static std::queue<RequestBaton *> immediate_queue;
+
+  /// The maximum number of requests using the render lane at once
+  unsigned int render_limit;
+
+  /// The number of requests currently using the render lane
+  unsigned int renders_active;
+
+  /// The minimum level of log messages passed to the logger
+  volatile mapcache_log_level log_level;
+
+  /// The requests waiting to use the render lane
+  std::deque<RequestBaton *> render_queue;
+
+  /// Set if single tile requests are grouped by metatile
+  bool coalesce_metatiles;
+
+  /// The requests waiting for another request for the same metatile, keyed on metatile
+  std::map<std::string, std::vector<RequestBaton *> > metatile_jobs;
+
+  /// The number of requests that have waited for another request
+  uint64_t coalesced;
+
+  /// The number of requests not coalesced as their tiles are probably cached
+  uint64_t coalesce_bypassed;
+
+  /// Times the phases of requests when running
+  Profiler profiler;
+
+  /// Accounts for the memory held by requests
+  MemoryMeter memory_meter;
+
+  /// The number of invalidations currently running
+  unsigned int invalidations_active;
+
+  /// Incremented as each invalidation finishes
+  uint32_t invalidation_epoch;
+
   /// A Baton specifically used when instantiating from a config file
   struct ConfigBaton : Baton {
     /// The file path representing the configuration file
@@ -211,11 +604,41 @@ private:
     config_context *config;
     /// The optional `EventEmitter` used for logging
     Persistent<Object> logger;
+    /// Set if the configuration is loaded a tileset at a time
+    bool lazy;
+  };
+
+  /// A Baton specifically used when loading a full lazy configuration
+  struct LoadConfigBaton : Baton {
+    /// The full configuration once loaded
+    mapcache_cfg *cfg;
   };
 
   /// Intantiate a mapcache with a configuration context and optional logger
   MapCache(config_context *config, Local<Object> logger) :
-    config(config)
+    config(config),
+    blank_index(NULL),
+    existence_filter(NULL),
+    write_behind(NULL),
+    access_log(NULL),
+    shared_cache(NULL),
+    revalidator(NULL),
+    source_guard(NULL),
+    connection_pool(NULL),
+    body_store(NULL),
+    map_assembler(NULL),
+    response_cache(NULL),
+    hot_tiles(NULL),
+    variant_cache(NULL),
+    disk_sweeper(NULL),
+    render_limit(1),
+    renders_active(0),
+    log_level(MAPCACHE_DEBUG),
+    coalesce_metatiles(false),
+    coalesced(0),
+    coalesce_bypassed(0),
+    invalidations_active(0),
+    invalidation_epoch(0)
   {
     // should throw an error here if !config
     if (!logger.IsEmpty())
@@ -223,29 +646,187 @@ private:
   }
 
   /// Clear up the configuration context
-  ~MapCache() {
-    if (config && config->pool) {
-      apr_pool_destroy(config->pool);
-      config = NULL;
-    }
-    logger.Dispose();
-  }
+  ~MapCache();
 
   /// Instantiate an object
   static Handle<Value> New(const Arguments& args);
 
+  /// Dispatch a request to the thread pool, or the render lane queue
+  void QueueRequest(RequestBaton *baton);
+
+  /// The key of the metatile containing a tile
+  static std::string MetatileKey(const std::string &layer, const TileKey &key);
+
   /// Perform a query of the cache
   static void GetRequestWork(uv_work_t *req);
 
   /// Return the cache response to the caller
   static void GetRequestAfter(uv_work_t *req);
 
+  /// Return responses that were created in the Node/V8 thread
+  static void GetRequestImmediate(uv_async_t *handle, int status /*UNUSED*/);
+
+  /// Write the blank tile index to disk
+  static void SaveBlankIndexWork(uv_work_t *req);
+
+  /// Return the outcome of writing the blank tile index
+  static void SaveBlankIndexAfter(uv_work_t *req);
+
+  /// Seed the blank tile index from the disk caches
+  static void SeedBlankIndexWork(uv_work_t *req);
+
+  /// Merge the seeded tiles into the blank tile index
+  static void SeedBlankIndexAfter(uv_work_t *req);
+
+  /// Build the existence filter in its own thread
+  static void BuildExistenceFilter(void *arg);
+
+  /// Finish building the existence filter
+  static void BuildExistenceFilterAfter(uv_async_t *handle, int status /*UNUSED*/);
+
+  /// Free the existence filter baton once its handle has closed
+  static void FilterBatonClosed(uv_handle_t *handle);
+
+  /// Create a javascript object describing the existence filter
+  Local<Object> ExistenceFilterStatsObject();
+
+  /// Create a `Buffer` for a response body, shared if possible
+  Local<Object> BodyBuffer(const char *data, size_t size, const uint64_t *hash);
+
+  /// Record a tile (and its metatile if it was rendered) as cached
+  void RecordCachedTile(const RequestBaton *baton);
+
+  /// Add a record describing a request to the access log
+  static void RecordAccess(const RequestBaton *baton, mapcache_request *request, uint64_t work_start);
+
+  /// Export tiles to an MBTiles file
+  static void ExportWork(uv_work_t *req);
+
+  /// Return the outcome of an export
+  static void ExportAfter(uv_work_t *req);
+
+  /// Write the record of the most requested tiles to disk
+  static void SaveHotTilesWork(uv_work_t *req);
+
+  /// Prefetch tiles into the cache
+  static void WarmupWork(uv_work_t *req);
+
+  /// Return the outcome of a warmup
+  static void WarmupAfter(uv_work_t *req);
+
+  /// Parse the tileset, grid, zoom range and extent of a range of tiles
+  static Handle<Value> ParseTileSelection(mapcache_cfg *cfg, Local<Object> options,
+                                          mapcache_tileset **tileset, mapcache_grid_link **grid_link,
+                                          int *minz, int *maxz, bool *has_extent, mapcache_extent *extent);
+
+  /// Parse the limits applied to a source by the source guard
+  static Handle<Value> ParseSourceLimits(Local<Object> options, SourceGuard::Options *limits);
+
+  /// Delete tiles from the cache
+  static void InvalidateWork(uv_work_t *req);
+
+  /// Report the progress of an invalidation
+  static void InvalidateProgress(uv_timer_t *handle, int status /*UNUSED*/);
+
+  /// Return the outcome of an invalidation
+  static void InvalidateAfter(uv_work_t *req);
+
+  /// Free the invalidation baton once its timer has closed
+  static void InvalidateClosed(uv_handle_t *handle);
+
+  /// Report the profile once its duration has elapsed
+  static void ProfileAfter(uv_timer_t *handle, int status /*UNUSED*/);
+
+  /// Free the profile baton once its timer has closed
+  static void ProfileClosed(uv_handle_t *handle);
+
+  /// Dispatch queued tile refreshes to the thread pool
+  static void DispatchRefreshes(uv_async_t *handle, int status /*UNUSED*/);
+
+  /// Refresh an expired tile
+  static void RefreshWork(uv_work_t *req);
+
+  /// Finish refreshing an expired tile
+  static void RefreshAfter(uv_work_t *req);
+
+  /// Wait for queued tiles to be written
+  static void FlushWritesWork(uv_work_t *req);
+
+  /// Return once queued tiles have been written
+  static void FlushWritesAfter(uv_work_t *req);
+
+  /// Create a context for the background writer
+  static mapcache_context* CreateWriteContext(apr_pool_t *pool) {
+    return (mapcache_context *) CreateRequestContext(pool, NULL, NULL);
+  }
+
+  /// Identify the tile requested by a URL, if any
+  bool IdentifyTile(const char *pathInfo, const char *queryString, TileKey *key);
+
+  /// Identify the single tileset requested by a URL, if any
+  bool IdentifyTileset(const char *pathInfo, const char *queryString, std::string &name);
+
+  /// Check whether a tileset is in a configuration
+  static bool HasTileset(const std::string &name, void *cfg) {
+    return mapcache_configuration_get_tileset((mapcache_cfg *) cfg, name.c_str()) != NULL;
+  }
+
+  /// Create a javascript response for a tile bypassing the mapcache core
+  static Local<Object> TileResponse(Handle<Object> buffer, size_t size, const char *content_type,
+                                    apr_time_t mtime, const TileKey &key);
+
+  /// Return a response created in the Node/V8 thread
+  static void RespondImmediately(RequestBaton *baton, size_t bytes, uint8_t flags);
+
+  /// The key of a tile in the shared memory cache
+  std::string SharedKey(const std::string &layer, const TileKey &key) const;
+
+  /// The prefix of the shared memory cache keys of a layer
+  std::string SharedPrefix(const std::string &layer) const {
+    return std::string(ConfigFile()) + "#" + layer;
+  }
+
+  /// The location of the configuration file
+  const char* ConfigFile() const {
+    if (config->lazy) {
+      return config->lazy->path.c_str();
+    }
+    return (config->cfg->configFile) ? config->cfg->configFile : "";
+  }
+
+  /// The full configuration, loading it first if it is lazy
+  mapcache_cfg* Config(std::string &error);
+
+  /// Check whether a tile response represents a blank tile
+  static bool IsBlankResponse(mapcache_context *ctx, mapcache_http_response *response);
+
+  /// Transcode a tile response into the variant requested
+  static void TranscodeTile(mapcache_context *ctx, RequestBaton *baton,
+                            mapcache_request_get_tile *req_tile, mapcache_http_response *response);
+
+  /// Set the `Vary` header of a javascript response
+  static void SetVaryHeader(Handle<Object> result, const std::string &vary);
+
+  /// The name of the blank index layer containing a tile
+  static std::string LayerName(const TileKey &key) {
+    return std::string(key.tileset->name) + "@" + key.grid_link->grid->name;
+  }
+
   /// Create a mapcache configuration context from a file path
   static void FromConfigFileWork(uv_work_t *req);
 
+  /// The number of bytes currently allocated from the heap
+  static size_t HeapInUse();
+
   /// Return the cache response to the caller
   static void FromConfigFileAfter(uv_work_t *req);
 
+  /// Load the full lazy configuration
+  static void LoadConfigWork(uv_work_t *req);
+
+  /// Return the outcome of loading the full configuration
+  static void LoadConfigAfter(uv_work_t *req);
+
   /// Create a new mapcache configuration context.
   static config_context* CreateConfigContext();
 
@@ -394,6 +975,24 @@ private:
  * This defines a `Local<Object>` variable and then delegates to the
  * `ASSIGN_OBJ_ARG` macro.
 
+ * @def ASSIGN_NUM_OPTION(OPTIONS, NAME, VAR)
+ *
+ * This throws a `TypeError` if the property is present but is not a number.
+ * The variable is left untouched if the property is not present.
+ *
+ * @param OPTIONS A `Local<Object>` which may be empty.
+ * @param NAME The unquoted property name.
+ * @param VAR The variable to assign the value to.
+
+ * @def REQ_FULL_CONFIG(CACHE, VAR)
+ *
+ * This throws an `Error` if the instance was created with a lazy
+ * configuration whose full configuration hasn't been loaded by
+ * `cache.loadConfig()` or a request.
+ *
+ * @param CACHE A pointer to the `MapCache` instance.
+ * @param VAR The name of the `mapcache_cfg` pointer variable to create.
+
  * @def THROW_CSTR_ERROR(TYPE, STR)
  *
  * This returns from the containing function throwing an error of a
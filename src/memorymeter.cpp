@@ -0,0 +1,137 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file memorymeter.cpp
+ * @brief This defines the `MemoryMeter` class.
+ */
+
+#include <apr_allocator.h>
+
+#include "memorymeter.hpp"
+
+MemoryMeter::MemoryMeter() :
+  limit(0),
+  requests(0),
+  peak(0),
+  rejected(0)
+{
+}
+
+/**
+ * @details The allocator is owned by the pool so it is destroyed, freeing
+ * all its memory, along with the pool.  A failed allocation is handled by the
+ * abort function of the parent pool.
+ *
+ * @param pool Set to the new pool.
+ * @param parent The pool whose destruction also destroys the new pool.
+ */
+apr_status_t MemoryMeter::CreatePool(apr_pool_t **pool, apr_pool_t *parent) {
+  apr_allocator_t *allocator;
+  apr_status_t status = apr_allocator_create(&allocator);
+  if (status != APR_SUCCESS) {
+    return status;
+  }
+
+  status = apr_pool_create_ex(pool, parent, NULL, allocator);
+  if (status != APR_SUCCESS) {
+    apr_allocator_destroy(allocator);
+    return status;
+  }
+  apr_allocator_owner_set(allocator, *pool);
+
+  return APR_SUCCESS;
+}
+
+/**
+ * @details Only decoded images are counted as they dominate the memory of
+ * requests that render or assemble tiles.  The estimate is an upper bound:
+ * each tile is assumed to be rendered as part of a metatile.
+ *
+ * @param request The request dispatched by the mapcache core.
+ */
+size_t MemoryMeter::Estimate(mapcache_request *request) {
+  size_t bytes = 0;
+
+  switch (request->type) {
+  case MAPCACHE_REQUEST_GET_TILE: {
+    mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*) request;
+    for (int i = 0; i < req_tile->ntiles; i++) {
+      mapcache_tile *tile = req_tile->tiles[i];
+      mapcache_tileset *tileset = tile->tileset;
+      mapcache_grid *grid = tile->grid_link->grid;
+      size_t width = (size_t) tileset->metasize_x * grid->tile_sx + 2 * tileset->metabuffer;
+      size_t height = (size_t) tileset->metasize_y * grid->tile_sy + 2 * tileset->metabuffer;
+      bytes += (width * height + (size_t) grid->tile_sx * grid->tile_sy) * 4;
+    }
+    break;
+  }
+  case MAPCACHE_REQUEST_GET_MAP: {
+    // each map is assembled from tiles into an image which is then merged
+    mapcache_request_get_map *req_map = (mapcache_request_get_map*) request;
+    for (int i = 0; i < req_map->nmaps; i++) {
+      bytes += (size_t) req_map->maps[i]->width * req_map->maps[i]->height * 4 * 2;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+
+  return bytes;
+}
+
+/**
+ * @param bytes The estimated memory needed by the request.
+ * @return `false` if the estimate exceeds the limit.
+ */
+bool MemoryMeter::Reserve(size_t bytes) {
+  if (limit && bytes > limit) {
+    __sync_fetch_and_add(&rejected, 1);
+    return false;
+  }
+
+  size_t current = __sync_add_and_fetch(&requests, bytes);
+  size_t highest = peak;
+  while (current > highest) {
+    size_t seen = __sync_val_compare_and_swap(&peak, highest, current);
+    if (seen == highest) {
+      break;
+    }
+    highest = seen;
+  }
+
+  return true;
+}
+
+/**
+ * @param bytes The memory reserved by `Reserve`.
+ */
+void MemoryMeter::Release(size_t bytes) {
+  __sync_fetch_and_sub(&requests, bytes);
+}
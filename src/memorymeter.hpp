@@ -0,0 +1,95 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_MEMORY_METER_H__
+#define __NODE_MAPCACHE_MEMORY_METER_H__
+
+/**
+ * @file memorymeter.hpp
+ * @brief This declares the `MemoryMeter` class.
+ */
+
+// Standard headers
+#include <stdint.h>
+#include <stddef.h>
+
+// Apache headers
+#include <apr_pools.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief An account of the memory held by the requests of a cache
+ *
+ * Each request is given a memory pool with its own APR allocator, so the
+ * memory of a large request is returned to the system when it completes
+ * instead of being kept on the free list shared by every request.  Before a
+ * request is handled by the mapcache core the memory needed for its images
+ * is estimated and reserved: a request whose estimate exceeds the per-request
+ * limit fails without being handled.  This is an admission check based on an
+ * estimate, not a bound on the memory a request actually allocates: the
+ * allocations themselves are not limited.
+ *
+ * The counters are updated atomically so the meter can be shared by every
+ * thread without locking.
+ */
+class MemoryMeter {
+public:
+
+  /// Intantiate a meter without a limit
+  MemoryMeter();
+
+  /// Create a request memory pool with its own allocator
+  static apr_status_t CreatePool(apr_pool_t **pool, apr_pool_t *parent);
+
+  /// Estimate the memory needed by the images of a request in bytes
+  static size_t Estimate(mapcache_request *request);
+
+  /// Reserve memory for a request, failing if it exceeds the limit
+  bool Reserve(size_t bytes);
+
+  /// Release the memory reserved for a request
+  void Release(size_t bytes);
+
+  /// The maximum estimated memory of a single request in bytes, or 0
+  size_t limit;
+
+  /// The estimated memory currently reserved by requests in bytes
+  volatile size_t requests;
+
+  /// The greatest value of `requests`
+  volatile size_t peak;
+
+  /// The number of requests that exceeded the limit
+  volatile uint64_t rejected;
+};
+
+#endif  /* __NODE_MAPCACHE_MEMORY_METER_H__ */
@@ -100,6 +100,18 @@ extern "C" {
     NODE_MAPCACHE_CONSTANT(logLevels, EMERG, MAPCACHE_EMERG);
     target->Set(String::NewSymbol("logLevels"), logLevels);
 
+    // set the services used in access records
+    Local<Object> services = Object::New();
+    NODE_MAPCACHE_CONSTANT(services, TMS, MAPCACHE_SERVICE_TMS);
+    NODE_MAPCACHE_CONSTANT(services, WMTS, MAPCACHE_SERVICE_WMTS);
+    NODE_MAPCACHE_CONSTANT(services, DEMO, MAPCACHE_SERVICE_DEMO);
+    NODE_MAPCACHE_CONSTANT(services, GMAPS, MAPCACHE_SERVICE_GMAPS);
+    NODE_MAPCACHE_CONSTANT(services, KML, MAPCACHE_SERVICE_KML);
+    NODE_MAPCACHE_CONSTANT(services, VE, MAPCACHE_SERVICE_VE);
+    NODE_MAPCACHE_CONSTANT(services, WMS, MAPCACHE_SERVICE_WMS);
+    target->Set(String::NewSymbol("services"), services);
+    target->Set(String::NewSymbol("accessRecordSize"), Integer::New(NODE_MAPCACHE_ACCESS_RECORD_SIZE));
+
     atexit(cleanup);            // clean up on normal exit
   }
 }
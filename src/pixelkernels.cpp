@@ -0,0 +1,457 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file pixelkernels.cpp
+ * @brief This defines the `PixelKernels` class.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NODE_MAPCACHE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "pixelkernels.hpp"
+
+/// The selected `PixelKernels::Level`, or -1 before the first selection
+static volatile int selected_level = -1;
+
+/**
+ * @brief The source positions sampled along one axis of the destination
+ *
+ * Positions outside `[begin, end)` fall outside the source.  For bilinear
+ * sampling `weight` is the weight of `second` out of 256.
+ */
+struct Axis {
+  std::vector<int32_t> first;
+  std::vector<int32_t> second;
+  std::vector<uint16_t> weight;
+  size_t begin, end;
+};
+
+/**
+ * @param dst_size The number of destination pixels.
+ *
+ * @param src_size The number of source pixels.
+ *
+ * @param off The position of the source origin in destination pixels.
+ *
+ * @param scale The size of a source pixel in destination pixels.
+ *
+ * @param bilinear Set if pairs of pixels and their weights are needed.
+ *
+ * @param axis Set to the sampled positions.
+ */
+static void MapAxis(size_t dst_size, size_t src_size, double off, double scale, bool bilinear, Axis &axis) {
+  axis.first.assign(dst_size, 0);
+  if (bilinear) {
+    axis.second.assign(dst_size, 0);
+    axis.weight.assign(dst_size, 0);
+  }
+  axis.begin = axis.end = 0;
+
+  for (size_t d = 0; d < dst_size; d++) {
+    double s = (d + 0.5 - off) / scale;
+    if (s < 0 || s >= src_size) {
+      continue;
+    }
+    if (axis.begin == axis.end) {
+      axis.begin = d;           // the sampled positions are contiguous
+    }
+    axis.end = d + 1;
+
+    if (!bilinear) {
+      axis.first[d] = (int32_t) s;
+      continue;
+    }
+
+    double u = s - 0.5, lower = floor(u);
+    int32_t x0 = (int32_t) lower, x1;
+    int weight = (int) ((u - lower) * 256 + 0.5);
+    if (weight == 256) {
+      x0++;
+      weight = 0;
+    }
+    x1 = x0 + 1;
+    axis.first[d] = (x0 < 0) ? 0 : ((x0 >= (int32_t) src_size) ? src_size - 1 : x0);
+    axis.second[d] = (x1 < 0) ? 0 : ((x1 >= (int32_t) src_size) ? src_size - 1 : x1);
+    axis.weight[d] = weight;
+  }
+}
+
+/// Blank the pixels of a row outside the sampled columns
+static void ClearOutside(unsigned char *row, size_t width, const Axis &columns) {
+  memset(row, 0, columns.begin * 4);
+  memset(row + columns.end * 4, 0, (width - columns.end) * 4);
+}
+
+static inline void NearestRowScalar(const unsigned char *src, unsigned char *dst, const Axis &columns, size_t from) {
+  for (size_t d = from; d < columns.end; d++) {
+    memcpy(dst + d * 4, src + columns.first[d] * 4, 4);
+  }
+}
+
+static inline void BilinearRowScalar(const unsigned char *top, const unsigned char *bottom, unsigned int fy,
+                                     unsigned char *dst, const Axis &columns, size_t from) {
+  for (size_t d = from; d < columns.end; d++) {
+    const unsigned char *a = top + columns.first[d] * 4, *b = top + columns.second[d] * 4,
+      *c = bottom + columns.first[d] * 4, *e = bottom + columns.second[d] * 4;
+    unsigned int fx = columns.weight[d];
+    for (int i = 0; i < 4; i++) {
+      unsigned int t = (a[i] * (256 - fx) + b[i] * fx + 128) >> 8;
+      unsigned int u = (c[i] * (256 - fx) + e[i] * fx + 128) >> 8;
+      dst[d * 4 + i] = (t * (256 - fy) + u * fy + 128) >> 8;
+    }
+  }
+}
+
+static inline void CompositeRowScalar(unsigned char *base, const unsigned char *overlay, size_t from, size_t width) {
+  for (size_t d = from; d < width; d++) {
+    unsigned char *b = base + d * 4;
+    const unsigned char *o = overlay + d * 4;
+    unsigned int inverse = 255 - o[3];
+    for (int i = 0; i < 4; i++) {
+      unsigned int t = b[i] * inverse + 128;
+      unsigned int value = o[i] + ((t + (t >> 8)) >> 8);
+      b[i] = (value > 255) ? 255 : value;
+    }
+  }
+}
+
+#ifdef NODE_MAPCACHE_X86_KERNELS
+
+static inline int Load32(const unsigned char *pixel) {
+  int value;
+  memcpy(&value, pixel, 4);
+  return value;
+}
+
+/// Widen the pixels at two columns of a row to 16 bit channels
+__attribute__((target("sse2")))
+static inline __m128i LoadPair(const unsigned char *row, int32_t left, int32_t right) {
+  __m128i pair = _mm_unpacklo_epi32(_mm_cvtsi32_si128(Load32(row + left * 4)),
+                                    _mm_cvtsi32_si128(Load32(row + right * 4)));
+  return _mm_unpacklo_epi8(pair, _mm_setzero_si128());
+}
+
+/// Compute `(a * (256 - w) + b * w + 128) >> 8` for each 16 bit channel
+__attribute__((target("sse2")))
+static inline __m128i Lerp(__m128i a, __m128i b, __m128i w) {
+  __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(256), w);
+  __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, inverse), _mm_mullo_epi16(b, w));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+/// Compute `base * (255 - alpha) / 255 + overlay`, rounded, for 16 bit channels
+__attribute__((target("sse2")))
+static inline __m128i Over(__m128i base, __m128i overlay) {
+  __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(overlay, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(base, _mm_sub_epi16(_mm_set1_epi16(255), alpha)), _mm_set1_epi16(128));
+  return _mm_add_epi16(overlay, _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8));
+}
+
+__attribute__((target("sse2")))
+static void BilinearRowSSE2(const unsigned char *top, const unsigned char *bottom, unsigned int fy,
+                            unsigned char *dst, const Axis &columns, const uint16_t *weights) {
+  __m128i wy = _mm_set1_epi16(fy);
+  size_t d = columns.begin;
+  for (; d + 2 <= columns.end; d += 2) {
+    __m128i wx = _mm_loadu_si128((const __m128i *) (weights + d * 4));
+    __m128i t = Lerp(LoadPair(top, columns.first[d], columns.first[d + 1]),
+                     LoadPair(top, columns.second[d], columns.second[d + 1]), wx);
+    __m128i u = Lerp(LoadPair(bottom, columns.first[d], columns.first[d + 1]),
+                     LoadPair(bottom, columns.second[d], columns.second[d + 1]), wx);
+    __m128i v = Lerp(t, u, wy);
+    _mm_storel_epi64((__m128i *) (dst + d * 4), _mm_packus_epi16(v, v));
+  }
+  BilinearRowScalar(top, bottom, fy, dst, columns, d);
+}
+
+__attribute__((target("sse2")))
+static void CompositeRowSSE2(unsigned char *base, const unsigned char *overlay, size_t width) {
+  __m128i zero = _mm_setzero_si128();
+  size_t d = 0;
+  for (; d + 4 <= width; d += 4) {
+    __m128i b = _mm_loadu_si128((const __m128i *) (base + d * 4));
+    __m128i o = _mm_loadu_si128((const __m128i *) (overlay + d * 4));
+    __m128i low = Over(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(o, zero));
+    __m128i high = Over(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(o, zero));
+    _mm_storeu_si128((__m128i *) (base + d * 4), _mm_packus_epi16(low, high));
+  }
+  CompositeRowScalar(base, overlay, d, width);
+}
+
+__attribute__((target("avx2")))
+static void NearestRowAVX2(const unsigned char *src, unsigned char *dst, const Axis &columns) {
+  size_t d = columns.begin;
+  for (; d + 8 <= columns.end; d += 8) {
+    __m256i index = _mm256_loadu_si256((const __m256i *) &columns.first[d]);
+    _mm256_storeu_si256((__m256i *) (dst + d * 4), _mm256_i32gather_epi32((const int *) src, index, 4));
+  }
+  NearestRowScalar(src, dst, columns, d);
+}
+
+/// Widen the pixels at four columns of a row to 16 bit channels
+__attribute__((target("avx2")))
+static inline __m256i LoadQuad(const unsigned char *row, const int32_t *index) {
+  __m128i pixels = _mm_i32gather_epi32((const int *) row, _mm_loadu_si128((const __m128i *) index), 4);
+  return _mm256_cvtepu8_epi16(pixels);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Lerp256(__m256i a, __m256i b, __m256i w) {
+  __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(256), w);
+  __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, inverse), _mm256_mullo_epi16(b, w));
+  return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Over256(__m256i base, __m256i overlay) {
+  __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(overlay, _MM_SHUFFLE(3, 3, 3, 3)),
+                                         _MM_SHUFFLE(3, 3, 3, 3));
+  __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(base, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha)),
+                               _mm256_set1_epi16(128));
+  return _mm256_add_epi16(overlay, _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8));
+}
+
+__attribute__((target("avx2")))
+static void BilinearRowAVX2(const unsigned char *top, const unsigned char *bottom, unsigned int fy,
+                            unsigned char *dst, const Axis &columns, const uint16_t *weights) {
+  __m256i wy = _mm256_set1_epi16(fy);
+  size_t d = columns.begin;
+  for (; d + 4 <= columns.end; d += 4) {
+    __m256i wx = _mm256_loadu_si256((const __m256i *) (weights + d * 4));
+    __m256i t = Lerp256(LoadQuad(top, &columns.first[d]), LoadQuad(top, &columns.second[d]), wx);
+    __m256i u = Lerp256(LoadQuad(bottom, &columns.first[d]), LoadQuad(bottom, &columns.second[d]), wx);
+    __m256i v = Lerp256(t, u, wy);
+    __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storeu_si128((__m128i *) (dst + d * 4), packed);
+  }
+  BilinearRowScalar(top, bottom, fy, dst, columns, d);
+}
+
+__attribute__((target("avx2")))
+static void CompositeRowAVX2(unsigned char *base, const unsigned char *overlay, size_t width) {
+  __m256i zero = _mm256_setzero_si256();
+  size_t d = 0;
+  for (; d + 8 <= width; d += 8) {
+    __m256i b = _mm256_loadu_si256((const __m256i *) (base + d * 4));
+    __m256i o = _mm256_loadu_si256((const __m256i *) (overlay + d * 4));
+    __m256i low = Over256(_mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(o, zero));
+    __m256i high = Over256(_mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(o, zero));
+    _mm256_storeu_si256((__m256i *) (base + d * 4), _mm256_packus_epi16(low, high));
+  }
+  CompositeRowScalar(base, overlay, d, width);
+}
+
+#endif  /* NODE_MAPCACHE_X86_KERNELS */
+
+PixelKernels::Level PixelKernels::Supported() {
+#ifdef NODE_MAPCACHE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SSE2;
+  }
+#endif
+  return SCALAR;
+}
+
+PixelKernels::Level PixelKernels::Selected() {
+  if (selected_level < 0) {
+    selected_level = Supported();
+  }
+  return (Level) selected_level;
+}
+
+/**
+ * @param level The preferred implementation.
+ * @return The implementation now used.
+ */
+PixelKernels::Level PixelKernels::Select(Level level) {
+  Level supported = Supported();
+  selected_level = (level > supported) ? supported : level;
+  return (Level) selected_level;
+}
+
+const char* PixelKernels::LevelName(Level level) {
+  switch (level) {
+  case AVX2:
+    return "avx2";
+  case SSE2:
+    return "sse2";
+  default:
+    return "scalar";
+  }
+}
+
+/**
+ * @details The centre of each destination pixel is mapped into the source
+ * and the pixel containing it is copied.  Destination pixels that map
+ * outside the source are made transparent.  There is no SSE2 implementation
+ * as SSE2 lacks a gather instruction.
+ *
+ * @param src The source image.
+ *
+ * @param dst The destination image.
+ *
+ * @param off_x The horizontal position of the source origin in destination
+ * pixels.
+ *
+ * @param off_y The vertical position of the source origin in destination
+ * pixels.
+ *
+ * @param scale_x The width of a source pixel in destination pixels.
+ *
+ * @param scale_y The height of a source pixel in destination pixels.
+ */
+void PixelKernels::ResampleNearest(const Image &src, Image &dst,
+                                   double off_x, double off_y, double scale_x, double scale_y) {
+  Axis columns, rows;
+  MapAxis(dst.w, src.w, off_x, scale_x, false, columns);
+  MapAxis(dst.h, src.h, off_y, scale_y, false, rows);
+  Level level = Selected();
+
+  for (size_t y = 0; y < dst.h; y++) {
+    unsigned char *out = dst.data + y * dst.stride;
+    if (y < rows.begin || y >= rows.end) {
+      memset(out, 0, dst.w * 4);
+      continue;
+    }
+
+    const unsigned char *in = src.data + rows.first[y] * src.stride;
+    ClearOutside(out, dst.w, columns);
+#ifdef NODE_MAPCACHE_X86_KERNELS
+    if (level == AVX2) {
+      NearestRowAVX2(in, out, columns);
+      continue;
+    }
+#endif
+    NearestRowScalar(in, out, columns, columns.begin);
+  }
+  (void) level;
+}
+
+/**
+ * @details The centre of each destination pixel is mapped into the source
+ * and the four pixels around it are interpolated, using weights with eight
+ * bits of precision.  Pixels beyond the edges of the source repeat the edge
+ * pixels, while destination pixels that map outside the source are made
+ * transparent.
+ *
+ * @param src The source image.
+ *
+ * @param dst The destination image.
+ *
+ * @param off_x The horizontal position of the source origin in destination
+ * pixels.
+ *
+ * @param off_y The vertical position of the source origin in destination
+ * pixels.
+ *
+ * @param scale_x The width of a source pixel in destination pixels.
+ *
+ * @param scale_y The height of a source pixel in destination pixels.
+ */
+void PixelKernels::ResampleBilinear(const Image &src, Image &dst,
+                                    double off_x, double off_y, double scale_x, double scale_y) {
+  Axis columns, rows;
+  MapAxis(dst.w, src.w, off_x, scale_x, true, columns);
+  MapAxis(dst.h, src.h, off_y, scale_y, true, rows);
+  Level level = Selected();
+
+  // the vector implementations load a weight for each channel
+  std::vector<uint16_t> weights;
+  if (level != SCALAR) {
+    weights.resize(dst.w * 4 + 32);
+    for (size_t d = 0; d < dst.w; d++) {
+      for (int i = 0; i < 4; i++) {
+        weights[d * 4 + i] = columns.weight[d];
+      }
+    }
+  }
+
+  for (size_t y = 0; y < dst.h; y++) {
+    unsigned char *out = dst.data + y * dst.stride;
+    if (y < rows.begin || y >= rows.end) {
+      memset(out, 0, dst.w * 4);
+      continue;
+    }
+
+    const unsigned char *top = src.data + rows.first[y] * src.stride;
+    const unsigned char *bottom = src.data + rows.second[y] * src.stride;
+    ClearOutside(out, dst.w, columns);
+#ifdef NODE_MAPCACHE_X86_KERNELS
+    if (level == AVX2) {
+      BilinearRowAVX2(top, bottom, rows.weight[y], out, columns, &weights[0]);
+      continue;
+    } else if (level == SSE2) {
+      BilinearRowSSE2(top, bottom, rows.weight[y], out, columns, &weights[0]);
+      continue;
+    }
+#endif
+    BilinearRowScalar(top, bottom, rows.weight[y], out, columns, columns.begin);
+  }
+}
+
+/**
+ * @details This is the Porter-Duff "over" operator on premultiplied pixels,
+ * with the division by 255 rounded to nearest.
+ *
+ * @param base The image composited onto.
+ *
+ * @param overlay The image composited over `base`.
+ */
+void PixelKernels::Composite(Image &base, const Image &overlay) {
+  size_t width = (base.w < overlay.w) ? base.w : overlay.w;
+  size_t height = (base.h < overlay.h) ? base.h : overlay.h;
+  Level level = Selected();
+
+  for (size_t y = 0; y < height; y++) {
+    unsigned char *b = base.data + y * base.stride;
+    const unsigned char *o = overlay.data + y * overlay.stride;
+#ifdef NODE_MAPCACHE_X86_KERNELS
+    if (level == AVX2) {
+      CompositeRowAVX2(b, o, width);
+      continue;
+    } else if (level == SSE2) {
+      CompositeRowSSE2(b, o, width);
+      continue;
+    }
+#endif
+    CompositeRowScalar(b, o, 0, width);
+  }
+  (void) level;
+}
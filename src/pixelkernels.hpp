@@ -0,0 +1,101 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_PIXELKERNELS_H__
+#define __NODE_MAPCACHE_PIXELKERNELS_H__
+
+/**
+ * @file pixelkernels.hpp
+ * @brief This declares the `PixelKernels` class.
+ */
+
+// Standard headers
+#include <stddef.h>
+
+/**
+ * @brief Resampling and compositing of premultiplied 32 bit images
+ *
+ * Each kernel has a scalar implementation, which is the reference, and
+ * vectorised SSE2 and AVX2 implementations producing identical output.  The
+ * fastest implementation supported by the CPU is selected at runtime.  All
+ * arithmetic is in fixed point so that the implementations agree pixel for
+ * pixel: `tools/kernel-bench.cpp` verifies this and measures each of them.
+ *
+ * The kernels have no dependencies on Node or mapcache so they can be built
+ * on their own.
+ */
+class PixelKernels {
+public:
+
+  /// An image of premultiplied 32 bit pixels with the alpha in the last byte
+  struct Image {
+    /// The first pixel of the first row
+    unsigned char *data;
+    /// The width in pixels
+    size_t w;
+    /// The height in pixels
+    size_t h;
+    /// The distance between rows in bytes
+    size_t stride;
+  };
+
+  /// The available implementations, in order of preference
+  enum Level {
+    /// Portable C++
+    SCALAR = 0,
+    /// SSE2 instructions
+    SSE2,
+    /// AVX2 instructions
+    AVX2
+  };
+
+  /// The best implementation supported by the CPU
+  static Level Supported();
+
+  /// The implementation currently used
+  static Level Selected();
+
+  /// Use an implementation, limited to those supported by the CPU
+  static Level Select(Level level);
+
+  /// The name of an implementation
+  static const char* LevelName(Level level);
+
+  /// Resample an image by taking the nearest pixel
+  static void ResampleNearest(const Image &src, Image &dst,
+                              double off_x, double off_y, double scale_x, double scale_y);
+
+  /// Resample an image by bilinear interpolation of the nearest four pixels
+  static void ResampleBilinear(const Image &src, Image &dst,
+                               double off_x, double off_y, double scale_x, double scale_y);
+
+  /// Composite an image over another of the same size
+  static void Composite(Image &base, const Image &overlay);
+};
+
+#endif  /* __NODE_MAPCACHE_PIXELKERNELS_H__ */
@@ -0,0 +1,68 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_PROBES_H__
+#define __NODE_MAPCACHE_PROBES_H__
+
+/**
+ * @file probes.hpp
+ * @brief This defines the static tracepoints of the `node_mapcache` provider.
+ *
+ * When built with `NODE_MAPCACHE_SDT` defined the probes are compiled as
+ * SystemTap compatible USDT probes, which cost a single `nop` instruction
+ * until they are enabled by a tracer such as `perf`, `bpftrace` or `stap`.
+ * Otherwise they compile to nothing.
+ *
+ * The probes are:
+ *
+ * - `get_enqueue(path, query)`: a request is accepted by `cache.get()`
+ * - `work_start(path, query, queue_us)`: a thread starts handling a request
+ * - `core_start(path, type)`: the mapcache core is called for a request
+ * - `core_end(path, type, code)`: the mapcache core has returned
+ * - `work_end(path, code, bytes)`: a thread has finished handling a request
+ * - `respond(path, code, bytes)`: the response is passed to javascript
+ * - `log_emit(level, message)`: a log message is emitted
+ */
+
+#ifdef NODE_MAPCACHE_SDT
+
+#include <sys/sdt.h>
+
+#define NODE_MAPCACHE_PROBE2(name, a1, a2)                              \
+  DTRACE_PROBE2(node_mapcache, name, a1, a2)
+#define NODE_MAPCACHE_PROBE3(name, a1, a2, a3)                          \
+  DTRACE_PROBE3(node_mapcache, name, a1, a2, a3)
+
+#else
+
+#define NODE_MAPCACHE_PROBE2(name, a1, a2) do { } while (0)
+#define NODE_MAPCACHE_PROBE3(name, a1, a2, a3) do { } while (0)
+
+#endif  /* NODE_MAPCACHE_SDT */
+
+#endif  /* __NODE_MAPCACHE_PROBES_H__ */
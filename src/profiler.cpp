@@ -0,0 +1,135 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file profiler.cpp
+ * @brief This defines the `Profiler` class.
+ */
+
+#include <time.h>
+#include <string.h>
+
+#include <uv.h>
+
+#include "profiler.hpp"
+
+/**
+ * @param profiler The profiler to add times to, which may be `NULL`.
+ */
+Profiler::Timer::Timer(Profiler *profiler) :
+  profiler((profiler && profiler->Running()) ? profiler : NULL),
+  wall(0),
+  cpu(0)
+{
+  if (this->profiler) {
+    wall = uv_hrtime();
+    cpu = ThreadTime();
+  }
+}
+
+/**
+ * @param phase The phase that has just finished.
+ */
+void Profiler::Timer::Lap(Phase phase) {
+  if (!profiler) {
+    return;
+  }
+
+  uint64_t now_wall = uv_hrtime(), now_cpu = ThreadTime();
+  profiler->Add(phase, now_wall - wall, now_cpu - cpu);
+  wall = now_wall;
+  cpu = now_cpu;
+}
+
+Profiler::Profiler() :
+  running(false),
+  start(0)
+{
+  memset(totals, 0, sizeof(totals));
+}
+
+/**
+ * @details This should be called from the Node/V8 thread.
+ */
+void Profiler::Start() {
+  memset(totals, 0, sizeof(totals));
+  start = uv_hrtime();
+  __sync_synchronize();         // clear the totals before they are added to
+  running = true;
+}
+
+/**
+ * @details Requests being handled when the profiler stops may still add
+ * their current phase, so the totals should be read straight away.
+ */
+uint64_t Profiler::Stop() {
+  running = false;
+  __sync_synchronize();
+  return uv_hrtime() - start;
+}
+
+/**
+ * @param phase The phase to add to.
+ *
+ * @param wall The wall clock time in nanoseconds.
+ *
+ * @param cpu The thread CPU time in nanoseconds.
+ */
+void Profiler::Add(Phase phase, uint64_t wall, uint64_t cpu) {
+  if (!running) {
+    return;
+  }
+  __sync_fetch_and_add(&(totals[phase].count), 1);
+  __sync_fetch_and_add(&(totals[phase].wall), wall);
+  __sync_fetch_and_add(&(totals[phase].cpu), cpu);
+}
+
+const char* Profiler::PhaseName(Phase phase) {
+  switch (phase) {
+  case QUEUE: return "queue";
+  case DISPATCH: return "dispatch";
+  case CORE: return "core";
+  case FINISH: return "finish";
+  case RESPOND: return "respond";
+  default: return "unknown";
+  }
+}
+
+/**
+ * @details This uses the per thread CPU clock, returning 0 where it isn't
+ * available.
+ */
+uint64_t Profiler::ThreadTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+#endif
+  return 0;
+}
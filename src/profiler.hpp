@@ -0,0 +1,134 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_PROFILER_H__
+#define __NODE_MAPCACHE_PROFILER_H__
+
+/**
+ * @file profiler.hpp
+ * @brief This declares the `Profiler` class.
+ */
+
+// Standard headers
+#include <stdint.h>
+
+/**
+ * @brief An aggregator of the time spent in each phase of a request
+ *
+ * While the profiler is running, the threads handling requests add the wall
+ * clock and thread CPU time spent in each phase using a `Timer`.  The totals
+ * are updated atomically so the profiler can be shared by every thread
+ * without locking.
+ */
+class Profiler {
+public:
+
+  /// The phases of a request
+  enum Phase {
+    /// Waiting for a thread pool thread
+    QUEUE = 0,
+    /// Parsing the request and dispatching it to a service
+    DISPATCH,
+    /// Generating the response in the mapcache core
+    CORE,
+    /// Inspecting and recording the response in the thread pool
+    FINISH,
+    /// Converting the response to javascript in the Node/V8 thread
+    RESPOND,
+    /// The number of phases
+    PHASES
+  };
+
+  /// The totals for a phase
+  struct Totals {
+    /// The number of times the phase was timed
+    volatile uint64_t count;
+    /// The total wall clock time in nanoseconds
+    volatile uint64_t wall;
+    /// The total thread CPU time in nanoseconds
+    volatile uint64_t cpu;
+  };
+
+  /**
+   * @brief Measures consecutive phases in the current thread
+   *
+   * A timer for a profiler that isn't running does nothing.
+   */
+  class Timer {
+  public:
+    /// Start timing the first phase
+    Timer(Profiler *profiler);
+
+    /// Add the time since the last lap to `phase` and start the next phase
+    void Lap(Phase phase);
+
+  private:
+    /// The profiler being added to, `NULL` if it isn't running
+    Profiler *profiler;
+    /// The wall clock time at the start of the current phase
+    uint64_t wall;
+    /// The thread CPU time at the start of the current phase
+    uint64_t cpu;
+  };
+
+  /// Intantiate a stopped profiler
+  Profiler();
+
+  /// Clear the totals and start profiling
+  void Start();
+
+  /// Stop profiling, returning the duration in nanoseconds
+  uint64_t Stop();
+
+  /// Whether the profiler is running
+  bool Running() const {
+    return running;
+  }
+
+  /// Add a wall clock time, and optional CPU time, to a phase
+  void Add(Phase phase, uint64_t wall, uint64_t cpu);
+
+  /// The name of a phase
+  static const char* PhaseName(Phase phase);
+
+  /// The CPU time of the current thread in nanoseconds
+  static uint64_t ThreadTime();
+
+  /// The totals for each phase
+  Totals totals[PHASES];
+
+private:
+
+  /// Set while the profiler is running
+  volatile bool running;
+
+  /// The time the profiler was started
+  uint64_t start;
+};
+
+#endif  /* __NODE_MAPCACHE_PROFILER_H__ */
@@ -0,0 +1,275 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file responsecache.cpp
+ * @brief This defines the `ResponseCache` class.
+ */
+
+#include <algorithm>
+#include <ctype.h>
+#include <string.h>
+
+#include "responsecache.hpp"
+
+/**
+ * @param max_size The maximum total size of the responses in bytes.
+ *
+ * @param ttl The time to live of responses from sources without their own in
+ * seconds.
+ */
+ResponseCache::ResponseCache(uint64_t max_size, uint32_t ttl) :
+  max_size(max_size),
+  ttl(ttl)
+{
+  memset(&stats, 0, sizeof(stats));
+  uv_mutex_init(&mutex);
+}
+
+ResponseCache::~ResponseCache() {
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details This should be called before the cache is used.
+ *
+ * @param source The name of a `GetFeatureInfo` source or proxy forwarding
+ * rule.
+ *
+ * @param ttl The time to live of its responses in seconds.
+ */
+void ResponseCache::SetSourceTtl(const std::string &source, uint32_t ttl) {
+  source_ttls[source] = ttl;
+}
+
+/**
+ * @details Only proxied requests and `GetFeatureInfo` queries are cached.
+ * The `ttl` of `key` is set to zero for any other request, or for a request
+ * to a source that isn't cached.
+ *
+ * @param ctx The context of the request.
+ *
+ * @param request The request dispatched by mapcache.
+ *
+ * @param key Set to the identity of the request.
+ *
+ * @param response Set to the cached response on a hit, allocated from the
+ * pool of `ctx`.
+ */
+bool ResponseCache::Find(mapcache_context *ctx, mapcache_request *request, Key &key,
+                         mapcache_http_response **response) {
+  key.ttl = 0;
+  key.hit = false;
+
+  if (request->type == MAPCACHE_REQUEST_GET_FEATUREINFO) {
+    mapcache_feature_info *fi = ((mapcache_request_get_feature_info *) request)->fi;
+    if (!fi->map.tileset->source) {
+      return false;
+    }
+    key.source = fi->map.tileset->source->name;
+    key.params = apr_psprintf(ctx->pool, "featureinfo\n%s\n%s\n%.12g,%.12g,%.12g,%.12g\n%d,%d\n%d,%d\n%s\n",
+                              fi->map.tileset->name, fi->map.grid_link->grid->name,
+                              fi->map.extent.minx, fi->map.extent.miny, fi->map.extent.maxx, fi->map.extent.maxy,
+                              fi->map.width, fi->map.height, fi->i, fi->j,
+                              (fi->format) ? fi->format : "");
+    if (fi->map.dimensions) {
+      AppendParams(key.params, fi->map.dimensions);
+    }
+  } else if (request->type == MAPCACHE_REQUEST_PROXY) {
+    mapcache_request_proxy *req_proxy = (mapcache_request_proxy *) request;
+    key.source = req_proxy->http->url;
+
+    // name the source after the forwarding rule making the request
+    if (request->service && request->service->type == MAPCACHE_SERVICE_WMS) {
+      apr_array_header_t *rules = ((mapcache_service_wms *) request->service)->forwarding_rules;
+      for (int i = 0; rules && i < rules->nelts; i++) {
+        mapcache_forwarding_rule *rule = APR_ARRAY_IDX(rules, i, mapcache_forwarding_rule*);
+        if (rule->http == req_proxy->http) {
+          key.source = rule->name;
+          break;
+        }
+      }
+    }
+
+    key.params = std::string("proxy\n") + req_proxy->http->url + "\n"
+      + ((req_proxy->pathinfo) ? req_proxy->pathinfo : "") + "\n";
+    if (req_proxy->params) {
+      AppendParams(key.params, req_proxy->params);
+    }
+  } else {
+    return false;
+  }
+
+  std::map<std::string, uint32_t>::const_iterator source_ttl = source_ttls.find(key.source);
+  key.ttl = (source_ttl == source_ttls.end()) ? ttl : source_ttl->second;
+  if (!key.ttl) {
+    return false;
+  }
+
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator entry = entries.find(key.params);
+  if (entry != entries.end() && entry->second.expires <= apr_time_now()) {
+    Remove(entry);
+    stats.expired++;
+    entry = entries.end();
+  }
+  if (entry == entries.end()) {
+    stats.misses++;
+    uv_mutex_unlock(&mutex);
+    return false;
+  }
+
+  // copy the response out of the cache
+  Entry &cached = entry->second;
+  mapcache_http_response *copy = mapcache_http_response_create(ctx->pool);
+  copy->code = cached.code;
+  copy->mtime = cached.mtime;
+  copy->data = mapcache_buffer_create(cached.body.size(), ctx->pool);
+  mapcache_buffer_append(copy->data, cached.body.size(), (void *) cached.body.data());
+  copy->headers = apr_table_make(ctx->pool, cached.headers.size());
+  for (size_t i = 0; i < cached.headers.size(); i++) {
+    apr_table_add(copy->headers, cached.headers[i].first.c_str(), cached.headers[i].second.c_str());
+  }
+  lru.splice(lru.begin(), lru, cached.position);
+  stats.hits++;
+  uv_mutex_unlock(&mutex);
+
+  *response = copy;
+  key.hit = true;
+  return true;
+}
+
+/**
+ * @details Least recently used responses are evicted to make space for the
+ * response.  Responses larger than the cache are not added.
+ *
+ * @param key The identity of the request, as set by `Find()`.
+ *
+ * @param response The response to the request.
+ */
+void ResponseCache::Insert(const Key &key, mapcache_http_response *response) {
+  size_t size = (response->data) ? response->data->size : 0;
+  if (!key.ttl || size > max_size) {
+    return;
+  }
+
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator existing = entries.find(key.params);
+  if (existing != entries.end()) {
+    Remove(existing);
+  }
+  while (!lru.empty() && stats.bytes + size > max_size) {
+    Remove(entries.find(lru.back()));
+    stats.evicted++;
+  }
+
+  Entry &entry = entries[key.params];
+  entry.source = key.source;
+  entry.code = response->code;
+  entry.mtime = response->mtime;
+  entry.expires = apr_time_now() + apr_time_from_sec(key.ttl);
+  if (response->headers) {
+    const apr_array_header_t *elts = apr_table_elts(response->headers);
+    for (int i = 0; i < elts->nelts; i++) {
+      apr_table_entry_t header = APR_ARRAY_IDX(elts, i, apr_table_entry_t);
+      entry.headers.push_back(std::make_pair(std::string(header.key), std::string(header.val)));
+    }
+  }
+  if (size) {
+    entry.body.assign((char *) response->data->buf, size);
+  }
+  lru.push_front(key.params);
+  entry.position = lru.begin();
+  stats.bytes += size;
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param source The name of the source or forwarding rule.
+ */
+void ResponseCache::Purge(const std::string &source) {
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator entry = entries.begin();
+  while (entry != entries.end()) {
+    std::map<std::string, Entry>::iterator next = entry;
+    ++next;
+    if (entry->second.source == source) {
+      Remove(entry);
+    }
+    entry = next;
+  }
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param stats The object receiving the metrics.
+ */
+void ResponseCache::GetStats(Stats &stats) {
+  uv_mutex_lock(&mutex);
+  stats = this->stats;
+  stats.responses = entries.size();
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param entry The entry to remove.
+ */
+void ResponseCache::Remove(std::map<std::string, Entry>::iterator entry) {
+  stats.bytes -= entry->second.body.size();
+  lru.erase(entry->second.position);
+  entries.erase(entry);
+}
+
+/**
+ * @details Parameter names are compared case insensitively by mapcache so
+ * they are upper cased, and the parameters are sorted so their order in the
+ * query string doesn't matter.  Names and values are terminated by a NUL,
+ * which can't occur in either, so distinct parameters never share a key.
+ *
+ * @param params The key being built.
+ *
+ * @param table The parameters to append.
+ */
+void ResponseCache::AppendParams(std::string &params, const apr_table_t *table) {
+  const apr_array_header_t *elts = apr_table_elts(table);
+  std::vector<std::pair<std::string, std::string> > sorted;
+  for (int i = 0; i < elts->nelts; i++) {
+    apr_table_entry_t param = APR_ARRAY_IDX(elts, i, apr_table_entry_t);
+    std::string name(param.key);
+    for (std::string::iterator c = name.begin(); c != name.end(); ++c) {
+      *c = toupper(*c);
+    }
+    sorted.push_back(std::make_pair(name, std::string((param.val) ? param.val : "")));
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  for (size_t i = 0; i < sorted.size(); i++) {
+    params.append(sorted[i].first.c_str(), sorted[i].first.size() + 1);
+    params.append(sorted[i].second.c_str(), sorted[i].second.size() + 1);
+  }
+}
@@ -0,0 +1,168 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_RESPONSECACHE_H__
+#define __NODE_MAPCACHE_RESPONSECACHE_H__
+
+/**
+ * @file responsecache.hpp
+ * @brief This declares the `ResponseCache` class.
+ */
+
+// Standard headers
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief A memory cache of proxied and `GetFeatureInfo` responses
+ *
+ * The mapcache core forwards every proxied request and `GetFeatureInfo`
+ * query to its source, even when an identical request was answered moments
+ * before.  This class keeps successful responses for a time to live that
+ * can be set for each source, keyed on the parameters of the request as
+ * parsed by mapcache, so the spelling, case and order of the query string
+ * make no difference.  `GetFeatureInfo` sources are identified by the name
+ * of the source and proxied requests by the name of their forwarding rule.
+ *
+ * The total size of the cached bodies is bounded, with the least recently
+ * used responses evicted first.  Instances can be used from any thread.
+ */
+class ResponseCache {
+public:
+
+  /// A snapshot of the cache metrics
+  struct Stats {
+    /// The number of responses held
+    uint32_t responses;
+    /// The total size of the responses in bytes
+    uint64_t bytes;
+    /// The number of requests answered from the cache
+    uint64_t hits;
+    /// The number of cacheable requests that went to their source
+    uint64_t misses;
+    /// The number of responses evicted to stay within the size limit
+    uint64_t evicted;
+    /// The number of responses discarded as they had expired
+    uint64_t expired;
+  };
+
+  /// Identifies a cacheable request
+  struct Key {
+    /// The name of the source or forwarding rule answering the request
+    std::string source;
+    /// The normalised request parameters
+    std::string params;
+    /// The time to live of the response in seconds, or zero if it isn't cached
+    uint32_t ttl;
+    /// Set if the response was returned from the cache
+    bool hit;
+  };
+
+  /// Instantiate a cache of `max_size` bytes with a default time to live
+  ResponseCache(uint64_t max_size, uint32_t ttl);
+
+  /// Free the cached responses
+  ~ResponseCache();
+
+  /// Set the time to live of responses from a source, zero disabling caching
+  void SetSourceTtl(const std::string &source, uint32_t ttl);
+
+  /// Identify a request and look up its response, returning `true` on a hit
+  bool Find(mapcache_context *ctx, mapcache_request *request, Key &key,
+            mapcache_http_response **response);
+
+  /// Add the response to an identified request
+  void Insert(const Key &key, mapcache_http_response *response);
+
+  /// Remove the responses from a source
+  void Purge(const std::string &source);
+
+  /// Retrieve the cache metrics
+  void GetStats(Stats &stats);
+
+  /// The maximum total size of the responses in bytes
+  const uint64_t max_size;
+
+  /// The default time to live in seconds
+  const uint32_t ttl;
+
+private:
+
+  /// A cached response
+  struct Entry {
+    /// The source of the response
+    std::string source;
+    /// The HTTP status code
+    long code;
+    /// The modification time of the response
+    apr_time_t mtime;
+    /// The time after which the response is discarded
+    apr_time_t expires;
+    /// The response headers
+    std::vector<std::pair<std::string, std::string> > headers;
+    /// The response body
+    std::string body;
+    /// The position of the entry in `lru`
+    std::list<std::string>::iterator position;
+  };
+
+  /// The time to live of each source overriding the default
+  std::map<std::string, uint32_t> source_ttls;
+
+  /// The responses keyed on their request
+  std::map<std::string, Entry> entries;
+
+  /// The request keys from most to least recently used
+  std::list<std::string> lru;
+
+  /// Protects the entries and the metrics
+  uv_mutex_t mutex;
+
+  /// The metrics
+  Stats stats;
+
+  /// Remove an entry, with the mutex held
+  void Remove(std::map<std::string, Entry>::iterator entry);
+
+  /// Append the parameters of a table to a key in a canonical order
+  static void AppendParams(std::string &params, const apr_table_t *table);
+};
+
+#endif  /* __NODE_MAPCACHE_RESPONSECACHE_H__ */
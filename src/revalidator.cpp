@@ -0,0 +1,347 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file revalidator.cpp
+ * @brief This defines the `Revalidator` class.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "revalidator.hpp"
+#include "tileidentity.hpp"
+
+/// The refresh duration assumed before any refreshes have been timed
+#define NODE_MAPCACHE_DEFAULT_REFRESH_TIME 1000000
+
+std::map<mapcache_cache*, Revalidator::Hook*> Revalidator::registry;
+uv_rwlock_t Revalidator::registry_lock;
+uv_once_t Revalidator::registry_once = UV_ONCE_INIT;
+
+/// The modification time of an expired tile returned in the current thread
+static __thread apr_time_t stale_time = 0;
+
+/// Set while a refresh in the current thread should bypass the cache
+static __thread bool bypass = false;
+
+/// The random number generator state of the current thread
+static __thread uint64_t random_state = 0;
+
+/**
+ * @details This should be called in the Node/V8 thread when no requests are
+ * using the configuration.
+ *
+ * @param cfg The configuration containing the caches to revalidate.
+ *
+ * @param beta The weighting applied to early refreshes: larger values start
+ * refreshes earlier, 0 disables them.
+ *
+ * @param max_pending The maximum number of refreshes queued or running.
+ *
+ * @param dispatch Called in the Node/V8 thread when refreshes are queued.
+ *
+ * @param data Assigned to the `data` member of the handle passed to
+ * `dispatch`.
+ */
+Revalidator::Revalidator(mapcache_cfg *cfg, double beta, uint32_t max_pending, uv_async_cb dispatch, void *data) :
+  cfg(cfg),
+  beta(beta),
+  max_pending(max_pending)
+{
+  uv_mutex_init(&mutex);
+
+  stats.stale = stats.early = stats.refreshed = stats.skipped = stats.errors = 0;
+  stats.pending = 0;
+  stats.refresh_time = 0;
+
+  uv_async_init(uv_default_loop(), &async, dispatch);
+  async.data = data;
+  uv_unref((uv_handle_t *) &async); // don't keep the process alive
+
+  uv_once(&registry_once, InitRegistry);
+  uv_rwlock_wrlock(&registry_lock);
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->caches); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_cache *cache = (mapcache_cache *) val;
+
+    Hook *hook = new Hook();
+    hook->owner = this;
+    hook->tile_get = cache->tile_get;
+    registry[cache] = hook;
+    caches.push_back(cache);
+
+    cache->tile_get = TileGet;
+  }
+  uv_rwlock_wrunlock(&registry_lock);
+}
+
+Revalidator::~Revalidator() {
+  while (!queue.empty()) {
+    apr_pool_destroy(queue.front()->pool);
+    delete queue.front();
+    queue.pop_front();
+  }
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details Refreshes that have been queued but not yet dispatched are
+ * discarded.
+ */
+void Revalidator::Close() {
+  uv_rwlock_wrlock(&registry_lock);
+  for (std::vector<mapcache_cache*>::iterator it = caches.begin(); it != caches.end(); ++it) {
+    mapcache_cache *cache = *it;
+    Hook *hook = registry[cache];
+
+    // leave functions that have since been replaced by something else
+    if (cache->tile_get == TileGet) {
+      cache->tile_get = hook->tile_get;
+    }
+    registry.erase(cache);
+    delete hook;
+  }
+  uv_rwlock_wrunlock(&registry_lock);
+
+  async.data = this;            // nothing is dispatched once the handle is closing
+  uv_close((uv_handle_t *) &async, Closed);
+}
+
+/**
+ * @param handle The dispatch handle.
+ */
+void Revalidator::Closed(uv_handle_t *handle) {
+  Revalidator *self = static_cast<Revalidator*>(handle->data);
+  delete self;
+}
+
+Revalidator::Refresh* Revalidator::Next() {
+  Refresh *refresh = NULL;
+  uv_mutex_lock(&mutex);
+  if (!queue.empty()) {
+    refresh = queue.front();
+    queue.pop_front();
+  }
+  uv_mutex_unlock(&mutex);
+  return refresh;
+}
+
+/**
+ * @details The cache is bypassed for the first lookup of the tile, so the
+ * mapcache core renders the containing metatile as though it were missing,
+ * locking it against concurrent renders and storing the result.  The expired
+ * tile remains available to other requests until it is replaced.
+ *
+ * @param refresh The refresh to run.
+ *
+ * @param ctx A context for the current thread.
+ */
+void Revalidator::Run(Refresh *refresh, mapcache_context *ctx) {
+  bypass = true;
+  mapcache_tileset_tile_get(ctx, refresh->tile);
+  bypass = false;
+
+  uv_mutex_lock(&mutex);
+  if (GC_HAS_ERROR(ctx)) {
+    stats.errors++;
+    stats.last_error = ctx->get_error_message(ctx);
+  } else {
+    stats.refreshed++;
+  }
+  uv_mutex_unlock(&mutex);
+  ctx->clear_errors(ctx);
+}
+
+/**
+ * @param refresh The refresh that has run.
+ *
+ * @param duration How long the refresh took in microseconds.
+ */
+void Revalidator::Finish(Refresh *refresh, uint64_t duration) {
+  uv_mutex_lock(&mutex);
+  pending.erase(refresh->key);
+  stats.pending--;
+
+  // an exponentially weighted moving average
+  stats.refresh_time = (stats.refresh_time) ? (stats.refresh_time * 7 + duration) / 8 : duration;
+  uv_mutex_unlock(&mutex);
+
+  apr_pool_destroy(refresh->pool);
+  delete refresh;
+}
+
+void Revalidator::GetStats(Stats &stats) {
+  uv_mutex_lock(&mutex);
+  stats = this->stats;
+  uv_mutex_unlock(&mutex);
+}
+
+void Revalidator::ResetStaleTime() {
+  stale_time = 0;
+}
+
+apr_time_t Revalidator::StaleTime() {
+  return stale_time;
+}
+
+/**
+ * @details A tile is refreshed early with a probability that rises
+ * exponentially as it approaches expiry: `age - delta * beta * ln(rand())
+ * >= ttl`, where `delta` is the mean refresh time.
+ *
+ * @param tile The tile returned by the cache.
+ */
+bool Revalidator::Check(const mapcache_tile *tile) {
+  apr_time_t age = apr_time_now() - tile->mtime;
+  apr_time_t ttl = apr_time_from_sec(tile->tileset->auto_expire);
+  if (age >= ttl) {
+    uv_mutex_lock(&mutex);
+    stats.stale++;
+    uv_mutex_unlock(&mutex);
+    Schedule(tile);
+    return true;
+  }
+
+  if (beta > 0) {
+    uint64_t delta = stats.refresh_time;   // a torn read only skews the odds
+    if (!delta) {
+      delta = NODE_MAPCACHE_DEFAULT_REFRESH_TIME;
+    }
+    if (age - delta * beta * log(Random()) >= ttl) {
+      uv_mutex_lock(&mutex);
+      bool scheduled = (pending.find(TileIdentity::Key(tile)) == pending.end());
+      if (scheduled) {
+        stats.early++;
+      }
+      uv_mutex_unlock(&mutex);
+      if (scheduled) {
+        Schedule(tile);
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @details A copy of the tile location and dimensions is queued and the
+ * Node/V8 thread is signalled to dispatch it.
+ *
+ * @param tile The tile to refresh.
+ */
+void Revalidator::Schedule(const mapcache_tile *tile) {
+  std::string key = TileIdentity::Key(tile);
+
+  uv_mutex_lock(&mutex);
+  if (pending.find(key) != pending.end()) {
+    uv_mutex_unlock(&mutex);
+    return;
+  }
+  if (stats.pending >= max_pending) {
+    stats.skipped++;
+    uv_mutex_unlock(&mutex);
+    return;
+  }
+  pending.insert(key);
+  stats.pending++;
+  uv_mutex_unlock(&mutex);
+
+  Refresh *refresh = new Refresh();
+  refresh->key = key;
+  if (apr_pool_create(&(refresh->pool), NULL) != APR_SUCCESS) {
+    delete refresh;
+    uv_mutex_lock(&mutex);
+    pending.erase(key);
+    stats.pending--;
+    stats.errors++;
+    stats.last_error = "Could not create the refresh memory pool";
+    uv_mutex_unlock(&mutex);
+    return;
+  }
+
+  refresh->tile = mapcache_tileset_tile_create(refresh->pool, tile->tileset, tile->grid_link);
+  refresh->tile->x = tile->x;
+  refresh->tile->y = tile->y;
+  refresh->tile->z = tile->z;
+  if (tile->dimensions) {
+    refresh->tile->dimensions = apr_table_clone(refresh->pool, tile->dimensions);
+  }
+
+  uv_mutex_lock(&mutex);
+  queue.push_back(refresh);
+  uv_mutex_unlock(&mutex);
+  uv_async_send(&async);
+}
+
+void Revalidator::InitRegistry() {
+  uv_rwlock_init(&registry_lock);
+}
+
+/**
+ * @details This is a per thread xorshift64* generator seeded from the high
+ * resolution clock.
+ */
+double Revalidator::Random() {
+  if (!random_state) {
+    random_state = (uv_hrtime() ^ ((uint64_t) (uintptr_t) &random_state << 16)) | 1;
+  }
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  uint64_t value = (random_state * 0x2545f4914f6cdd1dULL) >> 11; // 53 bits
+  return (value + 1.0) / 9007199254740992.0;
+}
+
+/**
+ * @details Expired tiles are returned with their modification time cleared,
+ * which stops the mapcache core from deleting and rendering them again.  The
+ * modification time is made available via `StaleTime()` so it can be restored
+ * in the response.
+ */
+int Revalidator::TileGet(mapcache_context *ctx, mapcache_tile *tile) {
+  if (bypass) {
+    bypass = false;             // only the first lookup of a refresh is bypassed
+    return MAPCACHE_CACHE_MISS;
+  }
+
+  uv_rwlock_rdlock(&registry_lock);
+  Hook *hook = registry[tile->tileset->cache];
+  uv_rwlock_rdunlock(&registry_lock);
+
+  int ret = hook->tile_get(ctx, tile);
+  mapcache_tileset *tileset = tile->tileset;
+  if (ret == MAPCACHE_SUCCESS && tileset->auto_expire && tile->mtime
+      && tileset->source && !tileset->read_only) {
+    if (hook->owner->Check(tile)) {
+      stale_time = tile->mtime;
+      tile->mtime = 0;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,201 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_REVALIDATOR_H__
+#define __NODE_MAPCACHE_REVALIDATOR_H__
+
+/**
+ * @file revalidator.hpp
+ * @brief This declares the `Revalidator` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// Apache headers
+#include <apr_pools.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief Stale-while-revalidate handling of expiring tiles
+ *
+ * When a tileset sets `auto_expire`, the mapcache core deletes a cached tile
+ * that has outlived its expiry and renders it again before responding.  This
+ * class replaces the `tile_get` function of each cache so that expired tiles
+ * are returned as they are while a single refresh of the tile is scheduled
+ * in the background.
+ *
+ * Refreshes are also started probabilistically before a tile expires, using
+ * the technique described in "Optimal Probabilistic Cache Stampede
+ * Prevention" (Vattani, Chierichetti and Lowenstein): the closer a tile is to
+ * expiring, and the longer refreshes take, the more likely a request for it
+ * is to trigger one.  This spreads the refreshes of tiles cached at the same
+ * time.
+ *
+ * Refreshes are queued from the thread pool and dispatched in the Node/V8
+ * thread by the `uv_async_cb` passed to the constructor, which is expected to
+ * call `Next()`, `Run()` and `Finish()` for each refresh.
+ */
+class Revalidator {
+public:
+
+  /// A snapshot of the revalidation metrics
+  struct Stats {
+    /// The number of expired tiles returned while being refreshed
+    uint64_t stale;
+    /// The number of refreshes started before the tile expired
+    uint64_t early;
+    /// The number of refreshes completed
+    uint64_t refreshed;
+    /// The number of refreshes not started as too many were pending
+    uint64_t skipped;
+    /// The number of refreshes that failed
+    uint64_t errors;
+    /// The number of refreshes queued or running
+    uint32_t pending;
+    /// The mean duration of a refresh in microseconds
+    uint64_t refresh_time;
+    /// The message from the last failed refresh
+    std::string last_error;
+  };
+
+  /// A tile waiting to be refreshed
+  struct Refresh {
+    /// The pool containing the tile
+    apr_pool_t *pool;
+    /// The tile to render
+    mapcache_tile *tile;
+    /// The pending key of the tile
+    std::string key;
+  };
+
+  /// Intantiate a revalidator for the caches in `cfg`
+  Revalidator(mapcache_cfg *cfg, double beta, uint32_t max_pending, uv_async_cb dispatch, void *data);
+
+  /// Remove the next queued refresh, returning `NULL` if there are none
+  Refresh* Next();
+
+  /// Render a tile, replacing it in the cache: called from the thread pool
+  void Run(Refresh *refresh, mapcache_context *ctx);
+
+  /// Record a refresh as finished and free it
+  void Finish(Refresh *refresh, uint64_t duration);
+
+  /// Retrieve the current metrics
+  void GetStats(Stats &stats);
+
+  /// Restore the cache functions and free the revalidator once its handle has closed
+  void Close();
+
+  /// Forget any expired tile returned in the current thread
+  static void ResetStaleTime();
+
+  /// The modification time of an expired tile returned in the current thread, or 0
+  static apr_time_t StaleTime();
+
+private:
+
+  /// A cache whose `tile_get` function has been replaced
+  struct Hook {
+    /// The instance handling the cache
+    Revalidator *owner;
+    /// The original function
+    int (*tile_get)(mapcache_context *ctx, mapcache_tile *tile);
+  };
+
+  /// The configuration containing the caches
+  mapcache_cfg *cfg;
+
+  /// The weighting applied to early refreshes
+  const double beta;
+
+  /// The maximum number of refreshes queued or running
+  const uint32_t max_pending;
+
+  /// Protects the queue, the pending tiles and the metrics
+  uv_mutex_t mutex;
+
+  /// Signals the Node/V8 thread that refreshes are queued
+  uv_async_t async;
+
+  /// The refreshes waiting to be dispatched
+  std::deque<Refresh*> queue;
+
+  /// The keys of the tiles queued or being refreshed
+  std::set<std::string> pending;
+
+  /// The metrics
+  Stats stats;
+
+  /// The caches whose functions have been replaced
+  std::vector<mapcache_cache*> caches;
+
+  /// Decide whether a cached tile should be refreshed, returning `true` if it has expired
+  bool Check(const mapcache_tile *tile);
+
+  /// Queue a refresh of a tile unless one is already pending
+  void Schedule(const mapcache_tile *tile);
+
+  /// Free any queued refreshes once the handle has closed
+  static void Closed(uv_handle_t *handle);
+
+  /// Clear up the queue
+  ~Revalidator();
+
+  /// Replaced caches mapped to their hooks
+  static std::map<mapcache_cache*, Hook*> registry;
+
+  /// Protects the registry
+  static uv_rwlock_t registry_lock;
+
+  /// Ensures the registry lock is initialised once
+  static uv_once_t registry_once;
+
+  /// Initialise the registry lock
+  static void InitRegistry();
+
+  /// A uniformly distributed random number in the interval (0, 1]
+  static double Random();
+
+  /// The replacement `tile_get` function
+  static int TileGet(mapcache_context *ctx, mapcache_tile *tile);
+};
+
+#endif  /* __NODE_MAPCACHE_REVALIDATOR_H__ */
@@ -0,0 +1,442 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file sharedcache.cpp
+ * @brief This defines the `SharedCache` class.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sharedcache.hpp"
+
+/// The identifier at the start of every cache file
+#define SHARED_CACHE_MAGIC "NMCSHARE"
+
+/// The version of the cache file format
+#define SHARED_CACHE_VERSION 2
+
+/// The space reserved for the file header
+#define SHARED_CACHE_HEADER_SIZE 4096
+
+/// The alignment of each slot
+#define SHARED_CACHE_ALIGNMENT 64
+
+/// How long a slot can be held by a live writer before it is reclaimed
+#define SHARED_CACHE_LOCK_TIMEOUT apr_time_from_sec(1)
+
+/// Combine the process identifier of a writer with a slot sequence count
+#define SHARED_CACHE_SEQUENCE(PID, COUNT) (((uint64_t) (PID) << 32) | (uint32_t) (COUNT))
+
+struct SharedCache::Header {
+  char magic[sizeof(SHARED_CACHE_MAGIC) - 1];
+  uint32_t version;
+  uint32_t slot_size;
+  uint64_t nslots;
+  volatile uint64_t hits;
+  volatile uint64_t misses;
+  volatile uint64_t inserts;
+};
+
+struct SharedCache::Slot {
+  /// The count of writes in the low 32 bits, odd while the slot is being
+  /// written, and the process identifier of the last writer in the high bits
+  volatile uint64_t sequence;
+  /// The size of the tile, or 0 if the slot is empty
+  uint32_t size;
+  /// The hashes of the tile key
+  uint64_t h1, h2;
+  /// The tile modification time
+  apr_time_t mtime;
+  /// The time the tile was stored, used to choose a slot to replace
+  apr_time_t stamp;
+  /// The time the write lock was taken, or 0 once it is released
+  volatile apr_time_t locked;
+  char padding[SHARED_CACHE_ALIGNMENT - 56];
+};
+
+/**
+ * @param slot_size The maximum size of a tile in bytes.
+ *
+ * @return The distance between the start of each slot.
+ */
+uint64_t SharedCache::SlotStride(uint32_t slot_size) {
+  uint64_t stride = sizeof(SharedCache::Slot) + slot_size;
+  return ((stride + SHARED_CACHE_ALIGNMENT - 1) / SHARED_CACHE_ALIGNMENT) * SHARED_CACHE_ALIGNMENT;
+}
+
+SharedCache::SharedCache(const std::string &path) :
+  path(path),
+  fd(-1),
+  base(NULL),
+  length(0),
+  header(NULL)
+{}
+
+SharedCache::~SharedCache() {
+  if (base) {
+    munmap(base, length);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+/**
+ * @details The file is locked while it is being checked so that only one
+ * process creates it.  If the file already exists its geometry is used and
+ * `size` and `slot_size` are ignored.
+ *
+ * @param size The size of the file to create in bytes.
+ *
+ * @param slot_size The maximum size of a tile in bytes.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool SharedCache::Attach(uint64_t size, uint32_t slot_size, std::string &error) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+    error = "Could not open the shared cache " + path + ": " + strerror(errno);
+    return false;
+  }
+
+  struct stat info;
+  Header existing;
+  bool created = false;
+  if (fstat(fd, &info) != 0) {
+    error = "Could not read the shared cache " + path + ": " + strerror(errno);
+  } else if (info.st_size == 0) {
+    uint64_t nslots = (size > SHARED_CACHE_HEADER_SIZE) ?
+      (size - SHARED_CACHE_HEADER_SIZE) / SlotStride(slot_size) : 0;
+    if (nslots < 2) {
+      error = "The shared cache size is too small for the slot size";
+    } else {
+      length = SHARED_CACHE_HEADER_SIZE + nslots * SlotStride(slot_size);
+      if (ftruncate(fd, length) != 0) {
+        error = "Could not size the shared cache " + path + ": " + strerror(errno);
+      }
+      created = true;
+      memset(&existing, 0, sizeof(existing));
+      existing.slot_size = slot_size;
+      existing.nslots = nslots;
+    }
+  } else if (pread(fd, &existing, sizeof(existing), 0) != (ssize_t) sizeof(existing)
+             || memcmp(existing.magic, SHARED_CACHE_MAGIC, sizeof(existing.magic))
+             || existing.version != SHARED_CACHE_VERSION
+             || (uint64_t) info.st_size != SHARED_CACHE_HEADER_SIZE + existing.nslots * SlotStride(existing.slot_size)) {
+    error = "The shared cache " + path + " is not valid";
+  } else {
+    length = info.st_size;
+  }
+
+  if (error.empty()) {
+    void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      error = "Could not map the shared cache " + path + ": " + strerror(errno);
+    } else {
+      base = (char *) mapping;
+      header = (Header *) base;
+      if (created) {
+        header->slot_size = existing.slot_size;
+        header->nslots = existing.nslots;
+        header->version = SHARED_CACHE_VERSION;
+        memcpy(header->magic, SHARED_CACHE_MAGIC, sizeof(header->magic));
+      }
+    }
+  }
+
+  flock(fd, LOCK_UN);
+  return error.empty();
+}
+
+/**
+ * @param key The tile key.
+ *
+ * @param data Set to the tile data.
+ *
+ * @param mtime Set to the tile modification time.
+ *
+ * @return `true` if the tile was found.
+ */
+bool SharedCache::Get(const std::string &key, std::string &data, apr_time_t *mtime) {
+  uint64_t h1, h2;
+  Hash(key, &h1, &h2);
+  uint64_t first = h1 % header->nslots;
+  uint64_t candidates[2] = { first, (first + 1) % header->nslots };
+
+  for (int i = 0; i < 2; i++) {
+    Slot *slot = SlotAt(candidates[i]);
+
+    // a few attempts are made in case the slot is being written
+    for (int attempt = 0; attempt < 3; attempt++) {
+      uint64_t sequence = slot->sequence;
+      if (sequence & 1) {
+        continue;
+      }
+      __sync_synchronize();     // read the sequence before the slot
+
+      uint32_t size = slot->size;
+      bool match = (slot->h1 == h1 && slot->h2 == h2 && size && size <= header->slot_size);
+      if (match) {
+        data.assign((const char *) (slot + 1), size);
+        *mtime = slot->mtime;
+      }
+
+      __sync_synchronize();     // read the slot before checking the sequence
+      if (slot->sequence != sequence) {
+        continue;
+      }
+      if (match) {
+        __sync_fetch_and_add(&(header->hits), 1);
+        return true;
+      }
+      break;
+    }
+  }
+
+  __sync_fetch_and_add(&(header->misses), 1);
+  return false;
+}
+
+/**
+ * @details A slot already holding the tile is reused, otherwise an empty
+ * slot or the one that was stored longest ago is replaced.
+ *
+ * @param key The tile key.
+ *
+ * @param data The tile data.
+ *
+ * @param size The size of `data` in bytes.
+ *
+ * @param mtime The tile modification time.
+ *
+ * @return `false` if the tile is too big or its slot is being written.
+ */
+bool SharedCache::Set(const std::string &key, const char *data, size_t size, apr_time_t mtime) {
+  if (!size || size > header->slot_size) {
+    return false;
+  }
+
+  uint64_t h1, h2;
+  Hash(key, &h1, &h2);
+  uint64_t first = h1 % header->nslots;
+  Slot *a = SlotAt(first), *b = SlotAt((first + 1) % header->nslots), *slot;
+
+  if (a->h1 == h1 && a->h2 == h2) {
+    slot = a;
+  } else if (b->h1 == h1 && b->h2 == h2) {
+    slot = b;
+  } else if (!a->size) {
+    slot = a;
+  } else if (!b->size) {
+    slot = b;
+  } else {
+    slot = (a->stamp <= b->stamp) ? a : b;
+  }
+
+  uint64_t held;
+  if (!Lock(slot, false, &held)) {
+    return false;               // another process is writing the slot
+  }
+
+  slot->h1 = h1;
+  slot->h2 = h2;
+  slot->size = size;
+  slot->mtime = mtime;
+  slot->stamp = apr_time_now();
+  memcpy(slot + 1, data, size);
+
+  Unlock(slot, held);
+
+  __sync_fetch_and_add(&(header->inserts), 1);
+  return true;
+}
+
+/**
+ * @details Unlike `Set()`, this waits for a slot that is being written so
+ * that the tile is guaranteed to be gone.  The wait is bounded: it lasts long
+ * enough for the slot of a stalled writer to be reclaimed.  It only touches
+ * the mapping, so it may be called from several threads at once.
+ *
+ * @param key The tile key.
+ *
+ * @return `false` if a slot holding the tile could not be locked.
+ */
+bool SharedCache::Remove(const std::string &key) {
+  uint64_t h1, h2;
+  Hash(key, &h1, &h2);
+  uint64_t first = h1 % header->nslots;
+  uint64_t candidates[2] = { first, (first + 1) % header->nslots };
+  bool removed = true;
+
+  for (int i = 0; i < 2; i++) {
+    Slot *slot = SlotAt(candidates[i]);
+    if (slot->h1 != h1 || slot->h2 != h2) {
+      continue;
+    }
+
+    uint64_t held;
+    if (!Lock(slot, true, &held)) {
+      removed = false;
+      continue;
+    }
+
+    if (slot->h1 == h1 && slot->h2 == h2) {
+      slot->h1 = slot->h2 = 0;
+      slot->size = 0;
+    }
+
+    Unlock(slot, held);
+  }
+  return removed;
+}
+
+/**
+ * @param stats Set to the current metrics.
+ */
+void SharedCache::GetStats(Stats &stats) const {
+  stats.slots = header->nslots;
+  stats.slot_size = header->slot_size;
+  stats.hits = header->hits;
+  stats.misses = header->misses;
+  stats.inserts = header->inserts;
+}
+
+SharedCache::Slot* SharedCache::SlotAt(uint64_t index) const {
+  return (Slot *) (base + SHARED_CACHE_HEADER_SIZE + index * SlotStride(header->slot_size));
+}
+
+/**
+ * @details The lock is taken by making the sequence odd and recording this
+ * process as the writer.  An abandoned lock is taken over by advancing the
+ * sequence while keeping it odd, so readers continue to ignore the slot.
+ *
+ * @param slot The slot to lock.
+ *
+ * @param wait Whether to wait for a slot being written by another writer.
+ * The wait lasts for twice `SHARED_CACHE_LOCK_TIMEOUT`, by which time a lock
+ * that is still held has been abandoned.
+ *
+ * @param held Set to the sequence of the locked slot.
+ *
+ * @return `false` if the slot could not be locked.
+ */
+bool SharedCache::Lock(Slot *slot, bool wait, uint64_t *held) {
+  uint32_t pid = (uint32_t) getpid();
+  apr_time_t deadline = 0;
+
+  for (;;) {
+    uint64_t sequence = slot->sequence, locked = 0;
+    if (!(sequence & 1)) {
+      locked = SHARED_CACHE_SEQUENCE(pid, sequence + 1);
+    } else if (Abandoned(slot, sequence)) {
+      locked = SHARED_CACHE_SEQUENCE(pid, sequence + 2);
+    }
+
+    if (locked && __sync_bool_compare_and_swap(&(slot->sequence), sequence, locked)) {
+      slot->locked = apr_time_now();
+      __sync_synchronize();
+      *held = locked;
+      return true;
+    }
+
+    if (!wait) {
+      return false;
+    }
+    apr_time_t now = apr_time_now();
+    if (!deadline) {
+      deadline = now + 2 * SHARED_CACHE_LOCK_TIMEOUT;
+    } else if (now > deadline) {
+      return false;
+    }
+    sched_yield();
+  }
+}
+
+/**
+ * @details Nothing is released if the lock has been reclaimed from this
+ * writer in the meantime.
+ *
+ * @param slot The locked slot.
+ *
+ * @param held The sequence returned by `Lock()`.
+ */
+void SharedCache::Unlock(Slot *slot, uint64_t held) {
+  slot->locked = 0;
+  __sync_synchronize();         // write the slot before releasing it
+  __sync_bool_compare_and_swap(&(slot->sequence), held, SHARED_CACHE_SEQUENCE(held >> 32, held + 1));
+}
+
+/**
+ * @details A lock is abandoned if the process holding it no longer exists or
+ * it has been held for longer than `SHARED_CACHE_LOCK_TIMEOUT`: writing a
+ * slot is a single copy so a writer taking that long has been stopped.  The
+ * lock time is cleared on release, so it is never that of a previous writer.
+ *
+ * @param slot The slot being written.
+ *
+ * @param sequence The odd sequence of the slot.
+ */
+bool SharedCache::Abandoned(const Slot *slot, uint64_t sequence) {
+  pid_t writer = (pid_t) (sequence >> 32);
+  if (writer && kill(writer, 0) != 0 && errno == ESRCH) {
+    return true;
+  }
+
+  apr_time_t locked = slot->locked;
+  return locked && apr_time_now() - locked > SHARED_CACHE_LOCK_TIMEOUT;
+}
+
+/**
+ * @details Two 64 bit FNV-1a hashes with different offset bases are used:
+ * together they identify a key with negligible chance of a collision, so the
+ * keys themselves don't need storing.
+ *
+ * @param key The key to hash.
+ *
+ * @param h1 Set to the first hash.
+ *
+ * @param h2 Set to the second hash.
+ */
+void SharedCache::Hash(const std::string &key, uint64_t *h1, uint64_t *h2) {
+  uint64_t a = 0xcbf29ce484222325ULL, b = 0x84222325cbf29ce4ULL;
+  for (std::string::const_iterator it = key.begin(); it != key.end(); ++it) {
+    a = (a ^ (unsigned char) *it) * 0x100000001b3ULL;
+    b = (b ^ (unsigned char) *it) * 0x100000001b3ULL;
+  }
+  *h1 = a;
+  *h2 = b ^ (b >> 29);
+}
@@ -0,0 +1,144 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_SHAREDCACHE_H__
+#define __NODE_MAPCACHE_SHAREDCACHE_H__
+
+/**
+ * @file sharedcache.hpp
+ * @brief This declares the `SharedCache` class.
+ */
+
+// Standard headers
+#include <string>
+#include <stdint.h>
+
+// Apache headers
+#include <apr_time.h>
+
+/**
+ * @brief A tile cache in memory shared between processes
+ *
+ * The cache is a file mapped into the memory of every process that attaches
+ * to it, so a tile stored by one process can be read by all the others.  It
+ * is divided into equally sized slots, each holding a single tile, with each
+ * tile stored in one of two slots determined by a hash of its key.  Tiles
+ * larger than a slot are not stored.
+ *
+ * Each slot is protected by a sequence lock: readers never block and retry
+ * or give up if a slot changes while it is being copied, and writers give up
+ * rather than wait if a slot is being written by another process.  The lock
+ * records the process holding it and when it was taken, so a slot left
+ * locked by a process that died or stalled while writing is reclaimed by the
+ * next writer.  The counters in the file header are shared by all
+ * processes.
+ *
+ * Instances are not thread safe: they should only be used from the Node/V8
+ * thread, with the exception of `Remove()`.
+ */
+class SharedCache {
+public:
+
+  /// A snapshot of the cache metrics
+  struct Stats {
+    /// The number of slots
+    uint64_t slots;
+    /// The maximum size of a tile in bytes
+    uint32_t slot_size;
+    /// The number of tiles found, across all processes
+    uint64_t hits;
+    /// The number of tiles not found, across all processes
+    uint64_t misses;
+    /// The number of tiles stored, across all processes
+    uint64_t inserts;
+  };
+
+  /// Intantiate a cache backed by the file at `path`
+  SharedCache(const std::string &path);
+
+  /// Detach from the cache
+  ~SharedCache();
+
+  /// Map the cache file, creating it with the given geometry if necessary
+  bool Attach(uint64_t size, uint32_t slot_size, std::string &error);
+
+  /// Read a tile from the cache
+  bool Get(const std::string &key, std::string &data, apr_time_t *mtime);
+
+  /// Store a tile in the cache
+  bool Set(const std::string &key, const char *data, size_t size, apr_time_t mtime);
+
+  /// Remove a tile from the cache
+  bool Remove(const std::string &key);
+
+  /// Retrieve the cache metrics
+  void GetStats(Stats &stats) const;
+
+  /// The location of the cache file
+  const std::string path;
+
+private:
+
+  /// The file header
+  struct Header;
+
+  /// The header of a slot, which is followed by the tile data
+  struct Slot;
+
+  /// The descriptor of the cache file
+  int fd;
+
+  /// The mapped file
+  char *base;
+
+  /// The size of the mapping
+  size_t length;
+
+  /// The file header within the mapping
+  Header *header;
+
+  /// The distance between slots of a given size
+  static uint64_t SlotStride(uint32_t slot_size);
+
+  /// Find the slot at an index
+  Slot* SlotAt(uint64_t index) const;
+
+  /// Take the write lock of a slot, optionally waiting for another writer
+  static bool Lock(Slot *slot, bool wait, uint64_t *held);
+
+  /// Release the write lock of a slot
+  static void Unlock(Slot *slot, uint64_t held);
+
+  /// Check whether the writer holding a slot has died or stalled
+  static bool Abandoned(const Slot *slot, uint64_t sequence);
+
+  /// Compute the two hashes identifying a key
+  static void Hash(const std::string &key, uint64_t *h1, uint64_t *h2);
+};
+
+#endif  /* __NODE_MAPCACHE_SHAREDCACHE_H__ */
@@ -0,0 +1,281 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file sourceguard.cpp
+ * @brief This defines the `SourceGuard` class.
+ */
+
+#include "sourceguard.hpp"
+
+/// The weight given to each render time in the moving average
+#define NODE_MAPCACHE_LATENCY_WEIGHT 0.2
+
+/// The factor applied to the limit when a render is slow
+#define NODE_MAPCACHE_LIMIT_DECREASE 0.75
+
+std::map<mapcache_source*, SourceGuard::Guard*> SourceGuard::registry;
+uv_rwlock_t SourceGuard::registry_lock;
+uv_once_t SourceGuard::registry_once = UV_ONCE_INIT;
+
+/**
+ * @details This should be called in the Node/V8 thread when no requests are
+ * using the configuration.  Each source starts with its circuit closed and
+ * its limit at the maximum.
+ *
+ * @param cfg The configuration containing the sources to guard.
+ *
+ * @param options The limits applied to sources not in `overrides`.
+ *
+ * @param overrides The limits applied to particular sources, keyed on name.
+ */
+SourceGuard::SourceGuard(mapcache_cfg *cfg, const Options &options, const std::map<std::string, Options> &overrides) {
+  uv_once(&registry_once, InitRegistry);
+  uv_rwlock_wrlock(&registry_lock);
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->sources); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_source *source = (mapcache_source *) val;
+    std::map<std::string, Options>::const_iterator override = overrides.find(source->name);
+
+    Guard *guard = new Guard();
+    guard->owner = this;
+    guard->source = source;
+    guard->render_map = source->render_map;
+    guard->options = (override != overrides.end()) ? override->second : options;
+    uv_mutex_init(&guard->mutex);
+    uv_cond_init(&guard->cond);
+    guard->stats.name = source->name;
+    guard->stats.state = CLOSED;
+    guard->stats.limit = guard->options.max_concurrency;
+    guard->stats.active = guard->stats.waiting = 0;
+    guard->stats.requests = guard->stats.failures = guard->stats.rejected = guard->stats.trips = 0;
+    guard->stats.latency = 0;
+    guard->consecutive = 0;
+    guard->opened = 0;
+    guard->probing = false;
+
+    registry[source] = guard;
+    guards.push_back(guard);
+    source->render_map = RenderMap;
+  }
+  uv_rwlock_wrunlock(&registry_lock);
+}
+
+/**
+ * @details Sources whose functions have since been replaced by something
+ * else can't be restored: their guards stay registered, passing renders
+ * straight through to the original functions.
+ */
+SourceGuard::~SourceGuard() {
+  uv_rwlock_wrlock(&registry_lock);
+  for (std::vector<Guard*>::iterator it = guards.begin(); it != guards.end(); ++it) {
+    Guard *guard = *it;
+    if (guard->source->render_map == RenderMap) {
+      guard->source->render_map = guard->render_map;
+      registry.erase(guard->source);
+      uv_cond_destroy(&guard->cond);
+      uv_mutex_destroy(&guard->mutex);
+      delete guard;
+    } else {
+      guard->owner = NULL;
+    }
+  }
+  uv_rwlock_wrunlock(&registry_lock);
+}
+
+/**
+ * @param stats Set to the metrics of each guarded source.
+ */
+void SourceGuard::GetStats(std::vector<Stats> &stats) {
+  stats.clear();
+  for (std::vector<Guard*>::iterator it = guards.begin(); it != guards.end(); ++it) {
+    uv_mutex_lock(&(*it)->mutex);
+    stats.push_back((*it)->stats);
+    uv_mutex_unlock(&(*it)->mutex);
+  }
+}
+
+/**
+ * @param state The circuit breaker state.
+ */
+const char* SourceGuard::StateName(State state) {
+  switch (state) {
+  case CLOSED:
+    return "closed";
+  case OPEN:
+    return "open";
+  case HALF_OPEN:
+    return "half-open";
+  }
+  return "unknown";
+}
+
+/**
+ * @details A half open circuit admits a single render regardless of the
+ * limit.  Otherwise a render waits while the source is at its limit, giving
+ * up if the queue is full, the wait times out or the circuit opens.
+ *
+ * @param guard The guard of the source.
+ *
+ * @param ctx The context of the request, which receives any error.
+ */
+bool SourceGuard::Admit(Guard *guard, mapcache_context *ctx) {
+  const Options &options = guard->options;
+  Stats &stats = guard->stats;
+  const char *refusal = NULL;
+  uint64_t now = uv_hrtime();
+
+  uv_mutex_lock(&guard->mutex);
+  if (stats.state == OPEN && now - guard->opened >= options.open_time * 1000000) {
+    stats.state = HALF_OPEN;
+    guard->probing = false;
+  }
+
+  if (stats.state == OPEN || (stats.state == HALF_OPEN && guard->probing)) {
+    refusal = "the circuit breaker is open";
+  } else if (stats.state == HALF_OPEN) {
+    guard->probing = true;
+  } else if (stats.active >= (uint32_t) stats.limit) {
+    if (stats.waiting >= options.max_queue) {
+      refusal = "too many renders are waiting";
+    } else {
+      uint64_t deadline = now + options.queue_timeout * 1000000;
+      stats.waiting++;
+      while (stats.state == CLOSED && stats.active >= (uint32_t) stats.limit && now < deadline) {
+        uv_cond_timedwait(&guard->cond, &guard->mutex, deadline - now);
+        now = uv_hrtime();
+      }
+      stats.waiting--;
+
+      if (stats.state != CLOSED) {
+        refusal = "the circuit breaker is open";
+      } else if (stats.active >= (uint32_t) stats.limit) {
+        refusal = "timed out waiting to render";
+      }
+    }
+  }
+
+  if (refusal) {
+    stats.rejected++;
+  } else {
+    stats.active++;
+    stats.requests++;
+  }
+  uv_mutex_unlock(&guard->mutex);
+
+  if (refusal) {
+    ctx->set_error(ctx, 503, (char *) "source %s is unavailable: %s", guard->source->name, refusal);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @details A failure opens a half open circuit, as do enough consecutive
+ * failures when the circuit is closed; a success closes a half open
+ * circuit.  Slow renders shrink the limit while quick renders grow it.
+ *
+ * @param guard The guard of the source.
+ *
+ * @param duration The render time in nanoseconds.
+ *
+ * @param failed Set if the render failed.
+ */
+void SourceGuard::Release(Guard *guard, uint64_t duration, bool failed) {
+  const Options &options = guard->options;
+  Stats &stats = guard->stats;
+  double ms = duration / 1e6;
+
+  uv_mutex_lock(&guard->mutex);
+  stats.active--;
+  stats.latency = (stats.latency > 0)
+    ? stats.latency + NODE_MAPCACHE_LATENCY_WEIGHT * (ms - stats.latency)
+    : ms;
+
+  if (failed) {
+    stats.failures++;
+    guard->consecutive++;
+    if (stats.state == HALF_OPEN
+        || (stats.state == CLOSED && guard->consecutive >= options.failure_threshold)) {
+      stats.state = OPEN;
+      stats.trips++;
+      guard->opened = uv_hrtime();
+    }
+  } else {
+    guard->consecutive = 0;
+    if (stats.state == HALF_OPEN) {
+      stats.state = CLOSED;
+    }
+  }
+  if (stats.state == HALF_OPEN || stats.state == OPEN) {
+    guard->probing = false;
+  }
+
+  if (ms > options.latency_threshold) {
+    stats.limit *= NODE_MAPCACHE_LIMIT_DECREASE;
+    if (stats.limit < options.min_concurrency) {
+      stats.limit = options.min_concurrency;
+    }
+  } else if (!failed) {
+    stats.limit += 1 / stats.limit;
+    if (stats.limit > options.max_concurrency) {
+      stats.limit = options.max_concurrency;
+    }
+  }
+
+  uv_cond_broadcast(&guard->cond); // a slot is free or the state has changed
+  uv_mutex_unlock(&guard->mutex);
+}
+
+void SourceGuard::InitRegistry() {
+  uv_rwlock_init(&registry_lock);
+}
+
+/**
+ * @param ctx The context of the request.
+ *
+ * @param map The map to render.
+ */
+void SourceGuard::RenderMap(mapcache_context *ctx, mapcache_map *map) {
+  uv_rwlock_rdlock(&registry_lock);
+  Guard *guard = registry[map->tileset->source];
+  uv_rwlock_rdunlock(&registry_lock);
+
+  if (!guard->owner) {
+    guard->render_map(ctx, map);
+    return;
+  }
+  if (!Admit(guard, ctx)) {
+    return;
+  }
+
+  uint64_t start = uv_hrtime();
+  guard->render_map(ctx, map);
+  Release(guard, uv_hrtime() - start, GC_HAS_ERROR(ctx));
+}
@@ -0,0 +1,186 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_SOURCEGUARD_H__
+#define __NODE_MAPCACHE_SOURCEGUARD_H__
+
+/**
+ * @file sourceguard.hpp
+ * @brief This declares the `SourceGuard` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief Concurrency limits and circuit breakers for tile sources
+ *
+ * The `render_map` function of each source is replaced by one that limits
+ * the number of concurrent renders from the source.  Renders over the limit
+ * wait in a bounded queue for a limited time, and fail once the queue is
+ * full or the time has passed, so a slow source can't occupy every thread.
+ *
+ * The limit adapts to the latency of the source: it shrinks multiplicatively
+ * when a render takes longer than a threshold and grows additively when
+ * renders are quick, between a minimum and a maximum.
+ *
+ * Each source also has a circuit breaker.  After a number of consecutive
+ * failed renders the circuit opens and renders fail immediately.  Once a
+ * period has passed a single render is let through: if it succeeds the
+ * circuit closes, otherwise it opens again.
+ */
+class SourceGuard {
+public:
+
+  /// The limits applied to a source
+  struct Options {
+    /// The maximum number of concurrent renders
+    uint32_t max_concurrency;
+    /// The minimum number of concurrent renders
+    uint32_t min_concurrency;
+    /// The maximum number of renders waiting for a slot
+    uint32_t max_queue;
+    /// The time a render waits for a slot in milliseconds
+    uint64_t queue_timeout;
+    /// The render time above which the limit shrinks in milliseconds
+    uint64_t latency_threshold;
+    /// The number of consecutive failures opening the circuit
+    uint32_t failure_threshold;
+    /// The time the circuit stays open in milliseconds
+    uint64_t open_time;
+  };
+
+  /// The states of a circuit breaker
+  enum State {
+    /// Renders are allowed
+    CLOSED,
+    /// Renders fail immediately
+    OPEN,
+    /// A single render is testing the source
+    HALF_OPEN
+  };
+
+  /// A snapshot of the metrics of a source
+  struct Stats {
+    /// The source name
+    std::string name;
+    /// The circuit breaker state
+    State state;
+    /// The current concurrency limit
+    double limit;
+    /// The number of renders running
+    uint32_t active;
+    /// The number of renders waiting for a slot
+    uint32_t waiting;
+    /// The number of renders started
+    uint64_t requests;
+    /// The number of renders that failed
+    uint64_t failures;
+    /// The number of renders refused by the limit or the circuit breaker
+    uint64_t rejected;
+    /// The number of times the circuit has opened
+    uint64_t trips;
+    /// The moving average render time in milliseconds
+    double latency;
+  };
+
+  /// Guard the sources in `cfg`, using `overrides` for the sources it names
+  SourceGuard(mapcache_cfg *cfg, const Options &options, const std::map<std::string, Options> &overrides);
+
+  /// Restore the source functions
+  ~SourceGuard();
+
+  /// Retrieve the metrics of each source
+  void GetStats(std::vector<Stats> &stats);
+
+  /// The name of a circuit breaker state
+  static const char* StateName(State state);
+
+private:
+
+  /// A source whose `render_map` function has been replaced
+  struct Guard {
+    /// The instance handling the source, or `NULL` once it has gone
+    SourceGuard *owner;
+    /// The guarded source
+    mapcache_source *source;
+    /// The original function
+    void (*render_map)(mapcache_context *ctx, mapcache_map *map);
+    /// The limits applied to the source
+    Options options;
+    /// Protects the state and metrics
+    uv_mutex_t mutex;
+    /// Signalled when a slot may have become free
+    uv_cond_t cond;
+    /// The metrics
+    Stats stats;
+    /// The number of consecutive failures
+    uint32_t consecutive;
+    /// The high resolution time the circuit opened
+    uint64_t opened;
+    /// Set while a render is testing a half open circuit
+    bool probing;
+  };
+
+  /// The sources guarded by this instance
+  std::vector<Guard*> guards;
+
+  /// Wait for permission to render, returning `false` with an error set if refused
+  static bool Admit(Guard *guard, mapcache_context *ctx);
+
+  /// Record the outcome of a render
+  static void Release(Guard *guard, uint64_t duration, bool failed);
+
+  /// Replaced sources mapped to their guards
+  static std::map<mapcache_source*, Guard*> registry;
+
+  /// Protects the registry
+  static uv_rwlock_t registry_lock;
+
+  /// Ensures the registry lock is initialised once
+  static uv_once_t registry_once;
+
+  /// Initialise the registry lock
+  static void InitRegistry();
+
+  /// The replacement source rendering function
+  static void RenderMap(mapcache_context *ctx, mapcache_map *map);
+};
+
+#endif  /* __NODE_MAPCACHE_SOURCEGUARD_H__ */
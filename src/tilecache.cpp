@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file tilecache.cpp
+ * @brief This defines the `TilecacheWalker` class.
+ */
+
+#include <stdlib.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include "tilecache.hpp"
+
+/// The directory depth at which tile files are found in the `tilecache` layout
+#define TILECACHE_FILE_DEPTH 6
+
+/**
+ * @details Layer directories that don't exist are not reported as failures:
+ * they simply contain no tiles yet.
+ *
+ * @param directory The directory to read.
+ *
+ * @param depth The depth of `directory` below the layer directory.
+ *
+ * @param z The zoom level parsed so far.
+ *
+ * @param x The tile column parsed so far.
+ *
+ * @param y The tile row parsed so far.
+ */
+bool TilecacheWalker::Walk(const std::string &directory, int depth, int z, int x, int y) const {
+  DIR *dir = opendir(directory.c_str());
+  if (!dir) {
+    if (errno != ENOENT && fail) {
+      fail(directory, errno, data);
+    }
+    return true;
+  }
+
+  bool running = true;
+  struct dirent *entry;
+  while (running && (entry = readdir(dir)) != NULL) {
+    char *end;
+    long value = strtol(entry->d_name, &end, 10);
+    if (end == entry->d_name) {
+      continue;                 // not a number
+    }
+
+    std::string path = directory + "/" + entry->d_name;
+    if (depth == TILECACHE_FILE_DEPTH) {
+      if (*end == '.') {
+        running = visit(path, entry->d_type, z, x, y * 1000 + value, data);
+      }
+    } else if (*end == '\0' && entry->d_type != DT_REG && entry->d_type != DT_LNK) {
+      if (depth == 0) {
+        running = Walk(path, depth + 1, value, 0, 0);
+      } else if (depth <= 3) {
+        running = Walk(path, depth + 1, z, x * 1000 + value, 0);
+      } else {
+        running = Walk(path, depth + 1, z, x, y * 1000 + value);
+      }
+    }
+  }
+  closedir(dir);
+
+  return running;
+}
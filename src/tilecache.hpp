@@ -0,0 +1,87 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_TILECACHE_H__
+#define __NODE_MAPCACHE_TILECACHE_H__
+
+/**
+ * @file tilecache.hpp
+ * @brief This declares the `TilecacheWalker` class.
+ */
+
+// Standard headers
+#include <string>
+
+/**
+ * @brief A walker of the tiles stored by a disk cache
+ *
+ * Disk caches using the default `tilecache` layout store the tiles of a
+ * tileset and grid combination below a layer directory as
+ * `zz/xxx/xxx/xxx/yyy/yyy/yyy.ext`.  This class recursively descends a layer
+ * directory calling a visitor with the location and coordinates of every tile
+ * file found.  Entries not matching the layout (e.g. the `blanks` directory)
+ * are ignored.
+ */
+class TilecacheWalker {
+public:
+
+  /// Called for each tile with its path, directory entry type (`DT_*`),
+  /// coordinates and the walker data, returning `false` to stop the walk
+  typedef bool (*Visitor)(const std::string &path, unsigned char type, int z, int x, int y, void *data);
+
+  /// Called with the path and error number of a directory that can't be read
+  typedef void (*Failure)(const std::string &path, int errnum, void *data);
+
+  /// Instantiate a walker calling `visit`, and optionally `fail`, with `data`
+  TilecacheWalker(Visitor visit, Failure fail, void *data) :
+    visit(visit),
+    fail(fail),
+    data(data)
+  {}
+
+  /// Walk the tiles below a layer directory, returning `false` if stopped
+  bool Walk(const std::string &directory) const {
+    return Walk(directory, 0, 0, 0, 0);
+  }
+
+private:
+
+  /// The function called for each tile
+  Visitor visit;
+
+  /// The function called for unreadable directories, or `NULL`
+  Failure fail;
+
+  /// The data passed to the callbacks
+  void *data;
+
+  /// Walk a directory at a depth below the layer directory
+  bool Walk(const std::string &directory, int depth, int z, int x, int y) const;
+};
+
+#endif  /* __NODE_MAPCACHE_TILECACHE_H__ */
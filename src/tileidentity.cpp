@@ -0,0 +1,58 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file tileidentity.cpp
+ * @brief This defines the `TileIdentity` class.
+ */
+
+#include <stdio.h>
+
+#include "tileidentity.hpp"
+
+/**
+ * @details The key has the form `tileset@grid/z/x/y` followed by any
+ * dimensions as a query string.
+ *
+ * @param tile The tile to identify.
+ */
+std::string TileIdentity::Key(const mapcache_tile *tile) {
+  char coords[64];
+  snprintf(coords, sizeof(coords), "/%d/%d/%d", tile->z, tile->x, tile->y);
+
+  std::string key = std::string(tile->tileset->name) + "@" + tile->grid_link->grid->name + coords;
+  if (tile->dimensions && !apr_is_empty_table(tile->dimensions)) {
+    const apr_array_header_t *elts = apr_table_elts(tile->dimensions);
+    for (int i = 0; i < elts->nelts; i++) {
+      apr_table_entry_t entry = APR_ARRAY_IDX(elts, i, apr_table_entry_t);
+      key += (i) ? "&" : "?";
+      key += std::string(entry.key) + "=" + entry.val;
+    }
+  }
+  return key;
+}
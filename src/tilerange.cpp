@@ -0,0 +1,120 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file tilerange.cpp
+ * @brief This defines the `TileRange` class.
+ */
+
+#include "tilerange.hpp"
+
+/**
+ * @param grid_link The grid of a tileset, whose limits restrict the range.
+ *
+ * @param minz The minimum zoom level.
+ *
+ * @param maxz The maximum zoom level.
+ *
+ * @param extent The extent of the range in the grid SRS, or `NULL` for the
+ * whole grid.
+ */
+TileRange::TileRange(mapcache_grid_link *grid_link, int minz, int maxz, const mapcache_extent *extent) :
+  minz(minz),
+  maxz(maxz),
+  next_z(minz)
+{
+  mapcache_grid *grid = grid_link->grid;
+
+  limits.resize(grid->nlevels);
+  if (extent) {
+    mapcache_grid_compute_limits(grid, extent, &limits[0], 0);
+  }
+  for (int z = 0; z < grid->nlevels; z++) {
+    const mapcache_extent_i &grid_limits = grid_link->grid_limits[z];
+    if (!extent) {
+      limits[z] = grid_limits;
+    } else {
+      limits[z].minx = (limits[z].minx > grid_limits.minx) ? limits[z].minx : grid_limits.minx;
+      limits[z].miny = (limits[z].miny > grid_limits.miny) ? limits[z].miny : grid_limits.miny;
+      limits[z].maxx = (limits[z].maxx < grid_limits.maxx) ? limits[z].maxx : grid_limits.maxx;
+      limits[z].maxy = (limits[z].maxy < grid_limits.maxy) ? limits[z].maxy : grid_limits.maxy;
+    }
+  }
+  next_y = limits[next_z].miny;
+
+  uv_mutex_init(&mutex);
+}
+
+TileRange::~TileRange() {
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details This can be called from any thread.
+ *
+ * @param z Set to the zoom level of the row.
+ *
+ * @param y Set to the row.
+ *
+ * @param minx Set to the first column of the row.
+ *
+ * @param maxx Set to one past the last column of the row.
+ */
+bool TileRange::NextRow(int &z, int &y, int &minx, int &maxx) {
+  uv_mutex_lock(&mutex);
+  while (next_z <= maxz && (next_y >= limits[next_z].maxy || limits[next_z].minx >= limits[next_z].maxx)) {
+    if (++next_z <= maxz) {
+      next_y = limits[next_z].miny;
+    }
+  }
+  bool found = (next_z <= maxz);
+  if (found) {
+    z = next_z;
+    y = next_y++;
+    minx = limits[z].minx;
+    maxx = limits[z].maxx;
+  }
+  uv_mutex_unlock(&mutex);
+  return found;
+}
+
+void TileRange::Stop() {
+  uv_mutex_lock(&mutex);
+  next_z = maxz + 1;
+  uv_mutex_unlock(&mutex);
+}
+
+uint64_t TileRange::Count() const {
+  uint64_t count = 0;
+  for (int z = minz; z <= maxz; z++) {
+    if (limits[z].maxx > limits[z].minx && limits[z].maxy > limits[z].miny) {
+      count += (uint64_t) (limits[z].maxx - limits[z].minx) * (limits[z].maxy - limits[z].miny);
+    }
+  }
+  return count;
+}
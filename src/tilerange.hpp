@@ -0,0 +1,98 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_TILERANGE_H__
+#define __NODE_MAPCACHE_TILERANGE_H__
+
+/**
+ * @file tilerange.hpp
+ * @brief This declares the `TileRange` class.
+ */
+
+// Standard headers
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief The tiles of a grid within a zoom range and extent
+ *
+ * The range is divided into rows of tiles which are handed out to any number
+ * of threads by `NextRow()`.
+ */
+class TileRange {
+public:
+
+  /// Intantiate the range of `grid_link` between zoom levels `minz` and `maxz` inclusive
+  TileRange(mapcache_grid_link *grid_link, int minz, int maxz, const mapcache_extent *extent);
+
+  ~TileRange();
+
+  /// Claim the next row of tiles, returning `false` once every row has been claimed
+  bool NextRow(int &z, int &y, int &minx, int &maxx);
+
+  /// Stop handing out rows
+  void Stop();
+
+  /// The total number of tiles in the range
+  uint64_t Count() const;
+
+  /// The tile range of a zoom level (the maxima are exclusive)
+  const mapcache_extent_i& Limits(int z) const {
+    return limits[z];
+  }
+
+private:
+
+  /// The tile range of each zoom level, indexed on zoom level
+  std::vector<mapcache_extent_i> limits;
+
+  /// The minimum zoom level
+  const int minz;
+
+  /// The maximum zoom level
+  const int maxz;
+
+  /// The zoom level of the next row
+  int next_z;
+
+  /// The next row
+  int next_y;
+
+  /// Protects the position of the next row
+  uv_mutex_t mutex;
+};
+
+#endif  /* __NODE_MAPCACHE_TILERANGE_H__ */
@@ -0,0 +1,297 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file variantcache.cpp
+ * @brief This defines the `VariantCache` class.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "variantcache.hpp"
+
+/**
+ * @param max_size The maximum total size of the variants in memory in bytes.
+ *
+ * @param directory The directory to store variants in, or empty to only keep
+ * them in memory.
+ */
+VariantCache::VariantCache(uint64_t max_size, const std::string &directory) :
+  max_size(max_size),
+  directory(directory)
+{
+  memset(&stats, 0, sizeof(stats));
+  uv_mutex_init(&mutex);
+}
+
+VariantCache::~VariantCache() {
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details The key is also the location of the variant file relative to the
+ * cache directory.
+ *
+ * @param layer The name of the layer containing the tile (`tileset@grid`).
+ *
+ * @param z The tile zoom level.
+ *
+ * @param x The tile column.
+ *
+ * @param y The tile row.
+ *
+ * @param variant The name of the variant, identifying its format.
+ */
+std::string VariantCache::Key(const std::string &layer, int z, int x, int y, const std::string &variant) {
+  char coords[64];
+  snprintf(coords, sizeof(coords), "/%d/%d/%d.", z, x, y);
+  return layer + coords + variant;
+}
+
+/**
+ * @param key The key of the variant.
+ *
+ * @param variant Set to the variant if found.
+ *
+ * @return `true` if the variant is in memory.
+ */
+bool VariantCache::Get(const std::string &key, Variant &variant) {
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator entry = entries.find(key);
+  if (entry == entries.end()) {
+    uv_mutex_unlock(&mutex);
+    return false;
+  }
+  variant = entry->second.variant;
+  lru.splice(lru.begin(), lru, entry->second.position);
+  stats.hits++;
+  uv_mutex_unlock(&mutex);
+  return true;
+}
+
+/**
+ * @details Only the data and modification time of `variant` are set, as the
+ * format isn't stored in the file.  A variant read from disk is added to
+ * memory by the caller once its content type is set.
+ *
+ * @param key The key of the variant.
+ *
+ * @param mtime The modification time of the original tile.
+ *
+ * @param variant Set to the variant if found.
+ *
+ * @return `true` if a current variant is on disk.
+ */
+bool VariantCache::Load(const std::string &key, apr_time_t mtime, Variant &variant) {
+  if (directory.empty() || !mtime) {
+    return false;
+  }
+
+  std::string path = directory + "/" + key;
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0 || info.st_mtime != apr_time_sec(mtime)) {
+    return false;               // missing, or a variant of an earlier tile
+  }
+
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+  variant.data.resize(info.st_size);
+  bool ok = (info.st_size == 0 || fread(&variant.data[0], 1, info.st_size, fp) == (size_t) info.st_size);
+  fclose(fp);
+  if (!ok) {
+    return false;
+  }
+  variant.mtime = mtime;
+
+  uv_mutex_lock(&mutex);
+  stats.disk_hits++;
+  uv_mutex_unlock(&mutex);
+  return true;
+}
+
+/**
+ * @details Least recently used variants are evicted to make space for the
+ * variant.  Variants larger than the cache are only stored on disk.
+ *
+ * @param key The key of the variant.
+ *
+ * @param variant The variant.
+ *
+ * @param store Set to also write the variant to disk, if variants are stored.
+ */
+void VariantCache::Put(const std::string &key, const Variant &variant, bool store) {
+  if (store && !directory.empty()) {
+    Store(key, variant);
+  }
+  if (variant.data.size() > max_size) {
+    return;
+  }
+
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator existing = entries.find(key);
+  if (existing != entries.end()) {
+    Remove(existing);
+  }
+  while (!lru.empty() && stats.bytes + variant.data.size() > max_size) {
+    Remove(entries.find(lru.back()));
+    stats.evicted++;
+  }
+
+  Entry &entry = entries[key];
+  entry.variant = variant;
+  lru.push_front(key);
+  entry.position = lru.begin();
+  stats.variants++;
+  stats.bytes += variant.data.size();
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @details The tile is decoded and encoded again by the mapcache core, so
+ * any format it supports can be used, with the options set in the
+ * configuration.
+ *
+ * @param ctx The context of the request, the memory pool of which is used.
+ *
+ * @param tile The encoded tile.
+ *
+ * @param format The format to transcode the tile into.
+ *
+ * @param data Set to the transcoded tile.
+ *
+ * @return `true` on success.
+ */
+bool VariantCache::Transcode(mapcache_context *ctx, mapcache_buffer *tile, mapcache_image_format *format,
+                             std::string &data) {
+  mapcache_buffer *encoded = NULL;
+  mapcache_image *image = mapcache_imageio_decode(ctx, tile);
+  if (image && !GC_HAS_ERROR(ctx)) {
+    encoded = format->write(ctx, image, format);
+  }
+
+  bool ok = (encoded && !GC_HAS_ERROR(ctx));
+  if (ok) {
+    data.assign((char *) encoded->buf, encoded->size);
+  }
+  ctx->clear_errors(ctx);
+
+  uv_mutex_lock(&mutex);
+  if (ok) {
+    stats.transcoded++;
+  } else {
+    stats.errors++;
+  }
+  uv_mutex_unlock(&mutex);
+  return ok;
+}
+
+/**
+ * @details Variants on disk don't need removing as their original tiles
+ * will have a new modification time when they are next cached.
+ *
+ * @param tileset The name of the tileset, covering every grid.
+ */
+void VariantCache::Purge(const std::string &tileset) {
+  std::string prefix = tileset + "@";
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator entry = entries.lower_bound(prefix);
+  while (entry != entries.end() && entry->first.compare(0, prefix.size(), prefix) == 0) {
+    Remove(entry++);
+  }
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param stats Set to the cache metrics.
+ */
+void VariantCache::GetStats(Stats &stats) {
+  uv_mutex_lock(&mutex);
+  stats = this->stats;
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param entry The entry to remove.
+ */
+void VariantCache::Remove(std::map<std::string, Entry>::iterator entry) {
+  stats.variants--;
+  stats.bytes -= entry->second.variant.data.size();
+  lru.erase(entry->second.position);
+  entries.erase(entry);
+}
+
+/**
+ * @details The variant is written to a temporary file which is renamed into
+ * place, so readers never see a partial file, and is given the modification
+ * time of its original tile.  Missing directories are created.
+ *
+ * @param key The key of the variant.
+ *
+ * @param variant The variant.
+ *
+ * @return `true` if the variant was stored.
+ */
+bool VariantCache::Store(const std::string &key, const Variant &variant) {
+  if (!variant.mtime) {
+    return false;               // the variant couldn't be checked when loaded
+  }
+
+  std::string path = directory + "/" + key;
+  for (size_t slash = path.find('/', directory.size()); slash != std::string::npos;
+       slash = path.find('/', slash + 1)) {
+    if (mkdir(path.substr(0, slash).c_str(), 0777) != 0 && errno != EEXIST) {
+      return false;
+    }
+  }
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%lu.tmp", (unsigned long) uv_thread_self());
+  std::string tmp = path + suffix;
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+  bool ok = (fwrite(variant.data.data(), 1, variant.data.size(), fp) == variant.data.size());
+  ok = (fclose(fp) == 0) && ok;
+
+  struct timeval times[2];
+  times[0].tv_sec = times[1].tv_sec = apr_time_sec(variant.mtime);
+  times[0].tv_usec = times[1].tv_usec = 0;
+  if (!ok || utimes(tmp.c_str(), times) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,157 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_VARIANTCACHE_H__
+#define __NODE_MAPCACHE_VARIANTCACHE_H__
+
+/**
+ * @file variantcache.hpp
+ * @brief This declares the `VariantCache` class.
+ */
+
+// Standard headers
+#include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief A cache of tiles transcoded into other formats
+ *
+ * Each tileset is cached in a single format, but clients on slow links may
+ * be better served by a smaller encoding of the same tile, such as a lower
+ * quality JPEG.  Tiles are transcoded in the thread pool using the encoders
+ * of the mapcache core, and the variants kept in memory keyed on the tile
+ * and format, with the least recently used evicted first.  Variants can also
+ * be stored on disk, each file having the modification time of its original
+ * tile so that variants of tiles which have since changed are ignored.
+ * Instances can be used from any thread.
+ */
+class VariantCache {
+public:
+
+  /// A transcoded tile
+  struct Variant {
+    /// The encoded tile
+    std::string data;
+    /// The MIME type of the encoding
+    std::string content_type;
+    /// The modification time of the original tile
+    apr_time_t mtime;
+  };
+
+  /// A snapshot of the cache metrics
+  struct Stats {
+    /// The number of variants held in memory
+    uint32_t variants;
+    /// The total size of the variants in memory in bytes
+    uint64_t bytes;
+    /// The number of variants returned from memory
+    uint64_t hits;
+    /// The number of variants read from disk
+    uint64_t disk_hits;
+    /// The number of tiles transcoded
+    uint64_t transcoded;
+    /// The number of tiles that could not be transcoded
+    uint64_t errors;
+    /// The number of variants evicted to stay within the size limit
+    uint64_t evicted;
+  };
+
+  /// Instantiate a cache of `max_size` bytes, stored in `directory` if set
+  VariantCache(uint64_t max_size, const std::string &directory);
+
+  /// Free the cached variants
+  ~VariantCache();
+
+  /// The key of a variant of a tile
+  static std::string Key(const std::string &layer, int z, int x, int y, const std::string &variant);
+
+  /// Look up a variant in memory
+  bool Get(const std::string &key, Variant &variant);
+
+  /// Look up a variant on disk, checking it is a variant of the current tile
+  bool Load(const std::string &key, apr_time_t mtime, Variant &variant);
+
+  /// Add a variant to memory and, if `store` is set, to disk
+  void Put(const std::string &key, const Variant &variant, bool store);
+
+  /// Transcode a tile into a format
+  bool Transcode(mapcache_context *ctx, mapcache_buffer *tile, mapcache_image_format *format,
+                 std::string &data);
+
+  /// Remove the variants of a tileset from memory
+  void Purge(const std::string &tileset);
+
+  /// Retrieve the cache metrics
+  void GetStats(Stats &stats);
+
+  /// The maximum total size of the variants in memory in bytes
+  const uint64_t max_size;
+
+  /// The directory variants are stored in, or empty if they aren't
+  const std::string directory;
+
+private:
+
+  /// A cached variant
+  struct Entry {
+    /// The variant
+    Variant variant;
+    /// The position of the entry in `lru`
+    std::list<std::string>::iterator position;
+  };
+
+  /// The variants keyed on tile and format
+  std::map<std::string, Entry> entries;
+
+  /// The variant keys from most to least recently used
+  std::list<std::string> lru;
+
+  /// Protects the entries and the metrics
+  uv_mutex_t mutex;
+
+  /// The metrics
+  Stats stats;
+
+  /// Remove an entry, with the mutex held
+  void Remove(std::map<std::string, Entry>::iterator entry);
+
+  /// Write a variant to disk
+  bool Store(const std::string &key, const Variant &variant);
+};
+
+#endif  /* __NODE_MAPCACHE_VARIANTCACHE_H__ */
@@ -0,0 +1,147 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file warmer.cpp
+ * @brief This defines the `TileWarmer` class.
+ */
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "warmer.hpp"
+
+/// The niceness of low priority threads
+#define NODE_MAPCACHE_WARMUP_NICENESS 10
+
+/**
+ * @param cfg The configuration containing the tilesets.
+ *
+ * @param tiles The tiles to fetch, in the order they are fetched.
+ *
+ * @param threads The number of threads fetching tiles.
+ *
+ * @param low_priority Set to run the threads at a lower priority.
+ *
+ * @param factory Used by the threads to create mapcache contexts.
+ */
+TileWarmer::TileWarmer(mapcache_cfg *cfg, const std::vector<Tile> &tiles, unsigned int threads,
+                       bool low_priority, ContextFactory factory) :
+  processed(0),
+  errors(0),
+  duration(0),
+  cfg(cfg),
+  tiles(tiles),
+  threads(threads),
+  low_priority(low_priority),
+  factory(factory),
+  next(0)
+{
+}
+
+/**
+ * @param error Set to a description of any failure.
+ */
+bool TileWarmer::Run(std::string &error) {
+  uint64_t start = uv_hrtime();
+
+  std::vector<uv_thread_t> fetchers(threads);
+  for (unsigned int i = 0; i < threads; i++) {
+    if (uv_thread_create(&fetchers[i], RunFetcher, this) != 0) {
+      fetchers.resize(i);
+      break;
+    }
+  }
+  if (fetchers.empty()) {
+    error = "Could not create the warmup threads";
+    return false;
+  }
+
+  for (std::vector<uv_thread_t>::iterator it = fetchers.begin(); it != fetchers.end(); ++it) {
+    uv_thread_join(&(*it));
+  }
+
+  duration = uv_hrtime() - start;
+  return true;
+}
+
+/**
+ * @details Each thread uses its own context and memory pool, clearing the
+ * tile pool after every tile.  On Linux the niceness of a thread can be set
+ * independently of the rest of the process; elsewhere `low_priority` has no
+ * effect.
+ */
+void TileWarmer::Fetch() {
+  apr_pool_t *pool = NULL, *tile_pool = NULL;
+  mapcache_context *ctx = NULL;
+
+#ifdef __linux__
+  if (low_priority) {
+    setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), NODE_MAPCACHE_WARMUP_NICENESS);
+  }
+#endif
+
+  if (apr_pool_create(&pool, NULL) == APR_SUCCESS
+      && apr_pool_create(&tile_pool, pool) == APR_SUCCESS) {
+    ctx = factory(pool);
+  }
+
+  uint64_t i;
+  while (ctx && (i = __sync_fetch_and_add(&next, 1)) < tiles.size()) {
+    ctx->config = cfg;
+
+    mapcache_tile *tile = mapcache_tileset_tile_create(tile_pool, tiles[i].tileset, tiles[i].grid_link);
+    tile->x = tiles[i].x;
+    tile->y = tiles[i].y;
+    tile->z = tiles[i].z;
+    mapcache_tileset_tile_validate(ctx, tile);
+    if (!GC_HAS_ERROR(ctx)) {
+      mapcache_tileset_tile_get(ctx, tile);
+    }
+    if (GC_HAS_ERROR(ctx)) {
+      __sync_fetch_and_add(&errors, 1);
+      ctx->clear_errors(ctx);
+    }
+    apr_pool_clear(tile_pool);
+    __sync_fetch_and_add(&processed, 1);
+  }
+
+  if (pool) {
+    apr_pool_destroy(pool);
+  }
+}
+
+/**
+ * @param arg The `TileWarmer` instance.
+ */
+void TileWarmer::RunFetcher(void *arg) {
+  static_cast<TileWarmer*>(arg)->Fetch();
+}
@@ -0,0 +1,125 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_WARMER_H__
+#define __NODE_MAPCACHE_WARMER_H__
+
+/**
+ * @file warmer.hpp
+ * @brief This declares the `TileWarmer` class.
+ */
+
+// Standard headers
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// Apache headers
+#include <apr_pools.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief A prefetcher of tiles into the cache
+ *
+ * The tiles are shared between a number of threads, each of which requests
+ * its tiles from the tileset as a request would: tiles that aren't cached are
+ * rendered and stored, and those that are are read, bringing them into the
+ * operating system's page cache.  The threads can run at a lower scheduling
+ * priority so that prefetching doesn't slow down requests being served at the
+ * same time.  Progress is recorded in counters which can be read from any
+ * thread while the tiles are fetched.
+ */
+class TileWarmer {
+public:
+
+  /// A function creating a mapcache context from a memory pool
+  typedef mapcache_context* (*ContextFactory)(apr_pool_t *pool);
+
+  /// A tile to prefetch
+  struct Tile {
+    mapcache_tileset *tileset;
+    mapcache_grid_link *grid_link;
+    int x, y, z;
+  };
+
+  /// Intantiate a warmer of `tiles` using `threads` threads
+  TileWarmer(mapcache_cfg *cfg, const std::vector<Tile> &tiles, unsigned int threads,
+             bool low_priority, ContextFactory factory);
+
+  /// Fetch the tiles, blocking until finished
+  bool Run(std::string &error);
+
+  /// The total number of tiles
+  uint64_t Total() const {
+    return tiles.size();
+  }
+
+  /// The number of tiles fetched so far
+  volatile uint64_t processed;
+
+  /// The number of tiles that could not be fetched
+  volatile uint64_t errors;
+
+  /// The time taken in nanoseconds
+  uint64_t duration;
+
+private:
+
+  /// The configuration containing the tilesets
+  mapcache_cfg *cfg;
+
+  /// The tiles to fetch
+  std::vector<Tile> tiles;
+
+  /// The number of threads fetching tiles
+  unsigned int threads;
+
+  /// Set if the threads run at a lower scheduling priority
+  bool low_priority;
+
+  /// Creates contexts for the threads
+  ContextFactory factory;
+
+  /// The index of the next tile to claim
+  volatile uint64_t next;
+
+  /// Fetch the tiles claimed from the list
+  void Fetch();
+
+  /// The thread entry point
+  static void RunFetcher(void *arg);
+};
+
+#endif  /* __NODE_MAPCACHE_WARMER_H__ */
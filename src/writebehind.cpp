@@ -0,0 +1,442 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file writebehind.cpp
+ * @brief This defines the `WriteBehind` class.
+ */
+
+
+#include "writebehind.hpp"
+#include "tileidentity.hpp"
+
+std::map<mapcache_cache*, WriteBehind::Hook*> WriteBehind::registry;
+uv_rwlock_t WriteBehind::registry_lock;
+uv_once_t WriteBehind::registry_once = UV_ONCE_INIT;
+
+/**
+ * @param cfg The configuration containing the caches to write to.
+ *
+ * @param capacity The maximum number of tiles that can be queued.
+ *
+ * @param shared Whether other processes use the caches, in which case tiles
+ * are always written synchronously.
+ *
+ * @param factory Used by the writer thread to create mapcache contexts.
+ */
+WriteBehind::WriteBehind(mapcache_cfg *cfg, uint32_t capacity, bool shared, ContextFactory factory) :
+  cfg(cfg),
+  capacity(capacity),
+  shared(shared),
+  factory(factory),
+  started(false),
+  stopping(false)
+{
+  uv_mutex_init(&mutex);
+  uv_mutex_init(&write_mutex);
+  uv_cond_init(&work_cond);
+  uv_cond_init(&idle_cond);
+
+  stats.queued = stats.batches = 0;
+  stats.capacity = capacity;
+  stats.written = stats.synchronous = stats.errors = 0;
+}
+
+/**
+ * @details The queue is drained before the original storage functions are
+ * restored, so every tile accepted by the writer reaches its cache.
+ */
+WriteBehind::~WriteBehind() {
+  if (started) {
+    uv_mutex_lock(&mutex);
+    stopping = true;
+    uv_cond_signal(&work_cond);
+    uv_mutex_unlock(&mutex);
+    uv_thread_join(&thread);
+
+    uv_rwlock_wrlock(&registry_lock);
+    for (std::vector<mapcache_cache*>::iterator it = caches.begin(); it != caches.end(); ++it) {
+      mapcache_cache *cache = *it;
+      Hook *hook = registry[cache];
+      cache->tile_get = hook->original.tile_get;
+      cache->tile_exists = hook->original.tile_exists;
+      cache->tile_set = hook->original.tile_set;
+      cache->tile_multi_set = hook->original.tile_multi_set;
+      cache->tile_delete = hook->original.tile_delete;
+      registry.erase(cache);
+      delete hook;
+    }
+    uv_rwlock_wrunlock(&registry_lock);
+  }
+
+  uv_cond_destroy(&idle_cond);
+  uv_cond_destroy(&work_cond);
+  uv_mutex_destroy(&write_mutex);
+  uv_mutex_destroy(&mutex);
+}
+
+/**
+ * @details This should be called in the Node/V8 thread when no requests are
+ * using the configuration.
+ *
+ * @param error Set to a description of any failure.
+ */
+bool WriteBehind::Start(std::string &error) {
+  uv_once(&registry_once, InitRegistry);
+
+  if (uv_thread_create(&thread, Run, this) != 0) {
+    error = "Could not create the write behind thread";
+    return false;
+  }
+  started = true;
+
+  uv_rwlock_wrlock(&registry_lock);
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, cfg->caches); hi; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    mapcache_cache *cache = (mapcache_cache *) val;
+
+    Hook *hook = new Hook();
+    hook->owner = this;
+    hook->original = *cache;
+    registry[cache] = hook;
+    caches.push_back(cache);
+
+    cache->tile_get = TileGet;
+    cache->tile_exists = TileExists;
+    cache->tile_set = TileSet;
+    if (cache->tile_multi_set) {
+      cache->tile_multi_set = TileMultiSet;
+    }
+    cache->tile_delete = TileDelete;
+  }
+  uv_rwlock_wrunlock(&registry_lock);
+  return true;
+}
+
+/**
+ * @details This blocks the calling thread so it should not be called from the
+ * Node/V8 thread.
+ */
+void WriteBehind::Flush() {
+  uv_mutex_lock(&mutex);
+  while (stats.queued) {
+    uv_cond_wait(&idle_cond, &mutex);
+  }
+  uv_mutex_unlock(&mutex);
+}
+
+/**
+ * @param stats Set to the current metrics.
+ */
+void WriteBehind::GetStats(Stats &stats) {
+  uv_mutex_lock(&mutex);
+  stats = this->stats;
+  stats.batches = queue.size();
+  uv_mutex_unlock(&mutex);
+}
+
+void WriteBehind::InitRegistry() {
+  uv_rwlock_init(&registry_lock);
+}
+
+/**
+ * @param cache The cache being accessed by mapcache.
+ *
+ * @return The hook for `cache`, which must have been replaced.
+ */
+WriteBehind::Hook* WriteBehind::FindHook(mapcache_cache *cache) {
+  uv_rwlock_rdlock(&registry_lock);
+  Hook *hook = registry[cache];
+  uv_rwlock_rdunlock(&registry_lock);
+  return hook;
+}
+
+/**
+ * @details The tiles are encoded, if necessary, and copied with their
+ * dimensions into a pool owned by the queue.  The copies are then visible
+ * to `Read()` until they have been written.
+ *
+ * @param ctx The context of the request storing the tiles.
+ *
+ * @param hook The hook of the cache the tiles belong to.
+ *
+ * @param tiles The tiles to store.
+ *
+ * @param ntiles The number of tiles in `tiles`.
+ *
+ * @return `false` if the queue is full, or the caches are shared, and the
+ * tiles should be written synchronously.
+ */
+bool WriteBehind::Enqueue(mapcache_context *ctx, const Hook *hook, mapcache_tile *tiles, int ntiles) {
+  uv_mutex_lock(&mutex);
+  // a shared cache must hold the tiles before the metatile lock is released
+  bool synchronous = (shared || stopping || stats.queued + ntiles > capacity);
+  if (synchronous) {
+    stats.synchronous += ntiles;
+  } else {
+    stats.queued += ntiles;     // reserve space in the queue
+  }
+  uv_mutex_unlock(&mutex);
+  if (synchronous) {
+    return false;
+  }
+
+  Batch *batch = new Batch();
+  if (apr_pool_create(&(batch->pool), NULL) != APR_SUCCESS) {
+    delete batch;
+    uv_mutex_lock(&mutex);
+    stats.queued -= ntiles;
+    stats.synchronous += ntiles;
+    uv_mutex_unlock(&mutex);
+    return false;
+  }
+  batch->hook = hook;
+  batch->ntiles = ntiles;
+  batch->tiles = (mapcache_tile *) apr_pcalloc(batch->pool, ntiles * sizeof(mapcache_tile));
+  batch->keys.resize(ntiles);
+  batch->live.resize(ntiles, true);
+
+  apr_time_t now = apr_time_now();
+  for (int i = 0; i < ntiles; i++) {
+    mapcache_tile *tile = &tiles[i], *copy = &(batch->tiles[i]);
+
+    // the cache would otherwise encode the tile when it is stored
+    if (!tile->encoded_data) {
+      tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
+      if (GC_HAS_ERROR(ctx) || !tile->encoded_data) {
+        batch->live[i] = false;
+        continue;
+      }
+    }
+
+    *copy = *tile;
+    copy->lock = NULL;
+    copy->raw_image = NULL;
+    copy->encoded_data = mapcache_buffer_create(tile->encoded_data->size, batch->pool);
+    mapcache_buffer_append(copy->encoded_data, tile->encoded_data->size, tile->encoded_data->buf);
+    copy->dimensions = (tile->dimensions) ? apr_table_clone(batch->pool, tile->dimensions) : NULL;
+    if (!copy->mtime) {
+      copy->mtime = now;
+    }
+    batch->keys[i] = TileIdentity::Key(copy);
+  }
+
+  uv_mutex_lock(&mutex);
+  for (int i = 0; i < ntiles; i++) {
+    if (batch->live[i]) {
+      Entry entry = { batch, i };
+      pending[batch->keys[i]] = entry;
+    }
+  }
+  queue.push_back(batch);
+  uv_cond_signal(&work_cond);
+  uv_mutex_unlock(&mutex);
+  return true;
+}
+
+/**
+ * @param ctx The context of the request reading the tile.
+ *
+ * @param tile The tile to populate.
+ *
+ * @return `true` if the tile was queued and has been populated.
+ */
+bool WriteBehind::Read(mapcache_context *ctx, mapcache_tile *tile) {
+  std::string key = TileIdentity::Key(tile);
+  bool found = false;
+
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator it = pending.find(key);
+  if (it != pending.end()) {
+    const mapcache_tile *queued = &(it->second.batch->tiles[it->second.index]);
+    tile->encoded_data = mapcache_buffer_create(queued->encoded_data->size, ctx->pool);
+    mapcache_buffer_append(tile->encoded_data, queued->encoded_data->size, queued->encoded_data->buf);
+    tile->mtime = queued->mtime;
+    found = true;
+  }
+  uv_mutex_unlock(&mutex);
+  return found;
+}
+
+/**
+ * @details This holds the write mutex so a deletion can't be overtaken by a
+ * background write of the same tile.
+ *
+ * @param ctx The context of the request deleting the tile.
+ *
+ * @param hook The hook of the cache the tile belongs to.
+ *
+ * @param tile The tile to delete.
+ */
+void WriteBehind::Delete(mapcache_context *ctx, const Hook *hook, mapcache_tile *tile) {
+  std::string key = TileIdentity::Key(tile);
+
+  uv_mutex_lock(&write_mutex);
+  uv_mutex_lock(&mutex);
+  std::map<std::string, Entry>::iterator it = pending.find(key);
+  if (it != pending.end()) {
+    it->second.batch->live[it->second.index] = false;
+    pending.erase(it);
+  }
+  uv_mutex_unlock(&mutex);
+
+  hook->original.tile_delete(ctx, tile);
+  uv_mutex_unlock(&write_mutex);
+}
+
+/**
+ * @details This runs in the writer thread.  Tiles are removed from the
+ * pending tiles once they have been written, unless a later batch has
+ * replaced them.
+ *
+ * @param batch The batch to write, which is freed.
+ */
+void WriteBehind::Write(Batch *batch) {
+  const Hook *hook = batch->hook;
+  std::string error;
+
+  uv_mutex_lock(&write_mutex);
+
+  // collect the tiles that haven't been deleted in the meantime
+  uv_mutex_lock(&mutex);
+  mapcache_tile *tiles = (mapcache_tile *) apr_pcalloc(batch->pool, batch->ntiles * sizeof(mapcache_tile));
+  int ntiles = 0;
+  for (int i = 0; i < batch->ntiles; i++) {
+    if (batch->live[i]) {
+      tiles[ntiles++] = batch->tiles[i];
+    }
+  }
+  uv_mutex_unlock(&mutex);
+
+  mapcache_context *ctx = factory(batch->pool);
+  if (!ctx) {
+    error = "Could not create the write behind context";
+  } else if (ntiles) {
+    ctx->config = cfg;
+    if (ntiles > 1 && hook->original.tile_multi_set) {
+      hook->original.tile_multi_set(ctx, tiles, ntiles);
+    } else {
+      for (int i = 0; i < ntiles && !GC_HAS_ERROR(ctx); i++) {
+        hook->original.tile_set(ctx, &tiles[i]);
+      }
+    }
+
+    if (GC_HAS_ERROR(ctx)) {
+      const char *message = ctx->get_error_message(ctx);
+      error = (message) ? message : "The tiles could not be written";
+      ctx->clear_errors(ctx);
+    }
+  }
+
+  uv_mutex_lock(&mutex);
+  for (int i = 0; i < batch->ntiles; i++) {
+    std::map<std::string, Entry>::iterator it = pending.find(batch->keys[i]);
+    if (batch->live[i] && it != pending.end() && it->second.batch == batch) {
+      pending.erase(it);
+    }
+  }
+  stats.queued -= batch->ntiles;
+  if (error.empty()) {
+    stats.written += ntiles;
+  } else {
+    stats.errors += ntiles;
+    stats.last_error = error;
+  }
+  if (!stats.queued) {
+    uv_cond_broadcast(&idle_cond);
+  }
+  uv_mutex_unlock(&mutex);
+
+  uv_mutex_unlock(&write_mutex);
+
+  apr_pool_destroy(batch->pool);
+  delete batch;
+}
+
+/**
+ * @details The thread exits once it has been told to stop and the queue is
+ * empty.
+ *
+ * @param arg The `WriteBehind` instance.
+ */
+void WriteBehind::Run(void *arg) {
+  WriteBehind *self = static_cast<WriteBehind*>(arg);
+
+  uv_mutex_lock(&self->mutex);
+  for (;;) {
+    while (self->queue.empty() && !self->stopping) {
+      uv_cond_wait(&self->work_cond, &self->mutex);
+    }
+    if (self->queue.empty()) {
+      break;
+    }
+
+    Batch *batch = self->queue.front();
+    self->queue.pop_front();
+    uv_mutex_unlock(&self->mutex);
+    self->Write(batch);
+    uv_mutex_lock(&self->mutex);
+  }
+  uv_mutex_unlock(&self->mutex);
+}
+
+int WriteBehind::TileGet(mapcache_context *ctx, mapcache_tile *tile) {
+  const Hook *hook = FindHook(tile->tileset->cache);
+  if (hook->owner->Read(ctx, tile)) {
+    return MAPCACHE_SUCCESS;
+  }
+  return hook->original.tile_get(ctx, tile);
+}
+
+int WriteBehind::TileExists(mapcache_context *ctx, mapcache_tile *tile) {
+  const Hook *hook = FindHook(tile->tileset->cache);
+  uv_mutex_lock(&hook->owner->mutex);
+  bool queued = (hook->owner->pending.find(TileIdentity::Key(tile)) != hook->owner->pending.end());
+  uv_mutex_unlock(&hook->owner->mutex);
+  return (queued) ? MAPCACHE_TRUE : hook->original.tile_exists(ctx, tile);
+}
+
+void WriteBehind::TileSet(mapcache_context *ctx, mapcache_tile *tile) {
+  const Hook *hook = FindHook(tile->tileset->cache);
+  if (!hook->owner->Enqueue(ctx, hook, tile, 1)) {
+    hook->original.tile_set(ctx, tile);
+  }
+}
+
+void WriteBehind::TileMultiSet(mapcache_context *ctx, mapcache_tile *tiles, int ntiles) {
+  const Hook *hook = FindHook(tiles[0].tileset->cache);
+  if (!hook->owner->Enqueue(ctx, hook, tiles, ntiles)) {
+    hook->original.tile_multi_set(ctx, tiles, ntiles);
+  }
+}
+
+void WriteBehind::TileDelete(mapcache_context *ctx, mapcache_tile *tile) {
+  const Hook *hook = FindHook(tile->tileset->cache);
+  hook->owner->Delete(ctx, hook, tile);
+}
@@ -0,0 +1,240 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+#ifndef __NODE_MAPCACHE_WRITEBEHIND_H__
+#define __NODE_MAPCACHE_WRITEBEHIND_H__
+
+/**
+ * @file writebehind.hpp
+ * @brief This declares the `WriteBehind` class.
+ */
+
+// Standard headers
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+// Node headers
+#include <uv.h>
+
+// Apache headers
+#include <apr_pools.h>
+
+// MapCache headers
+extern "C" {
+#include "mapcache.h"
+}
+
+/**
+ * @brief A background writer for tiles stored in a cache
+ *
+ * When a tile is missing from a cache, the mapcache core renders the
+ * containing metatile and stores every tile in it before returning the
+ * requested tile, which it then reads back from the cache.  This class
+ * replaces the storage functions of each cache in a configuration so that the
+ * tiles are copied to a bounded queue and written by a background thread
+ * instead.
+ *
+ * Tiles waiting to be written are returned by the replacement read
+ * functions, so the requested tile is available as soon as it has been
+ * encoded.  When the queue is full tiles are written synchronously as
+ * normal.
+ *
+ * The mapcache core releases the metatile lock as soon as the tiles have been
+ * stored, so queued tiles are only visible within this process.  Other
+ * processes waiting on the lock would then find the tiles missing, so when
+ * the cache is shared every tile is written synchronously instead.
+ *
+ * As mapcache calls the storage functions without any user data, instances
+ * are found from the cache being accessed using a process wide registry.
+ */
+class WriteBehind {
+public:
+
+  /// A function creating a mapcache context from a memory pool
+  typedef mapcache_context* (*ContextFactory)(apr_pool_t *pool);
+
+  /// A snapshot of the writer metrics
+  struct Stats {
+    /// The number of tiles queued or being written
+    uint32_t queued;
+    /// The maximum number of tiles that can be queued
+    uint32_t capacity;
+    /// The number of batches waiting to be written
+    uint32_t batches;
+    /// The number of tiles written in the background
+    uint64_t written;
+    /// The number of tiles written synchronously as the queue was full or the
+    /// cache is shared
+    uint64_t synchronous;
+    /// The number of tiles that failed to be written in the background
+    uint64_t errors;
+    /// The message from the last background write failure
+    std::string last_error;
+  };
+
+  /// Intantiate a writer for the caches in `cfg`
+  WriteBehind(mapcache_cfg *cfg, uint32_t capacity, bool shared, ContextFactory factory);
+
+  /// Whether the caches are shared with other processes
+  bool Shared() const {
+    return shared;
+  }
+
+  /// Start the writer thread and take over the cache storage functions
+  bool Start(std::string &error);
+
+  /// Block until every queued tile has been written
+  void Flush();
+
+  /// Retrieve the current metrics
+  void GetStats(Stats &stats);
+
+  /// Write the queued tiles and restore the cache storage functions
+  ~WriteBehind();
+
+private:
+
+  /// A cache whose storage functions have been replaced
+  struct Hook {
+    /// The instance writing tiles to the cache
+    WriteBehind *owner;
+    /// A copy of the cache with the original functions
+    mapcache_cache original;
+  };
+
+  /// A group of tiles stored by a single call to the cache
+  struct Batch {
+    /// The pool containing the copied tiles
+    apr_pool_t *pool;
+    /// The hook of the cache the tiles belong to
+    const Hook *hook;
+    /// The copied tiles
+    mapcache_tile *tiles;
+    /// The number of tiles in `tiles`
+    int ntiles;
+    /// The pending key of each tile
+    std::vector<std::string> keys;
+    /// Whether each tile still needs writing (it may have been deleted)
+    std::vector<bool> live;
+  };
+
+  /// The location of a queued tile
+  struct Entry {
+    Batch *batch;
+    int index;
+  };
+
+  /// The configuration containing the caches
+  mapcache_cfg *cfg;
+
+  /// The maximum number of tiles that can be queued
+  const uint32_t capacity;
+
+  /// Whether tiles must be written before the metatile lock is released
+  const bool shared;
+
+  /// Creates contexts for the writer thread
+  ContextFactory factory;
+
+  /// Protects the queue, the pending tiles and the metrics
+  uv_mutex_t mutex;
+
+  /// Serialises background writes with tile deletions
+  uv_mutex_t write_mutex;
+
+  /// Signalled when a batch is queued or the writer is stopping
+  uv_cond_t work_cond;
+
+  /// Signalled when the queue becomes empty
+  uv_cond_t idle_cond;
+
+  /// The writer thread
+  uv_thread_t thread;
+
+  /// Set once `Start()` has succeeded
+  bool started;
+
+  /// Set when the writer thread should exit once the queue is empty
+  bool stopping;
+
+  /// The batches waiting to be written
+  std::deque<Batch*> queue;
+
+  /// The queued tiles, keyed on their location
+  std::map<std::string, Entry> pending;
+
+  /// The metrics
+  Stats stats;
+
+  /// The caches whose functions have been replaced
+  std::vector<mapcache_cache*> caches;
+
+  /// Replaced caches mapped to their hooks
+  static std::map<mapcache_cache*, Hook*> registry;
+
+  /// Protects the registry
+  static uv_rwlock_t registry_lock;
+
+  /// Ensures the registry lock is initialised once
+  static uv_once_t registry_once;
+
+  /// Initialise the registry lock
+  static void InitRegistry();
+
+  /// Find the hook for a cache
+  static Hook* FindHook(mapcache_cache *cache);
+
+  /// Copy tiles to the queue, returning `false` if they should be written now
+  bool Enqueue(mapcache_context *ctx, const Hook *hook, mapcache_tile *tiles, int ntiles);
+
+  /// Read a queued tile into `tile`, returning `false` if it isn't queued
+  bool Read(mapcache_context *ctx, mapcache_tile *tile);
+
+  /// Remove a tile from the queue and the cache
+  void Delete(mapcache_context *ctx, const Hook *hook, mapcache_tile *tile);
+
+  /// Write a batch to its cache
+  void Write(Batch *batch);
+
+  /// The writer thread entry point
+  static void Run(void *arg);
+
+  /// Replacement cache functions
+  /**@{*/
+  static int TileGet(mapcache_context *ctx, mapcache_tile *tile);
+  static int TileExists(mapcache_context *ctx, mapcache_tile *tile);
+  static void TileSet(mapcache_context *ctx, mapcache_tile *tile);
+  static void TileMultiSet(mapcache_context *ctx, mapcache_tile *tiles, int ntiles);
+  static void TileDelete(mapcache_context *ctx, mapcache_tile *tile);
+  /**@}*/
+};
+
+#endif  /* __NODE_MAPCACHE_WRITEBEHIND_H__ */
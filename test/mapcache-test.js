@@ -42,7 +42,11 @@ var vows = require('vows'),
     assert = require('assert'),
     path = require('path'),
     fs = require('fs'),
+    os = require('os'),
     events = require('events'),
+    http = require('http'),
+    url = require('url'),
+    zlib = require('zlib'),
     mapcache = require('../lib/mapcache');
 
 function checkContentLength(response, expectedLength) {
@@ -60,6 +64,81 @@ function checkContentLength(response, expectedLength) {
     }
 }
 
+// Create a PNG chunk of a type containing data
+function pngChunk(type, data) {
+    var chunk = new Buffer(12 + data.length), crc = 0xffffffff, i, k;
+
+    chunk.writeUInt32BE(data.length, 0);
+    chunk.write(type, 4, 'ascii');
+    data.copy(chunk, 8);
+    for (i = 4; i < 8 + data.length; i++) {
+        crc ^= chunk[i];
+        for (k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >>> 1) ^ 0xedb88320 : crc >>> 1;
+        }
+    }
+    chunk.writeUInt32BE((crc ^ 0xffffffff) >>> 0, 8 + data.length);
+    return chunk;
+}
+
+// Create a blank white PNG image
+function blankPng(width, height, callback) {
+    var header = new Buffer(13), rows = new Buffer((width * 3 + 1) * height), y;
+
+    header.fill(0);
+    header.writeUInt32BE(width, 0);
+    header.writeUInt32BE(height, 4);
+    header[8] = 8;              // bit depth
+    header[9] = 2;              // RGB
+    rows.fill(0xff);
+    for (y = 0; y < height; y++) {
+        rows[y * (width * 3 + 1)] = 0; // no filter
+    }
+
+    zlib.deflate(rows, function (err, data) {
+        if (err) {
+            return callback(err);
+        }
+        return callback(null, Buffer.concat([
+            new Buffer([137, 80, 78, 71, 13, 10, 26, 10]),
+            pngChunk('IHDR', header),
+            pngChunk('IDAT', data),
+            pngChunk('IEND', new Buffer(0))
+        ]));
+    });
+}
+
+// Start the stub WMS used by `stub-wms.xml`, returning blank images
+function startStubWms(callback) {
+    var server = http.createServer(function (req, res) {
+        var query = url.parse(req.url, true).query;
+
+        server.requests++;
+        blankPng(parseInt(query.WIDTH || query.width, 10), parseInt(query.HEIGHT || query.height, 10), function (err, png) {
+            res.writeHead(200, {'Content-Type': 'image/png'});
+            res.end(png);
+        });
+    });
+    server.requests = 0;
+    server.listen(38517, 'localhost', function () {
+        callback(server);
+    });
+}
+
+// The location of a tile in the stub WMS disk cache
+function stubTilePath(tileset, z, x, y) {
+    function pad(n, width) {
+        n = String(n);
+        while (n.length < width) {
+            n = '0' + n;
+        }
+        return n;
+    }
+    return path.join('/tmp/node-mapcache-stub', tileset, 'WGS84', pad(z, 2),
+                     pad(Math.floor(x / 1000000), 3), pad(Math.floor(x / 1000) % 1000, 3), pad(x % 1000, 3),
+                     pad(Math.floor(y / 1000000), 3), pad(Math.floor(y / 1000) % 1000, 3), pad(y % 1000, 3) + '.png');
+}
+
 vows.describe('mapcache').addBatch({
     // Ensure the module has the expected interface
 
@@ -223,6 +302,17 @@ vows.describe('mapcache').addBatch({
                 assert.equal(retval, 'undefined');
             }
         },
+        'works with four valid arguments': {
+            topic: function (FromConfigFile) {
+                var logger = new events.EventEmitter();
+                return typeof(FromConfigFile('non-existent-file', logger, {lazy: true}, function(err, cache) {
+                    // do nothing
+                }));
+            },
+            'returning undefined': function (retval) {
+                assert.equal(retval, 'undefined');
+            }
+        },
         'fails with one argument': {
             topic: function (FromConfigFile) {
                 try {
@@ -233,20 +323,20 @@ vows.describe('mapcache').addBatch({
             },
             'by throwing an error': function (err) {
                 assert.instanceOf(err, Error);
-                assert.equal(err.message, 'usage: MapCache.FromConfigFile(configfile, [logger], callback)');
+                assert.equal(err.message, 'usage: MapCache.FromConfigFile(configfile, [logger], [options], callback)');
             }
         },
-        'fails with four arguments': {
+        'fails with five arguments': {
             topic: function (FromConfigFile) {
                 try {
-                    return FromConfigFile('first-arg', 'second-arg', 'third-arg', 'fourth-arg');
+                    return FromConfigFile('first-arg', 'second-arg', 'third-arg', 'fourth-arg', 'fifth-arg');
                 } catch (e) {
                     return e;
                 }
             },
             'by throwing an error': function (err) {
                 assert.instanceOf(err, Error);
-                assert.equal(err.message, 'usage: MapCache.FromConfigFile(configfile, [logger], callback)');
+                assert.equal(err.message, 'usage: MapCache.FromConfigFile(configfile, [logger], [options], callback)');
             }
         },
         'requires a string for the first argument': {
@@ -376,20 +466,20 @@ vows.describe('mapcache').addBatch({
             },
             'throwing an error': function (err) {
                 assert.instanceOf(err, Error);
-                assert.equal(err.message, 'usage: cache.get(baseUrl, pathInfo, queryString, callback)');
+                assert.equal(err.message, 'usage: cache.get(baseUrl, pathInfo, queryString, [options], callback)');
             }
         },
-        'fails with five arguments': {
+        'fails with six arguments': {
             topic: function (cache) {
                 try {
-                    return cache.get('1st', '2nd', '3rd', '4th', '5th');
+                    return cache.get('1st', '2nd', '3rd', '4th', '5th', '6th');
                 } catch (e) {
                     return e;
                 }
             },
             'throwing an error': function (err) {
                 assert.instanceOf(err, Error);
-                assert.equal(err.message, 'usage: cache.get(baseUrl, pathInfo, queryString, callback)');
+                assert.equal(err.message, 'usage: cache.get(baseUrl, pathInfo, queryString, [options], callback)');
             }
         },
         'requires a string for the first argument': {
@@ -449,6 +539,21 @@ vows.describe('mapcache').addBatch({
                 assert.instanceOf(err, TypeError);
                 assert.equal(err.message, 'Argument 3 must be a function');
             }
+        },
+        'requires an object for the options argument': {
+            topic: function (cache) {
+                try {
+                    return cache.get('1st', '2nd', '3rd', '4th', function(err, response) {
+                        // do nothing
+                    });
+                } catch (e) {
+                    return e;
+                }
+            },
+            'throwing an error otherwise': function (err) {
+                assert.instanceOf(err, TypeError);
+                assert.equal(err.message, 'Argument 3 must be an object');
+            }
         }
     }
 }).addBatch({
@@ -763,57 +868,1784 @@ vows.describe('mapcache').addBatch({
         }
     }
 }).addBatch({
-    // Ensure the logger works as expected
+    // Ensure the blank tile index works as expected
 
-    'requesting an invalid KML cache resource': {
+    'the blank tile index': {
         topic: function () {
-            var promise = new events.EventEmitter(),
-                logger = new events.EventEmitter(),
-                timeout = setTimeout(function() {
-                    logger.emit('error', new Error('No log was emitted'));
-                }, 2000);
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
 
-            function log(level, msg) {
-                clearTimeout(timeout);
+        'requires one argument when enabled': function (cache) {
+            var err;
+            try {
+                cache.enableBlankIndex();
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'usage: cache.enableBlankIndex(path, [callback])');
+        },
+        'requires a string when enabled': function (cache) {
+            var err;
+            try {
+                cache.enableBlankIndex(42);
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Argument 0 must be a string');
+        },
+        'cannot be saved before it is enabled': function (cache) {
+            var err;
+            try {
+                cache.saveBlankIndex(function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'The blank tile index is not enabled');
+        },
+        'when enabled, used and saved': {
+            topic: function (cache) {
+                var self = this,
+                    index = path.join(os.tmpdir(), 'node-mapcache-blank-' + process.pid + '.idx');
 
-                // ignore all levels bar ERROR.
-                if (level == mapcache.logLevels.ERROR) {
-                    promise.emit('success', level, msg);
-                    logger.removeListener('log', log); // we've done our job
+                cache.enableBlankIndex(index);
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function (err, response) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    return cache.saveBlankIndex(function (err) {
+                        self.callback(err, cache, index, response);
+                    });
+                });
+            },
+            'still returns tiles': function (err, cache, index, response) {
+                assert.isNull(err);
+                assert.strictEqual(response.code, 200);
+                checkContentLength(response);
+            },
+            'writes the index file': function (err, cache, index, response) {
+                assert.isNull(err);
+                assert.isTrue(fs.existsSync(index));
+                fs.unlinkSync(index);
+            },
+            'cannot be enabled twice': function (err, cache, index, response) {
+                var e;
+                try {
+                    cache.enableBlankIndex(index);
+                } catch (ex) {
+                    e = ex;
                 }
+                assert.instanceOf(e, Error);
+                assert.equal(e.message, 'The blank tile index is already enabled');
             }
+        }
+    },
+    'a blank tile': {
+        topic: function () {
+            var self = this,
+                index = path.join(os.tmpdir(), 'node-mapcache-blank-stub-' + process.pid + '.idx'),
+                tile = '/tms/1.0.0/stub@WGS84/6/1/1.png';
 
-            logger.on('log', log);
+            if (fs.existsSync(stubTilePath('stub', 6, 1, 1))) {
+                fs.unlinkSync(stubTilePath('stub', 6, 1, 1));
+            }
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'stub-wms.xml'), function (err, cache) {
+                if (err) {
+                    return self.callback(err);
+                }
+                return cache.enableBlankIndex(index, function (err, seeded) {
+                    startStubWms(function (server) {
+                        cache.get('http://localhost:3000', tile, '', function (err, first) {
+                            server.close();
+                            if (err) {
+                                return self.callback(err);
+                            }
+                            // the tile can now only be returned from the index
+                            fs.unlinkSync(stubTilePath('stub', 6, 1, 1));
+                            return cache.get('http://localhost:3000', tile, '', function (err, second) {
+                                self.callback(err, seeded, first, second, server.requests);
+                            });
+                        });
+                    });
+                });
+            });
+        },
+        'is rendered once': function (err, seeded, first, second, requests) {
+            assert.isNull(err);
+            assert.equal(seeded, 0);
+            assert.strictEqual(first.code, 200);
+            assert.equal(requests, 1);
+        },
+        'is then returned from the index': function (err, seeded, first, second, requests) {
+            assert.strictEqual(second.code, 200);
+            checkContentLength(second, first.headers['Content-Length'][0]);
+            assert.deepEqual(second.headers['Content-Type'], first.headers['Content-Type']);
+        }
+    }
+}).addBatch({
+    // Ensure the existence filter works as expected
 
-            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), logger, function (err, cache) {
+    'the existence filter': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires an object for options': function (cache) {
+            var err;
+            try {
+                cache.enableExistenceFilter('options');
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Argument 0 must be an object');
+        },
+        'requires numeric options': function (cache) {
+            var err;
+            try {
+                cache.enableExistenceFilter({capacity: 'lots'});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Option `capacity` must be a number');
+        },
+        'requires a valid error rate': function (cache) {
+            var err;
+            try {
+                cache.enableExistenceFilter({errorRate: 2});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The existence filter capacity or error rate is out of range');
+        },
+        'has no statistics before it is enabled': function (cache) {
+            var err;
+            try {
+                cache.existenceFilterStats();
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'The existence filter is not enabled');
+        },
+        'when enabled': {
+            topic: function (cache) {
+                var self = this;
+                cache.enableExistenceFilter({capacity: 1000, renderConcurrency: 1}, function (err, stats) {
+                    self.callback(err, cache, stats);
+                });
+            },
+            'returns statistics': function (err, cache, stats) {
+                assert.isUndefined(err);
+                assert.isTrue(stats.ready);
+                assert.isNumber(stats.buildTime);
+                assert.strictEqual(stats.rendersActive, 0);
+                assert.strictEqual(stats.renderQueue, 0);
+            },
+            'finds the cached tiles': function (err, cache, stats) {
+                var layer = stats.layers['test@WGS84'];
+                assert.isObject(layer);
+                assert.isTrue(layer.walked);
+                assert.isTrue(layer.tiles >= 2);
+                assert.isTrue(layer.falsePositiveRate < 0.01);
+            },
+            'cannot be enabled twice': function (err, cache, stats) {
+                var e;
+                try {
+                    cache.enableExistenceFilter();
+                } catch (ex) {
+                    e = ex;
+                }
+                assert.instanceOf(e, Error);
+                assert.equal(e.message, 'The existence filter is already enabled');
+            },
+            'and requesting a cached tile': {
+                topic: function (cache) {
+                    cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', this.callback);
+                },
+                'returns the tile': function (response) {
+                    assert.strictEqual(response.code, 200);
+                    checkContentLength(response);
+                }
+            }
+        }
+    }
+}).addBatch({
+    // Ensure write behind works as expected
+
+    'write behind': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires an object for options': function (cache) {
+            var err;
+            try {
+                cache.enableWriteBehind(42);
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Argument 0 must be an object');
+        },
+        'requires a valid queue size': function (cache) {
+            var err;
+            try {
+                cache.enableWriteBehind({queueSize: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The write behind queue size is out of range');
+        },
+        'cannot be flushed before it is enabled': function (cache) {
+            var err;
+            try {
+                cache.flushWrites(function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'Write behind is not enabled');
+        },
+        'when enabled, used and flushed': {
+            topic: function (cache) {
+                var self = this;
+                cache.enableWriteBehind({queueSize: 64});
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function (err, response) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    return cache.flushWrites(function (err) {
+                        self.callback(err, cache, response);
+                    });
+                });
+            },
+            'still returns tiles': function (err, cache, response) {
+                assert.isUndefined(err);
+                assert.strictEqual(response.code, 200);
+                checkContentLength(response);
+            },
+            'returns statistics': function (err, cache, response) {
+                var stats = cache.writeBehindStats();
+                assert.strictEqual(stats.queued, 0);
+                assert.strictEqual(stats.queueSize, 64);
+                assert.strictEqual(stats.batches, 0);
+                assert.strictEqual(stats.errors, 0);
+            },
+            'cannot be enabled twice': function (err, cache, response) {
+                var e;
+                try {
+                    cache.enableWriteBehind();
+                } catch (ex) {
+                    e = ex;
+                }
+                assert.instanceOf(e, Error);
+                assert.equal(e.message, 'Write behind is already enabled');
+            }
+        }
+    },
+    'write behind for a missing tile': {
+        topic: function () {
+            var self = this;
+
+            if (fs.existsSync(stubTilePath('stub', 6, 2, 1))) {
+                fs.unlinkSync(stubTilePath('stub', 6, 2, 1));
+            }
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'stub-wms.xml'), function (err, cache) {
                 if (err) {
-                    clearTimeout(timeout);
-                    return promise.emit('error', err);
+                    return self.callback(err);
                 }
-                return cache.get(
-                    'http://localhost:3000/',
-                    '/kml/foobar',
-                    '',
-                    function (err, response) {
+                cache.enableWriteBehind();
+                return startStubWms(function (server) {
+                    cache.get('http://localhost:3000', '/tms/1.0.0/stub@WGS84/6/2/1.png', '', function (err, response) {
                         if (err) {
-                            clearTimeout(timeout);
-                            promise.emit('error', err);
+                            server.close();
+                            return self.callback(err);
                         }
+                        return cache.flushWrites(function (err) {
+                            server.close();
+                            self.callback(err, cache, response);
+                        });
                     });
+                });
             });
+        },
+        'returns the rendered tile': function (err, cache, response) {
+            assert.isUndefined(err);
+            assert.strictEqual(response.code, 200);
+            checkContentLength(response);
+        },
+        'writes it in the background': function (err, cache, response) {
+            var stats = cache.writeBehindStats();
+            assert.isTrue(stats.written > 0);
+            assert.strictEqual(stats.synchronous, 0);
+            assert.strictEqual(stats.errors, 0);
+            assert.isFalse(stats.shared);
+        },
+        'stores it on disk once flushed': function (err, cache, response) {
+            assert.isTrue(fs.existsSync(stubTilePath('stub', 6, 2, 1)));
+        },
+        'when the cache is shared': {
+            topic: function () {
+                var self = this;
 
-            return promise;
+                if (fs.existsSync(stubTilePath('stub', 6, 3, 1))) {
+                    fs.unlinkSync(stubTilePath('stub', 6, 3, 1));
+                }
+                mapcache.MapCache.FromConfigFile(path.join(__dirname, 'stub-wms.xml'), function (err, cache) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    cache.enableWriteBehind({shared: true});
+                    return startStubWms(function (server) {
+                        cache.get('http://localhost:3000', '/tms/1.0.0/stub@WGS84/6/3/1.png', '', function (err, response) {
+                            server.close();
+                            self.callback(err, cache, response);
+                        });
+                    });
+                });
+            },
+            'stores tiles before responding': function (err, cache, response) {
+                var stats = cache.writeBehindStats();
+                assert.isNull(err);
+                assert.strictEqual(response.code, 200);
+                assert.isTrue(stats.shared);
+                assert.isTrue(stats.synchronous > 0);
+                assert.strictEqual(stats.written, 0);
+                assert.isTrue(fs.existsSync(stubTilePath('stub', 6, 3, 1)));
+            }
+        }
+    }
+}).addBatch({
+    // Ensure the access log works as expected
+
+    'the access log': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
         },
-        'logs a valid log level': function (err, level, msg) {
-            assert.isNull(err);
-            assert.isNumber(level);
-            assert.equal(level >= mapcache.logLevels.DEBUG, true);
-            assert.equal(level <= mapcache.logLevels.EMERG, true);
+
+        'requires a callback': function (cache) {
+            var err;
+            try {
+                cache.enableAccessLog({});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Argument 0 must be a function');
         },
-        'logs a message': function (err, level, msg) {
+        'requires a valid size': function (cache) {
+            var err;
+            try {
+                cache.enableAccessLog({size: 0}, function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The access log size or interval is out of range');
+        },
+        'when enabled and used': {
+            topic: function (cache) {
+                var self = this, delivered = false;
+                cache.enableAccessLog({interval: 10}, function (records, dropped) {
+                    if (!delivered) {
+                        delivered = true;
+                        self.callback(null, records, dropped);
+                    }
+                });
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function () {});
+            },
+            'delivers a buffer of records': function (err, records, dropped) {
+                assert.isNull(err);
+                assert.isTrue(Buffer.isBuffer(records));
+                assert.strictEqual(records.length % mapcache.accessRecordSize, 0);
+                assert.strictEqual(dropped, 0);
+            },
+            'which can be decoded': function (err, records, dropped) {
+                var record = mapcache.decodeAccessLog(records)[0];
+                assert.instanceOf(record.time, Date);
+                assert.strictEqual(record.status, 200);
+                assert.strictEqual(record.service, mapcache.services.TMS);
+                assert.strictEqual(record.tileset, 'test');
+                assert.strictEqual(record.grid, 'WGS84');
+                assert.deepEqual([record.z, record.x, record.y], [0, 0, 0]);
+                assert.isTrue(record.bytes > 0);
+                assert.isTrue(record.hit);
+                assert.isFalse(record.failed);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure the shared memory cache works as expected
+
+    'the shared memory cache': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a path': function (cache) {
+            var err;
+            try {
+                cache.attachSharedCache();
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'usage: cache.attachSharedCache(path, [options])');
+        },
+        'requires a valid slot size': function (cache) {
+            var err;
+            try {
+                cache.attachSharedCache(path.join(os.tmpdir(), 'node-mapcache-invalid'), {slotSize: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The shared cache size or slot size is out of range');
+        },
+        'when attached and used': {
+            topic: function (cache) {
+                var self = this,
+                    file = path.join(os.tmpdir(), 'node-mapcache-shared-' + process.pid),
+                    tile = '/tms/1.0.0/test@WGS84/0/0/0.png';
+
+                cache.attachSharedCache(file, {size: 4 * 1024 * 1024});
+                cache.get('http://localhost:3000', tile, '', function (err, first) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    return cache.get('http://localhost:3000', tile, '', function (err, second) {
+                        var stats = cache.sharedCacheStats();
+                        fs.unlinkSync(file);
+                        self.callback(err, first, second, stats);
+                    });
+                });
+            },
+            'returns the same tile from shared memory': function (err, first, second, stats) {
+                assert.isNull(err);
+                assert.equal(second.code, 200);
+                assert.equal(second.data.toString('base64'), first.data.toString('base64'));
+                checkContentLength(second);
+            },
+            'counts the tile': function (err, first, second, stats) {
+                assert.isTrue(stats.slots > 0);
+                assert.equal(stats.inserts, 1);
+                assert.equal(stats.hits, 1);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure revalidation works as expected
+
+    'revalidation': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires valid options': function (cache) {
+            var err;
+            try {
+                cache.enableRevalidation({maxPending: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The revalidation beta or maximum pending refreshes is out of range');
+        },
+        'when enabled and used': {
+            topic: function (cache) {
+                var self = this;
+                cache.enableRevalidation();
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function (err, response) {
+                    self.callback(err, response, cache.revalidationStats());
+                });
+            },
+            'returns the tile': function (err, response, stats) {
+                assert.isNull(err);
+                assert.equal(response.code, 200);
+                assert.instanceOf(response.mtime, Date);
+            },
+            'returns statistics': function (err, response, stats) {
+                assert.isObject(stats);
+                assert.equal(stats.stale, 0); // the test tileset doesn't auto expire
+                assert.equal(stats.pending, 0);
+                assert.isNumber(stats.refreshTime);
+            }
+        }
+    },
+    'revalidation of an expiring tileset': {
+        topic: function () {
+            var self = this,
+                tile = '/tms/1.0.0/stub-expire@WGS84/6/4/1.png';
+
+            if (fs.existsSync(stubTilePath('stub-expire', 6, 4, 1))) {
+                fs.unlinkSync(stubTilePath('stub-expire', 6, 4, 1));
+            }
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'stub-wms.xml'), function (err, cache) {
+                if (err) {
+                    return self.callback(err);
+                }
+                cache.enableRevalidation({beta: 0}); // only refresh expired tiles
+                return startStubWms(function (server) {
+                    function finish(err, first, second, requested) {
+                        var stats = cache.revalidationStats();
+                        if (!err && stats.pending) {
+                            return setTimeout(function () {
+                                finish(err, first, second, requested);
+                            }, 50);
+                        }
+                        server.close();
+                        return self.callback(err, first, second, requested, stats, server.requests);
+                    }
+
+                    cache.get('http://localhost:3000', tile, '', function (err, first) {
+                        if (err) {
+                            return finish(err);
+                        }
+                        // wait for the tile to outlive its `auto_expire`
+                        return setTimeout(function () {
+                            var requested = Date.now();
+                            cache.get('http://localhost:3000', tile, '', function (err, second) {
+                                finish(err, first, second, requested);
+                            });
+                        }, 2100);
+                    });
+                });
+            });
+        },
+        'renders the missing tile': function (err, first, second, requested, stats, renders) {
             assert.isNull(err);
-            assert.isString(msg);
-            assert.equal(msg.length > 0, true);
+            assert.strictEqual(first.code, 200);
+        },
+        'returns the expired tile': function (err, first, second, requested, stats, renders) {
+            assert.strictEqual(second.code, 200);
+            checkContentLength(second, first.headers['Content-Length'][0]);
+            assert.equal(stats.stale, 1);
+        },
+        'restores its original modification time': function (err, first, second, requested, stats, renders) {
+            assert.instanceOf(second.mtime, Date);
+            assert.isTrue(second.mtime.getTime() < requested - 1000);
+            assert.isTrue(Math.abs(second.mtime.getTime() - first.mtime.getTime()) < 1000);
+        },
+        'refreshes it in the background': function (err, first, second, requested, stats, renders) {
+            assert.equal(stats.refreshed, 1);
+            assert.equal(stats.errors, 0);
+            assert.equal(stats.pending, 0);
+            assert.equal(renders, 2);
+        }
+    }
+}).addBatch({
+    // Ensure metatile coalescing works as expected
+
+    'metatile coalescing': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires enabling for statistics': function (cache) {
+            var err;
+            try {
+                cache.metatileCoalescingStats();
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'Metatile coalescing is not enabled');
+        },
+        'when enabled and used': {
+            topic: function (cache) {
+                var self = this, responses = [];
+
+                function done(err, response) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    responses.push(response);
+                    if (responses.length == 2) {
+                        self.callback(null, responses, cache.metatileCoalescingStats());
+                    }
+                    return undefined;
+                }
+
+                cache.enableMetatileCoalescing();
+                // both tiles are in the same metatile
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', done);
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/1/0.png', '', done);
+            },
+            'returns every tile': function (err, responses, stats) {
+                assert.isNull(err);
+                responses.forEach(function (response) {
+                    assert.equal(response.code, 200);
+                    checkContentLength(response);
+                });
+            },
+            'coalesces the requests without an existence filter': function (err, responses, stats) {
+                assert.equal(stats.coalesced, 1);
+                assert.equal(stats.bypassed, 0);
+                assert.equal(stats.active, 0);
+                assert.equal(stats.waiting, 0);
+            }
+        }
+    },
+    'metatile coalescing of cached tiles': {
+        topic: function () {
+            var self = this;
+
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), function (err, cache) {
+                if (err) {
+                    return self.callback(err);
+                }
+                cache.enableMetatileCoalescing();
+                return cache.enableExistenceFilter({capacity: 1000}, function (err) {
+                    var responses = [];
+
+                    function done(err, response) {
+                        if (err) {
+                            return self.callback(err);
+                        }
+                        responses.push(response);
+                        if (responses.length == 2) {
+                            self.callback(null, responses, cache.metatileCoalescingStats());
+                        }
+                        return undefined;
+                    }
+
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    // both tiles are cached in the same metatile
+                    cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', done);
+                    return cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/1/0.png', '', done);
+                });
+            });
+        },
+        'dispatches the requests straight away': function (err, responses, stats) {
+            assert.isNull(err);
+            assert.equal(stats.coalesced, 0);
+            assert.equal(stats.bypassed, 2);
+        }
+    },
+    'metatile coalescing of missing tiles': {
+        topic: function () {
+            var self = this,
+                tile = '/tms/1.0.0/stub@WGS84/6/5/1.png';
+
+            if (fs.existsSync(stubTilePath('stub', 6, 5, 1))) {
+                fs.unlinkSync(stubTilePath('stub', 6, 5, 1));
+            }
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'stub-wms.xml'), function (err, cache) {
+                if (err) {
+                    return self.callback(err);
+                }
+                cache.enableMetatileCoalescing();
+                return cache.enableExistenceFilter({capacity: 1000}, function (err) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    return startStubWms(function (server) {
+                        var responses = [];
+
+                        function done(err, response) {
+                            if (err) {
+                                server.close();
+                                return self.callback(err);
+                            }
+                            responses.push(response);
+                            if (responses.length == 2) {
+                                server.close();
+                                self.callback(null, responses, cache.metatileCoalescingStats(), server.requests);
+                            }
+                            return undefined;
+                        }
+
+                        cache.get('http://localhost:3000', tile, '', done);
+                        cache.get('http://localhost:3000', tile, '', done);
+                    });
+                });
+            });
+        },
+        'returns every tile': function (err, responses, stats, renders) {
+            assert.isNull(err);
+            responses.forEach(function (response) {
+                assert.equal(response.code, 200);
+                checkContentLength(response);
+            });
+        },
+        'coalesces the requests': function (err, responses, stats, renders) {
+            assert.equal(stats.coalesced, 1);
+            assert.equal(stats.bypassed, 0);
+            assert.equal(stats.active, 0);
+            assert.equal(stats.waiting, 0);
+            assert.equal(renders, 1);
+        }
+    }
+}).addBatch({
+    // Ensure profiling works as expected
+
+    'profiling': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a positive duration': function (cache) {
+            var err;
+            try {
+                cache.profile(0, function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The profile duration must be positive');
+        },
+        'when running': {
+            topic: function (cache) {
+                cache.profile(200, this.callback);
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function () {});
+            },
+            'returns a report': function (err, report) {
+                assert.isNull(err);
+                assert.isTrue(report.duration >= 200);
+                ['queue', 'dispatch', 'core', 'finish', 'respond'].forEach(function (name) {
+                    assert.isObject(report.phases[name]);
+                    assert.isNumber(report.phases[name].wall);
+                    assert.isNumber(report.phases[name].cpu);
+                });
+                assert.equal(report.phases.core.count, 1);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure exporting to MBTiles works as expected
+
+    'exporting tiles': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a valid tileset': function (cache) {
+            var err;
+            try {
+                cache.export({tileset: 'foobar'}, 'foobar.mbtiles', function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'The tileset does not exist');
+        },
+        'requires a valid zoom range': function (cache) {
+            var err;
+            try {
+                cache.export({tileset: 'test', zoomRange: [2, 1]}, 'foobar.mbtiles', function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The zoom range is outside the grid');
+        },
+        'from the disk cache': {
+            topic: function (cache) {
+                var self = this,
+                    file = path.join(os.tmpdir(), 'node-mapcache-export-' + process.pid + '.mbtiles'),
+                    options = {tileset: 'test', grid: 'WGS84', zoomRange: [0, 0], dedupe: true};
+
+                cache.export(options, file, function (err, summary) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    // a second export to the same file should fail
+                    return cache.export(options, file, function (existsErr) {
+                        var size = fs.statSync(file).size;
+                        fs.unlinkSync(file);
+                        self.callback(null, summary, size, existsErr);
+                    });
+                });
+            },
+            'exports the cached tiles': function (err, summary, size, existsErr) {
+                assert.isNull(err);
+                assert.equal(summary.tiles, 2);
+                assert.equal(summary.missing, 0);
+                assert.isTrue(summary.unique >= 1);
+                assert.isTrue(summary.bytes > 0);
+                assert.isNumber(summary.tilesPerSecond);
+                assert.isTrue(size > 0);
+            },
+            'will not overwrite a file': function (err, summary, size, existsErr) {
+                assert.instanceOf(existsErr, Error);
+                assert.match(existsErr.message, /already exists/);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure tiles can be invalidated in bulk
+
+    'invalidating tiles': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a valid tileset': function (cache) {
+            var err;
+            try {
+                cache.invalidate({tileset: 'foobar'}, function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'The tileset does not exist');
+        },
+        'requires known dimensions': function (cache) {
+            var err;
+            try {
+                cache.invalidate({tileset: 'test', dimensions: {foobar: '1'}}, function () {});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'The dimension is not used by the tileset');
+        },
+        'requires a callback': function (cache) {
+            var err;
+            try {
+                cache.invalidate({tileset: 'test'}, function () {}, 'foobar');
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Argument 2 must be a function');
+        },
+        'over an uncached range': {
+            topic: function (cache) {
+                // a small extent at a high zoom level leaves the cached tiles alone
+                var options = {tileset: 'test', grid: 'WGS84', zoomRange: [10, 10], extent: [0, 0, 1, 1], threads: 2};
+                cache.invalidate(options, function progress() {}, this.callback);
+            },
+            'visits every tile in the range': function (err, summary) {
+                assert.isNull(err);
+                assert.isTrue(summary.tiles > 0);
+                assert.equal(summary.errors, 0);
+                assert.isNumber(summary.duration);
+                assert.isNumber(summary.tilesPerSecond);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure sources are guarded against failure
+
+    'guarding sources': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'stub-wms.xml'), this.callback);
+        },
+
+        'requires valid limits': function (cache) {
+            var err;
+            try {
+                cache.enableSourceGuard({minConcurrency: 4, maxConcurrency: 2});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'A source guard limit is out of range');
+        },
+        'requires known sources': function (cache) {
+            var err;
+            try {
+                cache.enableSourceGuard({sources: {foobar: {maxConcurrency: 1}}});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'The source does not exist');
+        },
+        'against a failing WMS': {
+            topic: function (cache) {
+                var self = this,
+                    tile = '/tms/1.0.0/stub@WGS84/5/10/10.png',
+                    server = http.createServer(function (req, res) {
+                        res.writeHead(500, {'Content-Type': 'text/plain'});
+                        res.end('stub failure');
+                    });
+
+                cache.enableSourceGuard({sources: {stub: {failureThreshold: 1, openTime: 60000}}});
+                server.listen(38517, 'localhost', function () {
+                    cache.get('http://localhost:3000', tile, '', function (err, first) {
+                        if (err) {
+                            server.close();
+                            return self.callback(err);
+                        }
+                        return cache.get('http://localhost:3000', tile, '', function (err, second) {
+                            server.close();
+                            self.callback(err, first, second, cache.sourceGuardStats());
+                        });
+                    });
+                });
+            },
+            'passes on the source failure': function (err, first, second, stats) {
+                assert.isNull(err);
+                assert.isTrue(first.code >= 500);
+            },
+            'then fails fast': function (err, first, second, stats) {
+                assert.equal(second.code, 503);
+            },
+            'opens the circuit': function (err, first, second, stats) {
+                assert.equal(stats.stub.state, 'open');
+                assert.equal(stats.stub.requests, 1);
+                assert.equal(stats.stub.failures, 1);
+                assert.equal(stats.stub.rejected, 1);
+                assert.equal(stats.stub.trips, 1);
+                assert.equal(stats.stub.active, 0);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure connections to sources can be reused
+
+    'reusing connections': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'stub-wms.xml'), this.callback);
+        },
+
+        'requires valid limits': function (cache) {
+            var err;
+            try {
+                cache.enableConnectionReuse({maxHandles: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The connection reuse limits are out of range');
+        },
+        'against a WMS': {
+            topic: function (cache) {
+                var self = this,
+                    server = http.createServer(function (req, res) {
+                        res.writeHead(200, {'Content-Type': 'text/plain'});
+                        res.end('not an image');
+                    });
+
+                cache.enableConnectionReuse({idleTimeout: 60000});
+                server.listen(38517, 'localhost', function () {
+                    cache.get('http://localhost:3000', '/tms/1.0.0/stub@WGS84/5/10/10.png', '', function (err, first) {
+                        if (err) {
+                            server.close();
+                            return self.callback(err);
+                        }
+                        return cache.get('http://localhost:3000', '/tms/1.0.0/stub@WGS84/5/11/10.png', '', function (err, second) {
+                            server.close();
+                            self.callback(err, first, second, cache.connectionReuseStats());
+                        });
+                    });
+                });
+            },
+            'makes the requests': function (err, first, second, stats) {
+                assert.isNull(err);
+                assert.equal(first.code, 502);
+                assert.equal(second.code, 502);
+                assert.equal(stats.requests, 2);
+                assert.equal(stats.overflow, 0);
+            },
+            'keeps the handles open': function (err, first, second, stats) {
+                assert.isTrue(stats.handles >= 1);
+                assert.isTrue(stats.connects >= 1 && stats.connects <= 2);
+                assert.equal(stats.expired, 0);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure configurations can be loaded on demand
+
+    'a config registry': {
+        topic: function () {
+            var self = this,
+                registry = new mapcache.Registry(),
+                results = [];
+
+            registry.register('good', path.join(__dirname, 'good.xml'));
+            function handleCache(err, cache) {
+                results.push([err, cache]);
+                if (results.length === 2) {
+                    self.callback(null, registry, results);
+                }
+            }
+            registry.get('good', handleCache);
+            registry.get('good', handleCache);
+        },
+
+        'shares a single load': function (err, registry, results) {
+            assert.isNull(results[0][0]);
+            assert.isNull(results[1][0]);
+            assert.instanceOf(results[0][1], mapcache.MapCache);
+            assert.strictEqual(results[0][1], results[1][1]);
+            assert.equal(registry.stats().good.loads, 1);
+        },
+        'reports the configuration': function (err, registry, results) {
+            var stats = registry.stats().good,
+                config = results[0][1].configStats();
+            assert.isTrue(stats.loaded);
+            assert.isFalse(stats.loading);
+            assert.isNumber(stats.memory);
+            assert.isNumber(stats.loadTime);
+            assert.isNumber(config.memory);
+            assert.isNumber(config.loadTime);
+            assert.equal(config.file, path.join(__dirname, 'good.xml'));
+        },
+        'evicts idle configurations': function (err, registry) {
+            registry.ttl = 1;
+            assert.instanceOf(registry.stats().good.lastUsed, Date);
+            registry.entries.good.lastUsed -= 10;
+            registry.sweep();
+            assert.isFalse(registry.stats().good.loaded);
+            assert.equal(registry.stats().good.evictions, 1);
+            registry.close();
+        },
+        'for an unknown name': {
+            topic: function (registry) {
+                registry.get('unknown', this.callback);
+            },
+            'returns an error': function (err, cache) {
+                assert.instanceOf(err, Error);
+                assert.equal(err.message, 'No configuration is registered as unknown');
+                assert.isUndefined(cache);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure the memory of requests is accounted for
+
+    'memory accounting': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'reports the memory': function (cache) {
+            var stats = cache.memoryStats();
+            ['config', 'requests', 'total', 'peak', 'limit', 'rejected'].forEach(function (name) {
+                assert.isNumber(stats[name]);
+            });
+            assert.equal(stats.total, stats.config + stats.requests);
+            assert.equal(stats.limit, 0);
+        },
+        'requires a positive limit': function (cache) {
+            var err;
+            try {
+                cache.setRequestMemoryLimit(-1);
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Argument 0 must be a positive number');
+        },
+        'with a small limit': {
+            topic: function (cache) {
+                var self = this;
+                cache.setRequestMemoryLimit(1024);
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function (err, response) {
+                    cache.setRequestMemoryLimit(0);
+                    self.callback(err, response, cache.memoryStats());
+                });
+            },
+            'rejects the request': function (err, response, stats) {
+                assert.isNull(err);
+                assert.equal(response.code, 400);
+                assert.equal(stats.rejected, 1);
+                assert.equal(stats.requests, 0);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure identical response bodies are shared
+
+    'sharing bodies': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a positive size': function (cache) {
+            var err;
+            try {
+                cache.enableBodySharing({maxSize: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The maximum body size must be positive');
+        },
+        'when enabled': {
+            topic: function (cache) {
+                var self = this,
+                    tile = '/tms/1.0.0/test@WGS84/0/0/0.png';
+
+                cache.enableBodySharing();
+                cache.get('http://localhost:3000', tile, '', function (err, first) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    return cache.get('http://localhost:3000', tile, '', function (err, second) {
+                        self.callback(err, first, second, cache.bodySharingStats());
+                    });
+                });
+            },
+            'shares the body': function (err, first, second, stats) {
+                assert.isNull(err);
+                assert.equal(first.code, 200);
+                assert.equal(second.code, 200);
+                assert.strictEqual(second.data, first.data);
+                checkContentLength(second);
+            },
+            'counts the saving': function (err, first, second, stats) {
+                assert.equal(stats.bodies, 1);
+                assert.equal(stats.bytes, first.data.length);
+                assert.equal(stats.misses, 1);
+                assert.equal(stats.hits, 1);
+                assert.equal(stats.saved, first.data.length);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure maps can be assembled in parallel
+
+    'parallel assembly': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a positive band height': function (cache) {
+            var err;
+            try {
+                cache.enableParallelAssembly({bandHeight: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The thread count or band height is out of range');
+        },
+        'of a WMS `GetMap` request': {
+            topic: function (cache) {
+                var self = this,
+                    query = 'SERVICE=WMS&REQUEST=GetMap&VERSION=1.1.1&SRS=EPSG%3A4326&BBOX=-180,-90,180,90&WIDTH=400&HEIGHT=400&LAYERS=test';
+
+                cache.get('http://localhost:3000', '/', query, function (err, serial) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    cache.enableParallelAssembly({threads: 2, bandHeight: 100});
+                    return cache.get('http://localhost:3000', '/', query, function (err, parallel) {
+                        self.callback(err, serial, parallel, cache.parallelAssemblyStats());
+                    });
+                });
+            },
+            'returns the map': function (err, serial, parallel, stats) {
+                assert.isNull(err);
+                assert.strictEqual(parallel.code, 200);
+                assert.deepEqual(parallel.headers['Content-Type'], [ 'image/jpeg' ]);
+                assert.includes(parallel.headers, 'Cache-Control');
+                assert.includes(parallel.headers, 'Expires');
+                checkContentLength(parallel);
+            },
+            'matches the serial assembly': function (err, serial, parallel, stats) {
+                assert.equal(parallel.data.toString('base64'), serial.data.toString('base64'));
+            },
+            'assembles the map in bands': function (err, serial, parallel, stats) {
+                assert.equal(stats.threads, 2);
+                assert.equal(stats.maps, 1);
+                assert.isTrue(stats.tiles > 0);
+                assert.equal(stats.bands, 4);
+            }
+        }
+    },
+    'parallel assembly with the vectorised kernels': {
+        topic: function () {
+            var self = this;
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), function (err, cache) {
+                if (err) {
+                    return self.callback(err);
+                }
+                cache.enableParallelAssembly({threads: 2, bandHeight: 100, simd: true});
+                return cache.get('http://localhost:3000', '/', 'SERVICE=WMS&REQUEST=GetMap&VERSION=1.1.1&SRS=EPSG%3A4326&BBOX=-180,-90,180,90&WIDTH=400&HEIGHT=400&LAYERS=test', function (err, response) {
+                    self.callback(err, response, cache.parallelAssemblyStats());
+                });
+            });
+        },
+        'returns the map': function (err, response, stats) {
+            assert.isNull(err);
+            assert.strictEqual(response.code, 200);
+            assert.deepEqual(response.headers['Content-Type'], [ 'image/jpeg' ]);
+            checkContentLength(response);
+        },
+        'reports the kernels in use': function (err, response, stats) {
+            assert.include(['scalar', 'sse2', 'avx2'], stats.kernels);
+            assert.equal(stats.bands, 4);
+        }
+    }
+}).addBatch({
+    // Ensure proxied and `GetFeatureInfo` responses are cached
+
+    'a response cache': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a positive size': function (cache) {
+            var err;
+            try {
+                cache.enableResponseCache({maxSize: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The response cache size or time to live is out of range');
+        },
+        'requires numeric source times to live': function (cache) {
+            var err;
+            try {
+                cache.enableResponseCache({sources: {basic: 'forever'}});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+        },
+        'of a WMS `GetFeatureInfo` request': {
+            topic: function (cache) {
+                var self = this;
+
+                cache.enableResponseCache({ttl: 60, sources: {basic: 30}});
+                cache.get('http://localhost:3000', '/', 'SERVICE=WMS&REQUEST=GetFeatureInfo&VERSION=1.1.1&SRS=EPSG%3A4326&BBOX=-180,-90,180,90&WIDTH=400&HEIGHT=400&QUERY_LAYERS=basic&X=200&Y=200&INFO_FORMAT=text/plain', function (err, first) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    // the same query with its parameters reordered and in lower case
+                    return cache.get('http://localhost:3000', '/', 'info_format=text/plain&x=200&y=200&query_layers=basic&request=GetFeatureInfo&service=WMS&version=1.1.1&srs=EPSG%3A4326&bbox=-180,-90,180,90&width=400&height=400', function (err, second) {
+                        self.callback(err, first, second, cache.responseCacheStats());
+                    });
+                });
+            },
+            'returns the cached response': function (err, first, second, stats) {
+                assert.isNull(err);
+                assert.strictEqual(second.code, 200);
+                assert.deepEqual(second.headers['Content-Type'], [ 'text/plain' ]);
+                checkContentLength(second);
+                assert.equal(second.data.toString(), first.data.toString());
+            },
+            'records the hit': function (err, first, second, stats) {
+                assert.equal(stats.responses, 1);
+                assert.equal(stats.bytes, first.data.length);
+                assert.equal(stats.misses, 1);
+                assert.equal(stats.hits, 1);
+                assert.equal(stats.evicted, 0);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure clustered requests are routed by tile
+
+    'the tile key of': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'a TMS tile request': function (cache) {
+            var key = cache.tileKey('/tms/1.0.0/test@WGS84/0/0/0.png', '');
+            assert.isObject(key);
+            assert.equal(key.tileset, 'test');
+            assert.equal(key.grid, 'WGS84');
+            assert.equal(key.z, 0);
+            assert.equal(key.x, 0);
+            assert.equal(key.y, 0);
+            assert.isString(key.metatile);
+        },
+        'a WMS `GetCapabilities` request': function (cache) {
+            assert.isNull(cache.tileKey('/', 'SERVICE=WMS&REQUEST=GetCapabilities'));
+        },
+        'requires two arguments': function (cache) {
+            assert.throws(function () {
+                cache.tileKey('/');
+            }, Error);
+        },
+        'identifies the tileset of a request': function (cache) {
+            assert.equal(cache.tilesetFor('/tms/1.0.0/test@WGS84/0/0/0.png', ''), 'test');
+            assert.equal(cache.tilesetFor('/', 'SERVICE=WMS&REQUEST=GetMap&LAYERS=basic,basic'), 'basic');
+            assert.isNull(cache.tilesetFor('/', 'SERVICE=WMS&REQUEST=GetMap&LAYERS=test,basic'));
+            assert.isNull(cache.tilesetFor('/', 'SERVICE=WMS&REQUEST=GetCapabilities'));
+            assert.isNull(cache.tilesetFor('/tms/1.0.0/', ''));
+        },
+        'partitions requests by tileset': function (cache) {
+            var router = new mapcache.cluster.Router({workers: 2, cache: cache, partition: 'tileset'});
+            assert.equal(router.key('/tms/1.0.0/test@WGS84/0/0/0.png'), 'tileset:test');
+            assert.equal(router.key('/tms/1.0.0/test@WGS84/1/0/0.png'), 'tileset:test');
+            assert.equal(router.key('/?SERVICE=WMS&REQUEST=GetCapabilities'), '');
+            assert.equal(router.stats().partition, 'tileset');
+        },
+        'drops queued connections that fail': function (cache) {
+            var router = new mapcache.cluster.Router({workers: 2, cache: cache}),
+                socket = new (require('events').EventEmitter)();
+
+            socket.pause = function () {};
+            socket.destroy = function () {
+                socket.destroyed = true;
+            };
+            router.slots = [{ready: false}, {ready: false}]; // no worker is ready yet
+            router.accept(socket);
+            socket.emit('data', new Buffer('GET /tms/1.0.0/test@WGS84/0/0/0.png HTTP/1.1\r\n'));
+            assert.equal(router.pending.length, 1);
+            socket.emit('error', new Error('ECONNRESET'));
+            assert.equal(router.pending.length, 0);
+            assert.isTrue(socket.destroyed);
+        },
+        'routes every request by default': function (cache) {
+            assert.isFalse(new mapcache.cluster.Router({workers: 2, cache: cache}).stats().keepAlive);
+            assert.isTrue(new mapcache.cluster.Router({workers: 2, cache: cache, keepAlive: true}).stats().keepAlive);
+        },
+        'spreads a tileset across its owners by metatile': function (cache) {
+            var router = new mapcache.cluster.Router({workers: 4, cache: cache, partition: 'tileset', tilesetWorkers: 2}),
+                owners = router.ring.lookup('tileset:test').slice(0, 2),
+                first = router.share(router.ring.lookup('tileset:test'), '/tms/1.0.0/test@WGS84/0/0/0.png'),
+                again = router.share(router.ring.lookup('tileset:test'), '/tms/1.0.0/test@WGS84/0/1/0.png'),
+                untiled = [
+                    router.share(router.ring.lookup('tileset:test'), '/tms/1.0.0/test@WGS84/')[0],
+                    router.share(router.ring.lookup('tileset:test'), '/tms/1.0.0/test@WGS84/')[0]
+                ];
+
+            assert.equal(router.stats().tilesetWorkers, 2);
+            assert.notEqual(owners.indexOf(first[0]), -1);
+            assert.equal(again[0], first[0]); // the same metatile
+            assert.deepEqual(first.slice().sort(), [0, 1, 2, 3]);
+            assert.deepEqual(untiled.sort(), owners.slice().sort());
+        },
+        'requires a cache to partition by tileset': function (cache) {
+            assert.throws(function () {
+                return new mapcache.cluster.Router({workers: 2, partition: 'tileset'});
+            }, Error);
+        }
+    },
+    'a consistent hash ring': {
+        topic: function () {
+            return {
+                three: new mapcache.cluster.Ring(3, 100),
+                four: new mapcache.cluster.Ring(4, 100)
+            };
+        },
+
+        'routes a key to the same slot': function (rings) {
+            assert.deepEqual(rings.three.lookup('test@WGS84/3/1/2'), rings.three.lookup('test@WGS84/3/1/2'));
+        },
+        'orders every slot': function (rings) {
+            assert.deepEqual(rings.three.lookup('test@WGS84/3/1/2').sort(), [0, 1, 2]);
+        },
+        'spreads keys across the slots': function (rings) {
+            var counts = [0, 0, 0], i;
+            for (i = 0; i < 3000; i++) {
+                counts[rings.three.lookup('key' + i)[0]]++;
+            }
+            for (i = 0; i < 3; i++) {
+                assert.isTrue(counts[i] > 700 && counts[i] < 1300);
+            }
+        },
+        'only moves keys to an added slot': function (rings) {
+            var i, before, after;
+            for (i = 0; i < 1000; i++) {
+                before = rings.three.lookup('key' + i)[0];
+                after = rings.four.lookup('key' + i)[0];
+                assert.isTrue(after === before || after === 3);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure the most requested tiles are recorded and prefetched
+
+    'a hot tile record': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'requires a positive size': function (cache) {
+            var err;
+            try {
+                cache.enableHotTiles(path.join(os.tmpdir(), 'node-mapcache-hot-invalid'), {size: 0});
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The hot tile record size or interval is out of range');
+        },
+        'of tile requests': {
+            topic: function (cache) {
+                var self = this,
+                    file = path.join(os.tmpdir(), 'node-mapcache-hot-' + process.pid);
+
+                cache.enableHotTiles(file, {size: 100});
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function (err) {
+                    if (err) {
+                        return self.callback(err);
+                    }
+                    return cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function (err) {
+                        if (err) {
+                            return self.callback(err);
+                        }
+                        var stats = cache.hotTilesStats();
+                        return cache.saveHotTiles(function (err) {
+                            if (err) {
+                                return self.callback(err);
+                            }
+                            var record = fs.readFileSync(file, 'utf8');
+                            fs.unlinkSync(file);
+                            return cache.warmup({threads: 2}, function (err, warmed) {
+                                self.callback(err, stats, record, warmed);
+                            });
+                        });
+                    });
+                });
+            },
+            'counts the requests': function (err, stats, record, warmed) {
+                assert.isNull(err);
+                assert.equal(stats.tiles, 1);
+                assert.equal(stats.size, 100);
+                assert.equal(stats.recorded, 2);
+            },
+            'writes the record': function (err, stats, record, warmed) {
+                assert.equal(record, 'node-mapcache hot tiles 1\n2\ttest@WGS84/0/0/0\n');
+            },
+            'prefetches the tiles': function (err, stats, record, warmed) {
+                assert.equal(warmed.tiles, 1);
+                assert.equal(warmed.errors, 0);
+                assert.isNumber(warmed.duration);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure tilesets are set up on demand from a lazy configuration
+
+    'a lazy configuration': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), {lazy: true}, this.callback);
+        },
+
+        'is only indexed when loaded': function (cache) {
+            var stats = cache.configStats();
+            assert.isTrue(stats.lazy);
+            assert.isFalse(stats.loaded);
+            assert.isNumber(stats.loadTime);
+            assert.equal(stats.file, path.join(__dirname, 'good.xml'));
+            assert.deepEqual(stats.tilesets.test, {initialised: false});
+            assert.deepEqual(stats.tilesets.basic, {initialised: false});
+        },
+        'identifies requested tilesets without setting them up': function (cache) {
+            assert.equal(cache.tilesetFor('/tms/1.0.0/basic@WGS84/0/0/0.png', ''), 'basic');
+            assert.isNull(cache.tilesetFor('/tms/1.0.0/unknown@WGS84/0/0/0.png', ''));
+            assert.isFalse(cache.configStats().tilesets.basic.initialised);
+        },
+        'when a tile is requested': {
+            topic: function (cache) {
+                var self = this;
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', function (err, response) {
+                    self.callback(err, cache, response);
+                });
+            },
+            'returns the tile': function (err, cache, response) {
+                assert.isNull(err);
+                assert.strictEqual(response.code, 200);
+                checkContentLength(response);
+            },
+            'only sets up its tileset': function (err, cache, response) {
+                var stats = cache.configStats();
+                assert.isFalse(stats.loaded);
+                assert.isTrue(stats.tilesets.test.initialised);
+                assert.isNumber(stats.tilesets.test.initTime);
+                assert.isFalse(stats.tilesets.basic.initialised);
+            },
+            'and capabilities are requested': {
+                topic: function (err, cache) {
+                    var self = this;
+                    cache.get('http://localhost:3000', '/tms/1.0.0/', '', function (err, response) {
+                        self.callback(err, cache, response);
+                    });
+                },
+                'sets up the full configuration': function (err, cache, response) {
+                    var stats = cache.configStats();
+                    assert.isNull(err);
+                    assert.strictEqual(response.code, 200);
+                    assert.isTrue(stats.loaded);
+                    assert.isNumber(stats.fullLoadTime);
+                }
+            }
+        }
+    }
+}).addBatch({
+    // Ensure the full lazy configuration is loaded in the thread pool
+
+    'loading a full lazy configuration': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), {lazy: true}, this.callback);
+        },
+
+        'is needed by features acting on every tileset': function (cache) {
+            assert.throws(function () {
+                cache.enableWriteBehind();
+            }, /The full configuration is not loaded: use cache.loadConfig\(\) first/);
+            assert.isFalse(cache.configStats().loaded);
+        },
+        'requires a callback': function (cache) {
+            assert.throws(function () {
+                cache.loadConfig();
+            }, /usage: cache.loadConfig\(callback\)/);
+        },
+        'when loaded': {
+            topic: function (cache) {
+                var self = this;
+                cache.loadConfig(function (err) {
+                    self.callback(err, cache);
+                });
+            },
+            'sets up the full configuration': function (err, cache) {
+                assert.isNull(err);
+                assert.isTrue(cache.configStats().loaded);
+            },
+            'enables the features': function (err, cache) {
+                cache.enableRevalidation();
+                assert.isObject(cache.revalidationStats());
+            }
+        }
+    }
+}).addBatch({
+    // Ensure tiles can be transcoded into other formats
+
+    'requesting a format variant': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'fails when variants are not enabled': function (cache) {
+            assert.throws(function () {
+                cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', {format: 'JPEG'}, function () {});
+            }, /Format variants are not enabled/);
+        },
+        'when variants are enabled': {
+            topic: function (cache) {
+                cache.enableFormatVariants({maxSize: 1024 * 1024});
+                return cache;
+            },
+            'fails when enabled twice': function (cache) {
+                assert.throws(function () {
+                    cache.enableFormatVariants();
+                }, /Format variants are already enabled/);
+            },
+            'fails with an out of range quality': function (cache) {
+                assert.throws(function () {
+                    cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', {format: 'JPEG', quality: 101}, function () {});
+                }, RangeError);
+            },
+            'fails with an invalid vary option': function (cache) {
+                assert.throws(function () {
+                    cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', {format: 'JPEG', vary: 1}, function () {});
+                }, TypeError);
+            },
+            'and a tile is requested': {
+                topic: function (cache) {
+                    var self = this;
+                    cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', {format: 'JPEG', quality: 50}, function (err, response) {
+                        if (err) return self.callback(err);
+                        cache.get('http://localhost:3000', '/tms/1.0.0/test@WGS84/0/0/0.png', '', {format: 'JPEG', quality: 50}, function (err, cached) {
+                            self.callback(err, cache, response, cached);
+                        });
+                    });
+                },
+                'transcodes the tile': function (err, cache, response, cached) {
+                    assert.isNull(err);
+                    assert.strictEqual(response.code, 200);
+                    assert.deepEqual(response.headers['Content-Type'], [ 'image/jpeg' ]);
+                    assert.deepEqual(response.headers['Vary'], [ 'Accept' ]);
+                    checkContentLength(response);
+                },
+                'returns the cached variant': function (err, cache, response, cached) {
+                    assert.strictEqual(cached.code, 200);
+                    assert.deepEqual(cached.headers['Content-Type'], [ 'image/jpeg' ]);
+                    assert.equal(cached.data.length, response.data.length);
+                },
+                'counts the variants': function (err, cache, response, cached) {
+                    var stats = cache.formatVariantStats();
+                    assert.equal(stats.variants, 1);
+                    assert.equal(stats.transcoded, 1);
+                    assert.equal(stats.hits, 1);
+                    assert.equal(stats.errors, 0);
+                    assert.equal(stats.maxSize, 1024 * 1024);
+                }
+            }
+        }
+    }
+}).addBatch({
+    // Ensure the disk caches can be pruned in the background
+
+    'a disk sweeper': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+
+        'must be enabled for statistics': function (cache) {
+            assert.throws(function () {
+                cache.diskSweeperStats();
+            }, /The disk sweeper is not enabled/);
+        },
+        'fails with an out of range rate': function (cache) {
+            assert.throws(function () {
+                cache.enableDiskSweeper({rate: 0});
+            }, RangeError);
+        },
+        'when enabled': {
+            topic: function (cache) {
+                var self = this;
+                cache.enableDiskSweeper({rate: 10000, maxSize: 1024 * 1024 * 1024});
+                (function poll() {
+                    var stats = cache.diskSweeperStats();
+                    if (!stats.passes) {
+                        return setTimeout(poll, 10);
+                    }
+                    self.callback(null, cache, stats);
+                })();
+            },
+            'fails when enabled twice': function (err, cache, stats) {
+                assert.throws(function () {
+                    cache.enableDiskSweeper();
+                }, /The disk sweeper is already enabled/);
+            },
+            'completes a pass': function (err, cache, stats) {
+                assert.isNull(err);
+                assert.equal(stats.passes, 1);
+                assert.isFalse(stats.running);
+                assert.isNumber(stats.passTime);
+                assert.equal(stats.errors, 0);
+                assert.isObject(stats.caches.disk);
+                assert.equal(stats.pass.scanned, stats.caches.disk.files);
+            },
+            'keeps tiles within the limits': function (err, cache, stats) {
+                assert.equal(stats.removed, 0);
+                assert.equal(stats.reclaimed, 0);
+                assert.equal(stats.evicted, 0);
+            }
+        }
+    }
+}).addBatch({
+    // Ensure the logger works as expected
+
+    'requesting an invalid KML cache resource': {
+        topic: function () {
+            var promise = new events.EventEmitter(),
+                logger = new events.EventEmitter(),
+                timeout = setTimeout(function() {
+                    logger.emit('error', new Error('No log was emitted'));
+                }, 2000);
+
+            function log(level, msg) {
+                clearTimeout(timeout);
+
+                // ignore all levels bar ERROR.
+                if (level == mapcache.logLevels.ERROR) {
+                    promise.emit('success', level, msg);
+                    logger.removeListener('log', log); // we've done our job
+                }
+            }
+
+            logger.on('log', log);
+
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), logger, function (err, cache) {
+                if (err) {
+                    clearTimeout(timeout);
+                    return promise.emit('error', err);
+                }
+                return cache.get(
+                    'http://localhost:3000/',
+                    '/kml/foobar',
+                    '',
+                    function (err, response) {
+                        if (err) {
+                            clearTimeout(timeout);
+                            promise.emit('error', err);
+                        }
+                    });
+            });
+
+            return promise;
+        },
+        'logs a valid log level': function (err, level, msg) {
+            assert.isNull(err);
+            assert.isNumber(level);
+            assert.equal(level >= mapcache.logLevels.DEBUG, true);
+            assert.equal(level <= mapcache.logLevels.EMERG, true);
+        },
+        'logs a message': function (err, level, msg) {
+            assert.isNull(err);
+            assert.isString(msg);
+            assert.equal(msg.length > 0, true);
+        }
+    },
+    'requesting an invalid KML cache resource with a raised log level': {
+        topic: function () {
+            var self = this,
+                logger = new events.EventEmitter(),
+                levels = [];
+
+            logger.on('log', function (level, msg) {
+                levels.push(level);
+            });
+
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), logger, function (err, cache) {
+                if (err) {
+                    return self.callback(err);
+                }
+                cache.setLogLevel(mapcache.logLevels.CRIT);
+                return cache.get('http://localhost:3000/', '/kml/foobar', '', function (err, response) {
+                    // allow any queued messages to be emitted
+                    setTimeout(function () {
+                        self.callback(err, levels);
+                    }, 100);
+                });
+            });
+        },
+        'only logs messages at or above the level': function (err, levels) {
+            assert.isNull(err);
+            levels.forEach(function (level) {
+                assert.equal(level >= mapcache.logLevels.CRIT, true);
+            });
+        }
+    },
+    'setting the log level': {
+        topic: function () {
+            mapcache.MapCache.FromConfigFile(path.join(__dirname, 'good.xml'), this.callback);
+        },
+        'requires one argument': function (cache) {
+            var err;
+            try {
+                cache.setLogLevel();
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, Error);
+            assert.equal(err.message, 'usage: cache.setLogLevel(level)');
+        },
+        'requires an integer': function (cache) {
+            var err;
+            try {
+                cache.setLogLevel('WARN');
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, TypeError);
+            assert.equal(err.message, 'Argument 0 must be an integer');
+        },
+        'requires a valid level': function (cache) {
+            var err;
+            try {
+                cache.setLogLevel(42);
+            } catch (e) {
+                err = e;
+            }
+            assert.instanceOf(err, RangeError);
+            assert.equal(err.message, 'The log level is not one of `mapcache.logLevels`');
+        },
+        'accepts a valid level': function (cache) {
+            assert.isUndefined(cache.setLogLevel(mapcache.logLevels.WARN));
         }
     }
 }).export(module); // Export the Suite
@@ -0,0 +1,190 @@
+/******************************************************************************
+ * Copyright (c) 2012, GeoData Institute (www.geodata.soton.ac.uk)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+
+/**
+ * @file kernel-bench.cpp
+ * @brief Verify and benchmark the pixel kernels.
+ *
+ * Each vectorised implementation of the kernels in `src/pixelkernels.cpp`
+ * supported by the CPU is checked pixel for pixel against the scalar
+ * reference over a range of offsets and scales, and then timed.  The exit
+ * status is non-zero if any output differs.  Build and run it with `make
+ * bench`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "../src/pixelkernels.hpp"
+
+/// An image with its own pixels
+struct Buffer {
+  std::vector<unsigned char> pixels;
+  PixelKernels::Image image;
+
+  Buffer(size_t w, size_t h) : pixels(w * h * 4) {
+    image.data = &pixels[0];
+    image.w = w;
+    image.h = h;
+    image.stride = w * 4;
+  }
+};
+
+/// Fill an image with random premultiplied pixels, some opaque or clear
+static void Randomise(Buffer &buffer) {
+  for (size_t i = 0; i < buffer.pixels.size(); i += 4) {
+    int kind = rand() % 4;
+    unsigned int alpha = (kind == 0) ? 0 : ((kind == 1) ? 255 : rand() % 256);
+    for (int c = 0; c < 3; c++) {
+      buffer.pixels[i + c] = (alpha) ? rand() % (alpha + 1) : 0;
+    }
+    buffer.pixels[i + 3] = alpha;
+  }
+}
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// A resampling geometry: offsets and scales
+struct Geometry {
+  double off_x, off_y, scale_x, scale_y;
+};
+
+static const Geometry geometries[] = {
+  { 0, 0, 1, 1 },               // tiles at the map resolution
+  { -3.25, -7.5, 1.37, 1.37 },  // upsampling
+  { 10.5, -2.75, 0.61, 0.73 },  // downsampling
+  { -700, -700, 0.25, 0.25 },   // partially outside the source
+};
+
+typedef void (*Resampler)(const PixelKernels::Image&, PixelKernels::Image&, double, double, double, double);
+
+/// Compare a level against the scalar reference for every geometry
+static bool Verify(PixelKernels::Level level, const char *name, Resampler resample, const Buffer &src) {
+  bool ok = true;
+  for (size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+    const Geometry &geo = geometries[g];
+    for (size_t w = 1; w <= 67; w += 11) {
+      Buffer expected(w, 37), actual(w, 37);
+      PixelKernels::Select(PixelKernels::SCALAR);
+      resample(src.image, expected.image, geo.off_x, geo.off_y, geo.scale_x, geo.scale_y);
+      PixelKernels::Select(level);
+      resample(src.image, actual.image, geo.off_x, geo.off_y, geo.scale_x, geo.scale_y);
+      if (expected.pixels != actual.pixels) {
+        printf("FAIL %s %s: geometry %lu width %lu\n", PixelKernels::LevelName(level), name,
+               (unsigned long) g, (unsigned long) w);
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+static bool VerifyComposite(PixelKernels::Level level) {
+  bool ok = true;
+  for (size_t w = 1; w <= 67; w += 3) {
+    Buffer base(w, 5), overlay(w, 5);
+    Randomise(base);
+    Randomise(overlay);
+    Buffer expected = base, actual = base;
+    expected.image.data = &expected.pixels[0];
+    actual.image.data = &actual.pixels[0];
+
+    PixelKernels::Select(PixelKernels::SCALAR);
+    PixelKernels::Composite(expected.image, overlay.image);
+    PixelKernels::Select(level);
+    PixelKernels::Composite(actual.image, overlay.image);
+    if (expected.pixels != actual.pixels) {
+      printf("FAIL %s composite: width %lu\n", PixelKernels::LevelName(level), (unsigned long) w);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/// Time a resampler producing a 2048 pixel square map
+static double TimeResample(Resampler resample, const Buffer &src, Buffer &dst) {
+  int iterations = 0;
+  double start = Now(), elapsed;
+  do {
+    resample(src.image, dst.image, -5.5, -5.5, 1.37, 1.37);
+    iterations++;
+    elapsed = Now() - start;
+  } while (elapsed < 0.5);
+  return elapsed / iterations;
+}
+
+static double TimeComposite(Buffer &base, const Buffer &overlay) {
+  int iterations = 0;
+  double start = Now(), elapsed;
+  do {
+    PixelKernels::Composite(base.image, overlay.image);
+    iterations++;
+    elapsed = Now() - start;
+  } while (elapsed < 0.5);
+  return elapsed / iterations;
+}
+
+int main() {
+  bool ok = true;
+  srand(1);
+
+  Buffer src(1536, 1536), dst(2048, 2048), overlay(2048, 2048);
+  Randomise(src);
+  Randomise(dst);
+  Randomise(overlay);
+
+  PixelKernels::Level supported = PixelKernels::Supported();
+  printf("supported: %s\n", PixelKernels::LevelName(supported));
+
+  for (int level = PixelKernels::SSE2; level <= supported; level++) {
+    PixelKernels::Level l = (PixelKernels::Level) level;
+    ok = Verify(l, "nearest", PixelKernels::ResampleNearest, src) && ok;
+    ok = Verify(l, "bilinear", PixelKernels::ResampleBilinear, src) && ok;
+    ok = VerifyComposite(l) && ok;
+  }
+  printf("verification: %s\n", (ok) ? "identical" : "FAILED");
+
+  printf("%-8s %12s %12s %12s  (ms per 2048x2048 map)\n", "level", "nearest", "bilinear", "composite");
+  for (int level = PixelKernels::SCALAR; level <= supported; level++) {
+    PixelKernels::Select((PixelKernels::Level) level);
+    double nearest = TimeResample(PixelKernels::ResampleNearest, src, dst);
+    double bilinear = TimeResample(PixelKernels::ResampleBilinear, src, dst);
+    double composite = TimeComposite(dst, overlay);
+    printf("%-8s %12.2f %12.2f %12.2f\n", PixelKernels::LevelName((PixelKernels::Level) level),
+           nearest * 1e3, bilinear * 1e3, composite * 1e3);
+  }
+
+  return (ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}